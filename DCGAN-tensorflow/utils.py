@@ -30,8 +30,20 @@ def get_image(image_path, input_height, input_width,
                    resize_height, resize_width, crop)
 
 def save_images(images, size, image_path):
+  save_grid(images, size, image_path)
   return imsave(inverse_transform(images), size, image_path)
 
+def save_grid(images, size, image_path):
+  # layout of the sheet written by merge(), so that the FaceSwapper can slice the
+  # tiles instead of detecting the faces (see FaceSheet)
+  with open(image_path + '.grid', 'w') as f:
+    f.write('# face sheet layout\n')
+    f.write('rows %d\n' % size[0])
+    f.write('cols %d\n' % size[1])
+    f.write('tile_width %d\n' % images.shape[2])
+    f.write('tile_height %d\n' % images.shape[1])
+    f.write('count %d\n' % images.shape[0])
+
 def imread(path, grayscale = False):
   if (grayscale):
     return scipy.misc.imread(path, flatten = True).astype(np.float)
@@ -0,0 +1,62 @@
+#ifndef _DETECTIONNMS_H_
+#define _DETECTIONNMS_H_
+
+#include <vector>
+
+#include "DetectionRegion.h"
+
+/// Contiguous (structure of arrays) storage of detection boxes for batched overlap computations.
+/// Boxes are stored by their corners, i.e. [x1, x2) x [y1, y2) in continuous pixel coordinates.
+class DetectionBoxes
+{
+public:
+	/// Adds a box given by its upper left corner and size (as in DetectionRegion::getBoundingBox).
+	void add(float x, float y, float width, float height, float score);
+
+	/// Adds the bounding boxes of regions. The score is the classification confidence for face regions and the
+	/// region confidence otherwise.
+	void addRegions(const std::vector<DetectionRegion*> &regions);
+
+	void clear();
+
+	size_t size() const { return score.size(); }
+
+	std::vector<float> x1, y1, x2, y2;
+	std::vector<float> score;
+};
+
+/// Non-maximum suppression and merging of large detection sets.
+/// Candidates overlapping a box are looked up in a uniform grid spanning all boxes, so the cost is
+/// roughly linear in the number of boxes for typical (crowd, tiled) detection sets, and IoU values are computed
+/// for batches of candidates with SSE.
+///
+/// IoU semantics (shared with DetectionRegion::getIou and FaceDetectionRegion::getIou):
+///  - a box (x, y, width, height) covers [x, x + width) x [y, y + height), there is no +1 for pixel extents
+///  - boxes only touching at an edge have an intersection of 0
+///  - the IoU is 0 if the union is empty (e.g. for two empty boxes), it is never NaN
+///  - the IoU of identical non-empty boxes is 1
+class DetectionNms
+{
+public:
+	/// IoU of two boxes given by upper left corner and size.
+	static float iou(float xA, float yA, float widthA, float heightA, float xB, float yB, float widthB, float heightB);
+
+	/// IoU of box 'ref' with the boxes 'candidates'.
+	static void iouBatch(const DetectionBoxes &boxes, int ref, const std::vector<int> &candidates, std::vector<float> &result);
+
+	/// Greedy NMS: keeps the highest scoring box and suppresses all boxes with an IoU above the threshold.
+	/// @return		indices of the kept boxes, by decreasing score
+	static std::vector<int> greedy(const DetectionBoxes &boxes, float iouThreshold);
+
+	/// Weighted merging: each kept box is replaced by the score-weighted average of all boxes it suppresses
+	/// (including itself) and keeps the highest score of the cluster.
+	/// @param merged	receives the merged boxes, by decreasing score
+	/// @param members	optional, receives the indices of the boxes merged into each output box
+	static void weighted(const DetectionBoxes &boxes, float iouThreshold, DetectionBoxes &merged, std::vector< std::vector<int> > *members = 0);
+
+protected:
+	/// Runs greedy suppression, 'clusters' receives the kept box followed by the boxes it suppressed.
+	static void suppress(const DetectionBoxes &boxes, float iouThreshold, std::vector< std::vector<int> > &clusters);
+};
+
+#endif
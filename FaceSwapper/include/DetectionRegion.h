@@ -22,6 +22,7 @@
 struct _IplImage;
 typedef struct _IplImage IplImage;
 #include <list>
+#include <string>
 #include <vector>
 
 /// Abstract base class which has to be inherited by any detection class if it should be used in JRS application framework
@@ -51,6 +52,7 @@ public:
 	DetectionRegion(const float x, const float y, const float scale = 1.0);
 	DetectionRegion(const float xStart, const float yStart, const float width, const float height, const float scale = 1.0);
 	DetectionRegion(std::vector<DetectionRegion::Point> *points, const float scale = 1.0);
+	virtual ~DetectionRegion() {}
 
 	/// Get region center position
 	/// @param x	x-cooridinate
@@ -65,7 +67,7 @@ public:
 	/// Gets the bounding box of the region.
 	/// @param x,y				position of the upper left corner of the bounding box
 	/// @param width, height	size of the bounding box
-	virtual void getBoundingBox(float &x, float&y, float &width, float &height) 
+	virtual void getBoundingBox(float &x, float&y, float &width, float &height) const
 					{x = mBBXStart; y = mBBYStart; width = mBBWidth; height = mBBHeight;} 
 
 	/// Sets the bounding box of the region.
@@ -162,7 +164,7 @@ public:
 	/// @return			distance between two regions
 	virtual float matchDistance( const DetectionRegion &region );
 
-	/// Calculates the intersection over union (IoU) with the specified region
+	/// Calculates the intersection over union (IoU) with the specified region (see DetectionNms for the semantics)
 	float getIou(const DetectionRegion &region);
 
 	/// Calculate the visual features which describes the region appearance
@@ -197,7 +199,7 @@ public:
 	//--------------------------------------------------------------------------------------------------------------
 
 protected:
-	/// Calculates the overlap between two value ranges ([x1, x1+w1] and  [x2, x2+w2]).
+	/// Calculates the overlap between two value ranges ([x1, x1+w1] and  [x2, x2+w2]), negative if they are disjoint.
 	float mOverlap(float x1, float w1, float x2, float w2);
 
 	/// center point of the region
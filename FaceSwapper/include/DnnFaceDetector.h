@@ -0,0 +1,47 @@
+#pragma once
+// Face detector running the ResNet-10 SSD of the OpenCV face detection sample with the OpenCV dnn module.
+// Notes:
+// * The network consists of 'deploy.prototxt' and 'res10_300x300_ssd_iter_140000.caffemodel' (or the 16 bit
+//   version 'res10_300x300_ssd_iter_140000_fp16.caffemodel'), see
+//   https://github.com/opencv/opencv/tree/master/samples/dnn/face_detector
+// * It is several times faster than the dlib MMOD network on the CPU, but misses more small faces
+
+#include "FaceDetectionRegion.h"
+#include "FaceDetector.h"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/dnn.hpp>
+
+class FaceDetectorDnn : public FaceDetector
+{
+public:
+	FaceDetectorDnn();
+	virtual ~FaceDetectorDnn();
+
+	/// Loads the Caffe model. The network description is the one set with setConfigFile(), or 'deploy.prototxt' in
+	/// the directory of the model.
+	virtual void doLazyInit(std::string modelFile);
+
+	virtual std::vector<DetectionRegion*>* calculate(const cv::Mat img, double minConfidence);
+
+	virtual std::string getName() const { return "ssd"; }
+	virtual std::string getDefaultModel() const { return "res10_300x300_ssd_iter_140000.caffemodel"; }
+	virtual double getDefaultConfidence() const { return 0.5; }
+	virtual double getBankConfidence() const { return 0.9; }
+
+	/// Network description (prototxt), must be set before doLazyInit().
+	void setConfigFile(const std::string& configFile) { mConfigFile = configFile; }
+
+	/// Size of the network input (default 300x300, the training size). Larger sizes find smaller faces in large images
+	/// at a higher cost.
+	void setInputSize(cv::Size size) { mInputSize = size; }
+
+	/// Overlap above which the detections of the network are merged (default 0.4).
+	void setNmsThreshold(float threshold) { mNmsThreshold = threshold; }
+
+protected:
+	cv::dnn::Net mNet;
+	std::string mConfigFile;
+	cv::Size mInputSize;
+	float mNmsThreshold;
+};
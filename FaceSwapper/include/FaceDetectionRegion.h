@@ -1,6 +1,10 @@
 #ifndef _FACEDETECTIONREGION_H_
 #define _FACEDETECTIONREGION_H_
 
+#include <stdint.h>
+#include <fstream>
+#include <string>
+
 #include "DetectionRegion.h"
 
 // avoid compiler warning  C4275: non dll-interface class '???' used as base for dll-interface class '???' by exporting the base class
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "DetectionRegion.h"
+
+/// Interface of the face detector backends. A backend is created by name with create(), loads its model in
+/// doLazyInit() and returns FaceDetectionRegion objects with the detection confidence as classification confidence.
+/// calculate() may be called for images of any size; it is not reentrant, callers share a detector between threads
+/// only with a lock.
+class FaceDetector
+{
+public:
+	virtual ~FaceDetector() {}
+
+	/// Loads the model. Throws std::exception if the model cannot be loaded.
+	virtual void doLazyInit(std::string modelFile) = 0;
+
+	/// Detects the faces in a BGR image. The caller owns the returned list and the regions.
+	virtual std::vector<DetectionRegion*>* calculate(const cv::Mat img, double minConfidence) = 0;
+
+	/// Name of the backend, as accepted by create().
+	virtual std::string getName() const = 0;
+
+	/// Default model file of the backend.
+	virtual std::string getDefaultModel() const = 0;
+
+	/// Typical minimum confidence of faces to be replaced; the confidences of the backends are not on the same scale.
+	virtual double getDefaultConfidence() const = 0;
+
+	/// Stricter minimum confidence for face bank images, which should only yield clear frontal faces.
+	virtual double getBankConfidence() const = 0;
+
+	/// Creates a backend: "dlib" (MMOD CNN, see FaceDetectorDlib) or "ssd" (ResNet-10 SSD of the OpenCV dnn module, see
+	/// FaceDetectorDnn). Returns NULL for unknown names.
+	static FaceDetector* create(const std::string& backend);
+
+	/// Names of all backends, separated by '|'.
+	static std::string getBackendNames() { return "dlib|ssd"; }
+};
@@ -0,0 +1,70 @@
+#ifndef _FACEFEATUREMATCHER_H_
+#define _FACEFEATUREMATCHER_H_
+
+#include <vector>
+
+class FaceDetectionRegion;
+
+/// Matches the feature vector of one face against many candidates (e.g. tracks or a gallery) at once.
+/// The candidates are stored as mean-free, unit-length float vectors in one contiguous matrix, so the Pearson
+/// correlation used by FaceDetectionRegion::matchAppearance reduces to a dot product per row, which is computed
+/// with AVX/SSE where available.
+/// Scores are in the same range as in matchAppearance, i.e. (correlation + 1) / 2, so 1 - score corresponds to the
+/// appearance distance of matchAppearance without its overlap term.
+class FaceFeatureMatcher
+{
+public:
+	struct Match
+	{
+		Match() : index(-1), score(0.0f) {}
+		Match(int i, float s) : index(i), score(s) {}
+
+		int index;		// index of the candidate (as returned by add)
+		float score;	// similarity [0,1]
+	};
+
+	/// @param dimension	length of the feature vectors, 0 to take it from the first added vector
+	FaceFeatureMatcher(int dimension = 0);
+	~FaceFeatureMatcher();
+
+	/// Adds a candidate feature vector.
+	/// @return		index of the candidate, -1 if the dimension does not match
+	int add(const std::vector<double> &featureVect);
+
+	/// Adds the feature vector of a region (see FaceDetectionRegion::getFeatureVector).
+	/// @return		index of the candidate, -1 if the region has no feature vector or the dimension does not match
+	int add(FaceDetectionRegion *region);
+
+	/// Removes all candidates.
+	void clear();
+
+	/// Returns the number of candidates.
+	int size() const { return (int)mValid.size(); }
+
+	int getDimension() const { return mDimension; }
+
+	/// Scores the query against all candidates.
+	/// @param query	feature vector to be matched
+	/// @param scores	similarity for each candidate, 0 for candidates (or queries) without variance
+	void score(const std::vector<double> &query, std::vector<float> &scores) const;
+
+	/// Returns the k best matching candidates, sorted by decreasing score (all candidates if k exceeds their number,
+	/// none if k is negative).
+	std::vector<Match> match(const std::vector<double> &query, int k) const;
+	std::vector<Match> match(FaceDetectionRegion *region, int k) const;
+
+protected:
+	/// Converts a feature vector to a mean-free unit vector of length mStride (padded with zeros).
+	/// @return		false if the vector has no variance
+	bool normalize(const std::vector<double> &featureVect, float *dst) const;
+
+	/// Dot products of the query with all rows of the matrix.
+	void dotProducts(const float *query, float *result) const;
+
+	int mDimension;
+	int mStride;					// row length of the matrix, multiple of 8 floats
+	std::vector<float> mMatrix;		// normalized candidates, one per row
+	std::vector<char> mValid;		// indicates if a candidate has variance
+};
+
+#endif
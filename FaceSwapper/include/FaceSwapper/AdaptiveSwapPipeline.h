@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "FaceSwapper/LatencyGovernor.h"
+#include "FaceSwapper/SwapPipeline.h"
+#include "FaceSwapper/SwapProfile.h"
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Swap pipeline which degrades its profile to keep the latency of a stream of frames (e.g. a video, or frames
+/// submitted to the daemon) within a budget. It holds one initialized SwapPipeline per profile level, all with the
+/// same face bank, and a LatencyGovernor choosing the level of each frame from the measured latencies of process().
+/// The models of all levels are loaded up front, so switching the level does not stall the stream.
+/// process() is reentrant like SwapPipeline::process().
+class AdaptiveSwapPipeline {
+
+public:
+	AdaptiveSwapPipeline();
+
+	/// Initializes level 0 with 'config' and one level for each fallback profile after the first, which is applied to a
+	/// copy of 'config' (see SwapProfile::apply). Without fallbacks or budget, only level 0 is created.
+	/// @param fallbacks	profiles ordered from the best quality to the lowest latency (see SwapProfile::getFallbacks),
+	///						the first one is expected to be the one already applied to 'config'
+	/// @param budgetMs		latency budget per frame, <= 0 to always use level 0
+	bool init(const SwapPipelineConfig& config, const std::vector<SwapProfile>& fallbacks = std::vector<SwapProfile>(),
+		double budgetMs = 0.0);
+
+	/// Adds the faces of an image file to the face bank of all levels (see SwapPipeline::loadFaceBank).
+	bool loadFaceBank(const std::string& path);
+
+	/// Adds the faces of a face sheet to the face bank of all levels (see SwapPipeline::loadFaceSheet).
+	bool loadFaceSheet(const std::string& path, const std::string& grid = std::string());
+
+	/// Replaces all faces in a BGR frame in place with the pipeline of the current level and reports the latency to
+	/// the governor (see SwapPipeline::process).
+	int process(cv::Mat frame, double minConfidence = 0);
+
+	/// Number of bank faces of the level with the fewest, as every level has to be able to swap.
+	int getNumBankFaces() const;
+
+	int getNumLevels() const { return (int)pipelines.size(); }
+
+	/// Level of the next frame.
+	int getLevel() { return governor.getLevel(); }
+
+	/// Name of the profile of a level ("custom" for level 0 without profile).
+	const std::string& getProfileName(int level) const { return names[level]; }
+
+	SwapPipeline& getPipeline(int level) { return *pipelines[level]; }
+
+protected:
+	std::vector< std::unique_ptr<SwapPipeline> > pipelines;
+	std::vector<std::string> names;
+	LatencyGovernor governor;
+
+private:
+	AdaptiveSwapPipeline(const AdaptiveSwapPipeline&);
+	AdaptiveSwapPipeline& operator=(const AdaptiveSwapPipeline&);
+};
+
+}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "DetectionRegion.h"
+#include "FaceSwapper/SwapPipeline.h"
+#include "FaceSwapper/WorkerPool.h"
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Outcome of an asynchronous swap.
+struct SwapResult {
+	enum Status {
+		/// all faces have been replaced
+		DONE = 0,
+		/// cancelled before completion, the frame is unchanged
+		CANCELLED,
+		/// the deadline passed before completion, the frame is unchanged
+		DEADLINE_EXCEEDED,
+		/// the frame could not be processed
+		FAILED
+	};
+
+	SwapResult() : status(FAILED), faces(0) {}
+
+	Status status;
+	/// number of replaced faces
+	int faces;
+	/// header of the submitted frame
+	cv::Mat frame;
+	std::string message;
+};
+
+/// Handle of a submitted swap.
+class SwapTicket {
+
+public:
+	SwapTicket() {}
+
+	/// Requests cancellation. A swap which has not started yet is dropped, a running swap is abandoned before the
+	/// next group of faces. The future still becomes ready (with CANCELLED, unless the swap already completed).
+	void cancel() { if (cancelled) cancelled->store(true); }
+
+	std::future<SwapResult> result;
+
+protected:
+	std::shared_ptr< std::atomic<bool> > cancelled;
+
+	friend class AsyncSwapper;
+};
+
+/// Asynchronous front end of a SwapPipeline: swaps are submitted and executed on an internal pool of worker threads,
+/// so the caller can overlap I/O, decoding and several frames in flight without managing threads itself.
+/// Frames are modified in place; the caller keeps the frame buffer alive and does not access it until the result is
+/// ready. Frames are only written once all their faces are done, so cancelled or late swaps leave them unchanged.
+class AsyncSwapper {
+
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/// @param pipeline		initialized pipeline with a loaded face bank, which has to outlive the swapper
+	/// @param numThreads	number of worker threads, 0 uses the number of hardware threads
+	AsyncSwapper(SwapPipeline& pipeline, int numThreads = 0);
+
+	/// Completes all submitted swaps.
+	~AsyncSwapper();
+
+	/// Detects and replaces all faces of a frame.
+	SwapTicket submit(cv::Mat frame, Clock::time_point deadline = Clock::time_point::max());
+
+	/// Replaces the given faces of a frame. The regions are copied, the caller keeps ownership.
+	SwapTicket submit(cv::Mat frame, const std::vector<DetectionRegion*>& regions, Clock::time_point deadline = Clock::time_point::max());
+
+	/// Number of submitted swaps, which have not started yet.
+	size_t getQueueLength() { return pool.getQueueLength(); }
+
+protected:
+	SwapTicket submit(cv::Mat frame, const std::vector<DetectionRegion*>* regions, Clock::time_point deadline);
+
+	void run(std::shared_ptr< std::promise<SwapResult> > promise, std::shared_ptr< std::atomic<bool> > cancelled, cv::Mat frame,
+		std::shared_ptr< std::vector<DetectionRegion*> > regions, Clock::time_point deadline);
+
+	SwapPipeline& pipeline;
+
+	// declared last, so the workers are joined before the other members are destroyed
+	WorkerPool pool;
+};
+
+}
+}
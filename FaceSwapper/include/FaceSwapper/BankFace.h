@@ -0,0 +1,49 @@
+#pragma once
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/core/types.hpp>
+
+#include "DetectionRegion.h"
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Replacement face with everything the swap needs from it, computed once by FaceSwapping::prepareBankFace when the
+/// face is added to a bank. All images are crops around the face in the coordinates of the face set image shifted
+/// by 'crop', so a swap only warps them and matches the colours against the frame.
+/// A bank face is not modified by swapping and can be used by several threads at once.
+struct BankFace {
+
+	BankFace() : segmented(false), valid(false) {}
+
+	bool isValid() const { return valid; }
+
+	/// face set image cropped to the face
+	cv::Mat image;
+	/// position of the crop in the face set image
+	cv::Rect crop;
+	/// detection with its landmarks in crop coordinates
+	DetectionRegion region;
+
+	/// outline of the face (jaw line and forehead) used by the affine swap, in crop coordinates
+	cv::Point2i points[9];
+	/// chin and eye corners, which define the affine transformation
+	cv::Point2f transformPoints[3];
+	/// width of the soft edge
+	cv::Size feather;
+
+	/// filled outline (CV_8UC1, 0 or 255), or the foreground of the segmentation
+	cv::Mat mask;
+	/// blending weight (CV_8UC1): the mask eroded and blurred by the feather size, or the segmentation alpha
+	cv::Mat alpha;
+	/// the alpha comes from a segmentation of the face set image (see SegmentationAlpha) and is always warped,
+	/// whatever the feather mode; it may extend beyond the outline, so the whole crop is blended
+	bool segmented;
+	/// normalized cumulative histograms of the three channels inside the mask and the detected face box
+	float cdf[3][256];
+
+	bool valid;
+};
+
+}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// One image of a batch.
+struct BatchItem {
+	std::string input;
+	std::string output;
+};
+
+/// List of the images of a batch, split into shards for processing on several nodes.
+/// A manifest is a text file with one image per line, either "<input>\t<output>" or only "<input>", whose output is
+/// then written below an output directory under the same relative path. Empty lines and lines starting with '#' are
+/// skipped.
+/// The shard of an image only depends on its input path and the number of shards, not on the order or the other
+/// lines of the manifest, so nodes sharing a file system split the work without coordination and each image is
+/// processed by exactly one of them.
+class BatchManifest {
+
+public:
+	/// Reads a manifest. 'outputDir' is used for lines without output; it may be empty if all lines have one, or if
+	/// 'requireOutput' is false (the output of such lines is then empty).
+	static bool read(const std::string& path, const std::string& outputDir, std::vector<BatchItem>& items, bool requireOutput = true);
+
+	/// Shard (0 to shardCount - 1) of an input path.
+	static int getShard(const std::string& input, int shardCount);
+
+	/// Appends the items of one shard to 'shard', in manifest order.
+	static void selectShard(const std::vector<BatchItem>& items, int shardIndex, int shardCount, std::vector<BatchItem>& shard);
+
+	/// Parses a shard given as "<index>/<count>" (e.g. "3/16").
+	static bool parseShard(const std::string& text, int& shardIndex, int& shardCount);
+
+	/// Output path of an input below 'outputDir': relative inputs keep their path, absolute ones are made relative
+	/// (leading separators and drive letters are dropped).
+	static std::string getOutputPath(const std::string& input, const std::string& outputDir);
+
+	/// Creates the missing parent directories of an output path.
+	static bool makeParentDirectories(const std::string& path);
+
+	/// Writes an output file completely (via "<path>.<pid>.<n>.partial", synced and renamed) before it appears under
+	/// its name, so an interrupted run never leaves a partial output. On failure, 'error' (optional) receives the reason.
+	static bool writeAtomic(const std::string& path, const std::vector<unsigned char>& data, std::string* error = NULL);
+};
+
+}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Outcome of one image of a batch.
+struct BatchRecord {
+	BatchRecord() : done(false), outputHash(0), width(0), height(0), faces(0), readMs(0.0), processMs(0.0), writeMs(0.0) {}
+
+	std::string input;
+	std::string output;
+	/// true if the output has been written, false if the image failed (it is retried when the batch is resumed)
+	bool done;
+	/// hash of the output file as computed by DetectionCache::hashFile
+	uint64_t outputHash;
+	int width;
+	int height;
+	/// number of replaced faces
+	int faces;
+	double readMs;
+	double processMs;
+	double writeMs;
+	/// reason of a failure
+	std::string message;
+};
+
+/// Append-only log of the processed images of a batch, one JSON object per line:
+/// {"input": ..., "output": ..., "status": "done" or "failed", "hash": "<16 hex digits>", "width": ..., "height": ...,
+///  "faces": ..., "read_ms": ..., "process_ms": ..., "write_ms": ..., "message": ...}
+/// Each line is flushed once the output file is complete, so after a crash the log lists exactly the images whose
+/// outputs are on disk, apart from a possibly truncated last line, which is ignored. Reopening the log resumes the
+/// batch: the inputs of all "done" lines are skipped.
+/// append() may be called from several threads.
+class CompletionLog {
+
+public:
+	CompletionLog();
+
+	~CompletionLog();
+
+	/// Reads the completed inputs of an existing log and opens it for appending (creating it if needed).
+	bool open(const std::string& path);
+
+	/// Indicates if an input has been completed in an earlier run (or by append() in this one).
+	bool isCompleted(const std::string& input);
+
+	/// Appends a record and flushes it. Returns false if the line could not be written.
+	bool append(const BatchRecord& record);
+
+	size_t getNumCompleted();
+
+	/// Extracts a string field from one line of the log, false if the field is missing or the line is truncated.
+	static bool getField(const std::string& line, const std::string& name, std::string& value);
+
+protected:
+	std::set<std::string> completed;
+	std::ofstream stream;
+	std::mutex mutex;
+};
+
+}
+}
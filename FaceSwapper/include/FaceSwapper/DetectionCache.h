@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "DetectionRegion.h"
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// On-disk cache for face detections and their 68 landmark points.
+/// Entries are keyed by a content hash of the decoded image combined with the hashes of the model files and the
+/// detection parameters, so re-running the swap stage with different settings skips detection and landmarking.
+/// Each entry is a small text file in the cache directory; an index file keeps the size and last access of all
+/// entries for LRU eviction. All files are written to a temporary file of a unique name first and then renamed, so a
+/// crash never leaves a partially written entry or index behind.
+/// Several processes may share a cache directory (e.g. the shards of a batch): the index is written under a lock
+/// on "index.lock" and merged with the index on disk, so entries stored or evicted by other processes are kept or
+/// dropped. One instance must not be used by several threads at once.
+class DetectionCache {
+
+public:
+	/// @param directory	cache directory (has to exist)
+	/// @param maxBytes		maximum total size of all entries, least recently used entries are evicted beyond that
+	DetectionCache(const std::string& directory, uint64_t maxBytes = 256 * 1024 * 1024);
+
+	~DetectionCache();
+
+	/// Hashes the pixel data and geometry of a decoded image.
+	static uint64_t hashImage(const cv::Mat& img);
+
+	/// Hashes the content of a file (e.g. a model file), returns 0 if the file cannot be read.
+	static uint64_t hashFile(const std::string& path);
+
+	/// Hashes a block of memory, starting from the given seed.
+	static uint64_t hashBytes(const void* data, size_t len, uint64_t seed = 0);
+
+	/// Builds the cache key for an image.
+	/// @param img				decoded image
+	/// @param modelHash		combined hash of the detector and landmark model files
+	/// @param minConfidence	detection threshold
+	static std::string makeKey(const cv::Mat& img, uint64_t modelHash, double minConfidence);
+
+	/// Looks up the detections for a key. On success, newly allocated regions (with landmarks in their point list)
+	/// are appended to 'regions'.
+	/// @return true if the entry was found and is valid
+	bool lookup(const std::string& key, std::vector<DetectionRegion*>& regions);
+
+	/// Stores the detections (including their point lists) for a key. The index is only written every
+	/// INDEX_SAVE_INTERVAL stores and by flush(); entries missing from an index lost in a crash are adopted again
+	/// when they are looked up.
+	/// @return true if the entry has been written
+	bool store(const std::string& key, const std::vector<DetectionRegion*>& regions);
+
+	/// Writes the index, if it has changed since the last write (also done by the destructor).
+	bool flush();
+
+	static const int INDEX_SAVE_INTERVAL = 64;
+
+	uint64_t getTotalBytes() const { return totalBytes; }
+
+protected:
+
+	struct Entry {
+		uint64_t size;
+		uint64_t lastAccess;
+	};
+
+	std::string entryPath(const std::string& key) const;
+
+	void loadIndex();
+
+	/// Reads the index file, returns false if it does not exist or has another version.
+	bool readIndex(std::map<std::string, Entry>& index);
+
+	bool saveIndex();
+
+	/// Adds or replaces an entry, keeping totalBytes and accessOrder up to date.
+	void setEntry(const std::string& key, const Entry& entry);
+
+	void eraseEntry(std::map<std::string, Entry>::iterator iter);
+
+	void evict();
+
+	static bool writeAtomic(const std::string& path, const std::string& content);
+
+	std::string directory;
+	uint64_t maxBytes;
+	uint64_t totalBytes;
+	uint64_t accessCounter;
+	bool indexDirty;
+	/// stores since the index was last written
+	int unsavedStores;
+	/// keys stored or looked up, and keys evicted by this instance since the index was last written
+	std::set<std::string> touchedKeys;
+	std::set<std::string> evictedKeys;
+
+	std::map<std::string, Entry> entries;
+	/// keys by last access, the least recently used first
+	std::multimap<uint64_t, std::string> accessOrder;
+
+	// version number of the entry and index file format
+	static const int version = 1;
+
+};
+
+}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/core/types.hpp>
+
+#include "DetectionRegion.h"
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+class FaceSwapping;
+
+/// Grid of a face sheet: the tiles are stored row by row, as merge() in DCGAN-tensorflow/utils.py writes them.
+struct FaceSheetLayout {
+	FaceSheetLayout() : rows(0), cols(0), tileWidth(0), tileHeight(0), count(0) {}
+
+	int rows;
+	int cols;
+	int tileWidth;
+	int tileHeight;
+	/// number of used tiles, the last row may be incomplete
+	int count;
+
+	/// Checks that the grid is complete and fits into an image of the given size.
+	bool isValid(cv::Size sheetSize) const;
+};
+
+/// Loads generated faces from a sheet of samples (a grid of equally sized tiles with one centred face each), as
+/// written by the DCGAN sampler. The positions of the faces are known from the grid, so no detector is run: the
+/// tiles are views into the sheet and only the landmarks are fitted on each tile. Tiles whose landmarks are not
+/// plausible (no face, or a face the shape predictor could not follow) are dropped.
+class FaceSheet {
+
+public:
+	/// Reads the sidecar written by save_images() next to a sheet ("<sheet>.grid", lines of "<key> <value>").
+	static bool readLayout(const std::string& path, FaceSheetLayout& layout);
+
+	/// Name of the sidecar of a sheet.
+	static std::string getLayoutPath(const std::string& sheetPath) { return sheetPath + ".grid"; }
+
+	/// Grid given as "<rows>x<cols>", the tile size follows from the size of the sheet.
+	static bool parseGrid(const std::string& grid, cv::Size sheetSize, FaceSheetLayout& layout);
+
+	/// Slices the tiles and fits the landmarks of the face in each tile, the region of a face covers the tile without
+	/// a margin of 'inset' times the tile size. Appends the tiles (views into the sheet) and their regions (in tile
+	/// coordinates, with landmarks, owned by the caller) of all accepted faces.
+	/// @return the number of accepted faces
+	static int load(FaceSwapping& swapping, cv::Mat sheet, const FaceSheetLayout& layout, std::vector<cv::Mat>& tiles,
+		std::vector<DetectionRegion*>& regions, float inset = DEFAULT_INSET);
+
+	/// Checks that the landmarks of a region are roughly where a face in a tile of the given size has them: all points
+	/// near the tile, the eyes side by side at a plausible distance, the nose between eyes and chin.
+	static bool checkLandmarks(DetectionRegion* region, cv::Size tileSize);
+
+	// a constant expression, so callers of the shared library do not import it as data
+	static constexpr float DEFAULT_INSET = 0.125f;
+};
+
+}
+}
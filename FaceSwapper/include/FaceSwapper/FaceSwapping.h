@@ -1,3 +1,4 @@
+#pragma once
 
 #include <dlib/opencv.h>
 
@@ -6,51 +7,214 @@
 #include <dlib/image_io.h>
 
 #include <opencv2/core/mat.hpp>
+#include <opencv2/face.hpp>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include "DetectionRegion.h"
+#include "FaceSwapper/BankFace.h"
+#include "FaceSwapper/LandmarkTemplate.h"
+#include "FaceSwapper/SwapWorkspace.h"
 
 namespace Jrs {
 	namespace FaceSwapper{
 
 
 
+/// Swaps faces using the landmarks of the source and the face set region.
+/// The methods are reentrant, one instance can be shared by several threads as long as they do not modify the same
+/// regions or destination images concurrently. Temporary images are kept in the SwapWorkspace of the calling thread.
 class FaceSwapping {
 
 public:
+	/// 'landmarksFile' is a dlib shape predictor with 68 points, or with the 5 points of
+	/// shape_predictor_5_face_landmarks.dat, which is completed to 68 points by a LandmarkTemplate (see
+	/// setLandmarkTemplate). The 5 point predictor is an order of magnitude smaller and faster; its landmarks suffice
+	/// for the affine swap of roughly frontal faces, but not for the triangulated swap.
 	FaceSwapping(std::string landmarksFile, bool triangulation = false);
 
 	~FaceSwapping();
 
-	void swapFaces(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion);
+	/// Soft edge of the affine swap.
+	enum FeatherMode {
+		/// smooth ramp over the distance to the outline, drawn in the frame (default)
+		FEATHER_DISTANCE = 0,
+		/// outline mask eroded and box blurred by the feather size in the bank face, then warped (the original method)
+		FEATHER_BOX
+	};
+
+	/// Selects the soft edge. Must not be changed while faces are being swapped.
+	void setFeatherMode(FeatherMode mode) { featherMode = mode; }
+
+	FeatherMode getFeatherMode() const { return featherMode; }
+
+	/// Selects if the affine swap samples, colour corrects and blends the face in one pass over the face area
+	/// (default), or warps the face into an image first and corrects and blends it in separate passes. Both sample
+	/// the face bilinearly and give the same result up to rounding. Must not be changed while faces are being swapped.
+	void setFusedBlend(bool fused) { fusedBlend = fused; }
+
+	bool getFusedBlend() const { return fusedBlend; }
+
+	/// Caps the working resolution of the affine swap: faces whose area in the frame is larger than 'size' pixels
+	/// (longer side) are warped and colour corrected at that size, and only the corrected face and its alpha are
+	/// upsampled and blended at full resolution. The bank faces have little detail anyway, so this mostly saves time
+	/// on very large frames. 0 (default) always works at full resolution. Must not be changed while faces are being
+	/// swapped.
+	void setMaxPatchSize(int size) { maxPatchSize = size; }
+
+	int getMaxPatchSize() const { return maxPatchSize; }
+
+	/// Splits the pixel loops of a face (feathering, colour correction, blending) into row bands, which are processed
+	/// in parallel by 'threads' threads (0, the default, uses cv::getNumThreads(), 1 disables it). Face areas smaller
+	/// than 'minPixels' are processed by the calling thread, as splitting them costs more than it saves. Row bands
+	/// only run in parallel if the face is not already swapped concurrently with other faces of the image. Must not be
+	/// changed while faces are being swapped.
+	void setRowParallelism(int threads, int minPixels = DEFAULT_PARALLEL_MIN_PIXELS) { rowThreads = threads; parallelMinPixels = minPixels; }
+
+	int getRowThreads() const { return rowThreads; }
+
+	static const int DEFAULT_PARALLEL_MIN_PIXELS = 256 * 256;
+
+	/// Replaces the template completing the landmarks of a 5 point predictor (default: the built-in mean shape).
+	/// Must not be changed while landmarks are being fitted.
+	void setLandmarkTemplate(const LandmarkTemplate& landmarkTemplate) { this->landmarkTemplate = landmarkTemplate; }
+
+	/// Indicates if the landmarks are completed from the 5 points of the small predictor.
+	bool usesLandmarkTemplate() const { return !triangulation && shapepred.num_parts() == LandmarkTemplate::NUM_FIT_POINTS; }
+
+	/// Replaces the face of srcRegion by the face of fsRegion. Returns false if the face was not replaced (e.g. the
+	/// landmarks could not be fitted).
+	bool swapFaces(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion);
+
+	/// Replaces the face of srcRegion by a prepared bank face. Returns false if the face was not replaced.
+	bool swapFaces(cv::Mat src, cv::Mat dst, const BankFace& face, DetectionRegion* srcRegion);
+
+	/// Replaces several faces of one image in parallel: srcRegions[i] is replaced by fsRegions[i] of faceSets[i].
+	/// Only the area around a face is modified, faces whose areas do not overlap are swapped concurrently. Faces with
+	/// overlapping areas are swapped in the order of srcRegions, so the result is the same as swapping one after
+	/// another. 'stop' is checked between the groups of concurrent faces; if it returns true, false is returned and
+	/// dst is left partially swapped. 'numSwapped' (optional) receives the number of faces actually replaced.
+	bool swapFaces(cv::Mat src, cv::Mat dst, const std::vector<cv::Mat>& faceSets, const std::vector<DetectionRegion*>& srcRegions,
+		const std::vector<DetectionRegion*>& fsRegions, const std::function<bool()>& stop = std::function<bool()>(), int* numSwapped = NULL);
+
+	/// Replaces several faces of one image in parallel by prepared bank faces: srcRegions[i] is replaced by faces[i].
+	bool swapFaces(cv::Mat src, cv::Mat dst, const std::vector<const BankFace*>& faces, const std::vector<DetectionRegion*>& srcRegions,
+		const std::function<bool()>& stop = std::function<bool()>(), int* numSwapped = NULL);
+
+	/// Computes everything the swap needs from a replacement face once: the crop around the face, its outline, mask,
+	/// soft alpha and colour histograms (see BankFace). The landmarks of fsRegion are fitted if missing.
+	/// If a segmentation alpha of the face set is given (CV_8UC1 of the size of faceSet), the affine swap blends the
+	/// face with it instead of the outline of the landmarks.
+	/// Returns false (and leaves the bank face invalid) if the landmarks cannot be fitted or, for the affine swap, the
+	/// face box does not overlap the mask, so there are no colours to match.
+	bool prepareBankFace(cv::Mat faceSet, DetectionRegion* fsRegion, BankFace& face, cv::Mat segmentation = cv::Mat());
+
+	/// Fits the 68 facial landmarks to the region and stores them in the point list of the region (with a 5 point
+	/// predictor, the remaining points come from the landmark template).
+	/// Regions which already carry a full set of landmarks (e.g. restored from a DetectionCache) are left unchanged,
+	/// so the landmarks of a region are computed only once.
+	void computeLandmarks(cv::Mat img, DetectionRegion* dr);
+
+	/// Fits the landmarks of several regions of an image in parallel.
+	void computeLandmarks(cv::Mat img, const std::vector<DetectionRegion*>& regions);
+
+	/// Area of the destination image, which is modified when replacing the face of srcRegion (empty if the landmarks
+	/// of the regions cannot be fitted).
+	cv::Rect getSwapRoi(cv::Mat src, DetectionRegion* srcRegion, cv::Mat faceSet, DetectionRegion* fsRegion);
+
+	/// Area of the destination image, which is modified when replacing the face of srcRegion by a bank face.
+	cv::Rect getSwapRoi(cv::Mat src, DetectionRegion* srcRegion, const BankFace& face);
+
+	/// Indicates if the point list of the region contains a full set of landmarks.
+	static bool hasLandmarks(DetectionRegion* dr) { return dr->getPoints()->size() == NUM_LANDMARKS; }
+
+	static const int NUM_LANDMARKS = 68;
 
 protected:
 
 	static bool reuseDetections(cv::InputArray image, cv::OutputArray faces, DetectionRegion *dr);
 
-	void swapFacesAffine(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion);
+	bool swapFacesAffine(cv::Mat src, cv::Mat dst, const BankFace& face, DetectionRegion* srcRegion);
+
+	/// Affine swap at reduced resolution (see setMaxPatchSize). src and dst are the face areas of the frames, 'trafo'
+	/// maps the face crop to them.
+	void swapFacesAffineProxy(SwapWorkspace& ws, cv::Mat src, cv::Mat dst, const BankFace& face, const cv::Matx23d& trafo,
+		cv::Size feather, cv::Rect faceRect);
 
-	void swapFacesTriangulated(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion);
+	bool swapFacesTriangulated(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion);
 
-	void getLandmarks(cv::Mat img, DetectionRegion* dr, cv::Point2i* points, cv::Point2f* affine_transform_keypoints, cv::Size& feather_amount);
+	bool getLandmarks(cv::Mat img, DetectionRegion* dr, cv::Point2i* points, cv::Point2f* affine_transform_keypoints, cv::Size& feather_amount);
 	
-	void getWarpedMaskandFace(cv::Point2i* srcPoints, cv::Point2i* fsPoints, cv::Mat& trafo, cv::Mat fsImage, cv::Mat maskImage, cv::Mat warpedFaceImage);
+	/// Warps the face crop into the frame and computes its outline mask and alpha according to the feather mode.
+	void warpBankFace(SwapWorkspace& ws, const BankFace& face, const cv::Matx23d& trafo, cv::Size feather, cv::Mat maskImage,
+		cv::Mat alphaImage, cv::Mat warpedFaceImage);
 	
-	void colorCorrect(cv::Mat src, cv::Mat warped, cv::Mat maskImg, DetectionRegion* dr);
+	/// Maps the colours of the warped face inside the mask and 'rect', whose cumulative histograms are 'warpedCdf',
+	/// to the ones of the frame.
+	void colorCorrect(cv::Mat src, cv::Mat warped, cv::Mat maskImg, cv::Rect rect, const float warpedCdf[3][256]);
+
+	/// Blends the warped face into the frame, weighted by alpha.
+	void insertFaces(cv::Mat dst, cv::Mat warpedFace, cv::Mat alpha);
+
+	/// Colour lookup table mapping the histograms of the face ('warpedCdf') to the ones of the frame inside the mask.
+	/// Channels whose histogram is empty on either side are mapped to themselves.
+	static void computeColorLut(cv::Mat src, cv::Mat mask, const float warpedCdf[3][256], uint8_t lut[3][256], int bands = 1);
 
-	void insertFaces(cv::Mat dst, cv::Mat warpedFace, cv::Mat maskImage, cv::Size& feather);
+	/// Fused warp, colour correction and blend of the affine swap: walks the face area of the frame once in tiles,
+	/// samples the face crop at the inverse transformed position, applies the LUT inside the mask and 'lutRect' and
+	/// blends by alpha. 'trafo' maps the crop to 'dst'.
+	void blendBankFace(const BankFace& face, const cv::Matx23d& trafo, cv::Mat mask, cv::Mat alpha, cv::Rect lutRect,
+		const uint8_t lut[3][256], cv::Mat dst);
+
+	/// Soft edge of a mask: eroded and then blurred by the feather size, so it falls off to 0 inside the mask.
+	static void computeAlpha(cv::Mat mask, cv::Size feather, cv::Mat& alpha, int bands = 1);
+
+	/// Soft edge of a mask from the distance of each pixel to the outside of the mask (FEATHER_DISTANCE), 'distance'
+	/// is a CV_32FC1 buffer of the size of the mask.
+	static void computeDistanceAlpha(cv::Mat mask, cv::Size feather, cv::Mat distance, cv::Mat alpha, int bands = 1);
+
+	/// Normalized cumulative histograms of the three channels of the pixels inside the mask. With several bands, each
+	/// band counts into a histogram of its own and the histograms are summed at the end.
+	static void computeCdf(cv::Mat img, cv::Mat mask, float cdf[3][256], int bands = 1);
+
+	/// Number of row bands for the pixel loops over an area of the given size (1 if they run single threaded).
+	int getRowBands(cv::Size size) const;
 
 
 	///////
 
-	const cv::Point2i FaceSwapping::getPoint(dlib::full_object_detection& shape, int part_index);
+	static cv::Point2i getPoint(DetectionRegion* dr, int part_index);
+
+	/// Affine transformation mapping three points to three others, false if the source points are collinear.
+	static bool solveAffine(const cv::Point2f* src, const cv::Point2f* dst, cv::Matx23d& trafo);
+
+	/// Bounding box of the transformed points (at most 9) in the frame.
+	static cv::Rect getAffineRoi(const cv::Point2i* fsPoints, int numPoints, const cv::Matx23d& trafo, cv::Size frameSize);
+
+	/// Area of the frame covered by the outline of a bank face, or by its whole crop if the face is segmented.
+	static cv::Rect getAffineRoi(const BankFace& face, const cv::Matx23d& trafo, cv::Size frameSize);
+
+	static cv::Rect getTriangulatedRoi(DetectionRegion* srcRegion, cv::Size frameSize);
 
-	void divideIntoTriangles(cv::Rect rect, std::vector<cv::Point2f> &points, std::vector< std::vector<int> > &delaunayTri);
+	void divideIntoTriangles(cv::Rect rect, const std::vector<cv::Point2f> &points, std::vector<cv::Vec6f> &triangleList, std::vector<cv::Vec3i> &delaunayTri);
 
-	void warpTriangle(cv::Mat &img1, cv::Mat &img2, std::vector<cv::Point2f> &triangle1, std::vector<cv::Point2f> &triangle2);
+	void warpTriangle(SwapWorkspace& ws, cv::Mat &img1, cv::Mat &img2, cv::Point2f* triangle1, cv::Point2f* triangle2);
 
 	dlib::shape_predictor shapepred;
+	LandmarkTemplate landmarkTemplate;
+	cv::Ptr<cv::face::FacemarkKazemi> facemark;
+	// the Kazemi fitting keeps state in the model, so calls have to be serialized
+	std::mutex facemarkMutex;
 	std::string landmarksFile;
 	bool triangulation;
+	FeatherMode featherMode;
+	bool fusedBlend;
+	int maxPatchSize;
+	int rowThreads;
+	int parallelMinPixels;
 
 
 };
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Exclusive lock on a file between processes, released when destroyed (or by the system if the process dies).
+/// The lock file is created if missing and left in place.
+class FileLock {
+
+public:
+	/// Locks 'path', waiting for another holder to release it unless 'wait' is false.
+	FileLock(const std::string& path, bool wait = true);
+
+	~FileLock();
+
+	bool isLocked() const { return locked; }
+
+private:
+	FileLock(const FileLock&);
+	FileLock& operator=(const FileLock&);
+
+#ifdef _WINDOWS
+	void* handle;
+#else
+	int fd;
+#endif
+	bool locked;
+};
+
+}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <opencv2/core/mat.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Thresholds of a FrameChangeDetector.
+struct FrameChangeSettings {
+	FrameChangeSettings() :
+		thumbnailSize(160),
+		blockSize(4),
+		staticThreshold(3.0),
+		sceneCutThreshold(30.0),
+		maxStaticFrames(15)
+	{}
+
+	/// longer side of the grey thumbnail the frames are compared on
+	int thumbnailSize;
+	/// side of the compared blocks in thumbnail pixels; a face entering the frame has to cover a good part of a block
+	int blockSize;
+	/// a frame is static if the mean absolute grey level difference of every block is at most this
+	double staticThreshold;
+	/// a frame is a scene cut if the mean absolute grey level difference of the whole frame is at least this
+	double sceneCutThreshold;
+	/// number of static frames after which a frame is detected again anyway (0 never reuses detections)
+	int maxStaticFrames;
+};
+
+/// Cheap test if a video frame differs from the last frame whose faces were detected, so the detections and landmarks
+/// of that frame can be reused for static frames and only the swap has to be repeated.
+/// Frames are reduced to a small grey thumbnail and compared block by block (sum of absolute differences); a single
+/// changed block suffices to require a detection. Frames are always compared with the frame of the last detection,
+/// not with their predecessor, so slow changes add up until they require a detection as well.
+/// One instance per video stream, not thread safe.
+class FrameChangeDetector {
+
+public:
+	enum Change {
+		/// no block differs by more than the static threshold: the detections of the reference frame can be reused
+		STATIC = 0,
+		/// part of the frame has changed: detect again
+		CHANGED,
+		/// the whole frame has changed (or it is the first frame): detect again
+		SCENE_CUT,
+		/// static, but the maximum number of static frames has been reached: detect again
+		REFRESH
+	};
+
+	FrameChangeDetector(const FrameChangeSettings& settings = FrameChangeSettings());
+
+	/// Compares a BGR frame with the reference frame. Unless it is STATIC, the frame becomes the new reference, so
+	/// the caller has to detect its faces (or call reset() if that fails).
+	Change classify(cv::Mat frame);
+
+	/// Forgets the reference frame, the next frame is treated as a scene cut.
+	void reset();
+
+	/// Indicates if a change requires a detection.
+	static bool needsDetection(Change change) { return change != STATIC; }
+
+	/// Largest mean absolute difference of a block in the last classified frame.
+	double getMaxBlockDifference() const { return maxBlockDifference; }
+
+	/// Mean absolute difference of the whole last classified frame.
+	double getMeanDifference() const { return meanDifference; }
+
+	const FrameChangeSettings& getSettings() const { return settings; }
+
+protected:
+	void makeThumbnail(cv::Mat frame, cv::Mat& thumbnail) const;
+
+	FrameChangeSettings settings;
+	cv::Mat reference;
+	cv::Mat current;
+	int staticFrames;
+	double maxBlockDifference;
+	double meanDifference;
+};
+
+}
+}
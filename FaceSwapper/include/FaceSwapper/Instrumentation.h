@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+// Stage timers and counters for the swapping pipeline.
+// Instrumentation is only compiled in if FACESWAPPER_INSTRUMENTATION is defined, otherwise the FS_* macros expand
+// to nothing. Use the macros in the pipeline code instead of calling Instrumentation directly.
+
+#ifdef FACESWAPPER_INSTRUMENTATION
+#define FS_INSTRUMENTATION_CONCAT2(a, b) a##b
+#define FS_INSTRUMENTATION_CONCAT(a, b) FS_INSTRUMENTATION_CONCAT2(a, b)
+#define FS_SCOPED_TIMER(stage) Jrs::FaceSwapper::ScopedTimer FS_INSTRUMENTATION_CONCAT(fsScopedTimer, __LINE__)(Jrs::FaceSwapper::Instrumentation::stage)
+#define FS_COUNTER_ADD(counter, n) Jrs::FaceSwapper::Instrumentation::add(Jrs::FaceSwapper::Instrumentation::counter, (uint64_t)(n))
+#else
+#define FS_SCOPED_TIMER(stage)
+#define FS_COUNTER_ADD(counter, n)
+#endif
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Per-stage latency histograms and pipeline counters.
+/// Each thread records into its own histograms (registered on first use), so recording needs no locks and no
+/// atomic read-modify-write; exporting sums up the histograms of all threads.
+class Instrumentation {
+
+public:
+	enum Stage {
+		STAGE_IMAGE_READ = 0,
+		STAGE_DETECT,
+		STAGE_LANDMARKS,
+		STAGE_WARP,
+		STAGE_COLOR_CORRECT,
+		STAGE_INSERT_FACES,
+		STAGE_SWAP,
+		STAGE_IMAGE_WRITE,
+		NUM_STAGES
+	};
+
+	enum Counter {
+		FACES_DETECTED = 0,
+		FACES_SWAPPED,
+		FACES_SKIPPED,
+		BYTES_READ,
+		BYTES_WRITTEN,
+		JPEG_MCUS_RECODED,
+		NUM_COUNTERS
+	};
+
+	/// number of histogram buckets, bucket i holds durations in [2^i, 2^(i+1)) microseconds (bucket 0 also holds shorter ones)
+	static const int NUM_BUCKETS = 32;
+
+	/// Indicates if the library was built with FACESWAPPER_INSTRUMENTATION; otherwise nothing is recorded and the
+	/// exported metrics stay zero.
+	static bool isCompiledIn();
+
+	static const char* getStageName(Stage stage);
+	static const char* getCounterName(Counter counter);
+
+	/// Records the duration of a stage for the calling thread.
+	static void record(Stage stage, uint64_t nanoseconds);
+
+	/// Adds to a counter for the calling thread.
+	static void add(Counter counter, uint64_t value);
+
+	/// Writes the current state as one JSON line.
+	static void writeJsonLine(std::ostream& out);
+
+	/// Writes the current state in the Prometheus text exposition format.
+	static void writePrometheus(std::ostream& out);
+
+	/// Writes the Prometheus text to a file (via a temporary file, so scrapers never see a partial file).
+	static bool writePrometheusFile(const std::string& path);
+
+	/// Starts a background thread, which periodically appends a JSON line to 'jsonLinesPath' and/or rewrites the
+	/// Prometheus file 'prometheusPath' (empty paths are skipped). Fails for intervals that are not positive.
+	static bool startExporter(const std::string& jsonLinesPath, const std::string& prometheusPath, double intervalSeconds);
+
+	/// Stops the background exporter and writes a final snapshot.
+	static void stopExporter();
+
+	/// Sums the recorded data of all threads.
+	struct Snapshot {
+		uint64_t count[NUM_STAGES];
+		uint64_t sumNs[NUM_STAGES];
+		uint64_t buckets[NUM_STAGES][NUM_BUCKETS];
+		uint64_t counters[NUM_COUNTERS];
+	};
+	static void getSnapshot(Snapshot& snapshot);
+
+	/// Estimates a percentile of a stage from the histogram (in milliseconds).
+	static double getPercentileMs(const Snapshot& snapshot, Stage stage, double p);
+};
+
+/// Records the time from construction to destruction for a stage.
+class ScopedTimer {
+
+public:
+	ScopedTimer(Instrumentation::Stage stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+
+	~ScopedTimer()
+	{
+		Instrumentation::record(stage, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+
+protected:
+	Instrumentation::Stage stage;
+	std::chrono::steady_clock::time_point start;
+};
+
+}
+}
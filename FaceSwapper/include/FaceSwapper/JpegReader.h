@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Decodes JPEG files with libjpeg, using its DCT domain scaling to decode cheap reduced resolution proxies (e.g. for
+/// face detection). The full resolution is only decoded when it is needed, i.e. when the proxy contains faces; the
+/// swap writes the whole image, so the full image is decoded then rather than just the face regions.
+/// The file is read into memory once by open(), all decode calls work on that copy. Images are returned as BGR.
+/// Unlike cv::imread, the EXIF orientation is not applied; check getOrientation() if the coordinates have to match
+/// the ones of an image read with cv::imread.
+class JpegReader {
+
+public:
+	JpegReader();
+
+	/// Reads a JPEG file and parses its header. Returns false if the file cannot be read or is no JPEG.
+	bool open(const std::string& path);
+
+	/// Checks the signature of a file (without reading all of it).
+	static bool isJpeg(const std::string& path);
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+
+	/// EXIF orientation (1 to 8, 1 if there is no EXIF orientation tag).
+	int getOrientation() const { return orientation; }
+
+	/// Raw file content.
+	const std::vector<unsigned char>& getData() const { return data; }
+
+	/// Decodes the image at 1/scale of its resolution (scale 1, 2, 4 or 8), the size of the result is rounded up.
+	bool decode(cv::Mat& img, int scale = 1);
+
+	/// Encodes a modified version of the image as JPEG, recompressing only the MCUs which intersect 'regions'.
+	/// The DCT coefficients of all other MCUs are copied unchanged, so they do not lose quality, and the recompressed
+	/// MCUs use the quantization tables and sampling factors of the original. 'img' must have the size and orientation
+	/// of the original. The metadata markers (EXIF, ICC, comments) are kept. Returns false for images which cannot be
+	/// recoded (other colour spaces than YCbCr and grayscale, 12 bit), the caller then has to encode the whole image.
+	bool recode(const cv::Mat& img, const std::vector<cv::Rect>& regions, std::vector<unsigned char>& output);
+
+	/// Largest scale (1, 2, 4 or 8), for which the longer side of the reduced image is still at least 'minSide'.
+	static int chooseScale(int width, int height, int minSide);
+
+protected:
+	std::vector<unsigned char> data;
+	int width;
+	int height;
+	int orientation;
+};
+
+}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/matx.hpp>
+#include <opencv2/core/types.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Mean shape of the 68 facial landmarks, used to complete the 5 landmarks of dlib's small shape predictor
+/// (shape_predictor_5_face_landmarks.dat: the eye corners and the bottom of the nose) to the 68 point layout. The
+/// affine swap only needs the jaw line, brows, nose and eye corners, which a face in a roughly frontal pose has where
+/// the template puts them relative to the eyes and nose. The template is mapped onto a face by the least squares affine
+/// transformation of its 5 corresponding points, so the fitted eyes and nose are reproduced up to the residual of the
+/// fit, while the jaw and mouth follow the mean proportions of a face.
+/// The built-in template is the mean shape of the iBUG 300-W annotations; fit() learns one from the 68 point
+/// landmarks of a corpus instead, which follows the faces of the corpus (e.g. generated ones) more closely.
+class LandmarkTemplate {
+
+public:
+	/// Built-in template.
+	LandmarkTemplate();
+
+	/// Reads a template written by write(): 68 lines of "<x> <y>", lines starting with '#' are comments.
+	bool read(const std::string& path);
+
+	bool write(const std::string& path) const;
+
+	/// Completes the 5 points of the small predictor (in its order) to 68 points.
+	void expand(const cv::Point2f* fitPoints, std::vector<cv::Point2f>& points) const;
+
+	/// Replaces the template by the mean of the given 68 point shapes, each mapped into the frame of the current
+	/// template by the transformation of its 5 fitting points. Returns false (and keeps the template) if no shape
+	/// has 68 points.
+	bool fit(const std::vector< std::vector<cv::Point2f> >& shapes);
+
+	const std::vector<cv::Point2f>& getPoints() const { return points; }
+
+	/// Least squares affine transformation mapping the n points of src to the ones of dst, false if the source
+	/// points are collinear.
+	static bool solveAffine(const cv::Point2f* src, const cv::Point2f* dst, int n, cv::Matx23d& trafo);
+
+	static const int NUM_POINTS = 68;
+
+	static const int NUM_FIT_POINTS = 5;
+
+	/// Indices in the 68 point layout of the 5 points of the small predictor: outer and inner corner of the right
+	/// (in the image) eye, outer and inner corner of the left eye, bottom of the nose.
+	static const int FIT_INDICES[NUM_FIT_POINTS];
+
+protected:
+	std::vector<cv::Point2f> points;
+};
+
+}
+}
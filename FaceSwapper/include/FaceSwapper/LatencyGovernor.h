@@ -0,0 +1,65 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Keeps the latency of a stream of frames within a budget by stepping between quality levels (0 is the best, higher
+/// levels are faster, e.g. the fallbacks of a SwapProfile).
+/// The latency of each level is tracked as an exponential moving average. The governor steps down as soon as the
+/// average of the current level exceeds the budget, and steps up again once the latency predicted for the better
+/// level (the current average scaled by the cost ratio of the two levels, measured around the last switch between
+/// them) has stayed below the budget for a while, so it neither oscillates nor stays degraded after a burst of
+/// expensive frames.
+/// The methods may be called from several threads.
+class LatencyGovernor {
+
+public:
+	/// @param numLevels	number of levels, at least 1
+	/// @param budgetMs		latency budget per frame, <= 0 keeps level 0
+	LatencyGovernor(int numLevels = 1, double budgetMs = 0.0);
+
+	/// Changes the levels and the budget and forgets all measurements.
+	void reset(int numLevels, double budgetMs);
+
+	/// Level for the next frame.
+	int getLevel();
+
+	/// Records the latency of a frame processed at 'level' and returns the level for the next frame. Frames of other
+	/// levels than the current one (still in flight while the level changed) only update their level's average.
+	int update(int level, double latencyMs);
+
+	double getBudget() const { return budgetMs; }
+
+	/// weight of a new frame in the moving average
+	static const double SMOOTHING;
+
+	/// frames at a level before its average is trusted for stepping down
+	static const int MIN_FRAMES = 5;
+
+	/// consecutive frames the predicted latency of the better level has to stay within the budget before stepping up
+	static const int UPGRADE_FRAMES = 30;
+
+	/// fraction of the budget the predicted latency of the better level has to stay below before stepping up
+	static const double UPGRADE_HEADROOM;
+
+protected:
+	double budgetMs;
+	int level;
+
+	std::vector<double> average;
+	std::vector<int> frames;
+	/// cost of level i relative to level i + 1, 0 while unknown
+	std::vector<double> ratio;
+	/// level before the last switch, -1 if there was none
+	int previousLevel;
+	/// consecutive frames the better level was predicted to fit the budget
+	int upgradeFrames;
+
+	std::mutex mutex;
+};
+
+}
+}
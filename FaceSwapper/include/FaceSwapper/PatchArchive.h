@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+class FileLock;
+
+/// Area of a frame changed by the swap: the swapped pixels with an alpha, which is 255 where the swap changed the
+/// pixel and 0 elsewhere, so blending the patch over the original frame gives exactly the swapped frame.
+struct SwapPatch {
+	/// position in the frame
+	cv::Rect roi;
+	/// BGRA pixels (CV_8UC4) of the size of roi
+	cv::Mat pixels;
+};
+
+/// Creating and applying swap patches.
+class PatchArchive {
+
+public:
+	/// Extracts the changed pixels of the given areas (e.g. FaceSwapping::getSwapRoi) from a frame and its swapped
+	/// copy. Overlapping areas are merged, areas without changes are skipped.
+	static void extract(cv::Mat original, cv::Mat swapped, const std::vector<cv::Rect>& rois, std::vector<SwapPatch>& patches);
+
+	/// Blends patches over a BGR frame (CV_8UC3) in place. Returns false if a patch is outside of the frame.
+	static bool apply(cv::Mat frame, const std::vector<SwapPatch>& patches);
+
+	/// Encodes the patches of a frame as record of an archive.
+	static void encodeFrame(const std::string& key, cv::Size frameSize, const std::vector<SwapPatch>& patches, std::vector<unsigned char>& data);
+};
+
+/// Archive of the swap patches of many frames (the frames of a video, or the images of a batch), which are applied
+/// to the original media later, instead of storing the whole swapped frames.
+/// After the signature "FSP1" follow records of a four character tag and the size of the payload (32 bit little
+/// endian). A frame record ("FRME") holds the key of the frame (e.g. the input path or the frame number), the frame
+/// size and its patches, each with its position and the pixels as BGRA PNG. Frames without faces have a record
+/// without patches, so they are distinguishable from frames which have not been processed. The index record ("INDX")
+/// written on closing lists the offsets of all frames and ends with its own offset and "FSPE", so a reader finds it
+/// from the end of the file.
+/// An archive whose writer was killed has no index; it is read by scanning the frame records, and reopening it for
+/// writing drops a truncated last record and continues after it. Reopening an archive with an index drops the index,
+/// the new records take its place and close() writes an index of all frames. A frame written again replaces the
+/// earlier record.
+/// Only one writer may append to an archive at a time: open() holds the lock file "<archive>.lock" until close() and
+/// fails if another writer (in this or another process) holds it.
+class PatchWriter {
+
+public:
+	PatchWriter();
+
+	~PatchWriter();
+
+	/// Opens an archive for writing, appending to an existing one. Returns false if another writer has it open.
+	bool open(const std::string& path);
+
+	/// Appends the patches of a frame and flushes them to disk, may be called from several threads.
+	/// 'recordHash' receives the hash of the written record (DetectionCache::hashBytes), if not NULL.
+	bool write(const std::string& key, cv::Size frameSize, const std::vector<SwapPatch>& patches, uint64_t* recordHash = NULL);
+
+	/// Writes the index and closes the archive.
+	bool close();
+
+	size_t getNumFrames();
+
+protected:
+	bool writeRecord(const std::vector<unsigned char>& data);
+	void releaseLock();
+
+	FILE* file;
+	/// held from open() to close()
+	FileLock* writerLock;
+	std::string path;
+	uint64_t offset;
+	/// frames in the order of their first record, with the offset of their latest one
+	std::vector<std::string> keys;
+	std::map<std::string, uint64_t> offsets;
+	std::mutex mutex;
+
+private:
+	PatchWriter(const PatchWriter&);
+	PatchWriter& operator=(const PatchWriter&);
+};
+
+/// Reads the frames of a patch archive. Not thread safe.
+class PatchReader {
+
+public:
+	PatchReader() : validSize(0), indexOffset(0) {}
+
+	/// Opens an archive, from its index or, if it has none, by scanning the frame records.
+	bool open(const std::string& path);
+
+	/// Keys of the frames in the order they were first written.
+	const std::vector<std::string>& getKeys() const { return keys; }
+
+	bool contains(const std::string& key) const { return offsets.count(key) > 0; }
+
+	/// Reads the patches of a frame and the size of the frame they belong to.
+	bool read(const std::string& key, cv::Size& frameSize, std::vector<SwapPatch>& patches);
+
+	/// End of the last complete record (the size of the file, unless the last record is truncated).
+	uint64_t getValidSize() const { return validSize; }
+
+	/// Offset of the index record, 0 if the archive has no index and was scanned.
+	uint64_t getIndexOffset() const { return indexOffset; }
+
+	/// Offsets of the frame records.
+	const std::map<std::string, uint64_t>& getOffsets() const { return offsets; }
+
+protected:
+	bool readIndex(uint64_t fileSize);
+
+	void scan(uint64_t fileSize);
+
+	std::ifstream stream;
+	std::vector<std::string> keys;
+	std::map<std::string, uint64_t> offsets;
+	uint64_t validSize;
+	uint64_t indexOffset;
+};
+
+}
+}
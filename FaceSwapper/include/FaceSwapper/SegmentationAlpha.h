@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Compact storage of a precomputed foreground alpha (e.g. from the portrait segmenter in automatic-portrait-tf-master)
+/// next to a face bank image, used by the swap instead of the outline mask of the landmarks.
+/// The alpha is quantized to 16 levels and run length encoded over the rows: after the signature "FSA1" and the width
+/// and height (32 bit little endian) follow runs of one byte, the level in the high and the length minus one in the
+/// low nibble. A low nibble of 15 marks a long run, whose length minus 16 follows as LEB128 varint.
+class SegmentationAlpha {
+
+public:
+	/// Name of the alpha file of an image.
+	static std::string getPath(const std::string& imagePath) { return imagePath + ".alpha"; }
+
+	/// Reads an alpha file into a CV_8UC1 image. Returns false if the file does not exist or is invalid.
+	static bool read(const std::string& path, cv::Mat& alpha);
+
+	/// Writes a CV_8UC1 alpha image.
+	static bool write(const std::string& path, const cv::Mat& alpha);
+
+	static bool decode(const std::vector<unsigned char>& data, cv::Mat& alpha);
+
+	static void encode(const cv::Mat& alpha, std::vector<unsigned char>& data);
+};
+
+}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "DetectionRegion.h"
+#include "FaceSwapper/FrameChangeDetector.h"
+#include "FaceSwapper/SwapPipeline.h"
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Swaps the faces of the consecutive frames of one video stream with a SwapPipeline, reusing the detections and
+/// landmarks of the last detected frame as long as the frames are static (see FrameChangeDetector), so only the swap
+/// itself is repeated. Scene cuts, changes in any block of the frame and the maximum number of static frames force a
+/// full detection, and a failed detection is never replaced by older results. Reused faces keep their bank faces, and
+/// so do the faces of a new detection that overlap a face of the previous one, unless the scene was cut.
+/// One instance per stream, not thread safe; several instances may share a pipeline.
+class StreamSwapper {
+
+public:
+	/// @param pipeline	initialized pipeline with a loaded face bank, which has to outlive the swapper
+	StreamSwapper(SwapPipeline& pipeline, const FrameChangeSettings& settings = FrameChangeSettings());
+
+	~StreamSwapper();
+
+	/// Replaces all faces of the next BGR frame (CV_8UC3) of the stream in place.
+	/// Returns the number of replaced faces, or -1 on error.
+	int process(cv::Mat frame);
+
+	/// Forgets the detections, the next frame is detected (e.g. after seeking).
+	void reset();
+
+	/// Classification of the last processed frame.
+	FrameChangeDetector::Change getLastChange() const { return lastChange; }
+
+	int getNumFrames() const { return numFrames; }
+
+	/// Number of frames swapped with the detections of an earlier frame.
+	int getNumReused() const { return numReused; }
+
+protected:
+	void clearRegions();
+
+	/// Assigns the bank faces to the new regions (see class description).
+	void assignBankFaces(const std::vector<DetectionRegion*>& previous, const std::vector<const BankFace*>& previousFaces);
+
+	SwapPipeline& pipeline;
+	FrameChangeDetector changeDetector;
+	/// detections with landmarks of the reference frame of the change detector
+	std::vector<DetectionRegion*> regions;
+	/// bank faces replacing the regions, kept as long as the regions are reused
+	std::vector<const BankFace*> assigned;
+	FrameChangeDetector::Change lastChange;
+	int numFrames;
+	int numReused;
+
+private:
+	StreamSwapper(const StreamSwapper&);
+	StreamSwapper& operator=(const StreamSwapper&);
+};
+
+}
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "DetectionRegion.h"
+#include "FaceSwapper/BankFace.h"
+#include "FaceSwapper/FaceSheet.h"
+#include "FaceSwapper/PatchArchive.h"
+
+class FaceDetector;
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+class FaceSwapping;
+
+/// Settings of a SwapPipeline.
+struct SwapPipelineConfig {
+	SwapPipelineConfig() :
+		detectorBackend("dlib"),
+		detectorModel(),
+		detectSize(0),
+		landmarksModel("./models/shape_predictor_68_face_landmarks.dat"),
+		landmarkTemplate(),
+		triangulation(false),
+		boxFeather(false),
+		maxPatchSize(0),
+		rowThreads(0),
+		minConfidence(0.0),
+		bankMinConfidence(0.0)
+	{}
+
+	/// detector backend (see FaceDetector::create)
+	std::string detectorBackend;
+	/// model of the detector backend, empty for the default model of the backend
+	std::string detectorModel;
+	/// longer side of the image the detector runs on, larger images are reduced (the landmarks are still fitted at
+	/// full resolution); 0 for the full image
+	int detectSize;
+	/// dlib shape predictor with 68 or 5 points (or Kazemi model, if triangulation is used)
+	std::string landmarksModel;
+	/// template completing the landmarks of a 5 point predictor (see LandmarkTemplate::read), empty for the built-in one
+	std::string landmarkTemplate;
+	/// use triangulation based warping instead of the affine transform
+	bool triangulation;
+	/// blend with the eroded and box blurred mask of the original implementation instead of the distance based edge
+	bool boxFeather;
+	/// swap faces larger than this (in pixels) at reduced resolution, 0 for full resolution (see FaceSwapping::setMaxPatchSize)
+	int maxPatchSize;
+	/// threads for the pixel loops of a large face, 0 for the OpenCV thread count (see FaceSwapping::setRowParallelism)
+	int rowThreads;
+	/// minimum confidence of faces to be replaced, <= 0 for the default of the detector backend
+	double minConfidence;
+	/// minimum confidence of faces in the face bank, <= 0 for the default of the detector backend
+	double bankMinConfidence;
+};
+
+/// Detector, landmarking and swapping bundled for embedding into other applications.
+/// The models and the face bank are loaded once, then process() replaces the faces in caller-owned frames in place.
+/// process() is reentrant and may be called from several threads at once; the detector network is shared and
+/// serialized internally, all other steps run in parallel.
+class SwapPipeline {
+
+public:
+	SwapPipeline();
+
+	~SwapPipeline();
+
+	/// Loads the models. Returns false if a model cannot be loaded.
+	bool init(const SwapPipelineConfig& config);
+
+	/// Adds the faces found in an image file to the face bank. Returns false if the image cannot be read or contains
+	/// no face. A segmentation alpha stored next to the image (see SegmentationAlpha) is used for blending the faces.
+	/// Must not be called concurrently with process().
+	bool loadFaceBank(const std::string& path);
+
+	/// Adds the faces found in a BGR image to the face bank (the faces are copied). 'alpha' is an optional
+	/// segmentation of the image (CV_8UC1).
+	bool addFaceBankImage(cv::Mat img, cv::Mat alpha = cv::Mat());
+
+	/// Adds the faces of a face sheet to the face bank without running the detector (see FaceSheet). 'grid' is
+	/// "<rows>x<cols>"; if it is empty, the layout is read from the sidecar of the sheet. Returns false if the sheet
+	/// or its layout cannot be read or no tile contains a usable face.
+	bool loadFaceSheet(const std::string& path, const std::string& grid = std::string());
+
+	/// Adds the faces of a BGR face sheet with the given layout to the face bank. 'alpha' is an optional segmentation
+	/// of the sheet (CV_8UC1).
+	bool addFaceSheet(cv::Mat sheet, const FaceSheetLayout& layout, cv::Mat alpha = cv::Mat());
+
+	/// Replaces all faces in a BGR frame (CV_8UC3) in place. The frame may wrap a caller-owned buffer.
+	/// Faces below 'minConfidence' are kept (values <= 0 use the configured minimum confidence).
+	/// If 'patches' is given, it receives the changed areas of the frame (see PatchArchive).
+	/// If 'key' is given (e.g. the path of the input image), the bank faces are selected by it (see assignBankFaces).
+	/// Returns the number of replaced faces, or -1 on error.
+	int process(cv::Mat frame, double minConfidence = 0, std::vector<SwapPatch>* patches = NULL, const std::string& key = std::string());
+
+	/// Replaces the given faces in a BGR frame in place (landmarks are added to the regions if missing).
+	/// 'stop' is checked between the groups of concurrently swapped faces; if it returns true, the swap is abandoned, the frame is left unchanged and
+	/// INTERRUPTED is returned. If 'patches' is given, it receives the changed areas of the frame. Returns the number of
+	/// replaced faces, or -1 on error.
+	int swap(cv::Mat frame, const std::vector<DetectionRegion*>& regions, const std::function<bool()>& stop = std::function<bool()>(),
+		std::vector<SwapPatch>* patches = NULL);
+
+	/// As above, but regions[i] is replaced by assigned[i], a face of this pipeline's bank (see assignBankFaces).
+	int swap(cv::Mat frame, const std::vector<DetectionRegion*>& regions, const std::vector<const BankFace*>& assigned,
+		const std::function<bool()>& stop = std::function<bool()>(), std::vector<SwapPatch>* patches = NULL);
+
+	/// Selects the bank faces for 'numFaces' faces of a frame. With a key, face i gets the bank face selected by a hash
+	/// of the key and i, so the result does not depend on the frames processed before (thread scheduling, shards and
+	/// resumed runs of a batch); without a key, the bank faces are assigned round robin over all processed faces.
+	void assignBankFaces(size_t numFaces, std::vector<const BankFace*>& faces, const std::string& key = std::string());
+
+	/// Detects faces (with landmarks) in an image. The caller owns the returned regions.
+	bool detect(cv::Mat img, double minConfidence, std::vector<DetectionRegion*>& regions);
+
+	static const int INTERRUPTED = -2;
+
+	const SwapPipelineConfig& getConfig() const { return config; }
+
+	int getNumBankFaces() const { return (int)bankFaces.size(); }
+
+	bool isInitialized() const { return detector != NULL && swapping != NULL; }
+
+protected:
+
+	SwapPipelineConfig config;
+
+	FaceDetector* detector;
+	std::mutex detectorMutex;
+
+	FaceSwapping* swapping;
+
+	/// faces of the bank with their precomputed masks and histograms
+	std::vector<BankFace> bankFaces;
+
+	/// bank faces are assigned round robin over all processed faces without a key
+	std::atomic<unsigned int> nextBankFace;
+
+private:
+	SwapPipeline(const SwapPipeline&);
+	SwapPipeline& operator=(const SwapPipeline&);
+};
+
+}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+struct SwapPipelineConfig;
+
+/// Named trade-off between quality and latency, binding the settings of all stages of the pipeline:
+///  - realtime: SSD detector on frames reduced to 640 pixels, 5 point landmarks, affine warp blended by alpha with
+///    histogram colour transfer at a working resolution of at most 256 pixels
+///  - balanced: dlib detector on frames reduced to 1280 pixels, 68 point landmarks, affine warp blended by alpha with
+///    histogram colour transfer at full resolution
+///  - archival: dlib detector on the full frame, Kazemi landmarks, triangulated warp blended by Poisson image editing
+///    (seamlessClone), which also adapts the colours
+/// The colour transfer is bound to the blend: the Poisson blend takes the colours from the frame by itself.
+struct SwapProfile {
+	SwapProfile() : detectSize(0), triangulation(false), boxFeather(false), maxPatchSize(0) {}
+
+	std::string name;
+	/// longer side of the image the detector runs on, larger frames are reduced; 0 for the full frame
+	int detectSize;
+	/// detector backend (see FaceDetector::create), with its default model
+	std::string detectorBackend;
+	/// landmark model: a dlib shape predictor with 68 or 5 points, or the Kazemi model for the triangulated warp
+	std::string landmarksModel;
+	/// triangulated warp with Poisson blend instead of the affine warp with alpha blend and histogram colour transfer
+	bool triangulation;
+	/// soft edge of the alpha blend (see FaceSwapping::FEATHER_BOX)
+	bool boxFeather;
+	/// working resolution of the affine swap (see FaceSwapping::setMaxPatchSize)
+	int maxPatchSize;
+
+	/// Overwrites the settings of the profile in a pipeline configuration. The detector model is reset to the default
+	/// of the backend if the backend changes; all other settings (confidences, threads, landmark template) are kept.
+	void apply(SwapPipelineConfig& config) const;
+
+	/// Looks up a profile by name. Returns false for unknown names.
+	static bool find(const std::string& name, SwapProfile& profile);
+
+	/// All profiles, ordered from the best quality to the lowest latency.
+	static std::vector<SwapProfile> getProfiles();
+
+	/// The profile of the given name followed by all faster ones, which a LatencyGovernor steps down to. Empty for
+	/// unknown names.
+	static std::vector<SwapProfile> getFallbacks(const std::string& name);
+
+	/// Names of all profiles, separated by '|'.
+	static std::string getNames();
+};
+
+}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Binary protocol between the swap daemon and its clients over a local stream socket.
+/// Every message is a fixed 16 byte header (magic, version, type, job id, payload size; all little endian) followed
+/// by the payload. Strings are encoded as a 32 bit length followed by the bytes.
+/// The client sends JOB messages; the daemon answers each job with STATUS messages (QUEUED, RUNNING, then DONE or
+/// FAILED) carrying the job id of the request, so a client may have several jobs in flight on one connection.
+namespace SwapProtocol {
+
+	static const uint32_t MAGIC = 0x50575346; // "FSWP"
+	static const uint16_t VERSION = 1;
+	static const uint32_t HEADER_SIZE = 16;
+	static const uint32_t MAX_PAYLOAD_SIZE = 1 << 20;
+
+	enum MessageType {
+		MSG_JOB = 1,
+		MSG_STATUS = 2
+	};
+
+	enum FrameSource {
+		/// the input is an image file, the result is written to the output path
+		SOURCE_FILE = 0,
+		/// the input is a packed BGR frame in a POSIX shared memory object, which is modified in place
+		SOURCE_SHARED_MEMORY = 1
+	};
+
+	enum JobState {
+		STATE_QUEUED = 0,
+		STATE_RUNNING = 1,
+		STATE_DONE = 2,
+		STATE_FAILED = 3
+	};
+
+	struct Header {
+		uint16_t type;
+		uint32_t jobId;
+		uint32_t payloadSize;
+	};
+
+	struct Job {
+		Job() : source(SOURCE_FILE), width(0), height(0), stride(0), minConfidence(0) {}
+
+		uint8_t source;
+		/// image path or shared memory name
+		std::string input;
+		/// frame geometry for SOURCE_SHARED_MEMORY
+		uint32_t width, height, stride;
+		/// output path for SOURCE_FILE
+		std::string output;
+		/// minimum confidence of faces to replace, 0 for the daemon's default
+		float minConfidence;
+	};
+
+	struct Status {
+		Status() : state(STATE_QUEUED), faces(0), queueUs(0), readUs(0), processUs(0), writeUs(0) {}
+
+		uint8_t state;
+		/// number of replaced faces (DONE only)
+		int32_t faces;
+		/// time spent in the queue, reading the input, swapping and writing the output
+		uint32_t queueUs, readUs, processUs, writeUs;
+		/// error description (FAILED only)
+		std::string message;
+	};
+
+	void encodeJob(const Job& job, std::string& payload);
+	bool decodeJob(const std::string& payload, Job& job);
+
+	void encodeStatus(const Status& status, std::string& payload);
+	bool decodeStatus(const std::string& payload, Status& status);
+
+	/// Writes a complete message to a socket. Returns false on I/O errors.
+	bool writeMessage(int fd, MessageType type, uint32_t jobId, const std::string& payload);
+
+	/// Reads a complete message from a socket. Returns false on I/O errors, end of stream or invalid headers.
+	bool readMessage(int fd, Header& header, std::string& payload);
+
+}
+
+}
+}
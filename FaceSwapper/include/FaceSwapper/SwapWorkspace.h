@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/core/types.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Scratch buffers for swapping one face, reused across faces and frames.
+/// Each buffer keeps the largest size requested so far and hands out views of the requested size, so after the
+/// first frames of a stream (or the largest face of a batch) the workspace does not grow any more. The buffers of the
+/// point lists and histograms keep their capacity in the same way. This covers the images and lists of the swap
+/// itself; temporaries inside OpenCV functions (e.g. the index buffers of cv::warpAffine, the distance transform of
+/// the soft edge, the seamless clone of the triangulated swap) are still allocated by OpenCV on every call, so the
+/// swap is not free of heap allocations, but their number stays constant once the workspace has grown.
+/// A workspace is used by one thread at a time; local() returns the workspace of the calling thread.
+class SwapWorkspace {
+
+public:
+	SwapWorkspace();
+
+	/// Workspace of the calling thread.
+	static SwapWorkspace& local();
+
+	/// Returns a view of 'storage' (one of the buffers below) with the given size and type, growing 'storage' if it
+	/// is too small. The content of the view is undefined.
+	cv::Mat getBuffer(cv::Mat& storage, cv::Size size, int type);
+
+	/// Total size of the image buffers in bytes.
+	size_t getCapacity() const;
+
+	/// Number of times one of the image buffers had to grow.
+	size_t getNumAllocations() const { return numAllocations; }
+
+	/// Frees all buffers.
+	void release();
+
+	// affine swap: warped mask, alpha and face of a bank face, distance to the outline
+	cv::Mat mask;
+	cv::Mat alpha;
+	cv::Mat warpedFace;
+	cv::Mat distance;
+
+	// partial colour histograms of the row bands (see FaceSwapping::computeCdf)
+	std::vector<int> histograms;
+
+	// affine swap at reduced resolution: frame patch at working resolution, upsampled face and alpha
+	cv::Mat proxyFrame;
+	cv::Mat patch;
+	cv::Mat patchAlpha;
+
+	// triangulated swap
+	cv::Mat faceSetFloat;
+	cv::Mat warpedFloat;
+	cv::Mat warped;
+	cv::Mat hullMask;
+	cv::Mat cloned;
+	cv::Mat triangleMask;
+	cv::Mat triangleInverseMask;
+	cv::Mat triangleWarped;
+	std::vector<cv::Point2f> points1;
+	std::vector<cv::Point2f> points2;
+	std::vector<cv::Point2f> hull1;
+	std::vector<cv::Point2f> hull2;
+	std::vector<cv::Point> hullInt;
+	std::vector<int> hullIndex;
+	std::vector<cv::Vec3i> triangles;
+	std::vector<cv::Vec6f> triangleList;
+
+protected:
+	size_t numAllocations;
+};
+
+}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Fixed set of worker threads executing queued tasks in FIFO order.
+class WorkerPool {
+
+public:
+	/// @param numThreads	number of workers, 0 uses the number of hardware threads
+	WorkerPool(int numThreads = 0);
+
+	/// Runs the remaining queued tasks and joins the workers.
+	~WorkerPool();
+
+	/// Queues a task. Returns false if the pool is shutting down.
+	bool post(const std::function<void()>& task);
+
+	/// Waits until the queue is empty and no task is running.
+	void wait();
+
+	/// Number of queued tasks, which are not yet running.
+	size_t getQueueLength();
+
+	int getNumThreads() const { return (int)threads.size(); }
+
+protected:
+	void run();
+
+	std::vector<std::thread> threads;
+	std::deque< std::function<void()> > queue;
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::condition_variable idleCondition;
+	int running;
+	bool stopping;
+
+private:
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+};
+
+}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+/* C interface of the face swapping pipeline (see SwapPipeline).
+ * All functions are safe to call from several threads for the same pipeline, except create, destroy and
+ * load_face_bank, which must not overlap with other calls on that pipeline. */
+
+#if defined(_WIN32) && defined(FACESWAPPER_SHARED)
+#ifdef FACESWAPPER_EXPORTS
+#define FACESWAPPER_API __declspec(dllexport)
+#else
+#define FACESWAPPER_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define FACESWAPPER_API __attribute__((visibility("default")))
+#else
+#define FACESWAPPER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fs_pipeline fs_pipeline;
+
+typedef struct fs_config {
+	/* dlib MMOD face detector network */
+	const char* detector_model;
+	/* dlib shape predictor (or Kazemi model, if triangulation is set) */
+	const char* landmarks_model;
+	/* nonzero to use triangulation based warping */
+	int triangulation;
+	/* minimum confidence of faces to be replaced, <= 0 for the default */
+	double min_confidence;
+	/* minimum confidence of faces in the face bank, <= 0 for the default */
+	double bank_min_confidence;
+} fs_config;
+
+/* Loads the models, returns NULL on error. A NULL config or NULL fields use the defaults. */
+FACESWAPPER_API fs_pipeline* fs_pipeline_create(const fs_config* config);
+
+FACESWAPPER_API void fs_pipeline_destroy(fs_pipeline* pipeline);
+
+/* Adds the faces of an image file to the face bank, returns 0 on success. */
+FACESWAPPER_API int fs_pipeline_load_face_bank(fs_pipeline* pipeline, const char* path);
+
+/* Replaces the faces of a packed BGR frame (3 bytes per pixel, 'stride' bytes per row) in place.
+ * Returns the number of replaced faces, or -1 on error. */
+FACESWAPPER_API int fs_pipeline_process(fs_pipeline* pipeline, unsigned char* bgr, int width, int height, int stride);
+
+/* Describes the last error of the calling thread. */
+FACESWAPPER_API const char* fs_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
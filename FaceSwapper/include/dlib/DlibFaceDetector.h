@@ -7,10 +7,11 @@
 // * The detected faces will get class id '1000' and the class string 'face'
 
 #include "FaceDetectionRegion.h"
+#include "FaceDetector.h"
 
-#include <opencv2\highgui\highgui.hpp>
-#include <opencv2\core\core.hpp>
-#include <opencv\cv.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/core_c.h>
 
 #include "dlib/image_transforms/../pixel.h"
 #include "dlib/image_transforms/assign_image_abstract.h"
@@ -47,7 +48,7 @@ namespace dlibwrapper {
 	};
 }
 
-class FaceDetectorDlib 
+class FaceDetectorDlib : public FaceDetector
 {
 public:
 	/// All algorithm parameters for object detector have to provided in config file 'cfg'
@@ -57,6 +58,11 @@ public:
 	virtual void doLazyInit(std::string networkFile);
 	virtual std::vector<DetectionRegion*>* calculate(const cv::Mat img, double minConfidence);
 
+	virtual std::string getName() const { return "dlib"; }
+	virtual std::string getDefaultModel() const { return "mmod_human_face_detector.dat"; }
+	virtual double getDefaultConfidence() const { return 0.9; }
+	virtual double getBankConfidence() const { return 0.98; }
+
 
 protected:
 	dlibwrapper::Net* mNet;
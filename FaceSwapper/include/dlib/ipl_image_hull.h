@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdexcept>
+#include <opencv2/core/types_c.h>
+
 #include "dlib/algs.h"
 #include "dlib/pixel.h"
 #include "dlib/matrix/matrix_mat.h"
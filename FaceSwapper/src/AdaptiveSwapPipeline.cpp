@@ -0,0 +1,83 @@
+#include "FaceSwapper/AdaptiveSwapPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+AdaptiveSwapPipeline::AdaptiveSwapPipeline()
+{
+}
+
+bool AdaptiveSwapPipeline::init(const SwapPipelineConfig& config, const std::vector<SwapProfile>& fallbacks, double budgetMs)
+{
+	if (!pipelines.empty()) {
+		std::cerr << "pipeline is already initialized" << std::endl;
+		return false;
+	}
+
+	size_t numLevels = budgetMs > 0 ? std::max(fallbacks.size(), (size_t)1) : 1;
+	for (size_t i = 0; i < numLevels; i++) {
+		SwapPipelineConfig levelConfig = config;
+		if (i > 0)
+			fallbacks[i].apply(levelConfig);
+
+		std::unique_ptr<SwapPipeline> pipeline(new SwapPipeline());
+		if (!pipeline->init(levelConfig)) {
+			pipelines.clear();
+			names.clear();
+			return false;
+		}
+		pipelines.push_back(std::move(pipeline));
+		names.push_back(fallbacks.empty() ? std::string("custom") : fallbacks[i].name);
+	}
+
+	governor.reset((int)numLevels, budgetMs);
+	return true;
+}
+
+bool AdaptiveSwapPipeline::loadFaceBank(const std::string& path)
+{
+	bool ok = !pipelines.empty();
+	for (size_t i = 0; i < pipelines.size(); i++)
+		ok = pipelines[i]->loadFaceBank(path) && ok;
+	return ok;
+}
+
+bool AdaptiveSwapPipeline::loadFaceSheet(const std::string& path, const std::string& grid)
+{
+	bool ok = !pipelines.empty();
+	for (size_t i = 0; i < pipelines.size(); i++)
+		ok = pipelines[i]->loadFaceSheet(path, grid) && ok;
+	return ok;
+}
+
+int AdaptiveSwapPipeline::process(cv::Mat frame, double minConfidence)
+{
+	if (pipelines.empty())
+		return -1;
+
+	int level = governor.getLevel();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int faces = pipelines[level]->process(frame, minConfidence);
+	double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	int next = governor.update(level, latencyMs);
+	if (next != level)
+		std::cout << "latency " << latencyMs << " ms, switching from profile " << names[level] << " to " << names[next] << std::endl;
+
+	return faces;
+}
+
+int AdaptiveSwapPipeline::getNumBankFaces() const
+{
+	int faces = 0;
+	for (size_t i = 0; i < pipelines.size(); i++)
+		faces = i == 0 ? pipelines[i]->getNumBankFaces() : std::min(faces, pipelines[i]->getNumBankFaces());
+	return faces;
+}
+
+}
+}
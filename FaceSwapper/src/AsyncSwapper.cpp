@@ -0,0 +1,109 @@
+#include "FaceSwapper/AsyncSwapper.h"
+
+#include <exception>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Deletes the region copies of a submitted swap.
+static void deleteRegions(std::vector<DetectionRegion*>* regions)
+{
+	for (size_t i = 0; i < regions->size(); i++)
+		delete regions->at(i);
+	delete regions;
+}
+
+AsyncSwapper::AsyncSwapper(SwapPipeline& pipeline, int numThreads) :
+	pipeline(pipeline),
+	pool(numThreads)
+{
+}
+
+AsyncSwapper::~AsyncSwapper()
+{
+	pool.wait();
+}
+
+SwapTicket AsyncSwapper::submit(cv::Mat frame, Clock::time_point deadline)
+{
+	return submit(frame, NULL, deadline);
+}
+
+SwapTicket AsyncSwapper::submit(cv::Mat frame, const std::vector<DetectionRegion*>& regions, Clock::time_point deadline)
+{
+	return submit(frame, &regions, deadline);
+}
+
+SwapTicket AsyncSwapper::submit(cv::Mat frame, const std::vector<DetectionRegion*>* regions, Clock::time_point deadline)
+{
+	std::shared_ptr< std::promise<SwapResult> > promise(new std::promise<SwapResult>());
+	std::shared_ptr< std::atomic<bool> > cancelled(new std::atomic<bool>(false));
+
+	SwapTicket ticket;
+	ticket.result = promise->get_future();
+	ticket.cancelled = cancelled;
+
+	// NULL means the faces still have to be detected
+	std::shared_ptr< std::vector<DetectionRegion*> > copies;
+	if (regions) {
+		copies.reset(new std::vector<DetectionRegion*>(), deleteRegions);
+		for (size_t i = 0; i < regions->size(); i++) {
+			DetectionRegion* dr = new DetectionRegion();
+			dr->copyFromRegion(regions->at(i), true);
+			copies->push_back(dr);
+		}
+	}
+
+	if (!pool.post([this, promise, cancelled, frame, copies, deadline]() { run(promise, cancelled, frame, copies, deadline); })) {
+		SwapResult result;
+		result.frame = frame;
+		result.message = "swapper is shutting down";
+		promise->set_value(result);
+	}
+
+	return ticket;
+}
+
+void AsyncSwapper::run(std::shared_ptr< std::promise<SwapResult> > promise, std::shared_ptr< std::atomic<bool> > cancelled, cv::Mat frame,
+	std::shared_ptr< std::vector<DetectionRegion*> > regions, Clock::time_point deadline)
+{
+	SwapResult result;
+	result.frame = frame;
+
+	std::function<bool()> stop = [&cancelled, deadline]() { return cancelled->load() || Clock::now() >= deadline; };
+
+	try {
+		if (!stop()) {
+			if (!regions) {
+				regions.reset(new std::vector<DetectionRegion*>(), deleteRegions);
+				if (!pipeline.detect(frame, pipeline.getConfig().minConfidence, *regions))
+					regions.reset();
+			}
+
+			if (!regions)
+				result.message = "face detection failed";
+			else
+				result.faces = pipeline.swap(frame, *regions, stop);
+		}
+		else
+			result.faces = SwapPipeline::INTERRUPTED;
+
+		if (result.faces == SwapPipeline::INTERRUPTED) {
+			result.faces = 0;
+			result.status = cancelled->load() ? SwapResult::CANCELLED : SwapResult::DEADLINE_EXCEEDED;
+		}
+		else if (result.faces >= 0 && result.message.empty())
+			result.status = SwapResult::DONE;
+		else if (result.message.empty())
+			result.message = "swap failed";
+	}
+	catch (std::exception& e) {
+		result.status = SwapResult::FAILED;
+		result.message = e.what();
+	}
+
+	promise->set_value(result);
+}
+
+}
+}
@@ -0,0 +1,182 @@
+#include "FaceSwapper/BatchManifest.h"
+#include "FaceSwapper/DetectionCache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+static int getProcessId()
+{
+#ifdef _WINDOWS
+	return (int)GetCurrentProcessId();
+#else
+	return (int)getpid();
+#endif
+}
+
+bool BatchManifest::read(const std::string& path, const std::string& outputDir, std::vector<BatchItem>& items, bool requireOutput)
+{
+	std::ifstream fileStream(path.c_str());
+	if (!fileStream.is_open()) {
+		std::cerr << "failed to open manifest " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(fileStream, line)) {
+		lineNumber++;
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		BatchItem item;
+		size_t tab = line.find('\t');
+		if (tab != std::string::npos) {
+			item.input = line.substr(0, tab);
+			item.output = line.substr(tab + 1);
+		}
+		else {
+			item.input = line;
+			if (!outputDir.empty())
+				item.output = getOutputPath(line, outputDir);
+		}
+
+		if (item.input.empty() || (requireOutput && item.output.empty())) {
+			std::cerr << "no output for line " << lineNumber << " of manifest " << path << std::endl;
+			return false;
+		}
+		items.push_back(item);
+	}
+
+	return true;
+}
+
+int BatchManifest::getShard(const std::string& input, int shardCount)
+{
+	if (shardCount <= 1)
+		return 0;
+	uint64_t h = DetectionCache::hashBytes(input.data(), input.size());
+	return (int)(h % (uint64_t)shardCount);
+}
+
+void BatchManifest::selectShard(const std::vector<BatchItem>& items, int shardIndex, int shardCount, std::vector<BatchItem>& shard)
+{
+	for (size_t i = 0; i < items.size(); i++) {
+		if (getShard(items[i].input, shardCount) == shardIndex)
+			shard.push_back(items[i]);
+	}
+}
+
+bool BatchManifest::parseShard(const std::string& text, int& shardIndex, int& shardCount)
+{
+	int index = 0, count = 0;
+	char separator = 0;
+	if (sscanf(text.c_str(), "%d%c%d", &index, &separator, &count) != 3 || separator != '/' || count <= 0 || index < 0 || index >= count)
+		return false;
+
+	shardIndex = index;
+	shardCount = count;
+	return true;
+}
+
+std::string BatchManifest::getOutputPath(const std::string& input, const std::string& outputDir)
+{
+	size_t start = 0;
+	if (input.size() >= 2 && input[1] == ':')
+		start = 2;
+	while (start < input.size() && (input[start] == '/' || input[start] == '\\'))
+		start++;
+
+	std::string dir = outputDir;
+	if (!dir.empty() && dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\')
+		dir += "/";
+	return dir + input.substr(start);
+}
+
+bool BatchManifest::makeParentDirectories(const std::string& path)
+{
+	for (size_t pos = path.find_first_of("/\\", 1); pos != std::string::npos; pos = path.find_first_of("/\\", pos + 1)) {
+		std::string dir = path.substr(0, pos);
+		if (dir.empty() || dir[dir.size() - 1] == ':')
+			continue;
+#ifdef _WINDOWS
+		int result = _mkdir(dir.c_str());
+#else
+		int result = mkdir(dir.c_str(), 0777);
+#endif
+		if (result != 0 && errno != EEXIST)
+			return false;
+	}
+	return true;
+}
+
+bool BatchManifest::writeAtomic(const std::string& path, const std::vector<unsigned char>& data, std::string* error)
+{
+	// unique per process and call, so workers or shards writing the same output never share a temporary file
+	static std::atomic<unsigned int> counter(0);
+	std::ostringstream tmpName;
+	tmpName << path << "." << getProcessId() << "." << counter++ << ".partial";
+	std::string tmpPath = tmpName.str();
+
+	FILE* file = fopen(tmpPath.c_str(), "wb");
+	if (!file) {
+		if (error)
+			*error = strerror(errno);
+		return false;
+	}
+
+	// the error is taken at the first failing call, before later calls can change errno
+	bool ok = data.empty() || fwrite(&data[0], 1, data.size(), file) == data.size();
+	ok = ok && fflush(file) == 0;
+#ifdef _WINDOWS
+	ok = ok && _commit(_fileno(file)) == 0;
+#else
+	ok = ok && fsync(fileno(file)) == 0;
+#endif
+	if (!ok && error)
+		*error = strerror(errno);
+	if (fclose(file) != 0 && ok) {
+		if (error)
+			*error = strerror(errno);
+		ok = false;
+	}
+
+	if (ok) {
+#ifdef _WINDOWS
+		ok = MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+		if (!ok && error)
+			*error = "cannot replace the file (error " + std::to_string(GetLastError()) + ")";
+#else
+		ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+		if (!ok && error)
+			*error = strerror(errno);
+#endif
+	}
+
+	if (!ok)
+		remove(tmpPath.c_str());
+	return ok;
+}
+
+}
+}
@@ -0,0 +1,143 @@
+#include "FaceSwapper/CompletionLog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <sstream>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+static std::string jsonEscape(const std::string& text)
+{
+	std::string escaped;
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned char c = (unsigned char)text[i];
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += (char)c;
+		}
+		else if (c < 0x20) {
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+		}
+		else
+			escaped += (char)c;
+	}
+	return escaped;
+}
+
+CompletionLog::CompletionLog()
+{
+}
+
+CompletionLog::~CompletionLog()
+{
+}
+
+bool CompletionLog::open(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::ifstream existing(path.c_str());
+	std::string line;
+	while (std::getline(existing, line)) {
+		std::string input, status;
+		// a line cut short by a crash ends without the closing brace
+		if (line.empty() || line[line.size() - 1] != '}' || !getField(line, "input", input) || !getField(line, "status", status))
+			continue;
+		if (status == "done")
+			completed.insert(input);
+	}
+	bool endsWithNewline = true;
+	if (existing.is_open()) {
+		existing.clear();
+		existing.seekg(0, std::ios::end);
+		std::streamoff size = existing.tellg();
+		if (size > 0) {
+			existing.seekg(size - 1);
+			endsWithNewline = existing.get() == '\n';
+		}
+	}
+	existing.close();
+
+	stream.open(path.c_str(), std::ios::app);
+	if (!stream.is_open()) {
+		std::cerr << "failed to open completion log " << path << std::endl;
+		return false;
+	}
+	// a truncated last line is terminated, so the next record starts on a line of its own
+	if (!endsWithNewline)
+		stream << std::endl;
+	return true;
+}
+
+bool CompletionLog::isCompleted(const std::string& input)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return completed.count(input) > 0;
+}
+
+size_t CompletionLog::getNumCompleted()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return completed.size();
+}
+
+bool CompletionLog::append(const BatchRecord& record)
+{
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)record.outputHash);
+
+	std::ostringstream line;
+	line << "{\"input\": \"" << jsonEscape(record.input) << "\", \"output\": \"" << jsonEscape(record.output)
+		<< "\", \"status\": \"" << (record.done ? "done" : "failed") << "\", \"hash\": \"" << hash
+		<< "\", \"width\": " << record.width << ", \"height\": " << record.height << ", \"faces\": " << record.faces
+		<< ", \"read_ms\": " << record.readMs << ", \"process_ms\": " << record.processMs << ", \"write_ms\": " << record.writeMs
+		<< ", \"message\": \"" << jsonEscape(record.message) << "\"}";
+
+	std::lock_guard<std::mutex> lock(mutex);
+	// the whole line is written at once, so lines of concurrent workers do not interleave
+	stream << line.str() << std::endl;
+	if (!stream)
+		return false;
+	if (record.done)
+		completed.insert(record.input);
+	return true;
+}
+
+bool CompletionLog::getField(const std::string& line, const std::string& name, std::string& value)
+{
+	std::string key = "\"" + name + "\": \"";
+	size_t pos = line.find(key);
+	if (pos == std::string::npos)
+		return false;
+
+	value.clear();
+	for (pos += key.size(); pos < line.size(); pos++) {
+		char c = line[pos];
+		if (c == '"')
+			return true;
+		if (c != '\\') {
+			value += c;
+			continue;
+		}
+		if (++pos >= line.size())
+			return false;
+		if (line[pos] == 'u') {
+			// only control characters are written as \u escapes
+			if (pos + 4 >= line.size())
+				return false;
+			value += (char)strtol(line.substr(pos + 1, 4).c_str(), NULL, 16);
+			pos += 4;
+		}
+		else
+			value += line[pos];
+	}
+	return false;
+}
+
+}
+}
@@ -0,0 +1,399 @@
+#include "FaceSwapper/DetectionCache.h"
+#include "FaceSwapper/FileLock.h"
+#include "FaceDetectionRegion.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+static int getProcessId()
+{
+#ifdef _WINDOWS
+	return (int)GetCurrentProcessId();
+#else
+	return (int)getpid();
+#endif
+}
+
+static const uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+
+static inline uint64_t mixHash(uint64_t h, uint64_t w)
+{
+	h ^= w * HASH_MULTIPLIER;
+	h = (h << 31) | (h >> 33);
+	h *= 0xBF58476D1CE4E5B9ULL;
+	return h;
+}
+
+DetectionCache::DetectionCache(const std::string& directory, uint64_t maxBytes) :
+	directory(directory), maxBytes(maxBytes), totalBytes(0), accessCounter(0), indexDirty(false), unsavedStores(0)
+{
+	if (!this->directory.empty() && this->directory[this->directory.size() - 1] != '/' && this->directory[this->directory.size() - 1] != '\\')
+		this->directory += "/";
+	loadIndex();
+}
+
+DetectionCache::~DetectionCache()
+{
+	flush();
+}
+
+uint64_t DetectionCache::hashBytes(const void* data, size_t len, uint64_t seed)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t h = seed ^ (len * HASH_MULTIPLIER);
+
+	// process 8 bytes at a time, the tail is padded with zeros
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, 8);
+		h = mixHash(h, w);
+	}
+	if (i < len) {
+		uint64_t w = 0;
+		memcpy(&w, p + i, len - i);
+		h = mixHash(h, w);
+	}
+
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t DetectionCache::hashImage(const cv::Mat& img)
+{
+	int geometry[3] = { img.rows, img.cols, img.type() };
+	uint64_t h = hashBytes(geometry, sizeof(geometry));
+
+	size_t rowBytes = img.cols * img.elemSize();
+	for (int i = 0; i < img.rows; i++)
+		h = hashBytes(img.ptr(i), rowBytes, h);
+
+	return h;
+}
+
+uint64_t DetectionCache::hashFile(const std::string& path)
+{
+	std::ifstream fileStream(path.c_str(), std::ios::binary);
+	if (!fileStream.is_open())
+		return 0;
+
+	std::vector<char> buffer(1 << 20);
+	uint64_t h = 0;
+	while (fileStream) {
+		fileStream.read(&buffer[0], buffer.size());
+		std::streamsize n = fileStream.gcount();
+		if (n > 0)
+			h = hashBytes(&buffer[0], (size_t)n, h);
+	}
+	return h;
+}
+
+std::string DetectionCache::makeKey(const cv::Mat& img, uint64_t modelHash, double minConfidence)
+{
+	uint64_t h = hashImage(img);
+	h = hashBytes(&modelHash, sizeof(modelHash), h);
+	h = hashBytes(&minConfidence, sizeof(minConfidence), h);
+
+	std::ostringstream key;
+	key << std::hex << std::setw(16) << std::setfill('0') << h;
+	return key.str();
+}
+
+std::string DetectionCache::entryPath(const std::string& key) const
+{
+	return directory + key + ".det";
+}
+
+bool DetectionCache::lookup(const std::string& key, std::vector<DetectionRegion*>& regions)
+{
+	std::ifstream fileStream(entryPath(key).c_str());
+	if (!fileStream.is_open())
+		return false;
+
+	int fileVersion = 0;
+	size_t numRegions = 0;
+	fileStream >> fileVersion >> numRegions;
+	if (fileVersion != version || !fileStream)
+		return false;
+
+	std::vector<FaceDetectionRegion*> loaded;
+	bool valid = true;
+	for (size_t r = 0; r < numRegions && valid; r++) {
+		float x, y, width, height, confidence;
+		double classConfidence;
+		size_t numPoints;
+
+		fileStream >> x >> y >> width >> height >> confidence >> classConfidence >> numPoints;
+		if (!fileStream) {
+			valid = false;
+			break;
+		}
+
+		FaceDetectionRegion* fdr = new FaceDetectionRegion();
+		fdr->setBoundingBox(x, y, width, height);
+		fdr->setConfidence(confidence);
+		fdr->setClassificationConfidence(classConfidence);
+		for (size_t i = 0; i < numPoints; i++) {
+			float px, py;
+			fileStream >> px >> py;
+			fdr->addPoint(px, py);
+		}
+		loaded.push_back(fdr);
+		valid = (bool)fileStream;
+	}
+
+	// entries end with a marker, so that truncated files (e.g. written by an older version without atomic
+	// writes) are never used
+	std::string marker;
+	fileStream >> marker;
+	if (!valid || marker != "end") {
+		for (size_t i = 0; i < loaded.size(); i++)
+			delete loaded[i];
+		return false;
+	}
+
+	regions.insert(regions.end(), loaded.begin(), loaded.end());
+
+	std::map<std::string, Entry>::iterator iter = entries.find(key);
+	Entry entry;
+	if (iter == entries.end()) {
+		// entry not yet in the index (e.g. index was lost), adopt it
+		fileStream.clear();
+		fileStream.seekg(0, std::ios::end);
+		entry.size = (uint64_t)fileStream.tellg();
+	}
+	else
+		entry.size = iter->second.size;
+	entry.lastAccess = ++accessCounter;
+	setEntry(key, entry);
+	touchedKeys.insert(key);
+	evictedKeys.erase(key);
+	indexDirty = true;
+
+	return true;
+}
+
+bool DetectionCache::store(const std::string& key, const std::vector<DetectionRegion*>& regions)
+{
+	std::ostringstream content;
+	content << version << std::endl << regions.size() << std::endl;
+	content << std::setprecision(9);
+
+	for (size_t r = 0; r < regions.size(); r++) {
+		DetectionRegion* dr = regions[r];
+		float x, y, width, height;
+		dr->getBoundingBox(x, y, width, height);
+
+		double classConfidence = 0.0;
+		FaceDetectionRegion* fdr = dynamic_cast<FaceDetectionRegion*>(dr);
+		if (fdr)
+			classConfidence = fdr->getClassificationConfidence();
+
+		std::vector<DetectionRegion::Point>* points = dr->getPoints();
+		content << x << " " << y << " " << width << " " << height << " " << dr->getConfidence() << " " << classConfidence << " " << points->size() << std::endl;
+		for (size_t i = 0; i < points->size(); i++)
+			content << (*points)[i].x << " " << (*points)[i].y << std::endl;
+	}
+	content << "end" << std::endl;
+
+	std::string data = content.str();
+	if (!writeAtomic(entryPath(key), data))
+		return false;
+
+	Entry entry;
+	entry.size = data.size();
+	entry.lastAccess = ++accessCounter;
+	setEntry(key, entry);
+	touchedKeys.insert(key);
+	evictedKeys.erase(key);
+	indexDirty = true;
+
+	evict();
+
+	// rewriting the whole index for every entry would make a batch quadratic in the number of entries
+	if (++unsavedStores < INDEX_SAVE_INTERVAL)
+		return true;
+	return saveIndex();
+}
+
+bool DetectionCache::flush()
+{
+	if (!indexDirty)
+		return true;
+	return saveIndex();
+}
+
+void DetectionCache::setEntry(const std::string& key, const Entry& entry)
+{
+	std::map<std::string, Entry>::iterator iter = entries.find(key);
+	if (iter != entries.end())
+		eraseEntry(iter);
+
+	entries[key] = entry;
+	accessOrder.insert(std::make_pair(entry.lastAccess, key));
+	totalBytes += entry.size;
+}
+
+void DetectionCache::eraseEntry(std::map<std::string, Entry>::iterator iter)
+{
+	typedef std::multimap<uint64_t, std::string>::iterator OrderIterator;
+	std::pair<OrderIterator, OrderIterator> range = accessOrder.equal_range(iter->second.lastAccess);
+	for (OrderIterator order = range.first; order != range.second; order++) {
+		if (order->second == iter->first) {
+			accessOrder.erase(order);
+			break;
+		}
+	}
+
+	totalBytes -= iter->second.size;
+	entries.erase(iter);
+}
+
+void DetectionCache::evict()
+{
+	while (totalBytes > maxBytes && !accessOrder.empty()) {
+		std::map<std::string, Entry>::iterator oldest = entries.find(accessOrder.begin()->second);
+		remove(entryPath(oldest->first).c_str());
+		evictedKeys.insert(oldest->first);
+		touchedKeys.erase(oldest->first);
+		eraseEntry(oldest);
+		indexDirty = true;
+	}
+}
+
+bool DetectionCache::readIndex(std::map<std::string, Entry>& index)
+{
+	std::ifstream fileStream((directory + "index").c_str());
+	if (!fileStream.is_open())
+		return false;
+
+	int fileVersion = 0;
+	fileStream >> fileVersion;
+	if (fileVersion != version)
+		return false;
+
+	std::string key;
+	Entry entry;
+	while (fileStream >> key >> entry.size >> entry.lastAccess)
+		index[key] = entry;
+	return true;
+}
+
+void DetectionCache::loadIndex()
+{
+	std::map<std::string, Entry> index;
+	readIndex(index);
+	for (std::map<std::string, Entry>::iterator iter = index.begin(); iter != index.end(); iter++) {
+		setEntry(iter->first, iter->second);
+		if (iter->second.lastAccess > accessCounter)
+			accessCounter = iter->second.lastAccess;
+	}
+}
+
+bool DetectionCache::saveIndex()
+{
+	FileLock lock(directory + "index.lock");
+	if (!lock.isLocked()) {
+		std::cerr << "DetectionCache: failed to lock " << directory << "index.lock" << std::endl;
+		return false;
+	}
+
+	// merge with the index written by other processes in the meantime: their entries are taken over, unless this
+	// instance has evicted them, and entries of this instance, which have not been touched since the last write and
+	// are missing now, have been evicted by another process
+	std::map<std::string, Entry> merged;
+	if (readIndex(merged)) {
+		for (std::set<std::string>::iterator key = evictedKeys.begin(); key != evictedKeys.end(); key++)
+			merged.erase(*key);
+		for (std::set<std::string>::iterator key = touchedKeys.begin(); key != touchedKeys.end(); key++) {
+			std::map<std::string, Entry>::iterator own = entries.find(*key);
+			std::map<std::string, Entry>::iterator other = merged.find(*key);
+			if (own != entries.end() && (other == merged.end() || other->second.lastAccess < own->second.lastAccess))
+				merged[*key] = own->second;
+		}
+
+		entries.clear();
+		accessOrder.clear();
+		totalBytes = 0;
+		for (std::map<std::string, Entry>::iterator iter = merged.begin(); iter != merged.end(); iter++) {
+			setEntry(iter->first, iter->second);
+			if (iter->second.lastAccess > accessCounter)
+				accessCounter = iter->second.lastAccess;
+		}
+		evict();
+	}
+
+	std::ostringstream content;
+	content << version << std::endl;
+	for (std::map<std::string, Entry>::iterator iter = entries.begin(); iter != entries.end(); iter++)
+		content << iter->first << " " << iter->second.size << " " << iter->second.lastAccess << std::endl;
+
+	if (!writeAtomic(directory + "index", content.str()))
+		return false;
+
+	indexDirty = false;
+	unsavedStores = 0;
+	touchedKeys.clear();
+	evictedKeys.clear();
+	return true;
+}
+
+bool DetectionCache::writeAtomic(const std::string& path, const std::string& content)
+{
+	// unique per process and call, so processes sharing the directory never write into the same temporary file
+	static std::atomic<unsigned int> counter(0);
+	std::ostringstream tmpName;
+	tmpName << path << "." << getProcessId() << "." << counter++ << ".tmp";
+	std::string tmpPath = tmpName.str();
+
+	FILE* file = fopen(tmpPath.c_str(), "wb");
+	if (!file) {
+		std::cerr << "DetectionCache: failed to write " << tmpPath << std::endl;
+		return false;
+	}
+
+	bool ok = fwrite(content.data(), 1, content.size(), file) == content.size();
+	ok = ok && fflush(file) == 0;
+	// make sure the data is on disk before the rename makes it visible
+#ifdef _WINDOWS
+	ok = ok && _commit(_fileno(file)) == 0;
+#else
+	ok = ok && fsync(fileno(file)) == 0;
+#endif
+	ok = (fclose(file) == 0) && ok;
+
+	if (ok) {
+#ifdef _WINDOWS
+		ok = MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+#endif
+	}
+
+	if (!ok) {
+		remove(tmpPath.c_str());
+		std::cerr << "DetectionCache: failed to write " << path << std::endl;
+	}
+
+	return ok;
+}
+
+}
+}
@@ -0,0 +1,257 @@
+#include "DetectionNms.h"
+#include "FaceDetectionRegion.h"
+
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(HAVE_SSE2)
+#include <emmintrin.h>
+#define NMS_USE_SSE
+#endif
+
+// below this number of boxes, all pairs are checked without building the grid
+static const int MIN_BOXES_FOR_GRID = 64;
+// maximum number of grid cells per axis
+static const int MAX_GRID_CELLS = 512;
+
+void DetectionBoxes::add(float x, float y, float width, float height, float s)
+{
+	x1.push_back(x);
+	y1.push_back(y);
+	x2.push_back(x + width);
+	y2.push_back(y + height);
+	score.push_back(s);
+}
+
+void DetectionBoxes::addRegions(const std::vector<DetectionRegion*> &regions)
+{
+	for (size_t i = 0; i < regions.size(); i++) {
+		float x, y, width, height;
+		regions[i]->getBoundingBox(x, y, width, height);
+
+		FaceDetectionRegion* fdr = dynamic_cast<FaceDetectionRegion*>(regions[i]);
+		add(x, y, width, height, fdr ? (float)fdr->getClassificationConfidence() : regions[i]->getConfidence());
+	}
+}
+
+void DetectionBoxes::clear()
+{
+	x1.clear();
+	y1.clear();
+	x2.clear();
+	y2.clear();
+	score.clear();
+}
+
+float DetectionNms::iou(float xA, float yA, float widthA, float heightA, float xB, float yB, float widthB, float heightB)
+{
+	float w = std::min(xA + widthA, xB + widthB) - std::max(xA, xB);
+	float h = std::min(yA + heightA, yB + heightB) - std::max(yA, yB);
+	float i = (w > 0 && h > 0) ? w * h : 0.0f;
+	float u = widthA * heightA + widthB * heightB - i;
+
+	return u > 0 ? i / u : 0.0f;
+}
+
+void DetectionNms::iouBatch(const DetectionBoxes &boxes, int ref, const std::vector<int> &candidates, std::vector<float> &result)
+{
+	int n = (int)candidates.size();
+	result.resize(n);
+
+	float ax1 = boxes.x1[ref], ay1 = boxes.y1[ref], ax2 = boxes.x2[ref], ay2 = boxes.y2[ref];
+	float areaA = (ax2 - ax1) * (ay2 - ay1);
+
+	int k = 0;
+#ifdef NMS_USE_SSE
+	__m128 vax1 = _mm_set1_ps(ax1), vay1 = _mm_set1_ps(ay1), vax2 = _mm_set1_ps(ax2), vay2 = _mm_set1_ps(ay2);
+	__m128 vareaA = _mm_set1_ps(areaA);
+	__m128 zero = _mm_setzero_ps();
+
+	for (; k + 4 <= n; k += 4) {
+		const int *c = &candidates[k];
+		__m128 bx1 = _mm_setr_ps(boxes.x1[c[0]], boxes.x1[c[1]], boxes.x1[c[2]], boxes.x1[c[3]]);
+		__m128 by1 = _mm_setr_ps(boxes.y1[c[0]], boxes.y1[c[1]], boxes.y1[c[2]], boxes.y1[c[3]]);
+		__m128 bx2 = _mm_setr_ps(boxes.x2[c[0]], boxes.x2[c[1]], boxes.x2[c[2]], boxes.x2[c[3]]);
+		__m128 by2 = _mm_setr_ps(boxes.y2[c[0]], boxes.y2[c[1]], boxes.y2[c[2]], boxes.y2[c[3]]);
+
+		__m128 w = _mm_max_ps(_mm_sub_ps(_mm_min_ps(vax2, bx2), _mm_max_ps(vax1, bx1)), zero);
+		__m128 h = _mm_max_ps(_mm_sub_ps(_mm_min_ps(vay2, by2), _mm_max_ps(vay1, by1)), zero);
+		__m128 inter = _mm_mul_ps(w, h);
+		__m128 areaB = _mm_mul_ps(_mm_sub_ps(bx2, bx1), _mm_sub_ps(by2, by1));
+		__m128 uni = _mm_sub_ps(_mm_add_ps(vareaA, areaB), inter);
+
+		// division by an empty union yields 0 instead of NaN
+		__m128 valid = _mm_cmpgt_ps(uni, zero);
+		__m128 ratio = _mm_div_ps(inter, _mm_or_ps(_mm_and_ps(valid, uni), _mm_andnot_ps(valid, _mm_set1_ps(1.0f))));
+		_mm_storeu_ps(&result[k], _mm_and_ps(valid, ratio));
+	}
+#endif
+	for (; k < n; k++) {
+		int c = candidates[k];
+		result[k] = iou(ax1, ay1, ax2 - ax1, ay2 - ay1, boxes.x1[c], boxes.y1[c], boxes.x2[c] - boxes.x1[c], boxes.y2[c] - boxes.y1[c]);
+	}
+}
+
+struct ScoreOrder
+{
+	ScoreOrder(const std::vector<float> &s) : score(s) {}
+
+	bool operator()(int a, int b) const
+	{
+		if (score[a] != score[b])
+			return score[a] > score[b];
+		return a < b;
+	}
+
+	const std::vector<float> &score;
+};
+
+void DetectionNms::suppress(const DetectionBoxes &boxes, float iouThreshold, std::vector< std::vector<int> > &clusters)
+{
+	int n = (int)boxes.size();
+	clusters.clear();
+	if (n == 0)
+		return;
+
+	std::vector<int> order(n);
+	for (int i = 0; i < n; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), ScoreOrder(boxes.score));
+
+	std::vector<char> suppressed(n, 0);
+
+	// uniform grid with a cell size of the average box size, each box is registered in all cells it covers
+	bool useGrid = n >= MIN_BOXES_FOR_GRID;
+	float minX = boxes.x1[0], minY = boxes.y1[0], maxX = boxes.x2[0], maxY = boxes.y2[0];
+	float sumW = 0, sumH = 0;
+	for (int i = 0; i < n; i++) {
+		minX = std::min(minX, boxes.x1[i]);
+		minY = std::min(minY, boxes.y1[i]);
+		maxX = std::max(maxX, boxes.x2[i]);
+		maxY = std::max(maxY, boxes.y2[i]);
+		sumW += boxes.x2[i] - boxes.x1[i];
+		sumH += boxes.y2[i] - boxes.y1[i];
+	}
+	float cellW = std::max(std::max(sumW / n, (maxX - minX) / MAX_GRID_CELLS), 1.0f);
+	float cellH = std::max(std::max(sumH / n, (maxY - minY) / MAX_GRID_CELLS), 1.0f);
+	int gridCols = std::min((int)((maxX - minX) / cellW) + 1, MAX_GRID_CELLS);
+	int gridRows = std::min((int)((maxY - minY) / cellH) + 1, MAX_GRID_CELLS);
+
+	std::vector< std::vector<int> > grid;
+	if (useGrid) {
+		grid.resize(gridCols * gridRows);
+		for (int i = 0; i < n; i++) {
+			int c0 = std::min((int)((boxes.x1[i] - minX) / cellW), gridCols - 1);
+			int c1 = std::min((int)((boxes.x2[i] - minX) / cellW), gridCols - 1);
+			int r0 = std::min((int)((boxes.y1[i] - minY) / cellH), gridRows - 1);
+			int r1 = std::min((int)((boxes.y2[i] - minY) / cellH), gridRows - 1);
+			for (int r = r0; r <= r1; r++)
+				for (int c = c0; c <= c1; c++)
+					grid[r * gridCols + c].push_back(i);
+		}
+	}
+
+	std::vector<int> rank(n);
+	for (int i = 0; i < n; i++)
+		rank[order[i]] = i;
+
+	std::vector<int> visited(n, -1);
+	std::vector<int> candidates;
+	std::vector<float> ious;
+
+	for (int o = 0; o < n; o++) {
+		int ref = order[o];
+		if (suppressed[ref])
+			continue;
+
+		// collect the lower ranked, not yet suppressed boxes which may overlap
+		candidates.clear();
+		if (useGrid) {
+			int c0 = std::min((int)((boxes.x1[ref] - minX) / cellW), gridCols - 1);
+			int c1 = std::min((int)((boxes.x2[ref] - minX) / cellW), gridCols - 1);
+			int r0 = std::min((int)((boxes.y1[ref] - minY) / cellH), gridRows - 1);
+			int r1 = std::min((int)((boxes.y2[ref] - minY) / cellH), gridRows - 1);
+			for (int r = r0; r <= r1; r++) {
+				for (int c = c0; c <= c1; c++) {
+					const std::vector<int> &cell = grid[r * gridCols + c];
+					for (size_t k = 0; k < cell.size(); k++) {
+						int j = cell[k];
+						if (visited[j] != ref && rank[j] > o && !suppressed[j]) {
+							visited[j] = ref;
+							candidates.push_back(j);
+						}
+					}
+				}
+			}
+			// keep the cluster members in a deterministic order
+			std::sort(candidates.begin(), candidates.end(), ScoreOrder(boxes.score));
+		}
+		else {
+			for (int p = o + 1; p < n; p++) {
+				if (!suppressed[order[p]])
+					candidates.push_back(order[p]);
+			}
+		}
+
+		clusters.push_back(std::vector<int>(1, ref));
+		std::vector<int> &cluster = clusters.back();
+
+		iouBatch(boxes, ref, candidates, ious);
+		for (size_t k = 0; k < candidates.size(); k++) {
+			if (ious[k] > iouThreshold) {
+				suppressed[candidates[k]] = 1;
+				cluster.push_back(candidates[k]);
+			}
+		}
+	}
+}
+
+std::vector<int> DetectionNms::greedy(const DetectionBoxes &boxes, float iouThreshold)
+{
+	std::vector< std::vector<int> > clusters;
+	suppress(boxes, iouThreshold, clusters);
+
+	std::vector<int> kept(clusters.size());
+	for (size_t i = 0; i < clusters.size(); i++)
+		kept[i] = clusters[i][0];
+	return kept;
+}
+
+void DetectionNms::weighted(const DetectionBoxes &boxes, float iouThreshold, DetectionBoxes &merged, std::vector< std::vector<int> > *members)
+{
+	std::vector< std::vector<int> > clusters;
+	suppress(boxes, iouThreshold, clusters);
+
+	merged.clear();
+	for (size_t i = 0; i < clusters.size(); i++) {
+		const std::vector<int> &cluster = clusters[i];
+		double sx1 = 0, sy1 = 0, sx2 = 0, sy2 = 0, sw = 0;
+		for (size_t k = 0; k < cluster.size(); k++) {
+			int j = cluster[k];
+			double w = std::max(boxes.score[j], 0.0f);
+			sx1 += w * boxes.x1[j];
+			sy1 += w * boxes.y1[j];
+			sx2 += w * boxes.x2[j];
+			sy2 += w * boxes.y2[j];
+			sw += w;
+		}
+
+		int best = cluster[0];
+		if (sw > 0) {
+			merged.x1.push_back((float)(sx1 / sw));
+			merged.y1.push_back((float)(sy1 / sw));
+			merged.x2.push_back((float)(sx2 / sw));
+			merged.y2.push_back((float)(sy2 / sw));
+		}
+		else {
+			merged.x1.push_back(boxes.x1[best]);
+			merged.y1.push_back(boxes.y1[best]);
+			merged.x2.push_back(boxes.x2[best]);
+			merged.y2.push_back(boxes.y2[best]);
+		}
+		merged.score.push_back(boxes.score[best]);
+	}
+
+	if (members)
+		members->swap(clusters);
+}
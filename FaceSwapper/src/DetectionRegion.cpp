@@ -1,4 +1,5 @@
 #include "DetectionRegion.h"
+#include "DetectionNms.h"
 #include <math.h>
 
 DetectionRegion::DetectionRegion() : mXCenter(0.0f), mYCenter(0.0f), mBBXStart(0.0f), mBBYStart(0.0f), mBBWidth(0.0f), mBBHeight(0.0f), mScale(1.0), 
@@ -145,31 +146,20 @@ float DetectionRegion::matchDistance( const DetectionRegion &region )
 
 float DetectionRegion::mOverlap(float x1, float w1, float x2, float w2)
 {
-	float l1 = x1 - w1 / 2;
-	float l2 = x2 - w2 / 2;
-	float left = l1 > l2 ? l1 : l2;
-	float r1 = x1 + w1 / 2;
-	float r2 = x2 + w2 / 2;
+	float left = x1 > x2 ? x1 : x2;
+	float r1 = x1 + w1;
+	float r2 = x2 + w2;
 	float right = r1 < r2 ? r1 : r2;
 	return right - left;
 }
 
 float DetectionRegion::getIou(const DetectionRegion &region)
 {
-	float x, y, width, height, i;
-
-	((DetectionRegion)region).getBoundingBox(x, y, width, height);
-	float w = mOverlap(mBBXStart, mBBWidth, x, width);
-	float h = mOverlap(mBBYStart, mBBHeight, y, height);
-	if (w < 0 || h < 0)
-		i = 0;
-	else
-		i = w*h;
-
-	float u = mBBWidth*mBBHeight + width*height - i;
+	float x, y, width, height;
 
+	region.getBoundingBox(x, y, width, height);
 
-	return i / u; // getIntersection(region) / getUnion(region);
+	return DetectionNms::iou(mBBXStart, mBBYStart, mBBWidth, mBBHeight, x, y, width, height);
 }
 
 void DetectionRegion::shiftRegion( const float x, const float y , const float scale)
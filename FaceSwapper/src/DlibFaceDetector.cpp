@@ -1,4 +1,5 @@
 #include "dlib/DlibFaceDetector.h"
+#include "FaceSwapper/Instrumentation.h"
 
 #include "dlib/image_transforms/../pixel.h"
 #include "dlib/image_transforms/assign_image_abstract.h"
@@ -10,6 +11,7 @@
 #include "dlib/ipl_image_hull.h"
 
 
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -50,6 +52,8 @@ std::vector<DetectionRegion*>* FaceDetectorDlib::calculate(cv::Mat img, double m
 {
 	// taken and adapted from http://dlib.net/dnn_mmod_face_detection_ex.cpp.html
 
+	FS_SCOPED_TIMER(STAGE_DETECT);
+
 	std::vector<DetectionRegion*>* result = new std::vector<DetectionRegion*>();
 
 	IplImage iplImg = img;
@@ -88,6 +92,7 @@ std::vector<DetectionRegion*>* FaceDetectorDlib::calculate(cv::Mat img, double m
 				fdr->setClassificationConfidence(confidence);
 
 				result->push_back(fdr);
+				FS_COUNTER_ADD(FACES_DETECTED, 1);
 			}
 
 		}
@@ -0,0 +1,75 @@
+#include "DnnFaceDetector.h"
+#include "DetectionNms.h"
+#include "FaceSwapper/Instrumentation.h"
+
+#include <algorithm>
+
+FaceDetectorDnn::FaceDetectorDnn() :
+	mInputSize(300, 300),
+	mNmsThreshold(0.4f)
+{
+}
+
+FaceDetectorDnn::~FaceDetectorDnn()
+{
+}
+
+void FaceDetectorDnn::doLazyInit(std::string modelFile)
+{
+	std::string configFile = mConfigFile;
+	if (configFile.empty()) {
+		size_t slash = modelFile.find_last_of("/\\");
+		configFile = (slash == std::string::npos ? std::string() : modelFile.substr(0, slash + 1)) + "deploy.prototxt";
+	}
+
+	// throws a cv::Exception if one of the files cannot be read
+	mNet = cv::dnn::readNetFromCaffe(configFile, modelFile);
+}
+
+std::vector<DetectionRegion*>* FaceDetectorDnn::calculate(cv::Mat img, double minConfidence)
+{
+	FS_SCOPED_TIMER(STAGE_DETECT);
+
+	std::vector<DetectionRegion*>* result = new std::vector<DetectionRegion*>();
+	if (mNet.empty() || img.empty())
+		return result;
+
+	// the network is trained on BGR images with the mean of the training set subtracted
+	cv::Mat blob = cv::dnn::blobFromImage(img, 1.0, mInputSize, cv::Scalar(104.0, 177.0, 123.0), false, false);
+	mNet.setInput(blob);
+	cv::Mat output = mNet.forward();
+
+	// one row per detection: image, class, confidence and the corners relative to the image size
+	cv::Mat detections(output.size[2], output.size[3], CV_32F, output.ptr<float>());
+
+	DetectionBoxes boxes;
+	for (int i = 0; i < detections.rows; i++) {
+		const float* row = detections.ptr<float>(i);
+		float confidence = row[2];
+		if (confidence <= minConfidence)
+			continue;
+
+		float x1 = std::min(std::max(row[3], 0.0f), 1.0f) * img.cols;
+		float y1 = std::min(std::max(row[4], 0.0f), 1.0f) * img.rows;
+		float x2 = std::min(std::max(row[5], 0.0f), 1.0f) * img.cols;
+		float y2 = std::min(std::max(row[6], 0.0f), 1.0f) * img.rows;
+		if (x2 <= x1 || y2 <= y1)
+			continue;
+
+		boxes.add(x1, y1, x2 - x1, y2 - y1, confidence);
+	}
+
+	// the network output is only suppressed per class and prior size, overlapping boxes of one face remain
+	std::vector<int> kept = DetectionNms::greedy(boxes, mNmsThreshold);
+	for (size_t i = 0; i < kept.size(); i++) {
+		int k = kept[i];
+		FaceDetectionRegion* fdr = new FaceDetectionRegion();
+		fdr->setBoundingBox(boxes.x1[k], boxes.y1[k], boxes.x2[k] - boxes.x1[k], boxes.y2[k] - boxes.y1[k]);
+		fdr->setClassificationConfidence(boxes.score[k]);
+
+		result->push_back(fdr);
+		FS_COUNTER_ADD(FACES_DETECTED, 1);
+	}
+
+	return result;
+}
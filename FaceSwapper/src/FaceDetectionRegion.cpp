@@ -1,4 +1,5 @@
 #include "FaceDetectionRegion.h"
+#include "DetectionNms.h"
 #include <math.h>
 #include <iostream>
 #include <fstream>
@@ -172,11 +173,9 @@ void FaceDetectionRegion::copyFromRegion(const DetectionRegion *region, bool cop
 
 float FaceDetectionRegion::mOverlap(float x1, float w1, float x2, float w2)
 {
-	float l1 = x1 - w1 / 2;
-	float l2 = x2 - w2 / 2;
-	float left = l1 > l2 ? l1 : l2;
-	float r1 = x1 + w1 / 2;
-	float r2 = x2 + w2 / 2;
+	float left = x1 > x2 ? x1 : x2;
+	float r1 = x1 + w1;
+	float r2 = x2 + w2;
 	float right = r1 < r2 ? r1 : r2;
 	return right - left;
 }
@@ -185,7 +184,7 @@ float FaceDetectionRegion::getIntersection(const DetectionRegion &region)
 {
 	float x, y, width, height;
 
-	((DetectionRegion)region).getBoundingBox(x, y, width, height);
+	region.getBoundingBox(x, y, width, height);
 	float w = mOverlap(mBBXStart, mBBWidth, x, width);
 	float h = mOverlap(mBBYStart, mBBHeight, y, height);
 	if (w < 0 || h < 0) return 0;
@@ -197,7 +196,7 @@ float FaceDetectionRegion::mGetUnion(const DetectionRegion &region)
 {
 	float x, y, width, height;
 
-	((DetectionRegion)region).getBoundingBox(x, y, width, height);
+	region.getBoundingBox(x, y, width, height);
 	float i = getIntersection(region);
 	float u = mBBWidth*mBBHeight + width*height - i;
 	return u;
@@ -205,21 +204,11 @@ float FaceDetectionRegion::mGetUnion(const DetectionRegion &region)
 
 float FaceDetectionRegion::getIou(const DetectionRegion &region)
 {
-	float x, y, width, height, i;
-
-	((DetectionRegion)region).getBoundingBox(x, y, width, height);
-	float w = mOverlap(mBBXStart, mBBWidth, x, width);
-	float h = mOverlap(mBBYStart, mBBHeight, y, height);
-	if (w < 0 || h < 0)
-		if (w < 0 || h < 0)
-			i = 0;
-		else
-			i = w*h;
-
-	float u = mBBWidth*mBBHeight + width*height - i;
+	float x, y, width, height;
 
+	region.getBoundingBox(x, y, width, height);
 
-	return i / u; // getIntersection(region) / getUnion(region);
+	return DetectionNms::iou(mBBXStart, mBBYStart, mBBWidth, mBBHeight, x, y, width, height);
 }
 
 bool FaceDetectionRegion::saveToFile(const char* filename)
@@ -0,0 +1,12 @@
+#include "FaceDetector.h"
+#include "DnnFaceDetector.h"
+#include "dlib/DlibFaceDetector.h"
+
+FaceDetector* FaceDetector::create(const std::string& backend)
+{
+	if (backend == "dlib")
+		return new FaceDetectorDlib();
+	if (backend == "ssd")
+		return new FaceDetectorDnn();
+	return NULL;
+}
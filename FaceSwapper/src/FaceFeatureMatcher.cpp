@@ -0,0 +1,175 @@
+#include "FaceFeatureMatcher.h"
+#include "FaceDetectionRegion.h"
+
+#include <math.h>
+#include <algorithm>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
+static bool compareMatches(const FaceFeatureMatcher::Match &a, const FaceFeatureMatcher::Match &b)
+{
+	if (a.score != b.score)
+		return a.score > b.score;
+	return a.index < b.index;
+}
+
+FaceFeatureMatcher::FaceFeatureMatcher(int dimension)
+{
+	mDimension = dimension;
+	mStride = (dimension + 7) & ~7;
+}
+
+FaceFeatureMatcher::~FaceFeatureMatcher()
+{
+
+}
+
+bool FaceFeatureMatcher::normalize(const std::vector<double> &featureVect, float *dst) const
+{
+	int i;
+	double mean = 0.0, norm = 0.0;
+
+	for (i = 0; i < mDimension; i++)
+		mean += featureVect[i];
+	mean /= mDimension;
+
+	for (i = 0; i < mDimension; i++)
+		norm += (featureVect[i] - mean) * (featureVect[i] - mean);
+	norm = sqrt(norm);
+
+	for (i = mDimension; i < mStride; i++)
+		dst[i] = 0.0f;
+
+	if (norm == 0.0) {
+		for (i = 0; i < mDimension; i++)
+			dst[i] = 0.0f;
+		return false;
+	}
+
+	for (i = 0; i < mDimension; i++)
+		dst[i] = (float)((featureVect[i] - mean) / norm);
+	return true;
+}
+
+int FaceFeatureMatcher::add(const std::vector<double> &featureVect)
+{
+	if (featureVect.empty())
+		return -1;
+
+	if (mDimension == 0) {
+		mDimension = (int)featureVect.size();
+		mStride = (mDimension + 7) & ~7;
+	}
+	if ((int)featureVect.size() != mDimension)
+		return -1;
+
+	size_t offset = mMatrix.size();
+	mMatrix.resize(offset + mStride);
+	mValid.push_back(normalize(featureVect, &mMatrix[offset]) ? 1 : 0);
+
+	return (int)mValid.size() - 1;
+}
+
+int FaceFeatureMatcher::add(FaceDetectionRegion *region)
+{
+	if (!region->isFeatureVectorSet())
+		return -1;
+	return add(region->getFeatureVector());
+}
+
+void FaceFeatureMatcher::clear()
+{
+	mMatrix.clear();
+	mValid.clear();
+}
+
+void FaceFeatureMatcher::dotProducts(const float *query, float *result) const
+{
+	int n = size();
+
+	for (int r = 0; r < n; r++)
+	{
+		const float *row = &mMatrix[(size_t)r * mStride];
+
+#if defined(__AVX__)
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		int i = 0;
+		for (; i + 16 <= mStride; i += 16) {
+			acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(row + i), _mm256_loadu_ps(query + i)));
+			acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(row + i + 8), _mm256_loadu_ps(query + i + 8)));
+		}
+		if (i < mStride)
+			acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(row + i), _mm256_loadu_ps(query + i)));
+		acc0 = _mm256_add_ps(acc0, acc1);
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		result[r] = _mm_cvtss_f32(sum);
+#elif defined(__SSE2__) || defined(HAVE_SSE2)
+		__m128 acc0 = _mm_setzero_ps();
+		__m128 acc1 = _mm_setzero_ps();
+		for (int i = 0; i < mStride; i += 8) {
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(row + i), _mm_loadu_ps(query + i)));
+			acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(row + i + 4), _mm_loadu_ps(query + i + 4)));
+		}
+		__m128 sum = _mm_add_ps(acc0, acc1);
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		result[r] = _mm_cvtss_f32(sum);
+#else
+		float sum = 0.0f;
+		for (int i = 0; i < mStride; i++)
+			sum += row[i] * query[i];
+		result[r] = sum;
+#endif
+	}
+}
+
+void FaceFeatureMatcher::score(const std::vector<double> &query, std::vector<float> &scores) const
+{
+	scores.assign(size(), 0.0f);
+
+	if (size() == 0 || (int)query.size() != mDimension)
+		return;
+
+	std::vector<float> normQuery(mStride);
+	if (!normalize(query, &normQuery[0]))
+		return;
+
+	dotProducts(&normQuery[0], &scores[0]);
+
+	for (int r = 0; r < size(); r++) {
+		if (mValid[r])
+			scores[r] = (std::min(std::max(scores[r], -1.0f), 1.0f) + 1.0f) / 2.0f;
+		else
+			scores[r] = 0.0f;
+	}
+}
+
+std::vector<FaceFeatureMatcher::Match> FaceFeatureMatcher::match(const std::vector<double> &query, int k) const
+{
+	std::vector<float> scores;
+	score(query, scores);
+
+	std::vector<Match> matches(scores.size());
+	for (size_t r = 0; r < scores.size(); r++)
+		matches[r] = Match((int)r, scores[r]);
+
+	k = std::min(std::max(k, 0), (int)matches.size());
+	std::partial_sort(matches.begin(), matches.begin() + k, matches.end(), compareMatches);
+	matches.resize(k);
+
+	return matches;
+}
+
+std::vector<FaceFeatureMatcher::Match> FaceFeatureMatcher::match(FaceDetectionRegion *region, int k) const
+{
+	if (!region->isFeatureVectorSet())
+		return std::vector<Match>();
+	return match(region->getFeatureVector(), k);
+}
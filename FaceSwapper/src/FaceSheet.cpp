@@ -0,0 +1,153 @@
+#include "FaceSwapper/FaceSheet.h"
+#include "FaceSwapper/FaceSwapping.h"
+#include "FaceDetectionRegion.h"
+
+#include <stdio.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <opencv2/core/utility.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+constexpr float FaceSheet::DEFAULT_INSET;
+
+bool FaceSheetLayout::isValid(cv::Size sheetSize) const
+{
+	return rows > 0 && cols > 0 && tileWidth > 0 && tileHeight > 0 && count > 0 && count <= rows * cols &&
+		cols * tileWidth <= sheetSize.width && rows * tileHeight <= sheetSize.height;
+}
+
+bool FaceSheet::readLayout(const std::string& path, FaceSheetLayout& layout)
+{
+	std::ifstream fileStream(path.c_str());
+	if (!fileStream.is_open())
+		return false;
+
+	layout = FaceSheetLayout();
+	std::string line;
+	while (std::getline(fileStream, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream lineStream(line);
+		std::string key;
+		int value = 0;
+		lineStream >> key >> value;
+		if (!lineStream) {
+			std::cerr << "invalid line in face sheet layout " << path << ": " << line << std::endl;
+			return false;
+		}
+
+		if (key == "rows")
+			layout.rows = value;
+		else if (key == "cols")
+			layout.cols = value;
+		else if (key == "tile_width")
+			layout.tileWidth = value;
+		else if (key == "tile_height")
+			layout.tileHeight = value;
+		else if (key == "count")
+			layout.count = value;
+	}
+
+	// older sidecars may omit the count, the grid is then full
+	if (layout.count == 0)
+		layout.count = layout.rows * layout.cols;
+
+	return true;
+}
+
+bool FaceSheet::parseGrid(const std::string& grid, cv::Size sheetSize, FaceSheetLayout& layout)
+{
+	int rows = 0, cols = 0;
+	char separator = 0;
+	if (sscanf(grid.c_str(), "%d%c%d", &rows, &separator, &cols) != 3 || (separator != 'x' && separator != 'X') || rows <= 0 || cols <= 0)
+		return false;
+
+	layout.rows = rows;
+	layout.cols = cols;
+	layout.tileWidth = sheetSize.width / cols;
+	layout.tileHeight = sheetSize.height / rows;
+	layout.count = rows * cols;
+	return true;
+}
+
+int FaceSheet::load(FaceSwapping& swapping, cv::Mat sheet, const FaceSheetLayout& layout, std::vector<cv::Mat>& tiles,
+	std::vector<DetectionRegion*>& regions, float inset)
+{
+	if (!layout.isValid(sheet.size())) {
+		std::cerr << "face sheet layout " << layout.rows << "x" << layout.cols << " of " << layout.tileWidth << "x" << layout.tileHeight
+			<< " tiles does not match the sheet size " << sheet.cols << "x" << sheet.rows << std::endl;
+		return 0;
+	}
+
+	std::vector<cv::Mat> sheetTiles(layout.count);
+	std::vector<DetectionRegion*> sheetRegions(layout.count);
+	for (int i = 0; i < layout.count; i++) {
+		int row = i / layout.cols;
+		int col = i % layout.cols;
+		sheetTiles[i] = sheet(cv::Rect(col * layout.tileWidth, row * layout.tileHeight, layout.tileWidth, layout.tileHeight));
+
+		FaceDetectionRegion* fdr = new FaceDetectionRegion();
+		float dx = layout.tileWidth * inset;
+		float dy = layout.tileHeight * inset;
+		fdr->setBoundingBox(dx, dy, layout.tileWidth - 2 * dx, layout.tileHeight - 2 * dy);
+		fdr->setClassificationConfidence(1.0);
+		sheetRegions[i] = fdr;
+	}
+
+	// the landmarks are fitted on the tile views, so the neighbouring faces do not disturb them
+	cv::parallel_for_(cv::Range(0, layout.count), [&](const cv::Range& range) {
+		for (int i = range.start; i < range.end; i++)
+			swapping.computeLandmarks(sheetTiles[i], sheetRegions[i]);
+	});
+
+	int accepted = 0;
+	for (int i = 0; i < layout.count; i++) {
+		if (!FaceSwapping::hasLandmarks(sheetRegions[i]) || !checkLandmarks(sheetRegions[i], sheetTiles[i].size())) {
+			delete sheetRegions[i];
+			continue;
+		}
+		tiles.push_back(sheetTiles[i]);
+		regions.push_back(sheetRegions[i]);
+		accepted++;
+	}
+
+	return accepted;
+}
+
+bool FaceSheet::checkLandmarks(DetectionRegion* region, cv::Size tileSize)
+{
+	const std::vector<DetectionRegion::Point>& points = *region->getPoints();
+	if (points.size() != FaceSwapping::NUM_LANDMARKS)
+		return false;
+
+	// the outline may leave the tile a bit, but not by half a tile
+	float marginX = tileSize.width * 0.5f;
+	float marginY = tileSize.height * 0.5f;
+	for (size_t i = 0; i < points.size(); i++) {
+		if (points[i].x < -marginX || points[i].x > tileSize.width + marginX || points[i].y < -marginY || points[i].y > tileSize.height + marginY)
+			return false;
+	}
+
+	// centres of the eyes (points 36 to 41 and 42 to 47)
+	cv::Point2f leftEye, rightEye;
+	for (int i = 0; i < 6; i++) {
+		leftEye += cv::Point2f(points[36 + i].x, points[36 + i].y) * (1.0f / 6);
+		rightEye += cv::Point2f(points[42 + i].x, points[42 + i].y) * (1.0f / 6);
+	}
+	float eyeDistance = (float)cv::norm(rightEye - leftEye);
+	if (rightEye.x <= leftEye.x || eyeDistance < 0.15f * tileSize.width || eyeDistance > tileSize.width)
+		return false;
+
+	// nose tip (30) below the eyes and above the chin (8)
+	float eyeY = (leftEye.y + rightEye.y) * 0.5f;
+	return points[30].y > eyeY && points[8].y > points[30].y;
+}
+
+}
+}
@@ -16,14 +16,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <memory>
 
-#include <opencv2\highgui\highgui.hpp>
-#include <opencv2\core\core.hpp>
-#include <opencv\cv.hpp>
+#include <time.h>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
 
 #include "FaceSwapper/FaceSwapping.h"
-#include "dlib/DlibFaceDetector.h"
+#include "FaceSwapper/BatchManifest.h"
+#include "FaceSwapper/DetectionCache.h"
+#include "FaceSwapper/FaceSheet.h"
+#include "FaceSwapper/Instrumentation.h"
+#include "FaceSwapper/JpegReader.h"
+#include "FaceSwapper/PatchArchive.h"
+#include "FaceSwapper/SegmentationAlpha.h"
+#include "FaceSwapper/SwapProfile.h"
+#include "FaceDetector.h"
 
 std::vector<DetectionRegion*>* copyRegionList(std::vector<DetectionRegion*>* src) {
 	std::vector<DetectionRegion*>* dst = new std::vector<DetectionRegion*>();
@@ -38,68 +51,450 @@ std::vector<DetectionRegion*>* copyRegionList(std::vector<DetectionRegion*>* src
 
 }
 
+uint64_t getFileSize(const std::string& path) {
+	std::ifstream fileStream(path.c_str(), std::ios::binary | std::ios::ate);
+	return fileStream.is_open() ? (uint64_t)fileStream.tellg() : 0;
+}
+
+/// Reads an image (not timed, the callers time the whole read of an input, which may also decode it as JPEG).
+cv::Mat readImage(const std::string& path) {
+	FS_COUNTER_ADD(BYTES_READ, getFileSize(path));
+	return cv::imread(path, cv::IMREAD_COLOR);
+}
+
+bool isJpegPath(const std::string& path) {
+	size_t dot = path.find_last_of('.');
+	std::string ext = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == "jpg" || ext == "jpeg";
+}
+
+/// Writes the output via a temporary file, so a failed or interrupted run never leaves a partial output.
+/// Not timed, the write* functions below time the whole write of an output including its encoding.
+bool writeData(const std::string& path, const std::vector<unsigned char>& data) {
+	std::string error;
+	if (!Jrs::FaceSwapper::BatchManifest::writeAtomic(path, data, &error)) {
+		std::cerr << "cannot write " << path << ": " << error << std::endl;
+		return false;
+	}
+	FS_COUNTER_ADD(BYTES_WRITTEN, data.size());
+	return true;
+}
+
+/// Encodes an image in the format given by the extension of 'path'.
+bool encodeImage(const std::string& path, cv::Mat img, std::vector<unsigned char>& encoded) {
+	size_t dot = path.find_last_of('.');
+	try {
+		if (dot == std::string::npos || !cv::imencode(path.substr(dot), img, encoded))
+			return false;
+	}
+	catch (std::exception& e) {
+		std::cerr << "cannot encode " << path << ": " << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/// Writes already encoded data (see writeData).
+bool writeFile(const std::string& path, const std::vector<unsigned char>& data) {
+	FS_SCOPED_TIMER(STAGE_IMAGE_WRITE);
+	return writeData(path, data);
+}
+
+/// Encodes an image in the format given by the extension of 'path' and writes it (see writeData).
+bool writeImage(const std::string& path, cv::Mat img) {
+	FS_SCOPED_TIMER(STAGE_IMAGE_WRITE);
+	std::vector<unsigned char> encoded;
+	return encodeImage(path, img, encoded) && writeData(path, encoded);
+}
+
+/// Writes a swapped JPEG input, of which only the blocks in 'rois' are encoded again while all others are copied, or
+/// encodes the whole image if that is not possible (see writeData).
+bool writeRecoded(Jrs::FaceSwapper::JpegReader& jpeg, const std::string& path, cv::Mat img, const std::vector<cv::Rect>& rois) {
+	FS_SCOPED_TIMER(STAGE_IMAGE_WRITE);
+	std::vector<unsigned char> encoded;
+	if (!jpeg.recode(img, rois, encoded)) {
+		std::cout << "cannot recode the input, encoding the whole image" << std::endl;
+		encoded.clear();
+		if (!encodeImage(path, img, encoded))
+			return false;
+	}
+	return writeData(path, encoded);
+}
+
+/// Appends the swapped patches of an image to a patch archive, which is created if needed.
+bool writePatches(const std::string& path, const std::string& key, cv::Size frameSize, const std::vector<Jrs::FaceSwapper::SwapPatch>& patches) {
+	FS_SCOPED_TIMER(STAGE_IMAGE_WRITE);
+	Jrs::FaceSwapper::PatchWriter archive;
+	bool ok = archive.open(path) && archive.write(key, frameSize, patches) && archive.close();
+	FS_COUNTER_ADD(BYTES_WRITTEN, getFileSize(path));
+	return ok;
+}
+
+/// Detects the faces in an image and fits their landmarks, or restores both from the cache, if available.
+/// The detector runs on 'detectImg', which may be a proxy reduced by 'scale'; the landmarks are fitted on the full
+/// resolution image returned by 'fullImage', which is only called if faces were found.
+std::vector<DetectionRegion*>* detectFaces(FaceDetector& faceDetector, Jrs::FaceSwapper::FaceSwapping& fswap, Jrs::FaceSwapper::DetectionCache* cache, 
+	uint64_t modelHash, cv::Mat detectImg, int scale, const std::function<cv::Mat()>& fullImage, double minConfidence) 
+{
+	std::string key;
+
+	if (cache) {
+		key = Jrs::FaceSwapper::DetectionCache::makeKey(detectImg, modelHash, minConfidence);
+		std::vector<DetectionRegion*>* cached = new std::vector<DetectionRegion*>();
+		if (cache->lookup(key, *cached)) {
+			std::cout << "using cached detections " << key << std::endl;
+			return cached;
+		}
+		delete cached;
+	}
+
+	std::vector<DetectionRegion*>* regions = faceDetector.calculate(detectImg, minConfidence);
+
+	for (int i = 0; i < regions->size() && scale > 1; i++) {
+		float x, y, w, h;
+		regions->at(i)->getBoundingBox(x, y, w, h);
+		regions->at(i)->setBoundingBox(x * scale, y * scale, w * scale, h * scale);
+	}
+
+	if (!regions->empty())
+		fswap.computeLandmarks(fullImage(), *regions);
+
+	if (cache)
+		cache->store(key, *regions);
+
+	return regions;
+}
+
 int main(int argc, char** argv)
 {
 
 	if (argc < 4) {
 		std::cerr << "Error: insufficient number of parameters" << std::endl;
-		std::cerr << "Usage: FaceSwapper <inputImage> <faceImage> <outputImage>" << std::endl;
+		std::cerr << "Usage: FaceSwapper <inputImage> <faceImage> <outputImage> [options]" << std::endl;
+		std::cerr << "Options:" << std::endl;
+		std::cerr << "  --profile <name>       " << Jrs::FaceSwapper::SwapProfile::getNames() << ": settings of all stages (detection" << std::endl;
+		std::cerr << "                         resolution as --proxy-size), options after it override single settings" << std::endl;
+		std::cerr << "  --detector <backend>   face detector: " << FaceDetector::getBackendNames() << " (default dlib)" << std::endl;
+		std::cerr << "  --detector-model <f>   model of the detector (default: the model of the backend)" << std::endl;
+		std::cerr << "  --landmarks-model <f>  dlib shape predictor with 68 points (default) or 5 points, which are completed" << std::endl;
+		std::cerr << "                         by the landmark template" << std::endl;
+		std::cerr << "  --landmark-template <f> template completing 5 point landmarks (default: built-in mean shape)" << std::endl;
+		std::cerr << "  --cache <dir>          cache detections and landmarks in <dir>" << std::endl;
+		std::cerr << "  --cache-size <MB>      maximum size of the cache (default 256)" << std::endl;
+		std::cerr << "  --metrics-jsonl <file> append stage timings and counters as JSON lines" << std::endl;
+		std::cerr << "  --metrics-prom <file>  write stage timings and counters in Prometheus text format" << std::endl;
+		std::cerr << "  --metrics-interval <s> export interval for the metrics (default 10)" << std::endl;
+		std::cerr << "  --threads <n>          number of threads for swapping the faces (default: number of cores)" << std::endl;
+		std::cerr << "  --proxy-size <px>      detect faces in JPEG inputs on a reduced resolution decode, whose longer side is" << std::endl;
+		std::cerr << "                         at least <px>; inputs without faces are copied without a full decode" << std::endl;
+		std::cerr << "  --jpeg-recode          for JPEG inputs and outputs, only recompress the blocks around the swapped faces" << std::endl;
+		std::cerr << "  --patches              append only the swapped patches (with alpha) to the patch archive <outputImage>," << std::endl;
+		std::cerr << "                         keyed by <inputImage>, instead of writing the whole image" << std::endl;
+		std::cerr << "  --feather <mode>       soft edge of the replaced faces: distance (default) or box" << std::endl;
+		std::cerr << "  --max-patch <px>       warp and colour correct faces larger than <px> at that resolution" << std::endl;
+		std::cerr << "  --row-threads <n>      threads for the pixel loops of a large face, 1 to disable (default: --threads)" << std::endl;
+		std::cerr << "  --face-grid <grid>     <faceImage> is a sheet of generated faces in a grid of <rows>x<cols> tiles, or" << std::endl;
+		std::cerr << "                         'sidecar' to read the grid from <faceImage>.grid; no detector is run on it" << std::endl;
+		return 1;
 	}
 
 	std::string inputImage = argv[1];
 	std::string faceImage = argv[2];
 	std::string outputImage = argv[3];
 
+	std::string detectorBackend = "dlib";
+	std::string detectorModel;
+	std::string landmarksModel = "./models/shape_predictor_68_face_landmarks.dat";
+	std::string landmarkTemplate;
+
+	std::string cacheDir;
+	uint64_t cacheSize = 256;
+
+	std::string metricsJsonLines;
+	std::string metricsPrometheus;
+	double metricsInterval = 10.0;
+
+	int proxySize = 0;
+	bool jpegRecode = false;
+	bool patchOutput = false;
+	bool boxFeather = false;
+	int maxPatchSize = 0;
+	int rowThreads = 0;
+	bool triangulation = false;
+	std::string faceGrid;
+
+	for (int i = 4; i < argc; i++) {
+		std::string option = argv[i];
+		if (option == "--profile" && i + 1 < argc) {
+			Jrs::FaceSwapper::SwapProfile profile;
+			if (!Jrs::FaceSwapper::SwapProfile::find(argv[++i], profile)) {
+				std::cerr << "Error: unknown profile " << argv[i] << std::endl;
+				return 1;
+			}
+			if (detectorBackend != profile.detectorBackend)
+				detectorModel.clear();
+			detectorBackend = profile.detectorBackend;
+			landmarksModel = profile.landmarksModel;
+			triangulation = profile.triangulation;
+			boxFeather = profile.boxFeather;
+			maxPatchSize = profile.maxPatchSize;
+			// single images are only detected at reduced resolution if they can be decoded so (JPEG)
+			proxySize = profile.detectSize;
+		}
+		else if (option == "--detector" && i + 1 < argc)
+			detectorBackend = argv[++i];
+		else if (option == "--detector-model" && i + 1 < argc)
+			detectorModel = argv[++i];
+		else if (option == "--landmarks-model" && i + 1 < argc)
+			landmarksModel = argv[++i];
+		else if (option == "--landmark-template" && i + 1 < argc)
+			landmarkTemplate = argv[++i];
+		else if (option == "--cache" && i + 1 < argc)
+			cacheDir = argv[++i];
+		else if (option == "--cache-size" && i + 1 < argc)
+			cacheSize = atoi(argv[++i]);
+		else if (option == "--metrics-jsonl" && i + 1 < argc)
+			metricsJsonLines = argv[++i];
+		else if (option == "--metrics-prom" && i + 1 < argc)
+			metricsPrometheus = argv[++i];
+		else if (option == "--metrics-interval" && i + 1 < argc)
+			metricsInterval = atof(argv[++i]);
+		else if (option == "--proxy-size" && i + 1 < argc)
+			proxySize = atoi(argv[++i]);
+		else if (option == "--jpeg-recode")
+			jpegRecode = true;
+		else if (option == "--patches")
+			patchOutput = true;
+		else if (option == "--feather" && i + 1 < argc)
+			boxFeather = std::string(argv[++i]) == "box";
+		else if (option == "--max-patch" && i + 1 < argc)
+			maxPatchSize = atoi(argv[++i]);
+		else if (option == "--row-threads" && i + 1 < argc)
+			rowThreads = atoi(argv[++i]);
+		else if (option == "--face-grid" && i + 1 < argc)
+			faceGrid = argv[++i];
+		else if (option == "--threads" && i + 1 < argc)
+			cv::setNumThreads(atoi(argv[++i]));
+		else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	std::unique_ptr<FaceDetector> faceDetector(FaceDetector::create(detectorBackend));
+	if (!faceDetector) {
+		std::cerr << "Error: unknown detector " << detectorBackend << std::endl;
+		return 1;
+	}
+	if (detectorModel.empty())
+		detectorModel = faceDetector->getDefaultModel();
+
+	if ((!metricsJsonLines.empty() || !metricsPrometheus.empty()) && !Jrs::FaceSwapper::Instrumentation::isCompiledIn()) {
+		std::cerr << "Error: --metrics-jsonl and --metrics-prom require a build with FACESWAPPER_INSTRUMENTATION" << std::endl;
+		return 1;
+	}
+	if (!(metricsInterval > 0)) {
+		std::cerr << "Error: --metrics-interval must be positive" << std::endl;
+		return 1;
+	}
+	if ((!metricsJsonLines.empty() || !metricsPrometheus.empty()) &&
+		!Jrs::FaceSwapper::Instrumentation::startExporter(metricsJsonLines, metricsPrometheus, metricsInterval))
+		return 1;
+
 	std::cout << "loading " << inputImage << std::endl;
-	
-	cv::Mat inputImg = cv::imread(inputImage, CV_LOAD_IMAGE_COLOR);
-	cv::Mat targetImg = inputImg.clone();
 
-	std::cout << "loading " << faceImage << std::endl;
+	// JPEG inputs may be detected on a DCT scaled proxy (as long as no EXIF rotation has to be applied, which cv::imread
+	// would do), the full image is then only decoded if there are faces
+	cv::Mat inputImg;
+	cv::Mat detectImg;
+	int proxyScale = 1;
+	Jrs::FaceSwapper::JpegReader jpeg;
+	bool jpegInput;
+	{
+		FS_SCOPED_TIMER(STAGE_IMAGE_READ);
+		jpegInput = (proxySize > 0 || jpegRecode) && Jrs::FaceSwapper::JpegReader::isJpeg(inputImage) && jpeg.open(inputImage) && jpeg.getOrientation() == 1;
+		if (jpegInput && proxySize > 0) {
+			proxyScale = Jrs::FaceSwapper::JpegReader::chooseScale(jpeg.getWidth(), jpeg.getHeight(), proxySize);
+			if (proxyScale == 1 || !jpeg.decode(detectImg, proxyScale))
+				proxyScale = 1;
+		}
+		if (detectImg.empty()) {
+			inputImg = readImage(inputImage);
+			detectImg = inputImg;
+		}
+	}
 
-	cv::Mat faceImg = cv::imread(inputImage, CV_LOAD_IMAGE_COLOR);
-	
+	std::function<cv::Mat()> fullInputImage = [&]() -> cv::Mat {
+		if (inputImg.empty()) {
+			FS_SCOPED_TIMER(STAGE_IMAGE_READ);
+			if (!jpeg.decode(inputImg, 1))
+				inputImg = readImage(inputImage);
+		}
+		return inputImg;
+	};
+
+	Jrs::FaceSwapper::DetectionCache* cache = NULL;
+	uint64_t modelHash = 0;
+	if (!cacheDir.empty()) {
+		cache = new Jrs::FaceSwapper::DetectionCache(cacheDir, cacheSize * 1024 * 1024);
+		uint64_t landmarksHash = Jrs::FaceSwapper::DetectionCache::hashFile(landmarksModel);
+		if (!landmarkTemplate.empty()) {
+			// landmarks completed by another template differ, so they must not be restored
+			uint64_t templateHash = Jrs::FaceSwapper::DetectionCache::hashFile(landmarkTemplate);
+			landmarksHash = Jrs::FaceSwapper::DetectionCache::hashBytes(&templateHash, sizeof(templateHash), landmarksHash);
+		}
+		modelHash = Jrs::FaceSwapper::DetectionCache::hashBytes(&landmarksHash, sizeof(landmarksHash), Jrs::FaceSwapper::DetectionCache::hashFile(detectorModel));
+	}
 
 	std::cout << "running face det on both images " << std::endl;
 
-	FaceDetectorDlib faceDetector;
-	
-	faceDetector.doLazyInit("mmod_human_face_detector.dat");
+	faceDetector->doLazyInit(detectorModel);
+
+	Jrs::FaceSwapper::FaceSwapping fswap(landmarksModel, triangulation);
+	if (boxFeather)
+		fswap.setFeatherMode(Jrs::FaceSwapper::FaceSwapping::FEATHER_BOX);
+	fswap.setMaxPatchSize(maxPatchSize);
+	fswap.setRowParallelism(rowThreads);
+	if (!landmarkTemplate.empty()) {
+		Jrs::FaceSwapper::LandmarkTemplate shapeTemplate;
+		if (!shapeTemplate.read(landmarkTemplate))
+			return 1;
+		fswap.setLandmarkTemplate(shapeTemplate);
+	}
+	//Jrs::FaceSwapper::FaceSwapping fswap("./models/face_landmark_model.dat",true);
 	
-	std::vector<DetectionRegion*>* detectedInputRegions = faceDetector.calculate(inputImg, 0.9);
+	std::vector<DetectionRegion*>* detectedInputRegions = detectFaces(*faceDetector, fswap, cache, modelHash, detectImg, proxyScale, fullInputImage, faceDetector->getDefaultConfidence());
 
 	printf("Input: number of detected regions:%d\n", (int)(detectedInputRegions->size()));
 
+	if (detectedInputRegions->empty() && patchOutput) {
+		std::cout << "no faces found, adding the image without patches" << std::endl;
+		delete cache;
+		cv::Size frameSize = inputImg.empty() ? cv::Size(jpeg.getWidth(), jpeg.getHeight()) : inputImg.size();
+		bool ok = writePatches(outputImage, inputImage, frameSize, std::vector<Jrs::FaceSwapper::SwapPatch>());
+		if (!ok)
+			std::cerr << "failed to write patches to " << outputImage << std::endl;
+		Jrs::FaceSwapper::Instrumentation::stopExporter();
+		return ok ? 0 : 1;
+	}
 
-	std::vector<DetectionRegion*>* detectedFaceRegions = faceDetector.calculate(faceImg, 0.98);
-	printf("Face templates: number of detected regions:%d\n", (int)(detectedFaceRegions->size()));
-	
-	Jrs::FaceSwapper::FaceSwapping fswap("./models/shape_predictor_68_face_landmarks.dat");
-	//Jrs::FaceSwapper::FaceSwapping fswap("./models/face_landmark_model.dat",true);
+	if (detectedInputRegions->empty() && jpegInput && isJpegPath(outputImage)) {
+		std::cout << "no faces found, copying input" << std::endl;
+		delete cache;
+		bool ok = writeFile(outputImage, jpeg.getData());
+		if (!ok)
+			std::cerr << "failed to write image " << outputImage << std::endl;
+		Jrs::FaceSwapper::Instrumentation::stopExporter();
+		return ok ? 0 : 1;
+	}
+
+	cv::Mat targetImg = fullInputImage().clone();
 
+	std::cout << "loading " << faceImage << std::endl;
+
+	cv::Mat faceImg;
+	{
+		FS_SCOPED_TIMER(STAGE_IMAGE_READ);
+		faceImg = readImage(faceImage);
+	}
+
+	// replacement faces with the images they are located in (the face image, or the tiles of a face sheet)
+	std::vector<cv::Mat> faceTiles;
+	std::vector<DetectionRegion*>* detectedFaceRegions;
+	if (!faceGrid.empty()) {
+		Jrs::FaceSwapper::FaceSheetLayout layout;
+		bool layoutOk = faceGrid == "sidecar" ? Jrs::FaceSwapper::FaceSheet::readLayout(Jrs::FaceSwapper::FaceSheet::getLayoutPath(faceImage), layout) :
+			Jrs::FaceSwapper::FaceSheet::parseGrid(faceGrid, faceImg.size(), layout);
+		if (!layoutOk) {
+			std::cerr << "no valid face grid for " << faceImage << std::endl;
+			return 1;
+		}
+
+		detectedFaceRegions = new std::vector<DetectionRegion*>();
+		Jrs::FaceSwapper::FaceSheet::load(fswap, faceImg, layout, faceTiles, *detectedFaceRegions);
+		printf("Face templates: number of accepted tiles:%d of %d\n", (int)(detectedFaceRegions->size()), layout.count);
+	}
+	else {
+		detectedFaceRegions = detectFaces(*faceDetector, fswap, cache, modelHash, faceImg, 1, [&]() { return faceImg; }, faceDetector->getBankConfidence());
+		faceTiles.assign(detectedFaceRegions->size(), faceImg);
+		printf("Face templates: number of detected regions:%d\n", (int)(detectedFaceRegions->size()));
+	}
+
+	delete cache;
+
+	if (detectedFaceRegions->empty()) {
+		std::cerr << "no faces found in " << faceImage << std::endl;
+		return 1;
+	}
+	
 	std::cout << "replacing ... " << std::endl;
 
 	srand((unsigned)time(0));
 
+	// segmentation of the face image, if the segmenter has stored one next to it
+	cv::Mat faceAlpha;
+	if (Jrs::FaceSwapper::SegmentationAlpha::read(Jrs::FaceSwapper::SegmentationAlpha::getPath(faceImage), faceAlpha) && faceAlpha.size() != faceImg.size()) {
+		std::cerr << "segmentation of " << faceImage << " does not match the image size, ignored" << std::endl;
+		faceAlpha.release();
+	}
+
+	// each replacement face is prepared once, when it is first used
+	std::vector<Jrs::FaceSwapper::BankFace> bankFaces(detectedFaceRegions->size());
+	std::vector<bool> prepared(detectedFaceRegions->size(), false);
+	std::vector<const Jrs::FaceSwapper::BankFace*> faces;
 	for (int i = 0; i < detectedInputRegions->size(); i++) {
 
 		int faceId = rand() % detectedFaceRegions->size();
 
 		std::cout << "replacing face " << i << " with generated face " << faceId << std::endl;
 
-		fswap.swapFaces(inputImg, targetImg, faceImg, detectedInputRegions->at(i), detectedFaceRegions->at(faceId));
+		if (!prepared[faceId]) {
+			cv::Mat tileAlpha;
+			if (!faceAlpha.empty()) {
+				cv::Size sheetSize;
+				cv::Point offset;
+				faceTiles[faceId].locateROI(sheetSize, offset);
+				tileAlpha = faceAlpha(cv::Rect(offset, faceTiles[faceId].size()));
+			}
+			fswap.prepareBankFace(faceTiles[faceId], detectedFaceRegions->at(faceId), bankFaces[faceId], tileAlpha);
+			prepared[faceId] = true;
+		}
+		faces.push_back(&bankFaces[faceId]);
+	}
 
-		std::cout << "done " << std::endl;
+	fswap.swapFaces(inputImg, targetImg, faces, *detectedInputRegions);
 
-	}
+	std::cout << "done " << std::endl;
 
-	try {
+	if (patchOutput) {
+		std::vector<cv::Rect> rois;
+		for (int i = 0; i < detectedInputRegions->size(); i++)
+			rois.push_back(fswap.getSwapRoi(inputImg, detectedInputRegions->at(i), *faces[i]));
 
-		cv::imwrite(outputImage, targetImg);
+		std::vector<Jrs::FaceSwapper::SwapPatch> patches;
+		Jrs::FaceSwapper::PatchArchive::extract(inputImg, targetImg, rois, patches);
+		bool ok = writePatches(outputImage, inputImage, inputImg.size(), patches);
+		if (!ok)
+			std::cerr << "failed to write patches to " << outputImage << std::endl;
+		Jrs::FaceSwapper::Instrumentation::stopExporter();
+		return ok ? 0 : 1;
 	}
-	catch (std::exception e) {
-		std::cerr << "failed to write image " << std::endl;
+
+	// the coefficients of all blocks outside the swapped faces are copied from the input
+	bool ok;
+	if (jpegInput && jpegRecode && isJpegPath(outputImage)) {
+		std::vector<cv::Rect> rois;
+		for (int i = 0; i < detectedInputRegions->size(); i++)
+			rois.push_back(fswap.getSwapRoi(inputImg, detectedInputRegions->at(i), *faces[i]));
+		ok = writeRecoded(jpeg, outputImage, targetImg, rois);
 	}
+	else
+		ok = writeImage(outputImage, targetImg);
+	if (!ok)
+		std::cerr << "failed to write image " << outputImage << std::endl;
+
+	Jrs::FaceSwapper::Instrumentation::stopExporter();
 
-	return 0;
+	return ok ? 0 : 1;
 }
@@ -0,0 +1,314 @@
+// Batch anonymization of large image archives. Processes the images of a manifest (or one shard of it) with a
+// SwapPipeline on a number of worker threads and records every finished image in an append-only completion log, from
+// which an interrupted run resumes. Several nodes sharing a file system each run one shard with a log of their own.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include "FaceDetector.h"
+#include "FaceSwapper/BatchManifest.h"
+#include "FaceSwapper/CompletionLog.h"
+#include "FaceSwapper/DetectionCache.h"
+#include "FaceSwapper/PatchArchive.h"
+#include "FaceSwapper/SwapPipeline.h"
+#include "FaceSwapper/SwapProfile.h"
+
+using namespace Jrs::FaceSwapper;
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<bool> stopRequested(false);
+
+static void handleSignal(int)
+{
+	stopRequested = true;
+}
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/// Hash of the content of a file, identical to DetectionCache::hashFile of the written file.
+static uint64_t hashContent(const std::vector<unsigned char>& data)
+{
+	const size_t chunk = 1 << 20;
+	uint64_t h = 0;
+	for (size_t pos = 0; pos < data.size(); pos += chunk)
+		h = DetectionCache::hashBytes(&data[pos], std::min(chunk, data.size() - pos), h);
+	return h;
+}
+
+/// Swaps the faces of one image and writes the output image, or only the swapped patches into 'patchArchive'.
+static BatchRecord processItem(SwapPipeline& pipeline, const BatchItem& item, PatchWriter* patchArchive, const std::string& patchPath)
+{
+	BatchRecord record;
+	record.input = item.input;
+	record.output = item.output;
+
+	Clock::time_point start = Clock::now();
+	cv::Mat frame = cv::imread(item.input, cv::IMREAD_COLOR);
+	record.readMs = elapsedMs(start);
+	if (frame.empty()) {
+		record.message = "cannot read input";
+		return record;
+	}
+	record.width = frame.cols;
+	record.height = frame.rows;
+
+	start = Clock::now();
+	std::vector<SwapPatch> patches;
+	// the bank faces are selected by the input, so shards and resumed runs replace the faces of an image alike
+	record.faces = pipeline.process(frame, 0, patchArchive ? &patches : NULL, item.input);
+	record.processMs = elapsedMs(start);
+	if (record.faces < 0) {
+		record.message = "processing failed";
+		return record;
+	}
+
+	if (patchArchive) {
+		start = Clock::now();
+		record.output = patchPath;
+		if (!patchArchive->write(item.input, frame.size(), patches, &record.outputHash))
+			record.message = "cannot write to the patch archive";
+		record.writeMs = elapsedMs(start);
+		record.done = record.message.empty();
+		return record;
+	}
+
+	start = Clock::now();
+	size_t dot = item.output.find_last_of('.');
+	std::vector<unsigned char> encoded;
+	try {
+		if (dot == std::string::npos || !cv::imencode(item.output.substr(dot), frame, encoded))
+			record.message = "cannot encode output";
+	}
+	catch (std::exception& e) {
+		record.message = std::string("cannot encode output: ") + e.what();
+	}
+	if (record.message.empty()) {
+		record.outputHash = hashContent(encoded);
+		std::string error;
+		if (!BatchManifest::makeParentDirectories(item.output))
+			record.message = std::string("cannot create the output directory: ") + strerror(errno);
+		else if (!BatchManifest::writeAtomic(item.output, encoded, &error))
+			record.message = "cannot write output: " + error;
+	}
+	record.writeMs = elapsedMs(start);
+
+	record.done = record.message.empty();
+	return record;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::cerr << "Error: insufficient number of parameters" << std::endl;
+		std::cerr << "Usage: FaceSwapperBatch <manifest> --face-bank <image> [options]" << std::endl;
+		std::cerr << "  <manifest> lists one image per line, as \"<input>\" or \"<input>\\t<output>\"" << std::endl;
+		std::cerr << "Options:" << std::endl;
+		std::cerr << "  --output-dir <dir>        directory for the outputs of lines without output, below the path of the input" << std::endl;
+		std::cerr << "  --shard <i>/<n>           process only shard i of n (0 <= i < n), chosen by the hash of the input path" << std::endl;
+		std::cerr << "  --log <file>              completion log (default <manifest>.<i>-of-<n>.log), resumed if it exists" << std::endl;
+		std::cerr << "  --patches <file>          write only the swapped patches of all images into a patch archive (resumed" << std::endl;
+		std::cerr << "                            if it exists) instead of output images; outputs are then not needed" << std::endl;
+		std::cerr << "  --workers <n>             number of images processed in parallel (default: number of cores)" << std::endl;
+		std::cerr << "  --pipelines <n>           number of pipelines the workers are spread over (default 1); each loads the" << std::endl;
+		std::cerr << "                            models and the face bank, but runs its detector for one image at a time" << std::endl;
+		std::cerr << "  --face-bank <image>       image with replacement faces (may be repeated)" << std::endl;
+		std::cerr << "  --face-sheet <image>      grid of generated faces with a <image>.grid sidecar (may be repeated)" << std::endl;
+		std::cerr << "  --profile <name>          " << SwapProfile::getNames() << ": settings of all stages, options after it" << std::endl;
+		std::cerr << "                            override single settings" << std::endl;
+		std::cerr << "  --detector <backend>      face detector: " << FaceDetector::getBackendNames() << " (default dlib)" << std::endl;
+		std::cerr << "  --detector-model <file>   model of the detector (default: the model of the backend)" << std::endl;
+		std::cerr << "  --landmarks-model <file>  landmark model (68 points, or 5 points completed by the landmark template)" << std::endl;
+		std::cerr << "  --landmark-template <f>   template completing 5 point landmarks (default: built-in mean shape)" << std::endl;
+		std::cerr << "  --min-confidence <c>      minimum confidence of faces to replace" << std::endl;
+		return 1;
+	}
+
+	std::string manifest = argv[1];
+	std::string outputDir;
+	std::string logPath;
+	std::string patchPath;
+	int shardIndex = 0;
+	int shardCount = 1;
+	int numWorkers = 0;
+	int numPipelines = 1;
+	std::vector<std::string> faceBank;
+	std::vector<std::string> faceSheets;
+	SwapPipelineConfig config;
+
+	for (int i = 2; i < argc; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "Error: missing value for " << option << std::endl;
+			return 1;
+		}
+		if (option == "--output-dir")
+			outputDir = argv[++i];
+		else if (option == "--shard") {
+			if (!BatchManifest::parseShard(argv[++i], shardIndex, shardCount)) {
+				std::cerr << "Error: invalid shard " << argv[i] << std::endl;
+				return 1;
+			}
+		}
+		else if (option == "--log")
+			logPath = argv[++i];
+		else if (option == "--patches")
+			patchPath = argv[++i];
+		else if (option == "--workers")
+			numWorkers = atoi(argv[++i]);
+		else if (option == "--pipelines")
+			numPipelines = std::max(1, atoi(argv[++i]));
+		else if (option == "--face-bank")
+			faceBank.push_back(argv[++i]);
+		else if (option == "--face-sheet")
+			faceSheets.push_back(argv[++i]);
+		else if (option == "--profile") {
+			SwapProfile profile;
+			if (!SwapProfile::find(argv[++i], profile)) {
+				std::cerr << "Error: unknown profile " << argv[i] << std::endl;
+				return 1;
+			}
+			profile.apply(config);
+		}
+		else if (option == "--detector")
+			config.detectorBackend = argv[++i];
+		else if (option == "--detector-model")
+			config.detectorModel = argv[++i];
+		else if (option == "--landmarks-model")
+			config.landmarksModel = argv[++i];
+		else if (option == "--landmark-template")
+			config.landmarkTemplate = argv[++i];
+		else if (option == "--min-confidence")
+			config.minConfidence = atof(argv[++i]);
+		else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	if (faceBank.empty() && faceSheets.empty()) {
+		std::cerr << "Error: no face bank image given" << std::endl;
+		return 1;
+	}
+	if (logPath.empty())
+		logPath = manifest + "." + std::to_string(shardIndex) + "-of-" + std::to_string(shardCount) + ".log";
+	if (numWorkers <= 0)
+		numWorkers = std::max(1, (int)std::thread::hardware_concurrency());
+
+	std::vector<BatchItem> items;
+	if (!BatchManifest::read(manifest, outputDir, items, patchPath.empty()))
+		return 1;
+	std::vector<BatchItem> shard;
+	BatchManifest::selectShard(items, shardIndex, shardCount, shard);
+	items.clear();
+
+	CompletionLog log;
+	if (!log.open(logPath))
+		return 1;
+
+	// also opened if all images are completed, so the index of an interrupted archive is written on closing
+	PatchWriter patchArchive;
+	if (!patchPath.empty() && !patchArchive.open(patchPath))
+		return 1;
+
+	std::vector<BatchItem> pending;
+	for (size_t i = 0; i < shard.size(); i++) {
+		if (!log.isCompleted(shard[i].input))
+			pending.push_back(shard[i]);
+	}
+	std::cout << "shard " << shardIndex << "/" << shardCount << ": " << shard.size() << " images, " << shard.size() - pending.size()
+		<< " already completed" << std::endl;
+	if (pending.empty())
+		return 0;
+
+	std::vector< std::unique_ptr<SwapPipeline> > pipelines;
+	for (int p = 0; p < std::min(numPipelines, numWorkers); p++) {
+		std::unique_ptr<SwapPipeline> pipeline(new SwapPipeline());
+		if (!pipeline->init(config))
+			return 1;
+		for (size_t i = 0; i < faceBank.size(); i++)
+			pipeline->loadFaceBank(faceBank[i]);
+		for (size_t i = 0; i < faceSheets.size(); i++)
+			pipeline->loadFaceSheet(faceSheets[i]);
+		if (pipeline->getNumBankFaces() == 0) {
+			std::cerr << "Error: no faces found in the face bank" << std::endl;
+			return 1;
+		}
+		pipelines.push_back(std::move(pipeline));
+	}
+
+	// images already started are completed on SIGINT/SIGTERM, the remaining ones are left for the next run
+	signal(SIGINT, handleSignal);
+	signal(SIGTERM, handleSignal);
+
+	std::atomic<size_t> next(0);
+	std::atomic<size_t> done(0);
+	std::atomic<size_t> failed(0);
+	std::atomic<bool> logFailed(false);
+	Clock::time_point start = Clock::now();
+
+	// each image runs single threaded in the pipeline, the images are spread over the workers
+	cv::setNumThreads(1);
+
+	std::vector<std::thread> workers;
+	for (int w = 0; w < numWorkers; w++) {
+		SwapPipeline* pipeline = pipelines[w % pipelines.size()].get();
+		workers.push_back(std::thread([&, pipeline]() {
+			while (!stopRequested) {
+				size_t i = next++;
+				if (i >= pending.size())
+					break;
+
+				BatchRecord record = processItem(*pipeline, pending[i], patchPath.empty() ? NULL : &patchArchive, patchPath);
+				if (!log.append(record)) {
+					std::cerr << "Error: cannot write to the completion log " << logPath << ", stopping" << std::endl;
+					logFailed = true;
+					stopRequested = true;
+				}
+
+				if (record.done)
+					done++;
+				else {
+					failed++;
+					std::cerr << record.input << ": " << record.message << std::endl;
+				}
+
+				size_t count = done + failed;
+				if (count % 100 == 0)
+					std::cout << count << "/" << pending.size() << " images, " << failed << " failed, "
+						<< count / (elapsedMs(start) / 1000.0) << " images/s" << std::endl;
+			}
+		}));
+	}
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w].join();
+
+	std::cout << done << " images done, " << failed << " failed, " << pending.size() - done - failed << " left in "
+		<< elapsedMs(start) / 1000.0 << " s" << std::endl;
+
+	if (!patchPath.empty() && !patchArchive.close()) {
+		std::cerr << "Error: cannot write the index of the patch archive " << patchPath << std::endl;
+		return 1;
+	}
+	if (logFailed)
+		return 1;
+	return stopRequested || failed > 0 ? 2 : 0;
+}
@@ -0,0 +1,890 @@
+// Throughput benchmark for the face swapping pipeline (detect -> landmarks -> swap -> encode).
+// Runs over a local corpus of images and/or videos and writes the results as JSON, so that builds can be compared.
+// Everything runs offline, only the model files have to be available locally.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/videoio/videoio.hpp>
+
+#include "FaceSwapper/FaceSwapping.h"
+#include "FaceSwapper/FrameChangeDetector.h"
+#include "FaceSwapper/LandmarkTemplate.h"
+#include "FaceSwapper/SegmentationAlpha.h"
+#include "DetectionNms.h"
+#include "FaceDetectionRegion.h"
+#include "FaceDetector.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// allocation counting (counts allocations via operator new, buffers allocated by OpenCV's fastMalloc are not included)
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Returns the peak resident set size of the process in kB.
+static uint64_t getPeakRssKb()
+{
+#ifdef _WINDOWS
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize / 1024;
+	return 0;
+#else
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return strtoull(line.c_str() + 6, NULL, 10);
+	}
+	return 0;
+#endif
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+	if (values.empty())
+		return 0.0;
+	std::sort(values.begin(), values.end());
+	// nearest rank
+	size_t rank = (size_t)(p / 100.0 * values.size() + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > values.size())
+		rank = values.size();
+	return values[rank - 1];
+}
+
+static bool isVideo(const std::string& path)
+{
+	std::string ext = path.substr(path.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == "mp4" || ext == "avi" || ext == "mov" || ext == "mkv" || ext == "mpg" || ext == "webm";
+}
+
+static std::string encodeExtension(const std::string& path)
+{
+	if (isVideo(path))
+		return ".jpg";
+	size_t pos = path.find_last_of('.');
+	return pos == std::string::npos ? std::string(".jpg") : path.substr(pos);
+}
+
+static void deleteRegions(std::vector<DetectionRegion*>* regions)
+{
+	for (size_t i = 0; i < regions->size(); i++)
+		delete regions->at(i);
+	delete regions;
+}
+
+/// Reads the corpus: either a single image/video, or a text file listing one path per line ('#' starts a comment).
+static std::vector<std::string> readCorpus(const std::string& corpus)
+{
+	std::vector<std::string> files;
+	std::string ext = corpus.substr(corpus.find_last_of('.') + 1);
+	if (ext != "txt" && ext != "lst") {
+		files.push_back(corpus);
+		return files;
+	}
+
+	std::ifstream list(corpus.c_str());
+	std::string line;
+	while (std::getline(list, line)) {
+		line.erase(line.find_last_not_of(" \t\r\n") + 1);
+		if (!line.empty() && line[0] != '#')
+			files.push_back(line);
+	}
+	return files;
+}
+
+struct ModeResult {
+	std::string mode;
+	int images;
+	int faces;
+	double wallMs;
+	uint64_t allocations;
+	uint64_t peakRssKb;
+	std::map<std::string, std::vector<double> > stages;
+	/// PSNR of each face swapped at reduced resolution against the full resolution swap
+	std::vector<double> patchPsnr;
+	/// frames swapped with the detections of an earlier, unchanged frame (--static-threshold)
+	int reusedFrames;
+};
+
+static const char* STAGES[] = { "decode", "detect", "landmarks", "swap", "encode", "total" };
+
+/// Speed and agreement of a detector backend with the reference backend (the first one compared).
+struct DetectorResult {
+	std::string backend;
+	int images;
+	int faces;
+	/// faces of the reference backend
+	int referenceFaces;
+	/// faces matched one to one with a face of the reference backend (IoU of at least 0.5)
+	int matched;
+	std::vector<double> detectMs;
+};
+
+/// Speed and error of the 5 point landmarks completed by the template against the 68 point landmarks.
+struct LandmarkResult {
+	std::string model;
+	int faces;
+	std::vector<double> fullMs;
+	std::vector<double> fastMs;
+	/// mean distance of the points used by the affine swap per face, relative to the distance of the outer eye corners
+	std::vector<double> error;
+	/// largest distance of a single point, relative to the distance of the outer eye corners
+	double maxError;
+};
+
+struct BenchmarkOptions {
+	std::string detectorBackend;
+	std::string detectorModel;
+	std::string landmarksModel;
+	/// template for 5 point landmark models, empty for the built-in one
+	std::string landmarkTemplate;
+	std::string triangulationModel;
+	int repeat;
+	int warmup;
+	int maxFrames;
+	/// <= 0 for the default of the detector backend
+	double minConfidence;
+	bool fusedBlend;
+	int maxPatchSize;
+	int rowThreads;
+	/// reuse the detections of static frames if no block differs by more than this (0: detect every frame)
+	double staticThreshold;
+	int maxStaticFrames;
+};
+
+/// Detections with landmarks of the last detected frame, which are reused while the frames are static.
+struct FrameReuse {
+	FrameReuse(const Jrs::FaceSwapper::FrameChangeSettings& settings) : changeDetector(settings) {}
+
+	~FrameReuse() { clear(); }
+
+	void clear()
+	{
+		for (size_t i = 0; i < regions.size(); i++)
+			delete regions[i];
+		regions.clear();
+	}
+
+	Jrs::FaceSwapper::FrameChangeDetector changeDetector;
+	std::vector<DetectionRegion*> regions;
+};
+
+/// Decodes all images and video frames (at most maxFrames per video) of the corpus and passes them to 'process' with
+/// the extension to encode them with and the decode time.
+static void forEachFrame(const std::vector<std::string>& files, const BenchmarkOptions& options,
+	const std::function<void(cv::Mat, const std::string&, double)>& process)
+{
+	for (size_t f = 0; f < files.size(); f++) {
+		const std::string& file = files[f];
+		std::string ext = encodeExtension(file);
+
+		if (isVideo(file)) {
+			cv::VideoCapture capture(file);
+			if (!capture.isOpened()) {
+				std::cerr << "failed to open " << file << std::endl;
+				continue;
+			}
+			cv::Mat frame;
+			for (int n = 0; options.maxFrames <= 0 || n < options.maxFrames; n++) {
+				Clock::time_point start = Clock::now();
+				if (!capture.read(frame))
+					break;
+				process(frame, ext, elapsedMs(start));
+			}
+		}
+		else {
+			Clock::time_point start = Clock::now();
+			cv::Mat frame = cv::imread(file, cv::IMREAD_COLOR);
+			double decodeMs = elapsedMs(start);
+			if (frame.empty()) {
+				std::cerr << "failed to read " << file << std::endl;
+				continue;
+			}
+			process(frame, ext, decodeMs);
+		}
+	}
+}
+
+/// Processes one frame, appends the stage timings (decode time has been measured by the caller).
+/// With 'reuse', the detections of the last detected frame are reused for static frames; the frame comparison is
+/// counted as detection time.
+static int processFrame(FaceDetector& faceDetector, Jrs::FaceSwapper::FaceSwapping& fswap, cv::Mat frame,
+	const std::vector<Jrs::FaceSwapper::BankFace>& bankFaces, const std::string& ext, const BenchmarkOptions& options, ModeResult& result, double decodeMs, bool record,
+	FrameReuse* reuse)
+{
+	Clock::time_point start = Clock::now();
+	bool reused = reuse && !Jrs::FaceSwapper::FrameChangeDetector::needsDetection(reuse->changeDetector.classify(frame));
+	std::vector<DetectionRegion*>* regions = NULL;
+	if (!reused)
+		regions = faceDetector.calculate(frame, options.minConfidence > 0 ? options.minConfidence : faceDetector.getDefaultConfidence());
+	double detectMs = elapsedMs(start);
+
+	start = Clock::now();
+	if (!reused)
+		fswap.computeLandmarks(frame, *regions);
+	double landmarksMs = elapsedMs(start);
+
+	if (reuse && !reused) {
+		reuse->clear();
+		reuse->regions.swap(*regions);
+		delete regions;
+	}
+	if (reuse)
+		regions = &reuse->regions;
+
+	start = Clock::now();
+	cv::Mat target = frame.clone();
+	std::vector<const Jrs::FaceSwapper::BankFace*> replacements;
+	for (size_t i = 0; i < regions->size(); i++) {
+		// deterministic choice of the replacement face, so that runs are comparable
+		replacements.push_back(&bankFaces[i % bankFaces.size()]);
+	}
+	fswap.swapFaces(frame, target, replacements, *regions);
+	double swapMs = elapsedMs(start);
+
+	start = Clock::now();
+	std::vector<uchar> encoded;
+	cv::imencode(ext, target, encoded);
+	double encodeMs = elapsedMs(start);
+
+	int numFaces = (int)regions->size();
+	if (!reuse)
+		deleteRegions(regions);
+
+	if (record) {
+		result.stages["decode"].push_back(decodeMs);
+		result.stages["detect"].push_back(detectMs);
+		result.stages["landmarks"].push_back(landmarksMs);
+		result.stages["swap"].push_back(swapMs);
+		result.stages["encode"].push_back(encodeMs);
+		result.stages["total"].push_back(decodeMs + detectMs + landmarksMs + swapMs + encodeMs);
+		result.images++;
+		result.faces += numFaces;
+		if (reused)
+			result.reusedFrames++;
+	}
+	return numFaces;
+}
+
+/// Quality of the reduced resolution patches (affine swap only): swaps the faces of one frame with and without the
+/// patch size limit and compares the faces larger than the limit. Runs after the timed passes, so neither the
+/// reference swap nor the repeated detection is included in the timings and allocation counts.
+static void measurePatchPsnr(FaceDetector& faceDetector, Jrs::FaceSwapper::FaceSwapping& fswap, cv::Mat frame,
+	const std::vector<Jrs::FaceSwapper::BankFace>& bankFaces, const BenchmarkOptions& options, ModeResult& result)
+{
+	std::vector<DetectionRegion*>* regions = faceDetector.calculate(frame, options.minConfidence > 0 ? options.minConfidence : faceDetector.getDefaultConfidence());
+	fswap.computeLandmarks(frame, *regions);
+
+	std::vector<const Jrs::FaceSwapper::BankFace*> replacements;
+	for (size_t i = 0; i < regions->size(); i++)
+		replacements.push_back(&bankFaces[i % bankFaces.size()]);
+
+	cv::Mat target = frame.clone();
+	fswap.swapFaces(frame, target, replacements, *regions);
+
+	cv::Mat reference = frame.clone();
+	fswap.setMaxPatchSize(0);
+	fswap.swapFaces(frame, reference, replacements, *regions);
+	fswap.setMaxPatchSize(options.maxPatchSize);
+
+	for (size_t i = 0; i < regions->size(); i++) {
+		cv::Rect roi = fswap.getSwapRoi(frame, regions->at(i), *replacements[i]);
+		if (roi.area() > 0 && std::max(roi.width, roi.height) > options.maxPatchSize)
+			result.patchPsnr.push_back(cv::PSNR(reference(roi), target(roi)));
+	}
+
+	deleteRegions(regions);
+}
+
+static ModeResult runMode(const std::string& mode, const std::vector<std::string>& files, const std::string& faceImage, const BenchmarkOptions& options)
+{
+	ModeResult result;
+	result.mode = mode;
+	result.images = 0;
+	result.faces = 0;
+	result.wallMs = 0.0;
+	result.allocations = 0;
+	result.peakRssKb = 0;
+	result.reusedFrames = 0;
+
+	bool triangulation = (mode == "triangulated");
+
+	std::unique_ptr<FaceDetector> detector(FaceDetector::create(options.detectorBackend));
+	if (!detector) {
+		std::cerr << "unknown detector " << options.detectorBackend << std::endl;
+		return result;
+	}
+	detector->doLazyInit(options.detectorModel.empty() ? detector->getDefaultModel() : options.detectorModel);
+	FaceDetector& faceDetector = *detector;
+	Jrs::FaceSwapper::FaceSwapping fswap(triangulation ? options.triangulationModel : options.landmarksModel, triangulation);
+	fswap.setFusedBlend(options.fusedBlend);
+	fswap.setMaxPatchSize(options.maxPatchSize);
+	fswap.setRowParallelism(options.rowThreads);
+	if (!options.landmarkTemplate.empty()) {
+		Jrs::FaceSwapper::LandmarkTemplate landmarkTemplate;
+		if (landmarkTemplate.read(options.landmarkTemplate))
+			fswap.setLandmarkTemplate(landmarkTemplate);
+	}
+
+	// the face bank is prepared once, as in a long running process
+	cv::Mat faceImg = cv::imread(faceImage, cv::IMREAD_COLOR);
+	cv::Mat faceAlpha;
+	Jrs::FaceSwapper::SegmentationAlpha::read(Jrs::FaceSwapper::SegmentationAlpha::getPath(faceImage), faceAlpha);
+	std::vector<DetectionRegion*>* faceRegions = faceDetector.calculate(faceImg, faceDetector.getBankConfidence());
+	std::vector<Jrs::FaceSwapper::BankFace> bankFaces;
+	for (size_t i = 0; i < faceRegions->size(); i++) {
+		Jrs::FaceSwapper::BankFace face;
+		if (fswap.prepareBankFace(faceImg, faceRegions->at(i), face, faceAlpha))
+			bankFaces.push_back(face);
+	}
+	deleteRegions(faceRegions);
+	if (bankFaces.empty()) {
+		std::cerr << "no faces found in " << faceImage << std::endl;
+		return result;
+	}
+
+	uint64_t allocationsStart = allocationCount.load();
+	Clock::time_point wallStart = Clock::now();
+
+	for (int iteration = -options.warmup; iteration < options.repeat; iteration++) {
+		bool record = iteration >= 0;
+		if (iteration == 0) {
+			allocationsStart = allocationCount.load();
+			wallStart = Clock::now();
+		}
+
+		// each pass starts without a reference frame, so the passes are comparable
+		std::unique_ptr<FrameReuse> reuse;
+		if (options.staticThreshold > 0) {
+			Jrs::FaceSwapper::FrameChangeSettings settings;
+			settings.staticThreshold = options.staticThreshold;
+			settings.maxStaticFrames = options.maxStaticFrames;
+			reuse.reset(new FrameReuse(settings));
+		}
+
+		forEachFrame(files, options, [&](cv::Mat frame, const std::string& ext, double decodeMs) {
+			processFrame(faceDetector, fswap, frame, bankFaces, ext, options, result, decodeMs, record, reuse.get());
+		});
+	}
+
+	result.wallMs = elapsedMs(wallStart);
+	result.allocations = allocationCount.load() - allocationsStart;
+	result.peakRssKb = getPeakRssKb();
+
+	if (options.maxPatchSize > 0 && mode == "affine") {
+		forEachFrame(files, options, [&](cv::Mat frame, const std::string& ext, double decodeMs) {
+			measurePatchPsnr(faceDetector, fswap, frame, bankFaces, options, result);
+		});
+	}
+
+	return result;
+}
+
+/// Number of faces in 'regions' matched one to one with a face in 'reference' with an IoU of at least 0.5, greedily
+/// by decreasing overlap of the reference faces.
+static int matchRegions(const std::vector<DetectionRegion*>& reference, const std::vector<DetectionRegion*>& regions)
+{
+	std::vector<bool> used(regions.size(), false);
+	int matched = 0;
+	for (size_t r = 0; r < reference.size(); r++) {
+		float rx, ry, rw, rh;
+		reference[r]->getBoundingBox(rx, ry, rw, rh);
+
+		int best = -1;
+		float bestIou = 0.5f;
+		for (size_t i = 0; i < regions.size(); i++) {
+			float x, y, w, h;
+			regions[i]->getBoundingBox(x, y, w, h);
+			float iou = DetectionNms::iou(rx, ry, rw, rh, x, y, w, h);
+			if (!used[i] && iou >= bestIou) {
+				best = (int)i;
+				bestIou = iou;
+			}
+		}
+		if (best >= 0) {
+			used[best] = true;
+			matched++;
+		}
+	}
+	return matched;
+}
+
+/// Runs only the detection of each backend on every frame of the corpus, each at its default confidence.
+static std::vector<DetectorResult> compareDetectors(const std::vector<std::string>& backends, const std::vector<std::string>& files,
+	const BenchmarkOptions& options)
+{
+	std::vector< std::unique_ptr<FaceDetector> > detectors;
+	std::vector<DetectorResult> results;
+	for (size_t b = 0; b < backends.size(); b++) {
+		std::unique_ptr<FaceDetector> detector(FaceDetector::create(backends[b]));
+		if (!detector) {
+			std::cerr << "unknown detector " << backends[b] << std::endl;
+			continue;
+		}
+		// the model option applies to the backend of the swap modes, the others use their default models
+		detector->doLazyInit(backends[b] == options.detectorBackend && !options.detectorModel.empty() ? options.detectorModel : detector->getDefaultModel());
+		detectors.push_back(std::move(detector));
+
+		DetectorResult result;
+		result.backend = backends[b];
+		result.images = 0;
+		result.faces = 0;
+		result.referenceFaces = 0;
+		result.matched = 0;
+		results.push_back(result);
+	}
+
+	for (int iteration = -options.warmup; iteration < options.repeat; iteration++) {
+		bool record = iteration >= 0;
+
+		forEachFrame(files, options, [&](cv::Mat frame, const std::string&, double) {
+			std::vector<DetectionRegion*>* reference = NULL;
+			for (size_t d = 0; d < detectors.size(); d++) {
+				Clock::time_point start = Clock::now();
+				std::vector<DetectionRegion*>* regions = detectors[d]->calculate(frame, detectors[d]->getDefaultConfidence());
+				double detectMs = elapsedMs(start);
+
+				if (record) {
+					DetectorResult& result = results[d];
+					result.detectMs.push_back(detectMs);
+					result.images++;
+					result.faces += (int)regions->size();
+					result.referenceFaces += (int)(reference ? reference->size() : regions->size());
+					result.matched += reference ? matchRegions(*reference, *regions) : (int)regions->size();
+				}
+
+				if (reference)
+					deleteRegions(regions);
+				else
+					reference = regions;
+			}
+			if (reference)
+				deleteRegions(reference);
+		});
+	}
+
+	return results;
+}
+
+static std::string jsonEscape(const std::string& text)
+{
+	std::string escaped;
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '"' || text[i] == '\\')
+			escaped += '\\';
+		escaped += text[i];
+	}
+	return escaped;
+}
+
+// landmarks of the 68 point layout used by the affine swap: the outline and the eye corners
+static const int AFFINE_LANDMARKS[] = { 0, 3, 5, 8, 11, 13, 16, 17, 26, 27, 30, 36, 45 };
+
+/// Fits the landmarks of every detected face with the 68 point model and with the 5 point model 'fastModel', and
+/// compares the points used by the affine swap. If 'templateOutput' is given, a landmark template is fitted to the 68
+/// point landmarks of the corpus and written to it.
+static LandmarkResult compareLandmarks(const std::string& fastModel, const std::vector<std::string>& files, const BenchmarkOptions& options,
+	const std::string& templateOutput)
+{
+	LandmarkResult result;
+	result.model = fastModel;
+	result.faces = 0;
+	result.maxError = 0.0;
+
+	std::unique_ptr<FaceDetector> detector(FaceDetector::create(options.detectorBackend));
+	if (!detector) {
+		std::cerr << "unknown detector " << options.detectorBackend << std::endl;
+		return result;
+	}
+	detector->doLazyInit(options.detectorModel.empty() ? detector->getDefaultModel() : options.detectorModel);
+	double minConfidence = options.minConfidence > 0 ? options.minConfidence : detector->getDefaultConfidence();
+
+	Jrs::FaceSwapper::FaceSwapping full(options.landmarksModel);
+	Jrs::FaceSwapper::FaceSwapping fast(fastModel);
+	if (!options.landmarkTemplate.empty()) {
+		Jrs::FaceSwapper::LandmarkTemplate landmarkTemplate;
+		if (landmarkTemplate.read(options.landmarkTemplate))
+			fast.setLandmarkTemplate(landmarkTemplate);
+	}
+	if (!fast.usesLandmarkTemplate())
+		std::cerr << fastModel << " is not a 5 point model, its landmarks are not completed by the template" << std::endl;
+
+	std::vector< std::vector<cv::Point2f> > shapes;
+
+	for (int iteration = -options.warmup; iteration < options.repeat; iteration++) {
+		bool record = iteration >= 0;
+
+		forEachFrame(files, options, [&](cv::Mat frame, const std::string&, double) {
+			std::vector<DetectionRegion*>* regions = detector->calculate(frame, minConfidence);
+			for (size_t i = 0; i < regions->size(); i++) {
+				float x, y, w, h;
+				regions->at(i)->getBoundingBox(x, y, w, h);
+				FaceDetectionRegion fullRegion, fastRegion;
+				fullRegion.setBoundingBox(x, y, w, h);
+				fastRegion.setBoundingBox(x, y, w, h);
+
+				Clock::time_point start = Clock::now();
+				full.computeLandmarks(frame, &fullRegion);
+				double fullMs = elapsedMs(start);
+				start = Clock::now();
+				fast.computeLandmarks(frame, &fastRegion);
+				double fastMs = elapsedMs(start);
+
+				if (!record || !Jrs::FaceSwapper::FaceSwapping::hasLandmarks(&fullRegion) ||
+					!Jrs::FaceSwapper::FaceSwapping::hasLandmarks(&fastRegion))
+					continue;
+
+				const std::vector<DetectionRegion::Point>& fullPoints = *fullRegion.getPoints();
+				const std::vector<DetectionRegion::Point>& fastPoints = *fastRegion.getPoints();
+				double eyeDistance = hypot(fullPoints[45].x - fullPoints[36].x, fullPoints[45].y - fullPoints[36].y);
+				if (eyeDistance <= 0.0)
+					continue;
+
+				double sum = 0.0;
+				size_t numPoints = sizeof(AFFINE_LANDMARKS) / sizeof(AFFINE_LANDMARKS[0]);
+				for (size_t p = 0; p < numPoints; p++) {
+					int k = AFFINE_LANDMARKS[p];
+					double error = hypot(fastPoints[k].x - fullPoints[k].x, fastPoints[k].y - fullPoints[k].y) / eyeDistance;
+					sum += error;
+					result.maxError = std::max(result.maxError, error);
+				}
+
+				result.faces++;
+				result.fullMs.push_back(fullMs);
+				result.fastMs.push_back(fastMs);
+				result.error.push_back(sum / numPoints);
+
+				// each face of the corpus is used once for the template
+				if (iteration == 0 && !templateOutput.empty()) {
+					std::vector<cv::Point2f> shape(fullPoints.size());
+					for (size_t p = 0; p < fullPoints.size(); p++)
+						shape[p] = cv::Point2f(fullPoints[p].x, fullPoints[p].y);
+					shapes.push_back(shape);
+				}
+			}
+			deleteRegions(regions);
+		});
+	}
+
+	if (!templateOutput.empty()) {
+		Jrs::FaceSwapper::LandmarkTemplate landmarkTemplate;
+		if (!landmarkTemplate.fit(shapes) || !landmarkTemplate.write(templateOutput))
+			std::cerr << "failed to write the landmark template " << templateOutput << std::endl;
+	}
+
+	return result;
+}
+
+static void writeMsStats(std::ostream& out, const std::vector<double>& values)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < values.size(); i++)
+		sum += values[i];
+
+	out << "{ \"mean\": " << (values.empty() ? 0.0 : sum / values.size()) << ", \"p50\": " << percentile(values, 50)
+		<< ", \"p95\": " << percentile(values, 95) << " }";
+}
+
+static void writeJson(std::ostream& out, const std::string& corpus, const std::vector<std::string>& files, const BenchmarkOptions& options,
+	const std::vector<ModeResult>& results, const std::vector<DetectorResult>& detectorResults, const LandmarkResult* landmarkResult)
+{
+	out << "{" << std::endl;
+	out << "  \"corpus\": \"" << jsonEscape(corpus) << "\"," << std::endl;
+	out << "  \"files\": " << files.size() << "," << std::endl;
+	out << "  \"threads\": " << cv::getNumThreads() << "," << std::endl;
+	out << "  \"max_patch\": " << options.maxPatchSize << "," << std::endl;
+	out << "  \"detector\": \"" << jsonEscape(options.detectorBackend) << "\"," << std::endl;
+	out << "  \"modes\": [" << std::endl;
+
+	for (size_t m = 0; m < results.size(); m++) {
+		const ModeResult& r = results[m];
+		double seconds = r.wallMs / 1000.0;
+
+		out << "    {" << std::endl;
+		out << "      \"mode\": \"" << r.mode << "\"," << std::endl;
+		out << "      \"images\": " << r.images << "," << std::endl;
+		out << "      \"faces\": " << r.faces << "," << std::endl;
+		out << "      \"wall_seconds\": " << seconds << "," << std::endl;
+		out << "      \"images_per_sec\": " << (seconds > 0 ? r.images / seconds : 0.0) << "," << std::endl;
+		out << "      \"allocations_per_image\": " << (r.images > 0 ? (double)r.allocations / r.images : 0.0) << "," << std::endl;
+		out << "      \"peak_rss_kb\": " << r.peakRssKb << "," << std::endl;
+		if (options.staticThreshold > 0)
+			out << "      \"reused_frames\": " << r.reusedFrames << "," << std::endl;
+		if (!r.patchPsnr.empty()) {
+			double sum = 0.0;
+			for (size_t i = 0; i < r.patchPsnr.size(); i++)
+				sum += r.patchPsnr[i];
+			out << "      \"patch_psnr_db\": { \"faces\": " << r.patchPsnr.size() << ", \"mean\": " << sum / r.patchPsnr.size()
+				<< ", \"min\": " << *std::min_element(r.patchPsnr.begin(), r.patchPsnr.end()) << " }," << std::endl;
+		}
+		out << "      \"stages\": {" << std::endl;
+
+		size_t numStages = sizeof(STAGES) / sizeof(STAGES[0]);
+		for (size_t s = 0; s < numStages; s++) {
+			std::map<std::string, std::vector<double> >::const_iterator iter = r.stages.find(STAGES[s]);
+			std::vector<double> values;
+			if (iter != r.stages.end())
+				values = iter->second;
+
+			double sum = 0.0;
+			for (size_t i = 0; i < values.size(); i++)
+				sum += values[i];
+
+			out << "        \"" << STAGES[s] << "\": { \"mean_ms\": " << (values.empty() ? 0.0 : sum / values.size())
+				<< ", \"p50_ms\": " << percentile(values, 50) << ", \"p95_ms\": " << percentile(values, 95)
+				<< ", \"p99_ms\": " << percentile(values, 99) << " }" << (s + 1 < numStages ? "," : "") << std::endl;
+		}
+
+		out << "      }" << std::endl;
+		out << "    }" << (m + 1 < results.size() ? "," : "") << std::endl;
+	}
+
+	out << "  ]";
+
+	if (!detectorResults.empty()) {
+		// recall and precision are relative to the first backend, not to a ground truth
+		out << "," << std::endl << "  \"detectors\": [" << std::endl;
+		for (size_t d = 0; d < detectorResults.size(); d++) {
+			const DetectorResult& r = detectorResults[d];
+			out << "    { \"backend\": \"" << jsonEscape(r.backend) << "\", \"images\": " << r.images << ", \"faces\": " << r.faces
+				<< ", \"recall_vs_" << jsonEscape(detectorResults[0].backend) << "\": " << (r.referenceFaces > 0 ? (double)r.matched / r.referenceFaces : 0.0)
+				<< ", \"precision_vs_" << jsonEscape(detectorResults[0].backend) << "\": " << (r.faces > 0 ? (double)r.matched / r.faces : 0.0)
+				<< ", \"detect_ms\": ";
+			writeMsStats(out, r.detectMs);
+			out << " }" << (d + 1 < detectorResults.size() ? "," : "") << std::endl;
+		}
+		out << "  ]";
+	}
+
+	if (landmarkResult) {
+		// errors are relative to the 68 point landmarks, in units of the distance of the outer eye corners
+		const LandmarkResult& r = *landmarkResult;
+		double sum = 0.0;
+		for (size_t i = 0; i < r.error.size(); i++)
+			sum += r.error[i];
+
+		out << "," << std::endl << "  \"landmarks\": {" << std::endl;
+		out << "    \"model\": \"" << jsonEscape(r.model) << "\"," << std::endl;
+		out << "    \"faces\": " << r.faces << "," << std::endl;
+		out << "    \"full_ms\": ";
+		writeMsStats(out, r.fullMs);
+		out << "," << std::endl << "    \"fast_ms\": ";
+		writeMsStats(out, r.fastMs);
+		out << "," << std::endl << "    \"error_iod\": { \"mean\": " << (r.error.empty() ? 0.0 : sum / r.error.size())
+			<< ", \"p95\": " << percentile(r.error, 95) << ", \"max_point\": " << r.maxError << " }" << std::endl;
+		out << "  }";
+	}
+
+	out << std::endl << "}" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3) {
+		std::cerr << "Error: insufficient number of parameters" << std::endl;
+		std::cerr << "Usage: FaceSwapperBenchmark <corpus> <faceImage> [options]" << std::endl;
+		std::cerr << "  <corpus> is an image, a video or a .txt/.lst file listing images and videos" << std::endl;
+		std::cerr << "Options:" << std::endl;
+		std::cerr << "  --mode affine|triangulated|both|none  swap modes to run (default both)" << std::endl;
+		std::cerr << "  --repeat <n>                       measured passes over the corpus (default 1)" << std::endl;
+		std::cerr << "  --warmup <n>                       unmeasured passes before (default 1)" << std::endl;
+		std::cerr << "  --max-frames <n>                   frames per video, 0 for all (default 100)" << std::endl;
+		std::cerr << "  --detector <backend>               " << FaceDetector::getBackendNames() << " (default dlib)" << std::endl;
+		std::cerr << "  --detector-model <file>            (default: the model of the backend)" << std::endl;
+		std::cerr << "  --compare-detectors <b1,b2,...>    also run only the detection of these backends, recall and" << std::endl;
+		std::cerr << "                                     precision are relative to the first one" << std::endl;
+		std::cerr << "  --landmarks-model <file>           (default ./models/shape_predictor_68_face_landmarks.dat)" << std::endl;
+		std::cerr << "  --landmark-template <file>         template completing 5 point landmarks (default: built-in mean shape)" << std::endl;
+		std::cerr << "  --compare-landmarks <file>         also fit the landmarks with this 5 point model and report the error of" << std::endl;
+		std::cerr << "                                     the points of the affine swap against the 68 point model" << std::endl;
+		std::cerr << "  --fit-landmark-template <file>     with --compare-landmarks, write a template fitted to the corpus" << std::endl;
+		std::cerr << "  --triangulation-model <file>       (default ./models/face_landmark_model.dat)" << std::endl;
+		std::cerr << "  --threads <n>                      threads for swapping the faces of an image (default: number of cores)" << std::endl;
+		std::cerr << "  --blend fused|unfused              blend of the affine swap (default fused)" << std::endl;
+		std::cerr << "  --max-patch <px>                   swap larger faces at this resolution and report their PSNR" << std::endl;
+		std::cerr << "                                     against the full resolution swap (default 0: off)" << std::endl;
+		std::cerr << "  --row-threads <n>                  threads for the pixel loops of a large face, 1 to disable (default 0: --threads)" << std::endl;
+		std::cerr << "  --static-threshold <sad>           reuse the detections and landmarks of unchanged video frames, if no" << std::endl;
+		std::cerr << "                                     block differs by more than <sad> grey levels (default 0: off)" << std::endl;
+		std::cerr << "  --max-static-frames <n>            detect again after <n> reused frames (default 15)" << std::endl;
+		std::cerr << "  --output <file>                    write JSON to file instead of stdout" << std::endl;
+		return 1;
+	}
+
+	std::string corpus = argv[1];
+	std::string faceImage = argv[2];
+	std::string modes = "both";
+	std::string output;
+	std::vector<std::string> compareBackends;
+	std::string compareLandmarksModel;
+	std::string templateOutput;
+
+	BenchmarkOptions options;
+	options.detectorBackend = "dlib";
+	options.landmarksModel = "./models/shape_predictor_68_face_landmarks.dat";
+	options.triangulationModel = "./models/face_landmark_model.dat";
+	options.repeat = 1;
+	options.warmup = 1;
+	options.maxFrames = 100;
+	options.minConfidence = 0.0;
+	options.fusedBlend = true;
+	options.maxPatchSize = 0;
+	options.rowThreads = 0;
+	options.staticThreshold = 0.0;
+	options.maxStaticFrames = Jrs::FaceSwapper::FrameChangeSettings().maxStaticFrames;
+
+	for (int i = 3; i < argc; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "Error: missing value for " << option << std::endl;
+			return 1;
+		}
+		if (option == "--mode")
+			modes = argv[++i];
+		else if (option == "--repeat")
+			options.repeat = atoi(argv[++i]);
+		else if (option == "--warmup")
+			options.warmup = atoi(argv[++i]);
+		else if (option == "--max-frames")
+			options.maxFrames = atoi(argv[++i]);
+		else if (option == "--detector")
+			options.detectorBackend = argv[++i];
+		else if (option == "--compare-detectors") {
+			std::stringstream list(argv[++i]);
+			std::string backend;
+			while (std::getline(list, backend, ','))
+				compareBackends.push_back(backend);
+		}
+		else if (option == "--detector-model")
+			options.detectorModel = argv[++i];
+		else if (option == "--landmarks-model")
+			options.landmarksModel = argv[++i];
+		else if (option == "--landmark-template")
+			options.landmarkTemplate = argv[++i];
+		else if (option == "--compare-landmarks")
+			compareLandmarksModel = argv[++i];
+		else if (option == "--fit-landmark-template")
+			templateOutput = argv[++i];
+		else if (option == "--triangulation-model")
+			options.triangulationModel = argv[++i];
+		else if (option == "--threads")
+			cv::setNumThreads(atoi(argv[++i]));
+		else if (option == "--blend")
+			options.fusedBlend = std::string(argv[++i]) != "unfused";
+		else if (option == "--max-patch")
+			options.maxPatchSize = atoi(argv[++i]);
+		else if (option == "--row-threads")
+			options.rowThreads = atoi(argv[++i]);
+		else if (option == "--static-threshold")
+			options.staticThreshold = atof(argv[++i]);
+		else if (option == "--max-static-frames")
+			options.maxStaticFrames = atoi(argv[++i]);
+		else if (option == "--output")
+			output = argv[++i];
+		else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<std::string> files = readCorpus(corpus);
+	if (files.empty()) {
+		std::cerr << "Error: empty corpus " << corpus << std::endl;
+		return 1;
+	}
+
+	std::vector<ModeResult> results;
+	if (modes == "affine" || modes == "both")
+		results.push_back(runMode("affine", files, faceImage, options));
+	if (modes == "triangulated" || modes == "both")
+		results.push_back(runMode("triangulated", files, faceImage, options));
+
+	std::vector<DetectorResult> detectorResults;
+	if (!compareBackends.empty())
+		detectorResults = compareDetectors(compareBackends, files, options);
+
+	LandmarkResult landmarkResult;
+	if (!compareLandmarksModel.empty())
+		landmarkResult = compareLandmarks(compareLandmarksModel, files, options, templateOutput);
+
+	const LandmarkResult* landmarks = compareLandmarksModel.empty() ? NULL : &landmarkResult;
+	if (output.empty())
+		writeJson(std::cout, corpus, files, options, results, detectorResults, landmarks);
+	else {
+		std::ofstream out(output.c_str());
+		writeJson(out, corpus, files, options, results, detectorResults, landmarks);
+	}
+
+	return 0;
+}
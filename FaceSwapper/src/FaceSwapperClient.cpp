@@ -0,0 +1,267 @@
+// Command line client of the swap daemon. Submits single jobs, or drives the daemon with many concurrent jobs to
+// measure throughput and latency (stress mode).
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WINDOWS
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "FaceSwapper/SwapProtocol.h"
+
+using namespace Jrs::FaceSwapper;
+
+#ifdef _WINDOWS
+
+int main(int argc, char** argv)
+{
+	std::cerr << "Error: the client requires Unix domain sockets and is not available on this platform" << std::endl;
+	return 1;
+}
+
+#else
+
+typedef std::chrono::steady_clock Clock;
+
+static int connectDaemon(const std::string& socketPath)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		std::cerr << "Error: cannot connect to " << socketPath << ": " << strerror(errno) << std::endl;
+	return fd;
+}
+
+static bool submit(int fd, uint32_t jobId, const SwapProtocol::Job& job)
+{
+	std::string payload;
+	SwapProtocol::encodeJob(job, payload);
+	return SwapProtocol::writeMessage(fd, SwapProtocol::MSG_JOB, jobId, payload);
+}
+
+/// Reads status messages until a job has finished. Returns false if the connection is lost.
+static bool waitFinished(int fd, uint32_t& jobId, SwapProtocol::Status& status)
+{
+	SwapProtocol::Header header;
+	std::string payload;
+	while (SwapProtocol::readMessage(fd, header, payload)) {
+		if (header.type != SwapProtocol::MSG_STATUS || !SwapProtocol::decodeStatus(payload, status))
+			return false;
+		if (status.state == SwapProtocol::STATE_DONE || status.state == SwapProtocol::STATE_FAILED) {
+			jobId = header.jobId;
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Output path of a stress job, the job id is inserted before the extension so concurrent jobs never share a file.
+static std::string stressOutput(const std::string& output, int connection, uint32_t jobId)
+{
+	std::ostringstream suffix;
+	suffix << "_" << connection << "_" << jobId;
+	size_t dot = output.find_last_of('.');
+	if (dot == std::string::npos || output.find('/', dot) != std::string::npos)
+		return output + suffix.str();
+	return output.substr(0, dot) + suffix.str() + output.substr(dot);
+}
+
+struct StressResult {
+	StressResult() : done(0), failed(0), faces(0), queueUs(0), processUs(0) {}
+
+	std::vector<double> latencyMs;
+	int done, failed;
+	uint64_t faces, queueUs, processUs;
+	std::mutex mutex;
+};
+
+/// Runs 'numJobs' jobs over one connection, keeping up to 'inflight' jobs submitted at a time.
+static void stressConnection(const std::string& socketPath, int connection, int numJobs, int inflight, SwapProtocol::Job job,
+	const std::string& output, StressResult& result)
+{
+	int fd = connectDaemon(socketPath);
+	if (fd < 0) {
+		std::lock_guard<std::mutex> lock(result.mutex);
+		result.failed += numJobs;
+		return;
+	}
+
+	std::map<uint32_t, Clock::time_point> pending;
+	uint32_t nextJob = 0;
+	int finished = 0;
+
+	while (finished < numJobs) {
+		while ((int)nextJob < numJobs && (int)pending.size() < inflight) {
+			if (job.source == SwapProtocol::SOURCE_FILE)
+				job.output = stressOutput(output, connection, nextJob);
+			pending[nextJob] = Clock::now();
+			if (!submit(fd, nextJob, job))
+				break;
+			nextJob++;
+		}
+
+		uint32_t jobId;
+		SwapProtocol::Status status;
+		if (!waitFinished(fd, jobId, status) || pending.find(jobId) == pending.end()) {
+			std::cerr << "connection " << connection << " lost" << std::endl;
+			std::lock_guard<std::mutex> lock(result.mutex);
+			result.failed += numJobs - finished;
+			break;
+		}
+
+		double latency = std::chrono::duration<double, std::milli>(Clock::now() - pending[jobId]).count();
+		pending.erase(jobId);
+		finished++;
+
+		std::lock_guard<std::mutex> lock(result.mutex);
+		if (status.state == SwapProtocol::STATE_DONE) {
+			result.done++;
+			result.faces += status.faces;
+			result.queueUs += status.queueUs;
+			result.processUs += status.processUs;
+			result.latencyMs.push_back(latency);
+		}
+		else {
+			result.failed++;
+			if (result.failed == 1)
+				std::cerr << "job failed: " << status.message << std::endl;
+		}
+	}
+
+	close(fd);
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+	if (values.empty())
+		return 0.0;
+	std::sort(values.begin(), values.end());
+	size_t rank = (size_t)(p / 100.0 * values.size() + 0.5);
+	rank = std::min(std::max(rank, (size_t)1), values.size());
+	return values[rank - 1];
+}
+
+int main(int argc, char** argv)
+{
+	std::string socketPath = "/tmp/faceswapper.sock";
+	SwapProtocol::Job job;
+	std::string output;
+	int stressJobs = 0;
+	int connections = 4;
+	int inflight = 2;
+
+	std::vector<std::string> positional;
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+		if (option == "--socket" && i + 1 < argc)
+			socketPath = argv[++i];
+		else if (option == "--shm" && i + 4 < argc) {
+			job.source = SwapProtocol::SOURCE_SHARED_MEMORY;
+			job.input = argv[++i];
+			job.width = atoi(argv[++i]);
+			job.height = atoi(argv[++i]);
+			job.stride = atoi(argv[++i]);
+		}
+		else if (option == "--min-confidence" && i + 1 < argc)
+			job.minConfidence = (float)atof(argv[++i]);
+		else if (option == "--stress" && i + 1 < argc)
+			stressJobs = atoi(argv[++i]);
+		else if (option == "--connections" && i + 1 < argc)
+			connections = std::max(1, atoi(argv[++i]));
+		else if (option == "--inflight" && i + 1 < argc)
+			inflight = std::max(1, atoi(argv[++i]));
+		else if (option.compare(0, 2, "--") != 0)
+			positional.push_back(option);
+		else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	if (job.source == SwapProtocol::SOURCE_FILE && positional.size() == 2) {
+		job.input = positional[0];
+		output = positional[1];
+	}
+	else if (job.source != SwapProtocol::SOURCE_SHARED_MEMORY || !positional.empty()) {
+		std::cerr << "Usage: FaceSwapperClient [options] <inputImage> <outputImage>" << std::endl;
+		std::cerr << "       FaceSwapperClient [options] --shm <name> <width> <height> <stride>" << std::endl;
+		std::cerr << "Options:" << std::endl;
+		std::cerr << "  --socket <path>        Unix domain socket of the daemon (default /tmp/faceswapper.sock)" << std::endl;
+		std::cerr << "  --min-confidence <c>   minimum confidence of faces to replace" << std::endl;
+		std::cerr << "  --stress <jobs>        submit the job <jobs> times and report throughput and latency" << std::endl;
+		std::cerr << "  --connections <n>      concurrent connections in stress mode (default 4)" << std::endl;
+		std::cerr << "  --inflight <n>         jobs in flight per connection in stress mode (default 2)" << std::endl;
+		return 1;
+	}
+
+	if (stressJobs <= 0) {
+		int fd = connectDaemon(socketPath);
+		if (fd < 0)
+			return 1;
+
+		job.output = output;
+		uint32_t jobId;
+		SwapProtocol::Status status;
+		if (!submit(fd, 0, job) || !waitFinished(fd, jobId, status)) {
+			std::cerr << "Error: connection to the daemon lost" << std::endl;
+			close(fd);
+			return 1;
+		}
+		close(fd);
+
+		if (status.state != SwapProtocol::STATE_DONE) {
+			std::cerr << "Error: " << status.message << std::endl;
+			return 1;
+		}
+		printf("replaced %d faces (queue %.1f ms, read %.1f ms, swap %.1f ms, write %.1f ms)\n", status.faces,
+			status.queueUs / 1000.0, status.readUs / 1000.0, status.processUs / 1000.0, status.writeUs / 1000.0);
+		return 0;
+	}
+
+	// in shared memory mode all jobs modify the same frame, which is fine for measuring throughput
+	StressResult result;
+	std::vector<std::thread> threads;
+	Clock::time_point start = Clock::now();
+	for (int c = 0; c < connections; c++) {
+		int numJobs = stressJobs / connections + (c < stressJobs % connections ? 1 : 0);
+		threads.push_back(std::thread(stressConnection, socketPath, c, numJobs, inflight, job, output, std::ref(result)));
+	}
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	int done = std::max(result.done, 1);
+	printf("{\"jobs\":%d,\"failed\":%d,\"seconds\":%.3f,\"jobs_per_sec\":%.2f,\"faces\":%llu,"
+		"\"latency_ms\":{\"p50\":%.2f,\"p95\":%.2f,\"p99\":%.2f},\"mean_queue_ms\":%.2f,\"mean_swap_ms\":%.2f}\n",
+		result.done, result.failed, seconds, result.done / seconds, (unsigned long long)result.faces,
+		percentile(result.latencyMs, 50), percentile(result.latencyMs, 95), percentile(result.latencyMs, 99),
+		result.queueUs / 1000.0 / done, result.processUs / 1000.0 / done);
+
+	return result.failed > 0 ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,389 @@
+// Long-running face swapping service. Keeps the models and the face bank loaded and accepts jobs from local clients
+// over a Unix domain socket (see SwapProtocol.h), which are executed on a pool of worker threads.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include "FaceDetector.h"
+#include "FaceSwapper/AdaptiveSwapPipeline.h"
+#include "FaceSwapper/Instrumentation.h"
+#include "FaceSwapper/SwapPipeline.h"
+#include "FaceSwapper/SwapProtocol.h"
+#include "FaceSwapper/WorkerPool.h"
+
+using namespace Jrs::FaceSwapper;
+
+#ifdef _WINDOWS
+
+int main(int argc, char** argv)
+{
+	std::cerr << "Error: the daemon requires Unix domain sockets and is not available on this platform" << std::endl;
+	return 1;
+}
+
+#else
+
+typedef std::chrono::steady_clock Clock;
+
+static uint32_t elapsedUs(Clock::time_point start, Clock::time_point end)
+{
+	return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+static volatile sig_atomic_t stopRequested = 0;
+static int listenFd = -1;
+
+static void handleSignal(int)
+{
+	stopRequested = 1;
+	// wakes up accept()
+	if (listenFd >= 0)
+		shutdown(listenFd, SHUT_RDWR);
+}
+
+/// A client connection. Status messages of concurrently running jobs are serialized by the write mutex; the socket is
+/// closed when the reader and all jobs of the connection are done.
+struct Connection {
+	Connection(int fd) : fd(fd) {}
+	~Connection() { close(fd); }
+
+	bool send(uint32_t jobId, const SwapProtocol::Status& status)
+	{
+		std::string payload;
+		SwapProtocol::encodeStatus(status, payload);
+		std::lock_guard<std::mutex> lock(writeMutex);
+		return SwapProtocol::writeMessage(fd, SwapProtocol::MSG_STATUS, jobId, payload);
+	}
+
+	int fd;
+	std::mutex writeMutex;
+};
+
+/// Maps a POSIX shared memory frame, returns NULL on error.
+static unsigned char* mapFrame(const SwapProtocol::Job& job, size_t& size, std::string& error)
+{
+	if (job.width == 0 || job.height == 0 || job.stride < job.width * 3) {
+		error = "invalid frame geometry";
+		return NULL;
+	}
+	size = (size_t)job.stride * job.height;
+
+	int fd = shm_open(job.input.c_str(), O_RDWR, 0);
+	if (fd < 0) {
+		error = "cannot open shared memory " + job.input + ": " + strerror(errno);
+		return NULL;
+	}
+
+	struct stat st;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= size)
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		error = "cannot map shared memory " + job.input;
+		return NULL;
+	}
+	return (unsigned char*)data;
+}
+
+static void runJob(AdaptiveSwapPipeline& pipeline, std::shared_ptr<Connection> connection, uint32_t jobId, const SwapProtocol::Job& job, Clock::time_point queued)
+{
+	SwapProtocol::Status status;
+	Clock::time_point start = Clock::now();
+	status.queueUs = elapsedUs(queued, start);
+	status.state = SwapProtocol::STATE_RUNNING;
+	connection->send(jobId, status);
+
+	cv::Mat frame;
+	unsigned char* mapped = NULL;
+	size_t mappedSize = 0;
+
+	if (job.source == SwapProtocol::SOURCE_SHARED_MEMORY) {
+		mapped = mapFrame(job, mappedSize, status.message);
+		if (mapped)
+			frame = cv::Mat((int)job.height, (int)job.width, CV_8UC3, mapped, job.stride);
+	}
+	else {
+		FS_SCOPED_TIMER(STAGE_IMAGE_READ);
+		frame = cv::imread(job.input, cv::IMREAD_COLOR);
+		if (frame.empty())
+			status.message = "cannot read " + job.input;
+	}
+	Clock::time_point read = Clock::now();
+	status.readUs = elapsedUs(start, read);
+
+	if (!frame.empty()) {
+		status.faces = pipeline.process(frame, job.minConfidence);
+		if (status.faces < 0)
+			status.message = "processing failed";
+	}
+	Clock::time_point processed = Clock::now();
+	status.processUs = elapsedUs(read, processed);
+
+	if (status.message.empty() && job.source == SwapProtocol::SOURCE_FILE) {
+		FS_SCOPED_TIMER(STAGE_IMAGE_WRITE);
+		try {
+			if (!cv::imwrite(job.output, frame))
+				status.message = "cannot write " + job.output;
+		}
+		catch (std::exception& e) {
+			status.message = std::string("cannot write ") + job.output + ": " + e.what();
+		}
+	}
+	status.writeUs = elapsedUs(processed, Clock::now());
+
+	if (mapped)
+		munmap(mapped, mappedSize);
+
+	status.state = status.message.empty() ? SwapProtocol::STATE_DONE : SwapProtocol::STATE_FAILED;
+	connection->send(jobId, status);
+}
+
+static std::mutex connectionsMutex;
+static std::condition_variable connectionsCondition;
+static std::set<int> connectionFds;
+
+static void serveConnection(AdaptiveSwapPipeline& pipeline, WorkerPool& pool, std::shared_ptr<Connection> connection)
+{
+	SwapProtocol::Header header;
+	std::string payload;
+
+	while (SwapProtocol::readMessage(connection->fd, header, payload)) {
+		SwapProtocol::Job job;
+		SwapProtocol::Status status;
+
+		if (header.type != SwapProtocol::MSG_JOB || !SwapProtocol::decodeJob(payload, job)) {
+			status.state = SwapProtocol::STATE_FAILED;
+			status.message = "invalid message";
+			connection->send(header.jobId, status);
+			continue;
+		}
+
+		if (job.source != SwapProtocol::SOURCE_FILE && job.source != SwapProtocol::SOURCE_SHARED_MEMORY) {
+			status.state = SwapProtocol::STATE_FAILED;
+			status.message = "unknown frame source " + std::to_string(job.source);
+			connection->send(header.jobId, status);
+			continue;
+		}
+
+		status.state = SwapProtocol::STATE_QUEUED;
+		connection->send(header.jobId, status);
+
+		uint32_t jobId = header.jobId;
+		Clock::time_point queued = Clock::now();
+		if (!pool.post([&pipeline, connection, jobId, job, queued]() { runJob(pipeline, connection, jobId, job, queued); })) {
+			status.state = SwapProtocol::STATE_FAILED;
+			status.message = "daemon is shutting down";
+			connection->send(jobId, status);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(connectionsMutex);
+	connectionFds.erase(connection->fd);
+	connectionsCondition.notify_all();
+}
+
+int main(int argc, char** argv)
+{
+	std::string socketPath = "/tmp/faceswapper.sock";
+	int numWorkers = 0;
+	std::vector<std::string> faceBank;
+	std::vector<std::string> faceSheets;
+	SwapPipelineConfig config;
+	std::string profile;
+	double latencyBudget = 0.0;
+	std::string metricsJsonLines;
+	std::string metricsPrometheus;
+	double metricsInterval = 10.0;
+
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+		if (option == "--socket" && i + 1 < argc)
+			socketPath = argv[++i];
+		else if (option == "--workers" && i + 1 < argc)
+			numWorkers = atoi(argv[++i]);
+		else if (option == "--face-bank" && i + 1 < argc)
+			faceBank.push_back(argv[++i]);
+		else if (option == "--face-sheet" && i + 1 < argc)
+			faceSheets.push_back(argv[++i]);
+		else if (option == "--profile" && i + 1 < argc) {
+			profile = argv[++i];
+			SwapProfile swapProfile;
+			if (!SwapProfile::find(profile, swapProfile)) {
+				std::cerr << "Error: unknown profile " << profile << std::endl;
+				return 1;
+			}
+			swapProfile.apply(config);
+		}
+		else if (option == "--latency-budget" && i + 1 < argc)
+			latencyBudget = atof(argv[++i]);
+		else if (option == "--detector" && i + 1 < argc)
+			config.detectorBackend = argv[++i];
+		else if (option == "--detector-model" && i + 1 < argc)
+			config.detectorModel = argv[++i];
+		else if (option == "--landmarks-model" && i + 1 < argc)
+			config.landmarksModel = argv[++i];
+		else if (option == "--landmark-template" && i + 1 < argc)
+			config.landmarkTemplate = argv[++i];
+		else if (option == "--triangulation")
+			config.triangulation = true;
+		else if (option == "--min-confidence" && i + 1 < argc)
+			config.minConfidence = atof(argv[++i]);
+		else if (option == "--metrics-jsonl" && i + 1 < argc)
+			metricsJsonLines = argv[++i];
+		else if (option == "--metrics-prom" && i + 1 < argc)
+			metricsPrometheus = argv[++i];
+		else if (option == "--metrics-interval" && i + 1 < argc)
+			metricsInterval = atof(argv[++i]);
+		else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			std::cerr << "Usage: FaceSwapperDaemon --face-bank <image> [options]" << std::endl;
+			std::cerr << "Options:" << std::endl;
+			std::cerr << "  --socket <path>           Unix domain socket (default /tmp/faceswapper.sock)" << std::endl;
+			std::cerr << "  --workers <n>             number of worker threads (default: number of cores)" << std::endl;
+			std::cerr << "  --face-bank <image>       image with replacement faces (may be repeated)" << std::endl;
+			std::cerr << "  --face-sheet <image>      grid of generated faces with a <image>.grid sidecar, sliced without detection" << std::endl;
+			std::cerr << "                            (may be repeated)" << std::endl;
+			std::cerr << "  --profile <name>          " << SwapProfile::getNames() << ": settings of all stages, options after it" << std::endl;
+			std::cerr << "                            override single settings" << std::endl;
+			std::cerr << "  --latency-budget <ms>     with --profile, fall back to faster profiles while frames take longer" << std::endl;
+			std::cerr << "  --detector <backend>      face detector: " << FaceDetector::getBackendNames() << " (default dlib)" << std::endl;
+			std::cerr << "  --detector-model <file>   model of the detector (default: the model of the backend)" << std::endl;
+			std::cerr << "  --landmarks-model <file>  landmark model (68 points, or 5 points completed by the landmark template)" << std::endl;
+			std::cerr << "  --landmark-template <f>   template completing 5 point landmarks (default: built-in mean shape)" << std::endl;
+			std::cerr << "  --triangulation           use triangulation based warping" << std::endl;
+			std::cerr << "  --min-confidence <c>      default minimum confidence of faces to replace" << std::endl;
+			std::cerr << "  --metrics-jsonl <file>    append stage timings and counters as JSON lines" << std::endl;
+			std::cerr << "  --metrics-prom <file>     write stage timings and counters in Prometheus text format" << std::endl;
+			std::cerr << "  --metrics-interval <s>    export interval for the metrics (default 10)" << std::endl;
+			return 1;
+		}
+	}
+
+	if (faceBank.empty() && faceSheets.empty()) {
+		std::cerr << "Error: no face bank image given" << std::endl;
+		return 1;
+	}
+
+	if (latencyBudget > 0 && profile.empty()) {
+		std::cerr << "Error: --latency-budget requires --profile" << std::endl;
+		return 1;
+	}
+
+	if (!(metricsInterval > 0)) {
+		std::cerr << "Error: --metrics-interval must be positive" << std::endl;
+		return 1;
+	}
+
+	if ((!metricsJsonLines.empty() || !metricsPrometheus.empty()) && !Instrumentation::isCompiledIn()) {
+		std::cerr << "Error: --metrics-jsonl and --metrics-prom require a build with FACESWAPPER_INSTRUMENTATION" << std::endl;
+		return 1;
+	}
+
+	AdaptiveSwapPipeline pipeline;
+	if (!pipeline.init(config, SwapProfile::getFallbacks(profile), latencyBudget))
+		return 1;
+	for (size_t i = 0; i < faceBank.size(); i++)
+		pipeline.loadFaceBank(faceBank[i]);
+	for (size_t i = 0; i < faceSheets.size(); i++)
+		pipeline.loadFaceSheet(faceSheets[i]);
+	if (pipeline.getNumBankFaces() == 0) {
+		std::cerr << "Error: no faces found in the face bank" << std::endl;
+		return 1;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Error: socket path too long" << std::endl;
+		return 1;
+	}
+	strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socketPath.c_str());
+	if (listenFd < 0 || bind(listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+		std::cerr << "Error: cannot listen on " << socketPath << ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	signal(SIGINT, handleSignal);
+	signal(SIGTERM, handleSignal);
+	// a client closing its connection early must not terminate the daemon
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((!metricsJsonLines.empty() || !metricsPrometheus.empty()) &&
+		!Instrumentation::startExporter(metricsJsonLines, metricsPrometheus, metricsInterval)) {
+		close(listenFd);
+		unlink(socketPath.c_str());
+		return 1;
+	}
+
+	{
+		WorkerPool pool(numWorkers);
+
+		std::cout << "listening on " << socketPath << " with " << pool.getNumThreads() << " workers and "
+			<< pipeline.getNumBankFaces() << " bank faces" << std::endl;
+		if (pipeline.getNumLevels() > 1)
+			std::cout << "latency budget " << latencyBudget << " ms over " << pipeline.getNumLevels() << " profiles" << std::endl;
+
+		while (!stopRequested) {
+			int fd = accept(listenFd, NULL, NULL);
+			if (fd < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+
+			std::lock_guard<std::mutex> lock(connectionsMutex);
+			connectionFds.insert(fd);
+			std::shared_ptr<Connection> connection(new Connection(fd));
+			std::thread(serveConnection, std::ref(pipeline), std::ref(pool), connection).detach();
+		}
+
+		std::cout << "shutting down" << std::endl;
+
+		// stop reading new jobs, the jobs already queued are completed before the pool is destroyed
+		std::unique_lock<std::mutex> lock(connectionsMutex);
+		for (std::set<int>::iterator it = connectionFds.begin(); it != connectionFds.end(); ++it)
+			shutdown(*it, SHUT_RD);
+		connectionsCondition.wait(lock, []() { return connectionFds.empty(); });
+	}
+
+	close(listenFd);
+	unlink(socketPath.c_str());
+
+	Instrumentation::stopExporter();
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,116 @@
+// Lists the frames of a patch archive and applies their patches to the original images, which gives the swapped
+// images without running the swap again.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include "FaceSwapper/BatchManifest.h"
+#include "FaceSwapper/PatchArchive.h"
+
+using namespace Jrs::FaceSwapper;
+
+/// Applies the patches of a frame to an original image and writes the result.
+static bool applyFrame(PatchReader& archive, const std::string& key, const std::string& input, const std::string& output)
+{
+	cv::Size frameSize;
+	std::vector<SwapPatch> patches;
+	if (!archive.read(key, frameSize, patches)) {
+		std::cerr << key << ": no valid frame in the archive" << std::endl;
+		return false;
+	}
+
+	cv::Mat frame = cv::imread(input, cv::IMREAD_COLOR);
+	if (frame.empty()) {
+		std::cerr << input << ": cannot read image" << std::endl;
+		return false;
+	}
+	if (frame.size() != frameSize) {
+		std::cerr << input << ": image size " << frame.cols << "x" << frame.rows << " does not match the frame size "
+			<< frameSize.width << "x" << frameSize.height << " of the patches" << std::endl;
+		return false;
+	}
+
+	if (!PatchArchive::apply(frame, patches)) {
+		std::cerr << key << ": invalid patches" << std::endl;
+		return false;
+	}
+
+	if (!BatchManifest::makeParentDirectories(output)) {
+		std::cerr << output << ": cannot create the directory" << std::endl;
+		return false;
+	}
+
+	try {
+		if (!cv::imwrite(output, frame)) {
+			std::cerr << output << ": cannot write image" << std::endl;
+			return false;
+		}
+	}
+	catch (std::exception& e) {
+		std::cerr << output << ": cannot write image: " << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::cerr << "Error: insufficient number of parameters" << std::endl;
+		std::cerr << "Usage: FaceSwapperPatch <archive>                              list the frames of the archive" << std::endl;
+		std::cerr << "       FaceSwapperPatch <archive> --apply <input> <output> [<key>]" << std::endl;
+		std::cerr << "                        apply the patches of frame <key> (default <input>) to <input>" << std::endl;
+		std::cerr << "       FaceSwapperPatch <archive> --apply-all <outputDir>" << std::endl;
+		std::cerr << "                        apply the patches of all frames to the images named by their keys and write" << std::endl;
+		std::cerr << "                        them below <outputDir> (as FaceSwapperBatch --output-dir)" << std::endl;
+		return 1;
+	}
+
+	PatchReader archive;
+	if (!archive.open(argv[1]))
+		return 1;
+	const std::vector<std::string>& keys = archive.getKeys();
+
+	std::string mode = argc > 2 ? argv[2] : std::string();
+	if (mode.empty()) {
+		for (size_t i = 0; i < keys.size(); i++) {
+			cv::Size frameSize;
+			std::vector<SwapPatch> patches;
+			if (!archive.read(keys[i], frameSize, patches)) {
+				std::cout << keys[i] << "\tinvalid" << std::endl;
+				continue;
+			}
+
+			double area = 0;
+			for (size_t j = 0; j < patches.size(); j++)
+				area += patches[j].roi.area();
+			std::cout << keys[i] << "\t" << frameSize.width << "x" << frameSize.height << "\t" << patches.size() << " patches\t"
+				<< 100.0 * area / std::max(1, frameSize.area()) << "% of the frame" << std::endl;
+		}
+		std::cout << keys.size() << " frames" << std::endl;
+		return 0;
+	}
+
+	if (mode == "--apply" && (argc == 5 || argc == 6))
+		return applyFrame(archive, argc == 6 ? argv[5] : argv[3], argv[3], argv[4]) ? 0 : 1;
+
+	if (mode == "--apply-all" && argc == 4) {
+		int failed = 0;
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (!applyFrame(archive, keys[i], keys[i], BatchManifest::getOutputPath(keys[i], argv[3])))
+				failed++;
+		}
+		std::cout << keys.size() - failed << " images written, " << failed << " failed" << std::endl;
+		return failed > 0 ? 2 : 0;
+	}
+
+	std::cerr << "Error: invalid parameters" << std::endl;
+	return 1;
+}
@@ -1,4 +1,5 @@
 #include "FaceSwapper/FaceSwapping.h"
+#include "FaceSwapper/Instrumentation.h"
 
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/objdetect/objdetect.hpp>
@@ -10,6 +11,11 @@
 #include "opencv2/objdetect.hpp"
 #include "opencv2/photo.hpp"
 
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 
 
@@ -24,10 +30,17 @@ namespace Jrs {
 FaceSwapping::FaceSwapping(std::string landmarksFile, bool triangulation) {
 	this->landmarksFile = landmarksFile;
 	this->triangulation = triangulation;
+	this->featherMode = FEATHER_DISTANCE;
+	this->fusedBlend = true;
+	this->maxPatchSize = 0;
+	this->rowThreads = 0;
+	this->parallelMinPixels = DEFAULT_PARALLEL_MIN_PIXELS;
 	if (!triangulation) {
 		try
 		{
 			dlib::deserialize(landmarksFile) >> shapepred;
+			if (shapepred.num_parts() != NUM_LANDMARKS && shapepred.num_parts() != LandmarkTemplate::NUM_FIT_POINTS)
+				std::cerr << "Unsupported landmark model " << landmarksFile << " with " << shapepred.num_parts() << " points" << std::endl;
 		}
 		catch (std::exception& e)
 		{
@@ -35,6 +48,11 @@ FaceSwapping::FaceSwapping(std::string landmarksFile, bool triangulation) {
 				<< "You can download the file from http://sourceforge.net/projects/dclib/files/dlib/v18.10/shape_predictor_68_face_landmarks.dat.bz2" << std::endl;
 		}
 	}
+	else {
+		face::FacemarkKazemi::Params params;
+		facemark = face::FacemarkKazemi::create(params);
+		facemark->loadModel(landmarksFile);
+	}
 
 }
 
@@ -42,333 +60,953 @@ FaceSwapping::~FaceSwapping() {
 
 }
 
-void FaceSwapping::swapFaces(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion)
+bool FaceSwapping::swapFaces(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion)
+{
+	BankFace face;
+	prepareBankFace(faceSet, fsRegion, face);
+	return swapFaces(src, dst, face, srcRegion);
+}
+
+bool FaceSwapping::swapFaces(cv::Mat src, cv::Mat dst, const BankFace& face, DetectionRegion* srcRegion)
 {
+	FS_SCOPED_TIMER(STAGE_SWAP);
+
+	if (!face.isValid()) {
+		std::cerr << "failed to fit landmarks of the replacement face, face not replaced" << std::endl;
+		FS_COUNTER_ADD(FACES_SKIPPED, 1);
+		return false;
+	}
+
 	if (triangulation) {
-		swapFacesTriangulated(src, dst, faceSet, srcRegion, fsRegion);
+		// the region of a bank face already carries its landmarks, so it is only read
+		return swapFacesTriangulated(src, dst, face.image, srcRegion, const_cast<DetectionRegion*>(&face.region));
 	}
-	else {
-		swapFacesAffine(src, dst, faceSet, srcRegion, fsRegion);
+	return swapFacesAffine(src, dst, face, srcRegion);
+}
+
+
+bool FaceSwapping::swapFaces(cv::Mat src, cv::Mat dst, const std::vector<cv::Mat>& faceSets, const std::vector<DetectionRegion*>& srcRegions,
+	const std::vector<DetectionRegion*>& fsRegions, const std::function<bool()>& stop, int* numSwapped)
+{
+	size_t n = srcRegions.size();
+
+	// a face set region may be used for several faces, so it is prepared only once
+	std::vector<BankFace> prepared(n);
+	std::vector<const BankFace*> faces(n);
+	for (size_t i = 0; i < n; i++) {
+		faces[i] = &prepared[i];
+		for (size_t j = 0; j < i; j++) {
+			if (fsRegions[j] == fsRegions[i] && faceSets[j].data == faceSets[i].data) {
+				faces[i] = faces[j];
+				break;
+			}
+		}
+		if (faces[i] == &prepared[i])
+			prepareBankFace(faceSets[i], fsRegions[i], prepared[i]);
 	}
+
+	return swapFaces(src, dst, faces, srcRegions, stop, numSwapped);
 }
 
+bool FaceSwapping::swapFaces(cv::Mat src, cv::Mat dst, const std::vector<const BankFace*>& faces, const std::vector<DetectionRegion*>& srcRegions,
+	const std::function<bool()>& stop, int* numSwapped)
+{
+	size_t n = srcRegions.size();
+	std::atomic<int> swapped(0);
+	if (numSwapped)
+		*numSwapped = 0;
+
+	computeLandmarks(src, srcRegions);
+
+	// each face goes into the first wave after all earlier faces it overlaps with, so the faces of a wave are disjoint
+	// and overlapping faces keep their order
+	std::vector<cv::Rect> rois(n);
+	std::vector<int> wave(n, 0);
+	int numWaves = 0;
+	for (size_t i = 0; i < n; i++) {
+		rois[i] = getSwapRoi(src, srcRegions[i], *faces[i]);
+		for (size_t j = 0; j < i; j++) {
+			if ((rois[i] & rois[j]).area() > 0)
+				wave[i] = std::max(wave[i], wave[j] + 1);
+		}
+		numWaves = std::max(numWaves, wave[i] + 1);
+	}
+
+	std::vector<int> waveFaces;
+	for (int w = 0; w < numWaves; w++) {
+		if (stop && stop())
+			return false;
+
+		waveFaces.clear();
+		for (size_t i = 0; i < n; i++) {
+			if (wave[i] == w)
+				waveFaces.push_back((int)i);
+		}
+
+		// a single face is swapped on this thread, so that its pixel loops can use the row bands (OpenCV runs
+		// nested parallel loops sequentially)
+		if (waveFaces.size() == 1) {
+			if (swapFaces(src, dst, *faces[waveFaces[0]], srcRegions[waveFaces[0]]))
+				swapped++;
+		}
+		else {
+			cv::parallel_for_(cv::Range(0, (int)waveFaces.size()), [&](const cv::Range& range) {
+				for (int k = range.start; k < range.end; k++) {
+					int i = waveFaces[k];
+					if (swapFaces(src, dst, *faces[i], srcRegions[i]))
+						swapped++;
+				}
+			});
+		}
 
-void FaceSwapping::swapFacesAffine(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion)
+		if (numSwapped)
+			*numSwapped = swapped;
+	}
+
+	return true;
+}
+
+/// Fades an alpha image out towards its border over 'width' pixels.
+static void fadeBorder(cv::Mat alpha, int width)
 {
-	
-	cv::Point2i* srcPoints = new cv::Point2i[9];
-	cv::Point2f* srcTransformPoints = new cv::Point2f[3];
+	if (width < 1)
+		return;
+
+	for (int i = 0; i < alpha.rows; i++)
+	{
+		uint8_t* current_alpha = alpha.ptr<uint8_t>(i);
+		int dy = std::min(i + 1, alpha.rows - i);
+
+		for (int j = 0; j < alpha.cols; j++)
+		{
+			int d = std::min(dy, std::min(j + 1, alpha.cols - j));
+			if (d >= width)
+				continue;
+
+			float t = (float)d / width;
+			current_alpha[j] = (uint8_t)(current_alpha[j] * t * t * (3.0f - 2.0f * t) + 0.5f);
+		}
+	}
+}
+
+bool FaceSwapping::prepareBankFace(cv::Mat faceSet, DetectionRegion* fsRegion, BankFace& face, cv::Mat segmentation)
+{
+	face.valid = false;
+
+	cv::Point2i points[9];
+	cv::Point2f transformPoints[3];
+	cv::Size feather;
+	if (!getLandmarks(faceSet, fsRegion, points, transformPoints, feather))
+		return false;
+
+	// the crop covers all landmarks (which the triangulated swap uses) and the outline of the affine swap
+	cv::Point2f corners[NUM_LANDMARKS + 9];
+	for (int i = 0; i < NUM_LANDMARKS; i++)
+		corners[i] = cv::Point2f((*fsRegion->getPoints())[i].x, (*fsRegion->getPoints())[i].y);
+	for (int i = 0; i < 9; i++)
+		corners[NUM_LANDMARKS + i] = points[i];
+	cv::Rect crop = cv::boundingRect(cv::Mat(NUM_LANDMARKS + 9, 1, CV_32FC2, corners)) & cv::Rect(0, 0, faceSet.cols, faceSet.rows);
+	if (crop.area() == 0)
+		return false;
+
+	bool segmented = !triangulation && !segmentation.empty();
+	if (segmented && (segmentation.size() != faceSet.size() || segmentation.type() != CV_8UC1)) {
+		std::cerr << "segmentation does not match the face set image, using the outline of the face" << std::endl;
+		segmented = false;
+	}
+	if (segmented) {
+		// the segmentation covers the hair and jaw line beyond the outline, it fades out at the border of the crop
+		crop.x -= feather.width;
+		crop.y -= feather.height;
+		crop.width += 2 * feather.width;
+		crop.height += 2 * feather.height;
+		crop &= cv::Rect(0, 0, faceSet.cols, faceSet.rows);
+	}
+
+	face.crop = crop;
+	face.image = faceSet(crop).clone();
+
+	float x, y, w, h, cx, cy;
+	face.region.copyFromRegion(fsRegion, true);
+	face.region.getBoundingBox(x, y, w, h);
+	face.region.setBoundingBox(x - crop.x, y - crop.y, w, h);
+	face.region.getCenter(cx, cy);
+	face.region.setCenter(cx - crop.x, cy - crop.y);
+	std::vector<DetectionRegion::Point>& landmarks = *face.region.getPoints();
+	for (size_t i = 0; i < landmarks.size(); i++) {
+		landmarks[i].x -= crop.x;
+		landmarks[i].y -= crop.y;
+	}
+
+	for (int i = 0; i < 9; i++)
+		face.points[i] = points[i] - crop.tl();
+	for (int i = 0; i < 3; i++)
+		face.transformPoints[i] = transformPoints[i] - cv::Point2f((float)crop.x, (float)crop.y);
+	face.feather = feather;
+
+	face.segmented = segmented;
+	if (segmented) {
+		face.alpha = segmentation(crop).clone();
+		fadeBorder(face.alpha, face.feather.width);
+		cv::threshold(face.alpha, face.mask, 127, 255, cv::THRESH_BINARY);
+	}
+	else if (!triangulation) {
+		face.mask = cv::Mat::zeros(crop.size(), CV_8UC1);
+		cv::fillConvexPoly(face.mask, face.points, 9, cv::Scalar(255));
+
+		computeAlpha(face.mask, face.feather, face.alpha, getRowBands(crop.size()));
+	}
+
+	if (!triangulation) {
+		// the colours are matched inside the detected face box only
+		cv::Rect box = cv::Rect((int)x, (int)y, (int)w, (int)h) & crop;
+		box -= crop.tl();
+		if (box.area() > 0)
+			computeCdf(face.image(box), face.mask(box), face.cdf, getRowBands(box.size()));
+		if (box.area() == 0 || face.cdf[0][255] == 0) {
+			// the colour correction would have nothing to map the frame colours to
+			std::cerr << "face box of the bank face does not overlap its mask, face not used" << std::endl;
+			return false;
+		}
+	}
+
+	face.valid = true;
+	return true;
+}
+
+cv::Rect FaceSwapping::getSwapRoi(cv::Mat src, DetectionRegion* srcRegion, const BankFace& face)
+{
+	if (triangulation) {
+		computeLandmarks(src, srcRegion);
+		return hasLandmarks(srcRegion) && face.isValid() ? getTriangulatedRoi(srcRegion, src.size()) : cv::Rect();
+	}
+
+	cv::Point2i srcPoints[9];
+	cv::Point2f srcTransformPoints[3];
 	cv::Size srcFeather;
+	cv::Matx23d trafo;
+
+	if (!face.isValid() || !getLandmarks(src, srcRegion, srcPoints, srcTransformPoints, srcFeather) ||
+		!solveAffine(face.transformPoints, srcTransformPoints, trafo))
+		return cv::Rect();
+
+	return getAffineRoi(face, trafo, src.size());
+}
+
+cv::Rect FaceSwapping::getSwapRoi(cv::Mat src, DetectionRegion* srcRegion, cv::Mat faceSet, DetectionRegion* fsRegion)
+{
+	if (triangulation) {
+		computeLandmarks(src, srcRegion);
+		return hasLandmarks(srcRegion) ? getTriangulatedRoi(srcRegion, src.size()) : cv::Rect();
+	}
+
+	cv::Point2i srcPoints[9], fsPoints[9];
+	cv::Point2f srcTransformPoints[3], fsTransformPoints[3];
+	cv::Size srcFeather, fsFeather;
+
+	if (!getLandmarks(src, srcRegion, srcPoints, srcTransformPoints, srcFeather) ||
+		!getLandmarks(faceSet, fsRegion, fsPoints, fsTransformPoints, fsFeather))
+		return cv::Rect();
+
+	cv::Matx23d trafo;
+	if (!solveAffine(fsTransformPoints, srcTransformPoints, trafo))
+		return cv::Rect();
+	return getAffineRoi(fsPoints, 9, trafo, src.size());
+}
+
+bool FaceSwapping::solveAffine(const cv::Point2f* src, const cv::Point2f* dst, cv::Matx23d& trafo)
+{
+	// Cramer's rule on the differences to the third point, unlike cv::getAffineTransform this does not allocate
+	double x0 = src[0].x - src[2].x, y0 = src[0].y - src[2].y;
+	double x1 = src[1].x - src[2].x, y1 = src[1].y - src[2].y;
+	double det = x0 * y1 - x1 * y0;
+	if (fabs(det) < 1e-9)
+		return false;
+
+	for (int r = 0; r < 2; r++) {
+		double u0 = (r == 0 ? dst[0].x - dst[2].x : dst[0].y - dst[2].y);
+		double u1 = (r == 0 ? dst[1].x - dst[2].x : dst[1].y - dst[2].y);
+		double a = (u0 * y1 - u1 * y0) / det;
+		double b = (x0 * u1 - x1 * u0) / det;
+		trafo(r, 0) = a;
+		trafo(r, 1) = b;
+		trafo(r, 2) = (r == 0 ? dst[2].x : dst[2].y) - a * src[2].x - b * src[2].y;
+	}
+	return true;
+}
+
+cv::Rect FaceSwapping::getAffineRoi(const cv::Point2i* fsPoints, int numPoints, const cv::Matx23d& trafo, cv::Size frameSize)
+{
+	cv::Point2f warped[9];
+	numPoints = std::min(numPoints, 9);
+	for (int i = 0; i < numPoints; i++) {
+		warped[i].x = (float)(trafo(0, 0) * fsPoints[i].x + trafo(0, 1) * fsPoints[i].y + trafo(0, 2));
+		warped[i].y = (float)(trafo(1, 0) * fsPoints[i].x + trafo(1, 1) * fsPoints[i].y + trafo(1, 2));
+	}
+
+	// the soft edge lies inside the outline, 2 pixels cover the interpolation and rounding of the warp
+	cv::Rect roi = cv::boundingRect(cv::Mat(numPoints, 1, CV_32FC2, warped));
+	roi.x -= 2;
+	roi.y -= 2;
+	roi.width += 4;
+	roi.height += 4;
+
+	return roi & cv::Rect(0, 0, frameSize.width, frameSize.height);
+}
+
+cv::Rect FaceSwapping::getAffineRoi(const BankFace& face, const cv::Matx23d& trafo, cv::Size frameSize)
+{
+	if (!face.segmented)
+		return getAffineRoi(face.points, 9, trafo, frameSize);
+
+	cv::Point2i corners[4] = { cv::Point2i(0, 0), cv::Point2i(face.crop.width, 0), cv::Point2i(0, face.crop.height),
+		cv::Point2i(face.crop.width, face.crop.height) };
+	return getAffineRoi(corners, 4, trafo, frameSize);
+}
+
+cv::Rect FaceSwapping::getTriangulatedRoi(DetectionRegion* srcRegion, cv::Size frameSize)
+{
+	cv::Point2f points[NUM_LANDMARKS];
+	for (int i = 0; i < NUM_LANDMARKS; i++)
+		points[i] = cv::Point2f((*srcRegion->getPoints())[i].x, (*srcRegion->getPoints())[i].y);
+
+	// the hull of the landmarks is blended, 2 pixels cover the rounding of the clone position
+	cv::Rect roi = cv::boundingRect(cv::Mat(NUM_LANDMARKS, 1, CV_32FC2, points));
+	roi.x -= 2;
+	roi.y -= 2;
+	roi.width += 4;
+	roi.height += 4;
+
+	return roi & cv::Rect(0, 0, frameSize.width, frameSize.height);
+}
+
+bool FaceSwapping::swapFacesAffine(cv::Mat src, cv::Mat dst, const BankFace& face, DetectionRegion* srcRegion)
+{
 	
-	cv::Point2i* fsPoints = new cv::Point2i[9];
-	cv::Point2f* fsTransformPoints = new cv::Point2f[3];
-	cv::Size fsFeather;
+	cv::Point2i srcPoints[9];
+	cv::Point2f srcTransformPoints[3];
+	cv::Size srcFeather;
 
-	getLandmarks(src, srcRegion, srcPoints, srcTransformPoints, srcFeather);
-	getLandmarks(faceSet, fsRegion, fsPoints, fsTransformPoints, fsFeather);
+	if (!getLandmarks(src, srcRegion, srcPoints, srcTransformPoints, srcFeather)) {
+		std::cerr << "failed to fit landmarks, face not replaced" << std::endl;
+		FS_COUNTER_ADD(FACES_SKIPPED, 1);
+		return false;
+	}
 
 	//drawPoints(src, srcPoints, "d:\\temp\\srcpoints.png",srcRegion);
-	//drawPoints(faceSet, fsPoints, "d:\\temp\\fspoints.png",fsRegion);
 
-	cv::Mat trafoMatrix = cv::getAffineTransform(fsTransformPoints, srcTransformPoints);
+	cv::Matx23d trafo;
+	if (!solveAffine(face.transformPoints, srcTransformPoints, trafo)) {
+		std::cerr << "degenerate landmarks, face not replaced" << std::endl;
+		FS_COUNTER_ADD(FACES_SKIPPED, 1);
+		return false;
+	}
 
-	cv::Mat mask =  cv::Mat(src.rows, src.cols, CV_8UC1);
-	mask = Scalar(0);
+	// all further steps only work on the area around the face
+	cv::Rect roi = getAffineRoi(face, trafo, src.size());
+	if (roi.area() == 0) {
+		FS_COUNTER_ADD(FACES_SKIPPED, 1);
+		return false;
+	}
+	trafo(0, 2) -= roi.x;
+	trafo(1, 2) -= roi.y;
 
-	cv::Mat warpedFaceImage = src.clone();
+	float x, y, w, h;
+	srcRegion->getBoundingBox(x, y, w, h);
+	cv::Rect faceRect = cv::Rect((int)x, (int)y, (int)w, (int)h) & roi;
+	faceRect -= roi.tl();
 
-	getWarpedMaskandFace(srcPoints, fsPoints, trafoMatrix, faceSet, mask, warpedFaceImage);
-	
-	colorCorrect(src, warpedFaceImage, mask, srcRegion);
+	SwapWorkspace& ws = SwapWorkspace::local();
+
+	if (maxPatchSize > 0 && std::max(roi.width, roi.height) > maxPatchSize) {
+		swapFacesAffineProxy(ws, src(roi), dst(roi), face, trafo, srcFeather, faceRect);
+		FS_COUNTER_ADD(FACES_SWAPPED, 1);
+		return true;
+	}
+
+	cv::Mat mask = ws.getBuffer(ws.mask, roi.size(), CV_8UC1);
+	cv::Mat alpha = ws.getBuffer(ws.alpha, roi.size(), CV_8UC1);
+	// the fused blend samples the face while blending, so it is not warped into an image of its own
+	cv::Mat warpedFaceImage = fusedBlend ? cv::Mat() : ws.getBuffer(ws.warpedFace, roi.size(), src.type());
+
+	warpBankFace(ws, face, trafo, srcFeather, mask, alpha, warpedFaceImage);
+
+	if (fusedBlend) {
+		uint8_t lut[3][256];
+		{
+			FS_SCOPED_TIMER(STAGE_COLOR_CORRECT);
+			computeColorLut(src(roi)(faceRect), mask(faceRect), face.cdf, lut, getRowBands(faceRect.size()));
+		}
+		blendBankFace(face, trafo, mask, alpha, faceRect, lut, dst(roi));
+	}
+	else {
+		colorCorrect(src(roi), warpedFaceImage, mask, faceRect, face.cdf);
+
+		insertFaces(dst(roi), warpedFaceImage, alpha);
+	}
+
+	FS_COUNTER_ADD(FACES_SWAPPED, 1);
+	return true;
+}
+
+void FaceSwapping::swapFacesAffineProxy(SwapWorkspace& ws, cv::Mat src, cv::Mat dst, const BankFace& face, const cv::Matx23d& trafo,
+	cv::Size feather, cv::Rect faceRect)
+{
+	// working resolution of the patch, the longer side is capped to maxPatchSize
+	double scale = (double)maxPatchSize / std::max(src.cols, src.rows);
+	cv::Size size(std::max(1, cvRound(src.cols * scale)), std::max(1, cvRound(src.rows * scale)));
+	double sx = (double)size.width / src.cols;
+	double sy = (double)size.height / src.rows;
+
+	cv::Matx23d proxyTrafo = trafo;
+	for (int c = 0; c < 3; c++) {
+		proxyTrafo(0, c) *= sx;
+		proxyTrafo(1, c) *= sy;
+	}
+	cv::Size proxyFeather(std::max(1, cvRound(feather.width * sx)), std::max(1, cvRound(feather.height * sy)));
+	cv::Rect proxyFaceRect(cvFloor(faceRect.x * sx), cvFloor(faceRect.y * sy), cvCeil(faceRect.width * sx), cvCeil(faceRect.height * sy));
+	proxyFaceRect &= cv::Rect(0, 0, size.width, size.height);
+
+	cv::Mat proxyFrame = ws.getBuffer(ws.proxyFrame, size, src.type());
+	cv::Mat mask = ws.getBuffer(ws.mask, size, CV_8UC1);
+	cv::Mat alpha = ws.getBuffer(ws.alpha, size, CV_8UC1);
+	cv::Mat warpedFaceImage = ws.getBuffer(ws.warpedFace, size, src.type());
 
-	insertFaces(dst, warpedFaceImage, mask, srcFeather);
+	{
+		FS_SCOPED_TIMER(STAGE_WARP);
+		cv::resize(src, proxyFrame, size, 0, 0, cv::INTER_AREA);
+	}
+
+	// warp and colour correction at the working resolution
+	warpBankFace(ws, face, proxyTrafo, proxyFeather, mask, alpha, warpedFaceImage);
+	colorCorrect(proxyFrame, warpedFaceImage, mask, proxyFaceRect, face.cdf);
+
+	// only the corrected face and its alpha are upsampled, the frame around and behind the face keeps its resolution
+	cv::Mat patch = ws.getBuffer(ws.patch, src.size(), src.type());
+	cv::Mat patchAlpha = ws.getBuffer(ws.patchAlpha, src.size(), CV_8UC1);
+	{
+		FS_SCOPED_TIMER(STAGE_WARP);
+		cv::resize(warpedFaceImage, patch, src.size(), 0, 0, cv::INTER_LINEAR);
+		cv::resize(alpha, patchAlpha, src.size(), 0, 0, cv::INTER_LINEAR);
+	}
+
+	insertFaces(dst, patch, patchAlpha);
 }
 
-const cv::Point2i FaceSwapping::getPoint(dlib::full_object_detection& shape, int part_index)
+cv::Point2i FaceSwapping::getPoint(DetectionRegion* dr, int part_index)
 {
-	const auto &p = shape.part(part_index);
-	return cv::Point2i(p.x(), p.y());
+	const DetectionRegion::Point &p = (*dr->getPoints())[part_index];
+	return cv::Point2i((int)p.x, (int)p.y);
 };
 
-void FaceSwapping::getLandmarks(cv::Mat img, DetectionRegion* dr, cv::Point2i* points, cv::Point2f* affine_transform_keypoints, cv::Size& feather_amount) {
+void FaceSwapping::computeLandmarks(cv::Mat img, DetectionRegion* dr)
+{
+	if (hasLandmarks(dr))
+		return;
+
+	FS_SCOPED_TIMER(STAGE_LANDMARKS);
+
 	float x, y, w, h;
 	dr->getBoundingBox(x, y, w, h);
-	dlib::rectangle rect = dlib::rectangle(x,y,x+w,y+h);
 
-	IplImage iplImg = img;
+	dr->clearPoints();
+
+	if (triangulation) {
+		std::vector<Rect> faces;
+		faces.push_back(Rect((int)x, (int)y, (int)w, (int)h));
+		std::vector< std::vector<Point2f> > shapes;
+
+		bool fitted;
+		{
+			std::lock_guard<std::mutex> lock(facemarkMutex);
+			fitted = facemark->fit(img, faces, shapes);
+		}
+
+		if (fitted && !shapes.empty()) {
+			for (size_t i = 0; i < shapes[0].size(); i++)
+				dr->addPoint(shapes[0][i].x, shapes[0][i].y);
+		}
+	}
+	else {
+		dlib::rectangle rect = dlib::rectangle(x, y, x + w, y + h);
 
-	dlib::ipl_image_hull<dlib::rgb_pixel> dlibimg(&iplImg);
+		IplImage iplImg = img;
 
-	dlib::full_object_detection shape = shapepred(dlibimg, rect);
+		dlib::ipl_image_hull<dlib::rgb_pixel> dlibimg(&iplImg);
 
-	points[0] = getPoint(shape, 0);
-	points[1] = getPoint(shape, 3);
-	points[2] = getPoint(shape, 5);
-	points[3] = getPoint(shape, 8);
-	points[4] = getPoint(shape, 11);
-	points[5] = getPoint(shape, 13);
-	points[6] = getPoint(shape, 16);
+		dlib::full_object_detection shape = shapepred(dlibimg, rect);
 
-	cv::Point2i nose_length = getPoint(shape, 27) - getPoint(shape, 30);
-	points[7] = getPoint(shape, 26) + nose_length;
-	points[8] = getPoint(shape, 17) + nose_length;
+		if (shape.num_parts() == LandmarkTemplate::NUM_FIT_POINTS) {
+			cv::Point2f fitPoints[LandmarkTemplate::NUM_FIT_POINTS];
+			for (int i = 0; i < LandmarkTemplate::NUM_FIT_POINTS; i++)
+				fitPoints[i] = cv::Point2f((float)shape.part(i).x(), (float)shape.part(i).y());
+
+			std::vector<cv::Point2f> points;
+			landmarkTemplate.expand(fitPoints, points);
+			for (size_t i = 0; i < points.size(); i++)
+				dr->addPoint(points[i].x, points[i].y);
+		}
+		else {
+			for (unsigned long i = 0; i < shape.num_parts(); i++)
+				dr->addPoint((float)shape.part(i).x(), (float)shape.part(i).y());
+		}
+	}
+}
+
+void FaceSwapping::computeLandmarks(cv::Mat img, const std::vector<DetectionRegion*>& regions)
+{
+	cv::parallel_for_(cv::Range(0, (int)regions.size()), [&](const cv::Range& range) {
+		for (int i = range.start; i < range.end; i++)
+			computeLandmarks(img, regions[i]);
+	});
+}
+
+bool FaceSwapping::getLandmarks(cv::Mat img, DetectionRegion* dr, cv::Point2i* points, cv::Point2f* affine_transform_keypoints, cv::Size& feather_amount) {
+
+	computeLandmarks(img, dr);
+	if (!hasLandmarks(dr))
+		return false;
+
+	points[0] = getPoint(dr, 0);
+	points[1] = getPoint(dr, 3);
+	points[2] = getPoint(dr, 5);
+	points[3] = getPoint(dr, 8);
+	points[4] = getPoint(dr, 11);
+	points[5] = getPoint(dr, 13);
+	points[6] = getPoint(dr, 16);
+
+	cv::Point2i nose_length = getPoint(dr, 27) - getPoint(dr, 30);
+	points[7] = getPoint(dr, 26) + nose_length;
+	points[8] = getPoint(dr, 17) + nose_length;
 
 	affine_transform_keypoints[0] = points[3];
-	affine_transform_keypoints[1] = getPoint(shape, 36);
-	affine_transform_keypoints[2] = getPoint(shape, 45);
+	affine_transform_keypoints[1] = getPoint(dr, 36);
+	affine_transform_keypoints[2] = getPoint(dr, 45);
 
 	feather_amount.width = feather_amount.height = (int)cv::norm(points[0] - points[6]) / 8;
+
+	return true;
 }
 
 
-void FaceSwapping::getWarpedMaskandFace(cv::Point2i* srcPoints, cv::Point2i* fsPoints, cv::Mat& trafo, cv::Mat fsImage, cv::Mat maskImage, cv::Mat warpedFaceImage) {
+void FaceSwapping::warpBankFace(SwapWorkspace& ws, const BankFace& face, const cv::Matx23d& trafo, cv::Size feather, cv::Mat maskImage,
+	cv::Mat alphaImage, cv::Mat warpedFaceImage) {
 
-	// get mask
-	cv::Mat fsmask = cv::Mat(fsImage.rows,fsImage.cols, CV_8UC1);
-	fsmask = Scalar(0);
+	FS_SCOPED_TIMER(STAGE_WARP);
 
-	cv::fillConvexPoly(fsmask, fsPoints, 9, cv::Scalar(255));
-	
-	CvSize sz = fsmask.size();
-	
-	cv::warpAffine(fsmask, maskImage, trafo, sz, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+	cv::Size sz = maskImage.size();
+
+	if (featherMode == FEATHER_DISTANCE && !face.segmented) {
+		// the outline is drawn directly in the frame with 4 bits of subpixel precision
+		cv::Point outline[9];
+		for (int i = 0; i < 9; i++) {
+			outline[i].x = cvRound((trafo(0, 0) * face.points[i].x + trafo(0, 1) * face.points[i].y + trafo(0, 2)) * 16);
+			outline[i].y = cvRound((trafo(1, 0) * face.points[i].x + trafo(1, 1) * face.points[i].y + trafo(1, 2)) * 16);
+		}
+		maskImage = Scalar(0);
+		cv::fillConvexPoly(maskImage, outline, 9, cv::Scalar(255), cv::LINE_8, 4);
 
-	// get face image
+		computeDistanceAlpha(maskImage, feather, ws.getBuffer(ws.distance, sz, CV_32FC1), alphaImage, getRowBands(sz));
+	}
+	else {
+		cv::warpAffine(face.mask, maskImage, trafo, sz, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
 
-	cv::Mat faceCutout = fsImage.clone();
+		cv::warpAffine(face.alpha, alphaImage, trafo, sz, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0));
+	}
 
-	fsImage.copyTo(faceCutout, fsmask);
+	// only the pixels inside the mask are used later, so the face does not need to be cut out
+	if (!warpedFaceImage.empty())
+		cv::warpAffine(face.image, warpedFaceImage, trafo, sz, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
 
-	cv::warpAffine(faceCutout, warpedFaceImage, trafo, sz, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0, 0, 0));
+}
 
+// bands are not made smaller than this, to keep the per band overhead low
+static const int MIN_BAND_ROWS = 16;
 
+int FaceSwapping::getRowBands(cv::Size size) const
+{
+	if (rowThreads == 1 || size.area() < parallelMinPixels)
+		return 1;
 
+	int bands = rowThreads > 0 ? rowThreads : cv::getNumThreads();
+	return std::max(1, std::min(bands, size.height / MIN_BAND_ROWS));
 }
-	
 
-void FaceSwapping::colorCorrect(cv::Mat src, cv::Mat warped, cv::Mat maskImg, DetectionRegion* dr)
+/// Calls body(band, begin, end) for 'bands' bands of the rows [0, rows) in parallel. The bands start at multiples of
+/// 'align' rows. The body is not wrapped in a std::function, which would allocate for lambdas with many captures.
+template <typename Body>
+static void forEachRowBand(int rows, int bands, int align, const Body& body)
 {
-	uint8_t LUT[3][256];
-	int source_hist_int[3][256];
-	int target_hist_int[3][256];
-	float source_histogram[3][256];
-	float target_histogram[3][256];
+	if (bands <= 1) {
+		body(0, 0, rows);
+		return;
+	}
 
-	float x, y, w, h;
-	dr->getBoundingBox(x, y, w, h);
-	cv::Rect rect = cv::Rect(x, y, w, h);
+	int units = (rows + align - 1) / align;
+	cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+		for (int b = range.start; b < range.end; b++)
+			body(b, std::min(rows, units * b / bands * align), std::min(rows, units * (b + 1) / bands * align));
+	}, bands);
+}
 
-	cv::Mat source_image = src(rect);
-	cv::Mat target_image = warped(rect);
-	cv::Mat mask = mask(rect);
+void FaceSwapping::computeAlpha(cv::Mat mask, cv::Size feather, cv::Mat& alpha, int bands)
+{
+	if (feather.width < 1 || feather.height < 1) {
+		mask.copyTo(alpha);
+		return;
+	}
 
-	std::memset(source_hist_int, 0, sizeof(int) * 3 * 256);
-	std::memset(target_hist_int, 0, sizeof(int) * 3 * 256);
+	alpha.create(mask.size(), CV_8UC1);
+	cv::Mat kernel = getStructuringElement(cv::MORPH_RECT, feather);
+
+	// each band is filtered with a margin of the feather height, which covers both kernels, so the borders of the
+	// margin do not affect the rows of the band
+	int margin = feather.height + 1;
+	forEachRowBand(mask.rows, bands, 1, [&](int, int begin, int end) {
+		int top = std::max(0, begin - margin);
+		int bottom = std::min(mask.rows, end + margin);
+
+		cv::Mat eroded, blurred;
+		cv::erode(mask.rowRange(top, bottom), eroded, kernel, cv::Point(-1, -1), 1, cv::BORDER_CONSTANT | cv::BORDER_ISOLATED, cv::Scalar(0));
+		cv::blur(eroded, blurred, feather, cv::Point(-1, -1), cv::BORDER_CONSTANT | cv::BORDER_ISOLATED);
+		blurred.rowRange(begin - top, end - top).copyTo(alpha.rowRange(begin, end));
+	});
+}
 
-	for (size_t i = 0; i < mask.rows; i++)
-	{
-		auto current_mask_pixel = mask.row(i).data;
-		auto current_source_pixel = source_image.row(i).data;
-		auto current_target_pixel = target_image.row(i).data;
+void FaceSwapping::computeDistanceAlpha(cv::Mat mask, cv::Size feather, cv::Mat distance, cv::Mat alpha, int bands)
+{
+	// exact euclidean distance to the nearest pixel outside the mask, computed in linear time independent of the
+	// feather size
+	cv::distanceTransform(mask, distance, cv::DIST_L2, cv::DIST_MASK_PRECISE, CV_32F);
+
+	// the weight rises smoothly from 0 at the outline to 1 at the feather width, the same extent as eroding and
+	// blurring by the feather size, but with round corners
+	float scale = 1.0f / std::max(1, feather.width);
+	forEachRowBand(mask.rows, bands, 1, [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			const float* current_distance = distance.ptr<float>(i);
+			uint8_t* current_alpha = alpha.ptr<uint8_t>(i);
+
+			for (int j = 0; j < mask.cols; j++)
+			{
+				float t = std::min(current_distance[j] * scale, 1.0f);
+				current_alpha[j] = (uint8_t)(t * t * (3.0f - 2.0f * t) * 255.0f + 0.5f);
+			}
+		}
+	});
+}
+
+void FaceSwapping::computeCdf(cv::Mat img, cv::Mat mask, float cdf[3][256], int bands)
+{
+	// partial histograms of the bands, summed below
+	std::vector<int>& bandHist = SwapWorkspace::local().histograms;
+	bandHist.assign((size_t)std::max(bands, 1) * 3 * 256, 0);
 
-		for (size_t j = 0; j < mask.cols; j++)
+	forEachRowBand(mask.rows, bands, 1, [&](int band, int begin, int end) {
+		int* hist0 = &bandHist[(size_t)band * 3 * 256];
+		int* hist1 = hist0 + 256;
+		int* hist2 = hist1 + 256;
+
+		for (int i = begin; i < end; i++)
 		{
-			if (*current_mask_pixel != 0) {
-				source_hist_int[0][*current_source_pixel]++;
-				source_hist_int[1][*(current_source_pixel + 1)]++;
-				source_hist_int[2][*(current_source_pixel + 2)]++;
-
-				target_hist_int[0][*current_target_pixel]++;
-				target_hist_int[1][*(current_target_pixel + 1)]++;
-				target_hist_int[2][*(current_target_pixel + 2)]++;
+			const uint8_t* current_mask_pixel = mask.ptr<uint8_t>(i);
+			const uint8_t* current_pixel = img.ptr<uint8_t>(i);
+
+			for (int j = 0; j < mask.cols; j++)
+			{
+				if (*current_mask_pixel != 0) {
+					hist0[*current_pixel]++;
+					hist1[*(current_pixel + 1)]++;
+					hist2[*(current_pixel + 2)]++;
+				}
+
+				// Advance to next pixel
+				current_pixel += 3;
+				current_mask_pixel++;
 			}
+		}
+	});
 
-			// Advance to next pixel
-			current_source_pixel += 3;
-			current_target_pixel += 3;
-			current_mask_pixel++;
+	int hist[3][256];
+	std::memset(hist, 0, sizeof(hist));
+	for (size_t b = 0; b < bandHist.size(); b += 3 * 256)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			for (int i = 0; i < 256; i++)
+				hist[c][i] += bandHist[b + c * 256 + i];
 		}
 	}
 
 	// Calc CDF
-	for (size_t i = 1; i < 256; i++)
+	for (int i = 1; i < 256; i++)
 	{
-		source_hist_int[0][i] += source_hist_int[0][i - 1];
-		source_hist_int[1][i] += source_hist_int[1][i - 1];
-		source_hist_int[2][i] += source_hist_int[2][i - 1];
-
-		target_hist_int[0][i] += target_hist_int[0][i - 1];
-		target_hist_int[1][i] += target_hist_int[1][i - 1];
-		target_hist_int[2][i] += target_hist_int[2][i - 1];
+		hist[0][i] += hist[0][i - 1];
+		hist[1][i] += hist[1][i - 1];
+		hist[2][i] += hist[2][i - 1];
 	}
 
 	// Normalize CDF
-	for (size_t i = 0; i < 256; i++)
+	for (int c = 0; c < 3; c++)
 	{
-		source_histogram[0][i] = (source_hist_int[0][255] ? (float)source_hist_int[0][i] / source_hist_int[0][255] : 0);
-		source_histogram[1][i] = (source_hist_int[1][255] ? (float)source_hist_int[1][i] / source_hist_int[1][255] : 0);
-		source_histogram[2][i] = (source_hist_int[2][255] ? (float)source_hist_int[2][i] / source_hist_int[2][255] : 0);
-
-		target_histogram[0][i] = (target_hist_int[0][255] ? (float)target_hist_int[0][i] / target_hist_int[0][255] : 0);
-		target_histogram[1][i] = (target_hist_int[1][255] ? (float)target_hist_int[1][i] / target_hist_int[1][255] : 0);
-		target_histogram[2][i] = (target_hist_int[2][255] ? (float)target_hist_int[2][i] / target_hist_int[2][255] : 0);
+		for (int i = 0; i < 256; i++)
+			cdf[c][i] = (hist[c][255] ? (float)hist[c][i] / hist[c][255] : 0);
 	}
+}
 
-	// Create lookup table
+void FaceSwapping::computeColorLut(cv::Mat src, cv::Mat mask, const float warpedCdf[3][256], uint8_t lut[3][256], int bands)
+{
+	// the histogram of the replacement face has been computed with the bank face, only the frame is analyzed
+	float frameCdf[3][256];
+	computeCdf(src, mask, frameCdf, bands);
 
-	auto binary_search = [&](const float needle, const float haystack[]) -> uint8_t
+	// each value of the face is mapped to the first frame value with at least the same cumulative frequency,
+	// the colours are kept if either histogram is empty
+	for (int c = 0; c < 3; c++)
 	{
-		uint8_t l = 0, r = 255, m;
-		while (l < r)
+		bool empty = frameCdf[c][255] == 0 || warpedCdf[c][255] == 0;
+		for (int i = 0; i < 256; i++)
 		{
-			m = (l + r) / 2;
-			if (needle > haystack[m])
-				l = m + 1;
-			else
-				r = m - 1;
+			int value = (int)(std::lower_bound(frameCdf[c], frameCdf[c] + 256, warpedCdf[c][i]) - frameCdf[c]);
+			lut[c][i] = empty ? (uint8_t)i : (uint8_t)std::min(value, 255);
 		}
-		// TODO check closest value
-		return m;
-	};
-
-	for (size_t i = 0; i < 256; i++)
-	{
-		LUT[0][i] = binary_search(target_histogram[0][i], source_histogram[0]);
-		LUT[1][i] = binary_search(target_histogram[1][i], source_histogram[1]);
-		LUT[2][i] = binary_search(target_histogram[2][i], source_histogram[2]);
 	}
+}
+
+void FaceSwapping::colorCorrect(cv::Mat src, cv::Mat warped, cv::Mat maskImg, cv::Rect rect, const float target_histogram[3][256])
+{
+	FS_SCOPED_TIMER(STAGE_COLOR_CORRECT);
+
+	uint8_t LUT[3][256];
+
+	cv::Mat target_image = warped(rect);
+	cv::Mat mask = maskImg(rect);
+
+	int bands = getRowBands(mask.size());
+	computeColorLut(src(rect), mask, target_histogram, LUT, bands);
 
 	// repaint pixels
-	for (size_t i = 0; i < mask.rows; i++)
-	{
-		auto current_mask_pixel = mask.row(i).data;
-		auto current_target_pixel = target_image.row(i).data;
-		for (size_t j = 0; j < mask.cols; j++)
+	forEachRowBand(mask.rows, bands, 1, [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
 		{
-			if (*current_mask_pixel != 0)
+			auto current_mask_pixel = mask.row(i).data;
+			auto current_target_pixel = target_image.row(i).data;
+			for (int j = 0; j < mask.cols; j++)
 			{
-				*current_target_pixel = LUT[0][*current_target_pixel];
-				*(current_target_pixel + 1) = LUT[1][*(current_target_pixel + 1)];
-				*(current_target_pixel + 2) = LUT[2][*(current_target_pixel + 2)];
+				if (*current_mask_pixel != 0)
+				{
+					*current_target_pixel = LUT[0][*current_target_pixel];
+					*(current_target_pixel + 1) = LUT[1][*(current_target_pixel + 1)];
+					*(current_target_pixel + 2) = LUT[2][*(current_target_pixel + 2)];
+				}
+
+				// Advance to next pixel
+				current_target_pixel += 3;
+				current_mask_pixel++;
 			}
-
-			// Advance to next pixel
-			current_target_pixel += 3;
-			current_mask_pixel++;
 		}
-	}
+	});
 }
 
 
 
-inline void FaceSwapping::insertFaces(cv::Mat dst, cv::Mat warpedFace, cv::Mat mask, cv::Size& feather)
+inline void FaceSwapping::insertFaces(cv::Mat dst, cv::Mat warpedFace, cv::Mat mask)
 {
+	FS_SCOPED_TIMER(STAGE_INSERT_FACES);
+
+	forEachRowBand(dst.rows, getRowBands(dst.size()), 1, [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			auto frame_pixel = dst.row(i).data;
+			auto faces_pixel = warpedFace.row(i).data;
+			auto masks_pixel = mask.row(i).data;
 
-	cv::erode(mask, mask, getStructuringElement(cv::MORPH_RECT, feather), cv::Point(-1, -1), 1, cv::BORDER_CONSTANT, cv::Scalar(0));
+			for (int j = 0; j < dst.cols; j++)
+			{
+				if (*masks_pixel != 0)
+				{
+					*frame_pixel = ((255 - *masks_pixel) * (*frame_pixel) + (*masks_pixel) * (*faces_pixel)) >> 8; 
+					*(frame_pixel + 1) = ((255 - *masks_pixel) * (*(frame_pixel + 1)) + (*masks_pixel) * (*(faces_pixel + 1))) >> 8;
+					*(frame_pixel + 2) = ((255 - *masks_pixel) * (*(frame_pixel + 2)) + (*masks_pixel) * (*(faces_pixel + 2))) >> 8;
+				}
+
+				frame_pixel += 3;
+				faces_pixel += 3;
+				masks_pixel++;
+			}
+		}
+	});
+}
 
-	cv::blur(mask, mask, feather, cv::Point(-1, -1), cv::BORDER_CONSTANT);
+// tile size of the fused blend, a tile of the frame and the corresponding part of the face stay in the L1 cache
+static const int BLEND_TILE_WIDTH = 64;
+static const int BLEND_TILE_HEIGHT = 16;
 
-	for (size_t i = 0; i < dst.rows; i++)
-	{
-		auto frame_pixel = dst.row(i).data;
-		auto faces_pixel = warpedFace.row(i).data;
-		auto masks_pixel = mask.row(i).data;
+void FaceSwapping::blendBankFace(const BankFace& face, const cv::Matx23d& trafo, cv::Mat mask, cv::Mat alpha, cv::Rect lutRect,
+	const uint8_t lut[3][256], cv::Mat dst)
+{
+	FS_SCOPED_TIMER(STAGE_INSERT_FACES);
 
-		for (size_t j = 0; j < dst.cols; j++)
+	// inverse transformation from the frame to the face crop
+	double det = trafo(0, 0) * trafo(1, 1) - trafo(0, 1) * trafo(1, 0);
+	if (fabs(det) < 1e-12)
+		return;
+	float i00 = (float)(trafo(1, 1) / det), i01 = (float)(-trafo(0, 1) / det);
+	float i10 = (float)(-trafo(1, 0) / det), i11 = (float)(trafo(0, 0) / det);
+	float i02 = -(i00 * (float)trafo(0, 2) + i01 * (float)trafo(1, 2));
+	float i12 = -(i10 * (float)trafo(0, 2) + i11 * (float)trafo(1, 2));
+
+	int maxX = face.image.cols - 1;
+	int maxY = face.image.rows - 1;
+
+	// bands of whole tile rows
+	forEachRowBand(dst.rows, getRowBands(dst.size()), BLEND_TILE_HEIGHT, [&](int, int begin, int end) {
+		float sourceX[BLEND_TILE_WIDTH], sourceY[BLEND_TILE_WIDTH];
+
+		for (int ty = begin; ty < end; ty += BLEND_TILE_HEIGHT)
 		{
-			if (*masks_pixel != 0)
+			int tileBottom = std::min(ty + BLEND_TILE_HEIGHT, end);
+			for (int tx = 0; tx < dst.cols; tx += BLEND_TILE_WIDTH)
 			{
-				*frame_pixel = ((255 - *masks_pixel) * (*frame_pixel) + (*masks_pixel) * (*faces_pixel)) >> 8; 
-				*(frame_pixel + 1) = ((255 - *(masks_pixel + 1)) * (*(frame_pixel + 1)) + (*(masks_pixel + 1)) * (*(faces_pixel + 1))) >> 8;
-				*(frame_pixel + 2) = ((255 - *(masks_pixel + 2)) * (*(frame_pixel + 2)) + (*(masks_pixel + 2)) * (*(faces_pixel + 2))) >> 8;
+				int tileWidth = std::min(BLEND_TILE_WIDTH, dst.cols - tx);
+				for (int y = ty; y < tileBottom; y++)
+				{
+					const uint8_t* alpha_row = alpha.ptr<uint8_t>(y) + tx;
+					const uint8_t* mask_row = mask.ptr<uint8_t>(y) + tx;
+					uint8_t* frame_pixel = dst.ptr<uint8_t>(y) + 3 * tx;
+					bool lutRow = y >= lutRect.y && y < lutRect.y + lutRect.height;
+
+					// source positions of the row of the tile, kept separate from the gather so the compiler vectorizes it
+					float rowX = i00 * tx + i01 * y + i02;
+					float rowY = i10 * tx + i11 * y + i12;
+					for (int k = 0; k < tileWidth; k++)
+					{
+						sourceX[k] = rowX + i00 * k;
+						sourceY[k] = rowY + i10 * k;
+					}
+
+					for (int k = 0; k < tileWidth; k++, frame_pixel += 3)
+					{
+						int a = alpha_row[k];
+						if (a == 0)
+							continue;
+
+						// bilinear sample, replicating the border of the crop
+						int x0 = cvFloor(sourceX[k]);
+						int y0 = cvFloor(sourceY[k]);
+						float fx = sourceX[k] - x0;
+						float fy = sourceY[k] - y0;
+						int xa = std::min(std::max(x0, 0), maxX), xb = std::min(std::max(x0 + 1, 0), maxX);
+						int ya = std::min(std::max(y0, 0), maxY), yb = std::min(std::max(y0 + 1, 0), maxY);
+						const uint8_t* p00 = face.image.ptr<uint8_t>(ya) + 3 * xa;
+						const uint8_t* p01 = face.image.ptr<uint8_t>(ya) + 3 * xb;
+						const uint8_t* p10 = face.image.ptr<uint8_t>(yb) + 3 * xa;
+						const uint8_t* p11 = face.image.ptr<uint8_t>(yb) + 3 * xb;
+						float w00 = (1.0f - fx) * (1.0f - fy), w01 = fx * (1.0f - fy), w10 = (1.0f - fx) * fy, w11 = fx * fy;
+
+						// colours are corrected inside the outline and the detected face box, as in colorCorrect
+						int x = tx + k;
+						bool correct = lutRow && mask_row[k] != 0 && x >= lutRect.x && x < lutRect.x + lutRect.width;
+
+						for (int c = 0; c < 3; c++)
+						{
+							int value = (int)(w00 * p00[c] + w01 * p01[c] + w10 * p10[c] + w11 * p11[c] + 0.5f);
+							if (correct)
+								value = lut[c][value];
+							frame_pixel[c] = (uint8_t)(((255 - a) * frame_pixel[c] + a * value) >> 8);
+						}
+					}
+				}
 			}
-
-			frame_pixel += 3;
-			faces_pixel += 3;
-			masks_pixel++;
 		}
-	}
+	});
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // OpenCV with triangulation 
 /////////////////////////////////////////////////////////////////////////////////////////////
 
-void FaceSwapping::swapFacesTriangulated(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion){
+bool FaceSwapping::swapFacesTriangulated(cv::Mat src, cv::Mat dst, cv::Mat faceSet, DetectionRegion* srcRegion, DetectionRegion* fsRegion){
 
 
-	face::FacemarkKazemi::Params params;
-	Ptr<face::FacemarkKazemi> facemark = face::FacemarkKazemi::create(params);
-	facemark->loadModel(landmarksFile);
-	
-	//vector to store the faces detected in the image
-	std::vector<Rect> faces1, faces2;
-	std::vector< std::vector<Point2f> > shape1, shape2;
+	computeLandmarks(faceSet, fsRegion);
+	computeLandmarks(src, srcRegion);
+	if (!hasLandmarks(fsRegion) || !hasLandmarks(srcRegion)) {
+		std::cerr << "failed to fit landmarks, face not replaced" << std::endl;
+		FS_COUNTER_ADD(FACES_SKIPPED, 1);
+		return false;
+	}
 
-	Mat img1 = faceSet.clone();
-	Mat img2 = src.clone();
-	Mat img1Warped = img2.clone();
+	// all further steps only work on the area around the face, the destination points are relative to it
+	Rect roi = getTriangulatedRoi(srcRegion, src.size());
+	if (roi.area() == 0) {
+		FS_COUNTER_ADD(FACES_SKIPPED, 1);
+		return false;
+	}
 
-	facemark->setFaceDetector((face::FN_FaceDetector)FaceSwapping::reuseDetections, fsRegion);
-	facemark->getFaces(img1, faces1);
-	facemark->setFaceDetector((face::FN_FaceDetector)reuseDetections, srcRegion);
-	facemark->getFaces(img2, faces2);
+	SwapWorkspace& ws = SwapWorkspace::local();
 
+	ws.points1.clear();
+	ws.points2.clear();
+	for (int i = 0; i < NUM_LANDMARKS; i++) {
+		ws.points1.push_back(Point2f((*fsRegion->getPoints())[i].x, (*fsRegion->getPoints())[i].y));
+		ws.points2.push_back(Point2f((*srcRegion->getPoints())[i].x - roi.x, (*srcRegion->getPoints())[i].y - roi.y));
+	}
 
-	//Initialise the shape of the faces
-	facemark->fit(img1, faces1, shape1);
-	facemark->fit(img2, faces2, shape2);
-	int z = 0; // we have already limited to a single face
+	// only the bounding box of the face in the face set is converted, its points are relative to it
+	Rect fsRect = boundingRect(ws.points1) & Rect(0, 0, faceSet.cols, faceSet.rows);
+	for (size_t i = 0; i < ws.points1.size(); i++)
+		ws.points1[i] -= Point2f((float)fsRect.x, (float)fsRect.y);
 
-	std::vector<Point2f> points1 = shape1[z];
-	std::vector<Point2f> points2 = shape2[z];
-	img1.convertTo(img1, CV_32F);
-	img1Warped.convertTo(img1Warped, CV_32F);
+	Mat img1 = ws.getBuffer(ws.faceSetFloat, fsRect.size(), CV_32FC3);
+	Mat img1Warped = ws.getBuffer(ws.warpedFloat, roi.size(), CV_32FC3);
+	faceSet(fsRect).convertTo(img1, CV_32F);
+	src(roi).convertTo(img1Warped, CV_32F);
 	// Find convex hull
-	std::vector<Point2f> boundary_image1;
-	std::vector<Point2f> boundary_image2;
-	std::vector<int> index;
-	convexHull(Mat(points2), index, false, false);
-	for (size_t i = 0; i < index.size(); i++)
+	convexHull(ws.points2, ws.hullIndex, false, false);
+	ws.hull1.clear();
+	ws.hull2.clear();
+	for (size_t i = 0; i < ws.hullIndex.size(); i++)
 	{
-		boundary_image1.push_back(points1[index[i]]);
-		boundary_image2.push_back(points2[index[i]]);
+		ws.hull1.push_back(ws.points1[ws.hullIndex[i]]);
+		ws.hull2.push_back(ws.points2[ws.hullIndex[i]]);
 	}
 	// Triangulation for points on the convex hull
-	std::vector< std::vector<int> > triangles;
 	Rect rect(0, 0, img1Warped.cols, img1Warped.rows);
-	divideIntoTriangles(rect, boundary_image2, triangles);
+	divideIntoTriangles(rect, ws.hull2, ws.triangleList, ws.triangles);
 	// Apply affine transformation to Delaunay triangles
-	for (size_t i = 0; i < triangles.size(); i++)
+	for (size_t i = 0; i < ws.triangles.size(); i++)
 	{
-		std::vector<Point2f> triangle1, triangle2;
+		Point2f triangle1[3], triangle2[3];
 		// Get points for img1, img2 corresponding to the triangles
 		for (int j = 0; j < 3; j++)
 		{
-			triangle1.push_back(boundary_image1[triangles[i][j]]);
-			triangle2.push_back(boundary_image2[triangles[i][j]]);
+			triangle1[j] = ws.hull1[ws.triangles[i][j]];
+			triangle2[j] = ws.hull2[ws.triangles[i][j]];
 		}
-		warpTriangle(img1, img1Warped, triangle1, triangle2);
+		warpTriangle(ws, img1, img1Warped, triangle1, triangle2);
 	}
 	// Calculate mask
-	std::vector<Point> hull;
-	for (size_t i = 0; i < boundary_image2.size(); i++)
-	{
-		Point pt((int)boundary_image2[i].x, (int)boundary_image2[i].y);
-		hull.push_back(pt);
-	}
-	Mat mask = Mat::zeros(img2.rows, img2.cols, img2.depth());
-	fillConvexPoly(mask, &hull[0], (int)hull.size(), Scalar(255, 255, 255));
+	ws.hullInt.clear();
+	for (size_t i = 0; i < ws.hull2.size(); i++)
+		ws.hullInt.push_back(Point((int)ws.hull2[i].x, (int)ws.hull2[i].y));
+	Mat mask = ws.getBuffer(ws.hullMask, roi.size(), CV_8UC1);
+	mask = Scalar(0);
+	fillConvexPoly(mask, &ws.hullInt[0], (int)ws.hullInt.size(), Scalar(255, 255, 255));
 	// Clone seamlessly.
-	Rect r = boundingRect(boundary_image2);
+	Rect r = boundingRect(ws.hull2);
 	Point center = (r.tl() + r.br()) / 2;
 
-	cv::Mat output = dst.clone();
-
-	img1Warped.convertTo(img1Warped, CV_8UC3);
-	seamlessClone(img1Warped, dst, mask, center, output, NORMAL_CLONE);
+	Mat warped = ws.getBuffer(ws.warped, roi.size(), CV_8UC3);
+	Mat output = ws.getBuffer(ws.cloned, roi.size(), CV_8UC3);
 
+	img1Warped.convertTo(warped, CV_8U);
+	seamlessClone(warped, dst(roi), mask, center, output, NORMAL_CLONE);
+	output.copyTo(dst(roi));
 
+	FS_COUNTER_ADD(FACES_SWAPPED, 1);
+	return true;
 }
 
 bool FaceSwapping::reuseDetections(InputArray image, OutputArray faces, DetectionRegion *dr)
@@ -391,58 +1029,62 @@ bool FaceSwapping::reuseDetections(InputArray image, OutputArray faces, Detectio
 }
 
 //Divide the face into triangles for warping
-void FaceSwapping::divideIntoTriangles(Rect rect, std::vector<Point2f> &points, std::vector< std::vector<int> > &Tri) {
+void FaceSwapping::divideIntoTriangles(Rect rect, const std::vector<Point2f> &points, std::vector<Vec6f> &triangleList, std::vector<Vec3i> &Tri) {
 
 	// Create an instance of Subdiv2D
 	Subdiv2D subdiv(rect);
 	// Insert points into subdiv
-	for (std::vector<Point2f>::iterator it = points.begin(); it != points.end(); it++)
+	for (std::vector<Point2f>::const_iterator it = points.begin(); it != points.end(); it++)
 		subdiv.insert(*it);
-	std::vector<Vec6f> triangleList;
 	subdiv.getTriangleList(triangleList);
-	std::vector<Point2f> pt(3);
-	std::vector<int> ind(3);
+	Tri.clear();
+	Point2f pt[3];
+	Vec3i ind;
 	for (size_t i = 0; i < triangleList.size(); i++)
 	{
-		Vec6f triangle = triangleList[i];
+		const Vec6f& triangle = triangleList[i];
 		pt[0] = Point2f(triangle[0], triangle[1]);
 		pt[1] = Point2f(triangle[2], triangle[3]);
 		pt[2] = Point2f(triangle[4], triangle[5]);
 		if (rect.contains(pt[0]) && rect.contains(pt[1]) && rect.contains(pt[2])) {
 			for (int j = 0; j < 3; j++)
 				for (size_t k = 0; k < points.size(); k++)
-					if (abs(pt[j].x - points[k].x) < 1.0 && abs(pt[j].y - points[k].y) < 1)
+					if (fabs(pt[j].x - points[k].x) < 1.0 && fabs(pt[j].y - points[k].y) < 1)
 						ind[j] = (int)k;
 			Tri.push_back(ind);
 		}
 	}
 }
 
-void FaceSwapping::warpTriangle(Mat &img1, Mat &img2, std::vector<Point2f> &triangle1, std::vector<Point2f> &triangle2)
+void FaceSwapping::warpTriangle(SwapWorkspace& ws, Mat &img1, Mat &img2, Point2f* triangle1, Point2f* triangle2)
 {
-	Rect rectangle1 = boundingRect(triangle1);
-	Rect rectangle2 = boundingRect(triangle2);
+	Rect rectangle1 = boundingRect(Mat(3, 1, CV_32FC2, triangle1));
+	Rect rectangle2 = boundingRect(Mat(3, 1, CV_32FC2, triangle2));
 	// Offset points by left top corner of the respective rectangles
-	std::vector<Point2f> triangle1Rect, triangle2Rect;
-	std::vector<Point> triangle2RectInt;
+	Point2f triangle1Rect[3], triangle2Rect[3];
+	Point triangle2RectInt[3];
 	for (int i = 0; i < 3; i++)
 	{
-		triangle1Rect.push_back(Point2f(triangle1[i].x - rectangle1.x, triangle1[i].y - rectangle1.y));
-		triangle2Rect.push_back(Point2f(triangle2[i].x - rectangle2.x, triangle2[i].y - rectangle2.y));
-		triangle2RectInt.push_back(Point((int)(triangle2[i].x - rectangle2.x), (int)(triangle2[i].y - rectangle2.y))); // for fillConvexPoly
+		triangle1Rect[i] = Point2f(triangle1[i].x - rectangle1.x, triangle1[i].y - rectangle1.y);
+		triangle2Rect[i] = Point2f(triangle2[i].x - rectangle2.x, triangle2[i].y - rectangle2.y);
+		triangle2RectInt[i] = Point((int)(triangle2[i].x - rectangle2.x), (int)(triangle2[i].y - rectangle2.y)); // for fillConvexPoly
 	}
+	Matx23d warp_mat;
+	if (!solveAffine(triangle1Rect, triangle2Rect, warp_mat))
+		return;
 	// Get mask by filling triangle
-	Mat mask = Mat::zeros(rectangle2.height, rectangle2.width, CV_32FC3);
-	fillConvexPoly(mask, triangle2RectInt, Scalar(1.0, 1.0, 1.0), 16, 0);
+	Mat mask = ws.getBuffer(ws.triangleMask, rectangle2.size(), CV_32FC3);
+	mask = Scalar::all(0);
+	fillConvexPoly(mask, triangle2RectInt, 3, Scalar(1.0, 1.0, 1.0), 16, 0);
 	// Apply warpImage to small rectangular patches
-	Mat img1Rect;
-	img1(rectangle1).copyTo(img1Rect);
-	Mat img2Rect = Mat::zeros(rectangle2.height, rectangle2.width, img1Rect.type());
-	Mat warp_mat = getAffineTransform(triangle1Rect, triangle2Rect);
-	warpAffine(img1Rect, img2Rect, warp_mat, img2Rect.size(), INTER_LINEAR, BORDER_REFLECT_101);
+	Mat img2Rect = ws.getBuffer(ws.triangleWarped, rectangle2.size(), CV_32FC3);
+	warpAffine(img1(rectangle1), img2Rect, warp_mat, img2Rect.size(), INTER_LINEAR, BORDER_REFLECT_101);
 	multiply(img2Rect, mask, img2Rect);
-	multiply(img2(rectangle2), Scalar(1.0, 1.0, 1.0) - mask, img2(rectangle2));
-	img2(rectangle2) = img2(rectangle2) + img2Rect;
+	Mat inverseMask = ws.getBuffer(ws.triangleInverseMask, rectangle2.size(), CV_32FC3);
+	subtract(Scalar(1.0, 1.0, 1.0), mask, inverseMask);
+	Mat target = img2(rectangle2);
+	multiply(target, inverseMask, target);
+	add(target, img2Rect, target);
 }
 
 
@@ -0,0 +1,46 @@
+#include "FaceSwapper/FileLock.h"
+
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+FileLock::FileLock(const std::string& path, bool wait)
+{
+#ifdef _WINDOWS
+	handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, 0, NULL);
+	OVERLAPPED overlapped = {};
+	DWORD flags = LOCKFILE_EXCLUSIVE_LOCK | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+	locked = handle != INVALID_HANDLE_VALUE && LockFileEx((HANDLE)handle, flags, 0, MAXDWORD, MAXDWORD, &overlapped);
+#else
+	fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+	locked = fd >= 0 && flock(fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+FileLock::~FileLock()
+{
+#ifdef _WINDOWS
+	if (locked) {
+		OVERLAPPED overlapped = {};
+		UnlockFileEx((HANDLE)handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+	}
+	if (handle != INVALID_HANDLE_VALUE)
+		CloseHandle((HANDLE)handle);
+#else
+	if (locked)
+		flock(fd, LOCK_UN);
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+}
+}
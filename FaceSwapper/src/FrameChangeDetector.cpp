@@ -0,0 +1,94 @@
+#include "FaceSwapper/FrameChangeDetector.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+FrameChangeDetector::FrameChangeDetector(const FrameChangeSettings& settings) :
+	settings(settings),
+	staticFrames(0),
+	maxBlockDifference(0.0),
+	meanDifference(0.0)
+{
+}
+
+void FrameChangeDetector::reset()
+{
+	reference.release();
+	staticFrames = 0;
+}
+
+void FrameChangeDetector::makeThumbnail(cv::Mat frame, cv::Mat& thumbnail) const
+{
+	double scale = std::min(1.0, (double)settings.thumbnailSize / std::max(frame.cols, frame.rows));
+	cv::Size size(std::max(1, (int)(frame.cols * scale + 0.5)), std::max(1, (int)(frame.rows * scale + 0.5)));
+
+	// reducing first keeps the colour conversion cheap, area averaging suppresses the sensor noise
+	cv::Mat reduced;
+	cv::resize(frame, reduced, size, 0, 0, cv::INTER_AREA);
+	if (reduced.channels() == 3)
+		cv::cvtColor(reduced, thumbnail, cv::COLOR_BGR2GRAY);
+	else
+		thumbnail = reduced;
+}
+
+FrameChangeDetector::Change FrameChangeDetector::classify(cv::Mat frame)
+{
+	makeThumbnail(frame, current);
+
+	maxBlockDifference = 0.0;
+	meanDifference = 0.0;
+
+	Change change;
+	if (reference.empty() || reference.size() != current.size()) {
+		change = SCENE_CUT;
+	}
+	else {
+		int block = std::max(1, settings.blockSize);
+		uint64_t total = 0;
+		for (int by = 0; by < current.rows; by += block) {
+			int bh = std::min(block, current.rows - by);
+			for (int bx = 0; bx < current.cols; bx += block) {
+				int bw = std::min(block, current.cols - bx);
+
+				int sad = 0;
+				for (int y = by; y < by + bh; y++) {
+					const unsigned char* a = current.ptr(y);
+					const unsigned char* b = reference.ptr(y);
+					for (int x = bx; x < bx + bw; x++)
+						sad += abs(a[x] - b[x]);
+				}
+				total += sad;
+				maxBlockDifference = std::max(maxBlockDifference, (double)sad / (bw * bh));
+			}
+		}
+		meanDifference = (double)total / current.total();
+
+		if (meanDifference >= settings.sceneCutThreshold)
+			change = SCENE_CUT;
+		else if (maxBlockDifference > settings.staticThreshold)
+			change = CHANGED;
+		else if (staticFrames >= settings.maxStaticFrames)
+			change = REFRESH;
+		else
+			change = STATIC;
+	}
+
+	if (change == STATIC) {
+		staticFrames++;
+	}
+	else {
+		cv::swap(reference, current);
+		staticFrames = 0;
+	}
+	return change;
+}
+
+}
+}
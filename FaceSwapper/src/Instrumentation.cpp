@@ -0,0 +1,282 @@
+#include "FaceSwapper/Instrumentation.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// Data recorded by one thread. Only the owning thread writes, so plain load/store on the atomics is sufficient;
+/// the atomics only make the concurrent reads of the exporter well defined.
+struct ThreadStats {
+	std::atomic<uint64_t> count[Instrumentation::NUM_STAGES];
+	std::atomic<uint64_t> sumNs[Instrumentation::NUM_STAGES];
+	std::atomic<uint64_t> buckets[Instrumentation::NUM_STAGES][Instrumentation::NUM_BUCKETS];
+	std::atomic<uint64_t> counters[Instrumentation::NUM_COUNTERS];
+
+	ThreadStats()
+	{
+		for (int s = 0; s < Instrumentation::NUM_STAGES; s++) {
+			count[s].store(0, std::memory_order_relaxed);
+			sumNs[s].store(0, std::memory_order_relaxed);
+			for (int b = 0; b < Instrumentation::NUM_BUCKETS; b++)
+				buckets[s][b].store(0, std::memory_order_relaxed);
+		}
+		for (int c = 0; c < Instrumentation::NUM_COUNTERS; c++)
+			counters[c].store(0, std::memory_order_relaxed);
+	}
+};
+
+static inline void increment(std::atomic<uint64_t>& value, uint64_t n)
+{
+	value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// stats of all threads, kept until the end of the process so that the data of finished threads is not lost
+static std::mutex registryMutex;
+static std::vector<ThreadStats*>& getRegistry()
+{
+	static std::vector<ThreadStats*>* registry = new std::vector<ThreadStats*>();
+	return *registry;
+}
+
+static ThreadStats& getThreadStats()
+{
+	static thread_local ThreadStats* stats = NULL;
+	if (!stats) {
+		stats = new ThreadStats();
+		std::lock_guard<std::mutex> lock(registryMutex);
+		getRegistry().push_back(stats);
+	}
+	return *stats;
+}
+
+static const char* STAGE_NAMES[Instrumentation::NUM_STAGES] = {
+	"image_read", "detect", "landmarks", "warp", "color_correct", "insert_faces", "swap", "image_write"
+};
+
+static const char* COUNTER_NAMES[Instrumentation::NUM_COUNTERS] = {
+	"faces_detected", "faces_swapped", "faces_skipped", "bytes_read", "bytes_written", "jpeg_mcus_recoded"
+};
+
+bool Instrumentation::isCompiledIn()
+{
+#ifdef FACESWAPPER_INSTRUMENTATION
+	return true;
+#else
+	return false;
+#endif
+}
+
+const char* Instrumentation::getStageName(Stage stage)
+{
+	return STAGE_NAMES[stage];
+}
+
+const char* Instrumentation::getCounterName(Counter counter)
+{
+	return COUNTER_NAMES[counter];
+}
+
+void Instrumentation::record(Stage stage, uint64_t nanoseconds)
+{
+	ThreadStats& stats = getThreadStats();
+
+	uint64_t us = nanoseconds / 1000;
+	int bucket = 0;
+	while (us > 1 && bucket < NUM_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	increment(stats.count[stage], 1);
+	increment(stats.sumNs[stage], nanoseconds);
+	increment(stats.buckets[stage][bucket], 1);
+}
+
+void Instrumentation::add(Counter counter, uint64_t value)
+{
+	increment(getThreadStats().counters[counter], value);
+}
+
+void Instrumentation::getSnapshot(Snapshot& snapshot)
+{
+	memset(&snapshot, 0, sizeof(snapshot));
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	std::vector<ThreadStats*>& registry = getRegistry();
+
+	for (size_t t = 0; t < registry.size(); t++) {
+		ThreadStats& stats = *registry[t];
+		for (int s = 0; s < NUM_STAGES; s++) {
+			snapshot.count[s] += stats.count[s].load(std::memory_order_relaxed);
+			snapshot.sumNs[s] += stats.sumNs[s].load(std::memory_order_relaxed);
+			for (int b = 0; b < NUM_BUCKETS; b++)
+				snapshot.buckets[s][b] += stats.buckets[s][b].load(std::memory_order_relaxed);
+		}
+		for (int c = 0; c < NUM_COUNTERS; c++)
+			snapshot.counters[c] += stats.counters[c].load(std::memory_order_relaxed);
+	}
+}
+
+/// upper bound of a histogram bucket in milliseconds
+static double bucketUpperMs(int bucket)
+{
+	return (double)(2ULL << bucket) / 1000.0;
+}
+
+double Instrumentation::getPercentileMs(const Snapshot& snapshot, Stage stage, double p)
+{
+	uint64_t total = 0;
+	for (int b = 0; b < NUM_BUCKETS; b++)
+		total += snapshot.buckets[stage][b];
+	if (total == 0)
+		return 0.0;
+
+	uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	uint64_t cumulative = 0;
+	for (int b = 0; b < NUM_BUCKETS; b++) {
+		cumulative += snapshot.buckets[stage][b];
+		if (cumulative >= rank)
+			return bucketUpperMs(b);
+	}
+	return bucketUpperMs(NUM_BUCKETS - 1);
+}
+
+void Instrumentation::writeJsonLine(std::ostream& out)
+{
+	Snapshot snapshot;
+	getSnapshot(snapshot);
+
+	out << "{\"timestamp\":" << (uint64_t)time(NULL) << ",\"stages\":{";
+	for (int s = 0; s < NUM_STAGES; s++) {
+		Stage stage = (Stage)s;
+		out << (s > 0 ? "," : "") << "\"" << STAGE_NAMES[s] << "\":{\"count\":" << snapshot.count[s]
+			<< ",\"sum_ms\":" << snapshot.sumNs[s] / 1e6
+			<< ",\"p50_ms\":" << getPercentileMs(snapshot, stage, 50)
+			<< ",\"p95_ms\":" << getPercentileMs(snapshot, stage, 95)
+			<< ",\"p99_ms\":" << getPercentileMs(snapshot, stage, 99) << "}";
+	}
+	out << "},\"counters\":{";
+	for (int c = 0; c < NUM_COUNTERS; c++)
+		out << (c > 0 ? "," : "") << "\"" << COUNTER_NAMES[c] << "\":" << snapshot.counters[c];
+	out << "}}" << std::endl;
+}
+
+void Instrumentation::writePrometheus(std::ostream& out)
+{
+	Snapshot snapshot;
+	getSnapshot(snapshot);
+
+	out << "# HELP faceswapper_stage_seconds Latency of the face swapping stages." << std::endl;
+	out << "# TYPE faceswapper_stage_seconds histogram" << std::endl;
+	for (int s = 0; s < NUM_STAGES; s++) {
+		uint64_t cumulative = 0;
+		for (int b = 0; b < NUM_BUCKETS; b++) {
+			cumulative += snapshot.buckets[s][b];
+			out << "faceswapper_stage_seconds_bucket{stage=\"" << STAGE_NAMES[s] << "\",le=\"" << bucketUpperMs(b) / 1000.0 << "\"} " << cumulative << std::endl;
+		}
+		out << "faceswapper_stage_seconds_bucket{stage=\"" << STAGE_NAMES[s] << "\",le=\"+Inf\"} " << snapshot.count[s] << std::endl;
+		out << "faceswapper_stage_seconds_sum{stage=\"" << STAGE_NAMES[s] << "\"} " << snapshot.sumNs[s] / 1e9 << std::endl;
+		out << "faceswapper_stage_seconds_count{stage=\"" << STAGE_NAMES[s] << "\"} " << snapshot.count[s] << std::endl;
+	}
+
+	for (int c = 0; c < NUM_COUNTERS; c++) {
+		out << "# TYPE faceswapper_" << COUNTER_NAMES[c] << "_total counter" << std::endl;
+		out << "faceswapper_" << COUNTER_NAMES[c] << "_total " << snapshot.counters[c] << std::endl;
+	}
+}
+
+bool Instrumentation::writePrometheusFile(const std::string& path)
+{
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath.c_str());
+		if (!out.is_open())
+			return false;
+		writePrometheus(out);
+		if (!out)
+			return false;
+	}
+#ifdef _WINDOWS
+	remove(path.c_str());
+#endif
+	return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// periodic exporter
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::mutex exporterMutex;
+static std::condition_variable exporterCondition;
+static std::thread* exporterThread = NULL;
+static bool exporterStop = false;
+static std::string exporterJsonPath;
+static std::string exporterPrometheusPath;
+
+static void exportOnce()
+{
+	if (!exporterJsonPath.empty()) {
+		std::ofstream out(exporterJsonPath.c_str(), std::ios::app);
+		Instrumentation::writeJsonLine(out);
+	}
+	if (!exporterPrometheusPath.empty())
+		Instrumentation::writePrometheusFile(exporterPrometheusPath);
+}
+
+bool Instrumentation::startExporter(const std::string& jsonLinesPath, const std::string& prometheusPath, double intervalSeconds)
+{
+	// a zero interval would make the exporter thread rewrite the files in a busy loop
+	std::chrono::milliseconds interval((long long)(intervalSeconds * 1000));
+	if (!(intervalSeconds > 0) || interval.count() <= 0) {
+		std::cerr << "Error: invalid metrics interval " << intervalSeconds << std::endl;
+		return false;
+	}
+
+	stopExporter();
+
+	exporterJsonPath = jsonLinesPath;
+	exporterPrometheusPath = prometheusPath;
+	exporterStop = false;
+
+	exporterThread = new std::thread([interval]() {
+		std::unique_lock<std::mutex> lock(exporterMutex);
+		while (!exporterCondition.wait_for(lock, interval, []() { return exporterStop; }))
+			exportOnce();
+	});
+	return true;
+}
+
+void Instrumentation::stopExporter()
+{
+	if (!exporterThread)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(exporterMutex);
+		exporterStop = true;
+	}
+	exporterCondition.notify_all();
+	exporterThread->join();
+	delete exporterThread;
+	exporterThread = NULL;
+
+	exportOnce();
+}
+
+}
+}
@@ -0,0 +1,398 @@
+#include "FaceSwapper/JpegReader.h"
+#include "FaceSwapper/Instrumentation.h"
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include <jpeglib.h>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// libjpeg reports fatal errors by calling error_exit, which must not return; it jumps back to the decode function.
+struct JpegErrorManager {
+	jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+static void jpegErrorExit(j_common_ptr cinfo)
+{
+	JpegErrorManager* err = (JpegErrorManager*)cinfo->err;
+	longjmp(err->jump, 1);
+}
+
+static void jpegOutputMessage(j_common_ptr)
+{
+	// warnings about corrupt data are not printed, the decoders recover from them
+}
+
+static void initErrorManager(JpegErrorManager& err)
+{
+	jpeg_std_error(&err.pub);
+	err.pub.error_exit = jpegErrorExit;
+	err.pub.output_message = jpegOutputMessage;
+}
+
+static void initDecompress(jpeg_decompress_struct& cinfo, JpegErrorManager& err, const unsigned char* data, size_t size)
+{
+	initErrorManager(err);
+	cinfo.err = &err.pub;
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, (unsigned char*)data, (unsigned long)size);
+}
+
+static void setOutputFormat(jpeg_decompress_struct& cinfo)
+{
+#ifdef LIBJPEG_TURBO_VERSION
+	cinfo.out_color_space = JCS_EXT_BGR;
+#else
+	cinfo.out_color_space = JCS_RGB;
+#endif
+}
+
+static void setInputFormat(jpeg_compress_struct& cinfo)
+{
+#ifdef LIBJPEG_TURBO_VERSION
+	cinfo.in_color_space = JCS_EXT_BGR;
+#else
+	cinfo.in_color_space = JCS_RGB;
+#endif
+}
+
+#ifndef LIBJPEG_TURBO_VERSION
+static void swapRedBlue(unsigned char* p, int width)
+{
+	for (int x = 0; x < width; x++, p += 3) {
+		unsigned char r = p[0];
+		p[0] = p[2];
+		p[2] = r;
+	}
+}
+#endif
+
+static void finishOutput(cv::Mat& img)
+{
+#ifndef LIBJPEG_TURBO_VERSION
+	for (int y = 0; y < img.rows; y++)
+		swapRedBlue(img.ptr(y), img.cols);
+#endif
+}
+
+static uint16_t readU16(const unsigned char* p, bool bigEndian)
+{
+	return bigEndian ? (uint16_t)((p[0] << 8) | p[1]) : (uint16_t)((p[1] << 8) | p[0]);
+}
+
+static uint32_t readU32(const unsigned char* p, bool bigEndian)
+{
+	return bigEndian ? ((uint32_t)readU16(p, true) << 16) | readU16(p + 2, true) : ((uint32_t)readU16(p + 2, false) << 16) | readU16(p, false);
+}
+
+/// Reads the orientation tag from the first IFD of an EXIF APP1 segment.
+static int parseExifOrientation(const unsigned char* data, unsigned int len)
+{
+	if (len < 14 || memcmp(data, "Exif\0\0", 6) != 0)
+		return 1;
+
+	const unsigned char* tiff = data + 6;
+	unsigned int tiffLen = len - 6;
+	bool bigEndian = tiff[0] == 'M';
+
+	uint32_t ifd = readU32(tiff + 4, bigEndian);
+	if (ifd + 2 > tiffLen)
+		return 1;
+
+	int entries = readU16(tiff + ifd, bigEndian);
+	for (int i = 0; i < entries; i++) {
+		uint32_t entry = ifd + 2 + 12 * i;
+		if (entry + 12 > tiffLen)
+			break;
+		if (readU16(tiff + entry, bigEndian) == 0x0112) {
+			int value = readU16(tiff + entry + 8, bigEndian);
+			return (value >= 1 && value <= 8) ? value : 1;
+		}
+	}
+	return 1;
+}
+
+JpegReader::JpegReader() :
+	width(0),
+	height(0),
+	orientation(1)
+{
+}
+
+bool JpegReader::isJpeg(const std::string& path)
+{
+	std::ifstream file(path.c_str(), std::ios::binary);
+	unsigned char signature[3] = { 0, 0, 0 };
+	file.read((char*)signature, 3);
+	return file && signature[0] == 0xff && signature[1] == 0xd8 && signature[2] == 0xff;
+}
+
+bool JpegReader::open(const std::string& path)
+{
+	width = height = 0;
+	orientation = 1;
+	data.clear();
+
+	std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+	std::streamoff size = file.tellg();
+	if (size < 4)
+		return false;
+	data.resize((size_t)size);
+	file.seekg(0);
+	if (!file.read((char*)&data[0], size))
+		return false;
+	FS_COUNTER_ADD(BYTES_READ, size);
+
+	if (data[0] != 0xff || data[1] != 0xd8)
+		return false;
+
+	jpeg_decompress_struct cinfo;
+	JpegErrorManager err;
+	initDecompress(cinfo, err, &data[0], data.size());
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+	jpeg_read_header(&cinfo, TRUE);
+
+	width = cinfo.image_width;
+	height = cinfo.image_height;
+	for (jpeg_saved_marker_ptr marker = cinfo.marker_list; marker; marker = marker->next) {
+		if (marker->marker == JPEG_APP0 + 1)
+			orientation = parseExifOrientation(marker->data, marker->data_length);
+	}
+
+	jpeg_destroy_decompress(&cinfo);
+	return true;
+}
+
+int JpegReader::chooseScale(int width, int height, int minSide)
+{
+	int side = std::max(width, height);
+	int scale = 1;
+	while (scale < 8 && (side + 2 * scale - 1) / (2 * scale) >= minSide)
+		scale *= 2;
+	return scale;
+}
+
+bool JpegReader::decode(cv::Mat& img, int scale)
+{
+	if (data.empty())
+		return false;
+
+	jpeg_decompress_struct cinfo;
+	JpegErrorManager err;
+	initDecompress(cinfo, err, &data[0], data.size());
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	jpeg_read_header(&cinfo, TRUE);
+	setOutputFormat(cinfo);
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = scale;
+	jpeg_start_decompress(&cinfo);
+
+	img.create(cinfo.output_height, cinfo.output_width, CV_8UC3);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = img.ptr(cinfo.output_scanline);
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+
+	finishOutput(img);
+	return true;
+}
+
+/// Encodes a part of an image with the colour space, sampling factors and quantization tables of the source image.
+/// The part starts at an MCU boundary, so its blocks are the same as the ones of the corresponding MCUs when encoding
+/// the whole image. The encoded data is written to a buffer allocated by libjpeg, which has to be freed by the caller.
+static bool encodePatch(const cv::Mat& img, const cv::Rect& rect, const jpeg_decompress_struct& src, unsigned char** buffer, unsigned long* size)
+{
+	std::vector<unsigned char> rowBuffer(rect.width * 3);
+
+	jpeg_compress_struct cinfo;
+	JpegErrorManager err;
+	initErrorManager(err);
+	cinfo.err = &err.pub;
+	jpeg_create_compress(&cinfo);
+	if (setjmp(err.jump)) {
+		jpeg_destroy_compress(&cinfo);
+		return false;
+	}
+
+	jpeg_mem_dest(&cinfo, buffer, size);
+	cinfo.image_width = rect.width;
+	cinfo.image_height = rect.height;
+	cinfo.input_components = 3;
+	setInputFormat(cinfo);
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_colorspace(&cinfo, src.jpeg_color_space);
+	cinfo.dct_method = JDCT_ISLOW;
+
+	for (int ci = 0; ci < src.num_components; ci++) {
+		cinfo.comp_info[ci].h_samp_factor = src.comp_info[ci].h_samp_factor;
+		cinfo.comp_info[ci].v_samp_factor = src.comp_info[ci].v_samp_factor;
+		cinfo.comp_info[ci].quant_tbl_no = src.comp_info[ci].quant_tbl_no;
+	}
+	for (int i = 0; i < NUM_QUANT_TBLS; i++) {
+		if (!src.quant_tbl_ptrs[i])
+			continue;
+		if (!cinfo.quant_tbl_ptrs[i])
+			cinfo.quant_tbl_ptrs[i] = jpeg_alloc_quant_table((j_common_ptr)&cinfo);
+		memcpy(cinfo.quant_tbl_ptrs[i]->quantval, src.quant_tbl_ptrs[i]->quantval, sizeof(cinfo.quant_tbl_ptrs[i]->quantval));
+	}
+
+	jpeg_start_compress(&cinfo, TRUE);
+	JSAMPROW row = &rowBuffer[0];
+	for (int y = 0; y < rect.height; y++) {
+		memcpy(row, img.ptr(rect.y + y) + rect.x * 3, rect.width * 3);
+#ifndef LIBJPEG_TURBO_VERSION
+		swapRedBlue(row, rect.width);
+#endif
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	return true;
+}
+
+/// Replaces the coefficients of the source blocks covered by an encoded patch, which starts at pixel (x, y).
+static bool copyPatch(jpeg_decompress_struct& src, jvirt_barray_ptr* coefs, const unsigned char* patchData, unsigned long patchSize, int x, int y)
+{
+	jpeg_decompress_struct patch;
+	JpegErrorManager err;
+	initDecompress(patch, err, patchData, patchSize);
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&patch);
+		return false;
+	}
+
+	jpeg_read_header(&patch, TRUE);
+	jvirt_barray_ptr* patchCoefs = jpeg_read_coefficients(&patch);
+
+	for (int ci = 0; ci < src.num_components; ci++) {
+		jpeg_component_info* comp = src.comp_info + ci;
+		jpeg_component_info* patchComp = patch.comp_info + ci;
+		JDIMENSION bx = x * comp->h_samp_factor / (src.max_h_samp_factor * DCTSIZE);
+		JDIMENSION by = y * comp->v_samp_factor / (src.max_v_samp_factor * DCTSIZE);
+
+		for (JDIMENSION row = 0; row < patchComp->height_in_blocks && by + row < comp->height_in_blocks; row++) {
+			JBLOCKARRAY patchRow = (*patch.mem->access_virt_barray)((j_common_ptr)&patch, patchCoefs[ci], row, 1, FALSE);
+			JBLOCKARRAY srcRow = (*src.mem->access_virt_barray)((j_common_ptr)&src, coefs[ci], by + row, 1, TRUE);
+			JDIMENSION cols = std::min(patchComp->width_in_blocks, comp->width_in_blocks - bx);
+			memcpy(srcRow[0] + bx, patchRow[0], cols * sizeof(JBLOCK));
+		}
+	}
+
+	jpeg_finish_decompress(&patch);
+	jpeg_destroy_decompress(&patch);
+	return true;
+}
+
+bool JpegReader::recode(const cv::Mat& img, const std::vector<cv::Rect>& regions, std::vector<unsigned char>& output)
+{
+	if (data.empty() || img.cols != width || img.rows != height || img.type() != CV_8UC3)
+		return false;
+
+	jpeg_decompress_struct src;
+	jpeg_compress_struct dst;
+	JpegErrorManager err;
+	unsigned char* buffer = NULL;
+	unsigned long size = 0;
+
+	initDecompress(src, err, &data[0], data.size());
+	dst.err = &err.pub;
+	jpeg_create_compress(&dst);
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&src);
+		jpeg_destroy_compress(&dst);
+		free(buffer);
+		return false;
+	}
+
+	jpeg_save_markers(&src, JPEG_COM, 0xffff);
+	for (int m = 0; m < 16; m++)
+		jpeg_save_markers(&src, JPEG_APP0 + m, 0xffff);
+	jpeg_read_header(&src, TRUE);
+
+	// the patches are encoded from BGR, so other colour spaces (e.g. CMYK) cannot be reproduced
+	bool supported = src.data_precision == 8 &&
+		((src.jpeg_color_space == JCS_YCbCr && src.num_components == 3) || (src.jpeg_color_space == JCS_GRAYSCALE && src.num_components == 1));
+	if (!supported) {
+		jpeg_destroy_decompress(&src);
+		jpeg_destroy_compress(&dst);
+		return false;
+	}
+
+	jvirt_barray_ptr* coefs = jpeg_read_coefficients(&src);
+
+	int mcuWidth = src.max_h_samp_factor * DCTSIZE;
+	int mcuHeight = src.max_v_samp_factor * DCTSIZE;
+	for (size_t i = 0; i < regions.size(); i++) {
+		cv::Rect region = regions[i] & cv::Rect(0, 0, width, height);
+		if (region.area() == 0)
+			continue;
+
+		int x0 = region.x / mcuWidth * mcuWidth;
+		int y0 = region.y / mcuHeight * mcuHeight;
+		int x1 = std::min(width, (region.x + region.width + mcuWidth - 1) / mcuWidth * mcuWidth);
+		int y1 = std::min(height, (region.y + region.height + mcuHeight - 1) / mcuHeight * mcuHeight);
+
+		unsigned char* patchData = NULL;
+		unsigned long patchSize = 0;
+		bool ok = encodePatch(img, cv::Rect(x0, y0, x1 - x0, y1 - y0), src, &patchData, &patchSize) &&
+			copyPatch(src, coefs, patchData, patchSize, x0, y0);
+		free(patchData);
+		if (!ok) {
+			jpeg_destroy_decompress(&src);
+			jpeg_destroy_compress(&dst);
+			return false;
+		}
+		FS_COUNTER_ADD(JPEG_MCUS_RECODED, ((x1 - x0 + mcuWidth - 1) / mcuWidth) * ((y1 - y0 + mcuHeight - 1) / mcuHeight));
+	}
+
+	jpeg_mem_dest(&dst, &buffer, &size);
+	jpeg_copy_critical_parameters(&src, &dst);
+	dst.optimize_coding = TRUE;
+	if (src.progressive_mode)
+		jpeg_simple_progression(&dst);
+	jpeg_write_coefficients(&dst, coefs);
+
+	// copy the metadata like jpegtran, except the JFIF and Adobe markers, which libjpeg writes itself
+	for (jpeg_saved_marker_ptr marker = src.marker_list; marker; marker = marker->next) {
+		if (dst.write_JFIF_header && marker->marker == JPEG_APP0 && marker->data_length >= 5 && memcmp(marker->data, "JFIF", 5) == 0)
+			continue;
+		if (dst.write_Adobe_marker && marker->marker == JPEG_APP0 + 14 && marker->data_length >= 5 && memcmp(marker->data, "Adobe", 5) == 0)
+			continue;
+		jpeg_write_marker(&dst, marker->marker, marker->data, marker->data_length);
+	}
+
+	jpeg_finish_compress(&dst);
+	jpeg_finish_decompress(&src);
+	jpeg_destroy_compress(&dst);
+	jpeg_destroy_decompress(&src);
+
+	output.assign(buffer, buffer + size);
+	free(buffer);
+	return true;
+}
+
+}
+}
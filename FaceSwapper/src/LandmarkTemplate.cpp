@@ -0,0 +1,182 @@
+#include "FaceSwapper/LandmarkTemplate.h"
+
+#include <math.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+const int LandmarkTemplate::FIT_INDICES[NUM_FIT_POINTS] = { 45, 42, 36, 39, 33 };
+
+// mean shape of the 300-W annotations, in units of about the width of the face (as normalized by OpenFace)
+static const float MEAN_SHAPE[LandmarkTemplate::NUM_POINTS][2] = {
+	// jaw line (0 - 16)
+	{ 0.0792397f, 0.3392237f }, { 0.0829219f, 0.4569554f }, { 0.0967927f, 0.5756480f }, { 0.1221415f, 0.6919216f },
+	{ 0.1686879f, 0.8003413f }, { 0.2397894f, 0.8957325f }, { 0.3256625f, 0.9770688f }, { 0.4223183f, 1.0432900f },
+	{ 0.5317778f, 1.0608037f }, { 0.6412963f, 1.0398192f }, { 0.7381059f, 0.9722688f }, { 0.8244444f, 0.8896241f },
+	{ 0.8947927f, 0.7924942f }, { 0.9393955f, 0.6815466f }, { 0.9611193f, 0.5622383f }, { 0.9705798f, 0.4417589f },
+	{ 0.9711933f, 0.3221187f },
+	// brows (17 - 26)
+	{ 0.1638462f, 0.2491517f }, { 0.2178035f, 0.2042559f }, { 0.2912994f, 0.1923673f }, { 0.3674602f, 0.2035822f },
+	{ 0.4392945f, 0.2331356f }, { 0.5864460f, 0.2281416f }, { 0.6601527f, 0.1959238f }, { 0.7374664f, 0.1823610f },
+	{ 0.8132365f, 0.1928280f }, { 0.8707572f, 0.2352934f },
+	// nose (27 - 35)
+	{ 0.5153453f, 0.3186355f }, { 0.5162214f, 0.3962004f }, { 0.5171189f, 0.4737977f }, { 0.5181643f, 0.5531578f },
+	{ 0.4337012f, 0.6040545f }, { 0.4755012f, 0.6207634f }, { 0.5207129f, 0.6342682f }, { 0.5658741f, 0.6187966f },
+	{ 0.6070540f, 0.6015767f },
+	// eyes (36 - 47)
+	{ 0.2524187f, 0.3310523f }, { 0.2986630f, 0.3026464f }, { 0.3557497f, 0.3030207f }, { 0.4037190f, 0.3386771f },
+	{ 0.3525072f, 0.3499876f }, { 0.2967918f, 0.3504790f }, { 0.6313261f, 0.3341367f }, { 0.6790734f, 0.2964540f },
+	{ 0.7359724f, 0.2947213f }, { 0.7828654f, 0.3213053f }, { 0.7403123f, 0.3418494f }, { 0.6849985f, 0.3437343f },
+	// outer lips (48 - 59)
+	{ 0.3531678f, 0.7461892f }, { 0.4145878f, 0.7190538f }, { 0.4776777f, 0.7068359f }, { 0.5227329f, 0.7170923f },
+	{ 0.5698321f, 0.7054145f }, { 0.6351958f, 0.7156557f }, { 0.6995167f, 0.7394192f }, { 0.6394472f, 0.8052369f },
+	{ 0.5764105f, 0.8354367f }, { 0.5253984f, 0.8417064f }, { 0.4764155f, 0.8375059f }, { 0.4137955f, 0.8100456f },
+	// inner lips (60 - 67)
+	{ 0.3800848f, 0.7499796f }, { 0.4779560f, 0.7451323f }, { 0.5233898f, 0.7489243f }, { 0.5710578f, 0.7433289f },
+	{ 0.6724091f, 0.7441770f }, { 0.5725396f, 0.7766093f }, { 0.5240107f, 0.7833708f }, { 0.4775612f, 0.7784763f }
+};
+
+LandmarkTemplate::LandmarkTemplate()
+{
+	points.resize(NUM_POINTS);
+	for (int i = 0; i < NUM_POINTS; i++)
+		points[i] = cv::Point2f(MEAN_SHAPE[i][0], MEAN_SHAPE[i][1]);
+}
+
+bool LandmarkTemplate::read(const std::string& path)
+{
+	std::ifstream fileStream(path.c_str());
+	if (!fileStream.is_open()) {
+		std::cerr << "failed to open landmark template " << path << std::endl;
+		return false;
+	}
+
+	std::vector<cv::Point2f> readPoints;
+	std::string line;
+	while (std::getline(fileStream, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream lineStream(line);
+		cv::Point2f p;
+		lineStream >> p.x >> p.y;
+		if (!lineStream) {
+			std::cerr << "invalid line in landmark template " << path << ": " << line << std::endl;
+			return false;
+		}
+		readPoints.push_back(p);
+	}
+
+	if (readPoints.size() != NUM_POINTS) {
+		std::cerr << "landmark template " << path << " has " << readPoints.size() << " instead of " << NUM_POINTS << " points" << std::endl;
+		return false;
+	}
+
+	points.swap(readPoints);
+	return true;
+}
+
+bool LandmarkTemplate::write(const std::string& path) const
+{
+	std::ofstream fileStream(path.c_str());
+	fileStream << "# mean shape of the 68 facial landmarks, see LandmarkTemplate" << std::endl;
+	for (size_t i = 0; i < points.size(); i++)
+		fileStream << points[i].x << " " << points[i].y << std::endl;
+	return (bool)fileStream;
+}
+
+void LandmarkTemplate::expand(const cv::Point2f* fitPoints, std::vector<cv::Point2f>& result) const
+{
+	cv::Point2f templatePoints[NUM_FIT_POINTS];
+	for (int i = 0; i < NUM_FIT_POINTS; i++)
+		templatePoints[i] = points[FIT_INDICES[i]];
+
+	result.resize(NUM_POINTS);
+
+	cv::Matx23d trafo;
+	if (!solveAffine(templatePoints, fitPoints, NUM_FIT_POINTS, trafo)) {
+		// the 5 points cannot be collinear for a face, but keep the result defined
+		for (int i = 0; i < NUM_POINTS; i++)
+			result[i] = fitPoints[NUM_FIT_POINTS - 1];
+		return;
+	}
+
+	for (int i = 0; i < NUM_POINTS; i++) {
+		const cv::Point2f& p = points[i];
+		result[i].x = (float)(trafo(0, 0) * p.x + trafo(0, 1) * p.y + trafo(0, 2));
+		result[i].y = (float)(trafo(1, 0) * p.x + trafo(1, 1) * p.y + trafo(1, 2));
+	}
+
+	// the fitted points themselves are kept exactly
+	for (int i = 0; i < NUM_FIT_POINTS; i++)
+		result[FIT_INDICES[i]] = fitPoints[i];
+}
+
+bool LandmarkTemplate::fit(const std::vector< std::vector<cv::Point2f> >& shapes)
+{
+	cv::Point2f templatePoints[NUM_FIT_POINTS];
+	for (int i = 0; i < NUM_FIT_POINTS; i++)
+		templatePoints[i] = points[FIT_INDICES[i]];
+
+	std::vector<cv::Point2d> sum(NUM_POINTS, cv::Point2d(0, 0));
+	int count = 0;
+	for (size_t s = 0; s < shapes.size(); s++) {
+		const std::vector<cv::Point2f>& shape = shapes[s];
+		if (shape.size() != NUM_POINTS)
+			continue;
+
+		cv::Point2f shapePoints[NUM_FIT_POINTS];
+		for (int i = 0; i < NUM_FIT_POINTS; i++)
+			shapePoints[i] = shape[FIT_INDICES[i]];
+
+		cv::Matx23d trafo;
+		if (!solveAffine(shapePoints, templatePoints, NUM_FIT_POINTS, trafo))
+			continue;
+
+		for (int i = 0; i < NUM_POINTS; i++) {
+			sum[i].x += trafo(0, 0) * shape[i].x + trafo(0, 1) * shape[i].y + trafo(0, 2);
+			sum[i].y += trafo(1, 0) * shape[i].x + trafo(1, 1) * shape[i].y + trafo(1, 2);
+		}
+		count++;
+	}
+
+	if (count == 0)
+		return false;
+
+	for (int i = 0; i < NUM_POINTS; i++)
+		points[i] = cv::Point2f((float)(sum[i].x / count), (float)(sum[i].y / count));
+	return true;
+}
+
+bool LandmarkTemplate::solveAffine(const cv::Point2f* src, const cv::Point2f* dst, int n, cv::Matx23d& trafo)
+{
+	// normal equations of the least squares problem, both rows of the transformation share the matrix
+	cv::Matx33d normal = cv::Matx33d::zeros();
+	cv::Matx32d rhs = cv::Matx32d::zeros();
+	for (int i = 0; i < n; i++) {
+		double v[3] = { src[i].x, src[i].y, 1.0 };
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 3; c++)
+				normal(r, c) += v[r] * v[c];
+			rhs(r, 0) += v[r] * dst[i].x;
+			rhs(r, 1) += v[r] * dst[i].y;
+		}
+	}
+
+	if (fabs(cv::determinant(normal)) < 1e-9)
+		return false;
+
+	cv::Matx32d solution = normal.solve(rhs, cv::DECOMP_LU);
+	for (int r = 0; r < 2; r++) {
+		for (int c = 0; c < 3; c++)
+			trafo(r, c) = solution(c, r);
+	}
+	return true;
+}
+
+}
+}
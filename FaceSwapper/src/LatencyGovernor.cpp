@@ -0,0 +1,80 @@
+#include "FaceSwapper/LatencyGovernor.h"
+
+#include <algorithm>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+const double LatencyGovernor::SMOOTHING = 0.2;
+
+const double LatencyGovernor::UPGRADE_HEADROOM = 0.8;
+
+LatencyGovernor::LatencyGovernor(int numLevels, double budgetMs)
+{
+	reset(numLevels, budgetMs);
+}
+
+void LatencyGovernor::reset(int numLevels, double budgetMs)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	this->budgetMs = budgetMs;
+	level = 0;
+	average.assign(std::max(numLevels, 1), 0.0);
+	frames.assign(std::max(numLevels, 1), 0);
+	ratio.assign(std::max(numLevels, 1), 0.0);
+	previousLevel = -1;
+	upgradeFrames = 0;
+}
+
+int LatencyGovernor::getLevel()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return level;
+}
+
+int LatencyGovernor::update(int frameLevel, double latencyMs)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (frameLevel < 0 || frameLevel >= (int)average.size())
+		return level;
+
+	average[frameLevel] = frames[frameLevel] == 0 ? latencyMs : average[frameLevel] + SMOOTHING * (latencyMs - average[frameLevel]);
+	frames[frameLevel]++;
+
+	if (budgetMs <= 0 || frameLevel != level)
+		return level;
+
+	// the average of the level switched from was last updated just before the switch, so both describe the same
+	// content of the stream
+	if (frames[level] == MIN_FRAMES && average[level] > 0) {
+		if (level > 0 && previousLevel == level - 1)
+			ratio[level - 1] = average[level - 1] / average[level];
+		else if (previousLevel == level + 1 && average[level + 1] > 0)
+			ratio[level] = average[level] / average[level + 1];
+	}
+
+	int next = level;
+	if (average[level] > budgetMs && frames[level] >= MIN_FRAMES && level + 1 < (int)average.size())
+		next = level + 1;
+	else if (level > 0) {
+		// without a measurement, the better level is assumed to cost up to the headroom more than the current one
+		double cost = ratio[level - 1] > 0 ? std::max(ratio[level - 1], 1.0) : 1.0 / UPGRADE_HEADROOM;
+		upgradeFrames = average[level] * cost < budgetMs * UPGRADE_HEADROOM ? upgradeFrames + 1 : 0;
+		if (upgradeFrames >= UPGRADE_FRAMES)
+			next = level - 1;
+	}
+
+	if (next != level) {
+		previousLevel = level;
+		level = next;
+		upgradeFrames = 0;
+		// the average of the new level is from an earlier phase of the stream, it restarts with the next frame
+		frames[level] = 0;
+	}
+
+	return level;
+}
+
+}
+}
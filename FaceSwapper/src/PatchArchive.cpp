@@ -0,0 +1,554 @@
+#include "FaceSwapper/PatchArchive.h"
+#include "FaceSwapper/DetectionCache.h"
+#include "FaceSwapper/FileLock.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+static const char SIGNATURE[4] = { 'F', 'S', 'P', '1' };
+static const char FRAME_TAG[4] = { 'F', 'R', 'M', 'E' };
+static const char INDEX_TAG[4] = { 'I', 'N', 'D', 'X' };
+static const char END_TAG[4] = { 'F', 'S', 'P', 'E' };
+
+// tag and payload size
+static const size_t RECORD_HEADER_SIZE = 8;
+// offset of the index and END_TAG
+static const size_t TRAILER_SIZE = 12;
+
+static void putUint32(std::vector<unsigned char>& data, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		data.push_back((unsigned char)(value >> (8 * i)));
+}
+
+static void putUint64(std::vector<unsigned char>& data, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+		data.push_back((unsigned char)(value >> (8 * i)));
+}
+
+static void putString(std::vector<unsigned char>& data, const std::string& text)
+{
+	putUint32(data, (uint32_t)text.size());
+	data.insert(data.end(), text.begin(), text.end());
+}
+
+static uint32_t getUint32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t getUint64(const unsigned char* p)
+{
+	return (uint64_t)getUint32(p) | ((uint64_t)getUint32(p + 4) << 32);
+}
+
+/// Sequential reading of a record payload with bounds checks.
+struct PayloadReader {
+	PayloadReader(const std::vector<unsigned char>& data) : data(data), pos(0), ok(true) {}
+
+	uint32_t getUint32()
+	{
+		if (!has(4))
+			return 0;
+		pos += 4;
+		return FaceSwapper::getUint32(&data[pos - 4]);
+	}
+
+	uint64_t getUint64()
+	{
+		if (!has(8))
+			return 0;
+		pos += 8;
+		return FaceSwapper::getUint64(&data[pos - 8]);
+	}
+
+	std::string getString()
+	{
+		uint32_t length = getUint32();
+		if (!has(length))
+			return std::string();
+		pos += length;
+		return std::string(data.begin() + (pos - length), data.begin() + pos);
+	}
+
+	bool has(size_t length)
+	{
+		ok = ok && length <= data.size() - pos;
+		return ok;
+	}
+
+	const std::vector<unsigned char>& data;
+	size_t pos;
+	bool ok;
+};
+
+static bool syncFile(FILE* file)
+{
+	if (fflush(file) != 0)
+		return false;
+#ifdef _WINDOWS
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool truncateFile(const std::string& path, uint64_t size)
+{
+#ifdef _WINDOWS
+	int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+	if (fd < 0)
+		return false;
+	bool ok = _chsize_s(fd, (__int64)size) == 0;
+	_close(fd);
+	return ok;
+#else
+	return truncate(path.c_str(), (off_t)size) == 0;
+#endif
+}
+
+void PatchArchive::extract(cv::Mat original, cv::Mat swapped, const std::vector<cv::Rect>& rois, std::vector<SwapPatch>& patches)
+{
+	patches.clear();
+
+	cv::Rect frameRect(0, 0, original.cols, original.rows);
+	std::vector<cv::Rect> areas;
+	for (size_t i = 0; i < rois.size(); i++) {
+		cv::Rect area = rois[i] & frameRect;
+		if (area.area() == 0)
+			continue;
+
+		// merge with all areas it overlaps, so every changed pixel is stored once
+		for (size_t j = 0; j < areas.size();) {
+			if ((areas[j] & area).area() > 0) {
+				area |= areas[j];
+				areas.erase(areas.begin() + j);
+				j = 0;
+			}
+			else
+				j++;
+		}
+		areas.push_back(area);
+	}
+
+	for (size_t i = 0; i < areas.size(); i++) {
+		cv::Rect area = areas[i];
+
+		// the patch is reduced to the bounding box of the changed pixels
+		int minX = area.width, minY = area.height, maxX = -1, maxY = -1;
+		for (int y = 0; y < area.height; y++) {
+			const cv::Vec3b* src = original.ptr<cv::Vec3b>(area.y + y) + area.x;
+			const cv::Vec3b* dst = swapped.ptr<cv::Vec3b>(area.y + y) + area.x;
+			for (int x = 0; x < area.width; x++) {
+				if (src[x] != dst[x]) {
+					minX = std::min(minX, x);
+					maxX = std::max(maxX, x);
+					minY = std::min(minY, y);
+					maxY = y;
+				}
+			}
+		}
+		if (maxX < 0)
+			continue;
+
+		SwapPatch patch;
+		patch.roi = cv::Rect(area.x + minX, area.y + minY, maxX - minX + 1, maxY - minY + 1);
+		patch.pixels.create(patch.roi.size(), CV_8UC4);
+		for (int y = 0; y < patch.roi.height; y++) {
+			const cv::Vec3b* src = original.ptr<cv::Vec3b>(patch.roi.y + y) + patch.roi.x;
+			const cv::Vec3b* dst = swapped.ptr<cv::Vec3b>(patch.roi.y + y) + patch.roi.x;
+			cv::Vec4b* out = patch.pixels.ptr<cv::Vec4b>(y);
+			for (int x = 0; x < patch.roi.width; x++) {
+				// unchanged pixels are zeroed, which compresses better
+				if (src[x] != dst[x])
+					out[x] = cv::Vec4b(dst[x][0], dst[x][1], dst[x][2], 255);
+				else
+					out[x] = cv::Vec4b(0, 0, 0, 0);
+			}
+		}
+		patches.push_back(patch);
+	}
+}
+
+bool PatchArchive::apply(cv::Mat frame, const std::vector<SwapPatch>& patches)
+{
+	if (frame.type() != CV_8UC3)
+		return false;
+
+	cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+	for (size_t i = 0; i < patches.size(); i++) {
+		const SwapPatch& patch = patches[i];
+		if ((patch.roi & frameRect) != patch.roi || patch.pixels.type() != CV_8UC4 || patch.pixels.size() != patch.roi.size())
+			return false;
+
+		for (int y = 0; y < patch.roi.height; y++) {
+			const cv::Vec4b* src = patch.pixels.ptr<cv::Vec4b>(y);
+			cv::Vec3b* dst = frame.ptr<cv::Vec3b>(patch.roi.y + y) + patch.roi.x;
+			for (int x = 0; x < patch.roi.width; x++) {
+				int a = src[x][3];
+				if (a == 255)
+					dst[x] = cv::Vec3b(src[x][0], src[x][1], src[x][2]);
+				else if (a > 0) {
+					for (int c = 0; c < 3; c++)
+						dst[x][c] = (unsigned char)((src[x][c] * a + dst[x][c] * (255 - a) + 127) / 255);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+void PatchArchive::encodeFrame(const std::string& key, cv::Size frameSize, const std::vector<SwapPatch>& patches, std::vector<unsigned char>& data)
+{
+	data.assign(FRAME_TAG, FRAME_TAG + sizeof(FRAME_TAG));
+	// payload size, filled in at the end
+	putUint32(data, 0);
+
+	putString(data, key);
+	putUint32(data, (uint32_t)frameSize.width);
+	putUint32(data, (uint32_t)frameSize.height);
+	putUint32(data, (uint32_t)patches.size());
+
+	std::vector<unsigned char> png;
+	for (size_t i = 0; i < patches.size(); i++) {
+		const SwapPatch& patch = patches[i];
+		cv::imencode(".png", patch.pixels, png);
+
+		putUint32(data, (uint32_t)patch.roi.x);
+		putUint32(data, (uint32_t)patch.roi.y);
+		putUint32(data, (uint32_t)patch.roi.width);
+		putUint32(data, (uint32_t)patch.roi.height);
+		putUint32(data, (uint32_t)png.size());
+		data.insert(data.end(), png.begin(), png.end());
+	}
+
+	uint32_t payloadSize = (uint32_t)(data.size() - RECORD_HEADER_SIZE);
+	for (int i = 0; i < 4; i++)
+		data[4 + i] = (unsigned char)(payloadSize >> (8 * i));
+}
+
+PatchWriter::PatchWriter() : file(NULL), writerLock(NULL), offset(0)
+{
+}
+
+PatchWriter::~PatchWriter()
+{
+	close();
+}
+
+bool PatchWriter::open(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (file) {
+		std::cerr << "patch archive " << this->path << " is already open" << std::endl;
+		return false;
+	}
+
+	this->path = path;
+	keys.clear();
+	offsets.clear();
+
+	// the lock is taken before the archive is read, a concurrent writer could change it in between otherwise
+	writerLock = new FileLock(path + ".lock", false);
+	if (!writerLock->isLocked()) {
+		std::cerr << "patch archive " << path << " is being written by another writer" << std::endl;
+		releaseLock();
+		return false;
+	}
+
+	std::ifstream existing(path.c_str(), std::ios::binary | std::ios::ate);
+	uint64_t fileSize = existing.is_open() ? (uint64_t)existing.tellg() : 0;
+	existing.close();
+
+	if (fileSize == 0) {
+		file = fopen(path.c_str(), "wb");
+		if (!file || fwrite(SIGNATURE, 1, sizeof(SIGNATURE), file) != sizeof(SIGNATURE)) {
+			std::cerr << "failed to create patch archive " << path << std::endl;
+			if (file)
+				fclose(file);
+			file = NULL;
+			releaseLock();
+			return false;
+		}
+		offset = sizeof(SIGNATURE);
+		return true;
+	}
+
+	PatchReader reader;
+	if (!reader.open(path)) {
+		releaseLock();
+		return false;
+	}
+	keys = reader.getKeys();
+	offsets = reader.getOffsets();
+
+	// new records replace the index, close() writes one for all frames; without an index, the last record of a
+	// killed writer is cut off and new records start behind the last complete one
+	offset = reader.getIndexOffset() > 0 ? reader.getIndexOffset() : reader.getValidSize();
+	if (offset < fileSize && !truncateFile(path, offset)) {
+		std::cerr << "failed to truncate patch archive " << path << std::endl;
+		releaseLock();
+		return false;
+	}
+
+	file = fopen(path.c_str(), "ab");
+	if (!file) {
+		std::cerr << "failed to open patch archive " << path << std::endl;
+		releaseLock();
+		return false;
+	}
+	return true;
+}
+
+void PatchWriter::releaseLock()
+{
+	delete writerLock;
+	writerLock = NULL;
+}
+
+bool PatchWriter::writeRecord(const std::vector<unsigned char>& data)
+{
+	if (!file)
+		return false;
+
+	if (fwrite(&data[0], 1, data.size(), file) != data.size() || !syncFile(file)) {
+		// the position of further records would be unknown
+		std::cerr << "failed to write to patch archive " << path << std::endl;
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	offset += data.size();
+	return true;
+}
+
+bool PatchWriter::write(const std::string& key, cv::Size frameSize, const std::vector<SwapPatch>& patches, uint64_t* recordHash)
+{
+	std::vector<unsigned char> data;
+	PatchArchive::encodeFrame(key, frameSize, patches, data);
+	if (recordHash)
+		*recordHash = DetectionCache::hashBytes(&data[0], data.size());
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint64_t recordOffset = offset;
+	if (!writeRecord(data))
+		return false;
+
+	if (offsets.count(key) == 0)
+		keys.push_back(key);
+	offsets[key] = recordOffset;
+	return true;
+}
+
+bool PatchWriter::close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!file) {
+		releaseLock();
+		return false;
+	}
+
+	std::vector<unsigned char> data(INDEX_TAG, INDEX_TAG + sizeof(INDEX_TAG));
+	putUint32(data, 0);
+	putUint32(data, (uint32_t)keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		putString(data, keys[i]);
+		putUint64(data, offsets[keys[i]]);
+	}
+	putUint64(data, offset);
+	data.insert(data.end(), END_TAG, END_TAG + sizeof(END_TAG));
+
+	uint32_t payloadSize = (uint32_t)(data.size() - RECORD_HEADER_SIZE);
+	for (int i = 0; i < 4; i++)
+		data[4 + i] = (unsigned char)(payloadSize >> (8 * i));
+
+	bool ok = writeRecord(data);
+	if (file) {
+		ok = fclose(file) == 0 && ok;
+		file = NULL;
+	}
+	releaseLock();
+	return ok;
+}
+
+size_t PatchWriter::getNumFrames()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return keys.size();
+}
+
+bool PatchReader::open(const std::string& path)
+{
+	keys.clear();
+	offsets.clear();
+	validSize = 0;
+	indexOffset = 0;
+
+	stream.close();
+	stream.clear();
+	stream.open(path.c_str(), std::ios::binary | std::ios::ate);
+	if (!stream.is_open()) {
+		std::cerr << "failed to open patch archive " << path << std::endl;
+		return false;
+	}
+	uint64_t fileSize = (uint64_t)stream.tellg();
+
+	char signature[sizeof(SIGNATURE)];
+	stream.seekg(0);
+	if (!stream.read(signature, sizeof(signature)) || memcmp(signature, SIGNATURE, sizeof(SIGNATURE)) != 0) {
+		std::cerr << "invalid patch archive " << path << std::endl;
+		return false;
+	}
+
+	if (!readIndex(fileSize)) {
+		keys.clear();
+		offsets.clear();
+		indexOffset = 0;
+		scan(fileSize);
+	}
+	return true;
+}
+
+bool PatchReader::readIndex(uint64_t fileSize)
+{
+	if (fileSize < sizeof(SIGNATURE) + RECORD_HEADER_SIZE + TRAILER_SIZE)
+		return false;
+
+	unsigned char trailer[TRAILER_SIZE];
+	stream.clear();
+	stream.seekg(fileSize - TRAILER_SIZE);
+	if (!stream.read((char*)trailer, TRAILER_SIZE) || memcmp(trailer + 8, END_TAG, sizeof(END_TAG)) != 0)
+		return false;
+
+	indexOffset = getUint64(trailer);
+	if (indexOffset < sizeof(SIGNATURE) || indexOffset > fileSize - RECORD_HEADER_SIZE - TRAILER_SIZE)
+		return false;
+
+	unsigned char header[RECORD_HEADER_SIZE];
+	stream.seekg(indexOffset);
+	if (!stream.read((char*)header, RECORD_HEADER_SIZE) || memcmp(header, INDEX_TAG, sizeof(INDEX_TAG)) != 0 ||
+		indexOffset + RECORD_HEADER_SIZE + getUint32(header + 4) != fileSize)
+		return false;
+
+	std::vector<unsigned char> payload(getUint32(header + 4));
+	if (!stream.read((char*)&payload[0], payload.size()))
+		return false;
+
+	PayloadReader reader(payload);
+	uint32_t count = reader.getUint32();
+	for (uint32_t i = 0; i < count && reader.ok; i++) {
+		std::string key = reader.getString();
+		uint64_t frameOffset = reader.getUint64();
+		if (!reader.ok || frameOffset >= indexOffset)
+			return false;
+		if (offsets.count(key) == 0)
+			keys.push_back(key);
+		offsets[key] = frameOffset;
+	}
+	if (!reader.ok)
+		return false;
+
+	validSize = fileSize;
+	return true;
+}
+
+void PatchReader::scan(uint64_t fileSize)
+{
+	uint64_t pos = sizeof(SIGNATURE);
+	unsigned char header[RECORD_HEADER_SIZE];
+	while (pos + RECORD_HEADER_SIZE <= fileSize) {
+		stream.clear();
+		stream.seekg(pos);
+		if (!stream.read((char*)header, RECORD_HEADER_SIZE))
+			break;
+		uint64_t end = pos + RECORD_HEADER_SIZE + getUint32(header + 4);
+		if (end > fileSize)
+			break;
+
+		if (memcmp(header, FRAME_TAG, sizeof(FRAME_TAG)) == 0) {
+			unsigned char length[4];
+			if (!stream.read((char*)length, sizeof(length)) || pos + RECORD_HEADER_SIZE + sizeof(length) + getUint32(length) > end)
+				break;
+			std::string key(getUint32(length), '\0');
+			if (!key.empty() && !stream.read(&key[0], key.size()))
+				break;
+
+			if (offsets.count(key) == 0)
+				keys.push_back(key);
+			offsets[key] = pos;
+		}
+		else if (memcmp(header, INDEX_TAG, sizeof(INDEX_TAG)) != 0)
+			break;
+
+		pos = end;
+	}
+	validSize = pos;
+}
+
+bool PatchReader::read(const std::string& key, cv::Size& frameSize, std::vector<SwapPatch>& patches)
+{
+	patches.clear();
+
+	std::map<std::string, uint64_t>::const_iterator iter = offsets.find(key);
+	if (iter == offsets.end())
+		return false;
+
+	unsigned char header[RECORD_HEADER_SIZE];
+	stream.clear();
+	stream.seekg(iter->second);
+	if (!stream.read((char*)header, RECORD_HEADER_SIZE) || memcmp(header, FRAME_TAG, sizeof(FRAME_TAG)) != 0)
+		return false;
+
+	std::vector<unsigned char> payload(getUint32(header + 4));
+	if (!payload.empty() && !stream.read((char*)&payload[0], payload.size()))
+		return false;
+
+	PayloadReader reader(payload);
+	if (reader.getString() != key)
+		return false;
+	frameSize.width = (int)reader.getUint32();
+	frameSize.height = (int)reader.getUint32();
+	uint32_t count = reader.getUint32();
+
+	for (uint32_t i = 0; i < count && reader.ok; i++) {
+		SwapPatch patch;
+		patch.roi.x = (int)reader.getUint32();
+		patch.roi.y = (int)reader.getUint32();
+		patch.roi.width = (int)reader.getUint32();
+		patch.roi.height = (int)reader.getUint32();
+		uint32_t length = reader.getUint32();
+		if (!reader.has(length))
+			break;
+
+		std::vector<unsigned char> png(payload.begin() + reader.pos, payload.begin() + reader.pos + length);
+		reader.pos += length;
+		patch.pixels = cv::imdecode(png, cv::IMREAD_UNCHANGED);
+		if (patch.pixels.type() != CV_8UC4 || patch.pixels.size() != patch.roi.size())
+			return false;
+		patches.push_back(patch);
+	}
+
+	return reader.ok;
+}
+
+}
+}
@@ -0,0 +1,155 @@
+#include "FaceSwapper/SegmentationAlpha.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+static const char SIGNATURE[4] = { 'F', 'S', 'A', '1' };
+static const size_t HEADER_SIZE = 12;
+
+// levels are stored in 4 bits, level 15 is fully opaque
+static const int LEVEL_SCALE = 17;
+
+// longest run of a single byte, longer runs continue with a varint
+static const int SHORT_RUN = 15;
+
+// upper limit of the image size, which protects against allocating huge images for corrupt files
+static const uint32_t MAX_SIDE = 1 << 15;
+
+static void putUint32(std::vector<unsigned char>& data, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		data.push_back((unsigned char)(value >> (8 * i)));
+}
+
+static uint32_t getUint32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void putRun(std::vector<unsigned char>& data, int level, size_t length)
+{
+	if (length <= (size_t)SHORT_RUN) {
+		data.push_back((unsigned char)((level << 4) | (int)(length - 1)));
+		return;
+	}
+
+	data.push_back((unsigned char)((level << 4) | SHORT_RUN));
+	size_t rest = length - SHORT_RUN - 1;
+	do {
+		unsigned char byte = (unsigned char)(rest & 0x7f);
+		rest >>= 7;
+		data.push_back(rest ? (unsigned char)(byte | 0x80) : byte);
+	} while (rest);
+}
+
+void SegmentationAlpha::encode(const cv::Mat& alpha, std::vector<unsigned char>& data)
+{
+	data.assign(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+	putUint32(data, (uint32_t)alpha.cols);
+	putUint32(data, (uint32_t)alpha.rows);
+
+	int level = -1;
+	size_t length = 0;
+	for (int y = 0; y < alpha.rows; y++) {
+		const unsigned char* row = alpha.ptr(y);
+		for (int x = 0; x < alpha.cols; x++) {
+			int current = (row[x] + LEVEL_SCALE / 2) / LEVEL_SCALE;
+			if (current == level) {
+				length++;
+				continue;
+			}
+			if (length > 0)
+				putRun(data, level, length);
+			level = current;
+			length = 1;
+		}
+	}
+	if (length > 0)
+		putRun(data, level, length);
+}
+
+bool SegmentationAlpha::decode(const std::vector<unsigned char>& data, cv::Mat& alpha)
+{
+	if (data.size() < HEADER_SIZE || memcmp(&data[0], SIGNATURE, sizeof(SIGNATURE)) != 0)
+		return false;
+
+	uint32_t width = getUint32(&data[4]);
+	uint32_t height = getUint32(&data[8]);
+	if (width == 0 || height == 0 || width > MAX_SIDE || height > MAX_SIDE)
+		return false;
+
+	alpha.create((int)height, (int)width, CV_8UC1);
+	size_t total = (size_t)width * height;
+	size_t written = 0;
+	size_t pos = HEADER_SIZE;
+	while (pos < data.size() && written < total) {
+		int level = data[pos] >> 4;
+		size_t length = (data[pos] & 0x0f) + 1;
+		pos++;
+
+		if (length == (size_t)SHORT_RUN + 1) {
+			size_t rest = 0;
+			int shift = 0;
+			bool more = true;
+			while (more && pos < data.size() && shift < 35) {
+				rest |= (size_t)(data[pos] & 0x7f) << shift;
+				more = (data[pos] & 0x80) != 0;
+				shift += 7;
+				pos++;
+			}
+			if (more)
+				return false;
+			length += rest;
+		}
+
+		if (length > total - written)
+			return false;
+
+		unsigned char value = (unsigned char)(level * LEVEL_SCALE);
+		while (length > 0) {
+			// runs continue over the end of a row
+			int x = (int)(written % width);
+			int n = (int)std::min(length, (size_t)(width - x));
+			memset(alpha.ptr((int)(written / width)) + x, value, n);
+			written += n;
+			length -= n;
+		}
+	}
+
+	return written == total && pos == data.size();
+}
+
+bool SegmentationAlpha::read(const std::string& path, cv::Mat& alpha)
+{
+	std::ifstream fileStream(path.c_str(), std::ios::binary);
+	if (!fileStream.is_open())
+		return false;
+
+	std::vector<unsigned char> data((std::istreambuf_iterator<char>(fileStream)), std::istreambuf_iterator<char>());
+	if (!decode(data, alpha)) {
+		std::cerr << "invalid alpha file " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool SegmentationAlpha::write(const std::string& path, const cv::Mat& alpha)
+{
+	std::vector<unsigned char> data;
+	encode(alpha, data);
+
+	std::ofstream fileStream(path.c_str(), std::ios::binary);
+	fileStream.write((const char*)&data[0], data.size());
+	return (bool)fileStream;
+}
+
+}
+}
@@ -0,0 +1,118 @@
+#include "FaceSwapper/StreamSwapper.h"
+
+#include "DetectionNms.h"
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+/// minimum IoU of a face with a face of the previous detection to be considered the same person
+static const float SAME_FACE_IOU = 0.5f;
+
+StreamSwapper::StreamSwapper(SwapPipeline& pipeline, const FrameChangeSettings& settings) :
+	pipeline(pipeline),
+	changeDetector(settings),
+	lastChange(FrameChangeDetector::SCENE_CUT),
+	numFrames(0),
+	numReused(0)
+{
+}
+
+StreamSwapper::~StreamSwapper()
+{
+	clearRegions();
+}
+
+void StreamSwapper::clearRegions()
+{
+	for (size_t i = 0; i < regions.size(); i++)
+		delete regions[i];
+	regions.clear();
+	assigned.clear();
+}
+
+void StreamSwapper::reset()
+{
+	changeDetector.reset();
+	clearRegions();
+}
+
+int StreamSwapper::process(cv::Mat frame)
+{
+	if (frame.empty() || frame.type() != CV_8UC3)
+		return -1;
+
+	numFrames++;
+
+	// classified before the swap modifies the frame, the reference thumbnail is taken from the original
+	lastChange = changeDetector.classify(frame);
+	if (FrameChangeDetector::needsDetection(lastChange)) {
+		std::vector<DetectionRegion*> previous;
+		std::vector<const BankFace*> previousFaces;
+		previous.swap(regions);
+		previousFaces.swap(assigned);
+
+		bool detected = pipeline.detect(frame, pipeline.getConfig().minConfidence, regions);
+		if (detected)
+			assignBankFaces(previous, previousFaces);
+
+		for (size_t i = 0; i < previous.size(); i++)
+			delete previous[i];
+
+		if (!detected) {
+			// the next frame must not reuse the (missing) detections of this one
+			reset();
+			return -1;
+		}
+	}
+	else
+		numReused++;
+
+	// the regions carry their landmarks, so the swap does not fit them again, and keep their bank faces, so the
+	// identities do not change between the frames of a static scene
+	return pipeline.swap(frame, regions, assigned);
+}
+
+void StreamSwapper::assignBankFaces(const std::vector<DetectionRegion*>& previous, const std::vector<const BankFace*>& previousFaces)
+{
+	// a face overlapping a face of the previous detection keeps its bank face, so the periodic refresh and changes
+	// elsewhere in the frame do not change the identities; after a scene cut all faces are new
+	assigned.assign(regions.size(), NULL);
+	size_t numNew = regions.size();
+	if (lastChange != FrameChangeDetector::SCENE_CUT && previousFaces.size() == previous.size()) {
+		std::vector<bool> matched(previous.size(), false);
+		for (size_t i = 0; i < regions.size(); i++) {
+			float x, y, w, h;
+			regions[i]->getBoundingBox(x, y, w, h);
+
+			int best = -1;
+			float bestIou = SAME_FACE_IOU;
+			for (size_t j = 0; j < previous.size(); j++) {
+				if (matched[j])
+					continue;
+				float px, py, pw, ph;
+				previous[j]->getBoundingBox(px, py, pw, ph);
+				float iou = DetectionNms::iou(x, y, w, h, px, py, pw, ph);
+				if (iou > bestIou) {
+					best = (int)j;
+					bestIou = iou;
+				}
+			}
+
+			if (best >= 0) {
+				matched[best] = true;
+				assigned[i] = previousFaces[best];
+				numNew--;
+			}
+		}
+	}
+
+	std::vector<const BankFace*> newFaces;
+	pipeline.assignBankFaces(numNew, newFaces);
+	for (size_t i = 0, k = 0; i < assigned.size() && k < newFaces.size(); i++) {
+		if (!assigned[i])
+			assigned[i] = newFaces[k++];
+	}
+}
+
+}
+}
@@ -0,0 +1,305 @@
+#include "FaceSwapper/SwapPipeline.h"
+#include "FaceSwapper/DetectionCache.h"
+#include "FaceSwapper/FaceSwapping.h"
+#include "FaceSwapper/SegmentationAlpha.h"
+#include "FaceDetector.h"
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <iostream>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+SwapPipeline::SwapPipeline() :
+	detector(NULL),
+	swapping(NULL),
+	nextBankFace(0)
+{
+}
+
+SwapPipeline::~SwapPipeline()
+{
+	delete swapping;
+	delete detector;
+}
+
+bool SwapPipeline::init(const SwapPipelineConfig& config)
+{
+	if (isInitialized()) {
+		std::cerr << "pipeline is already initialized" << std::endl;
+		return false;
+	}
+
+	this->config = config;
+
+	detector = FaceDetector::create(config.detectorBackend);
+	if (!detector) {
+		std::cerr << "unknown detector backend " << config.detectorBackend << std::endl;
+		return false;
+	}
+
+	std::string detectorModel = config.detectorModel.empty() ? detector->getDefaultModel() : config.detectorModel;
+	try {
+		detector->doLazyInit(detectorModel);
+	}
+	catch (std::exception& e) {
+		std::cerr << "Error loading detector from " << detectorModel << ": " << e.what() << std::endl;
+		delete detector;
+		detector = NULL;
+		return false;
+	}
+
+	if (this->config.minConfidence <= 0)
+		this->config.minConfidence = detector->getDefaultConfidence();
+	if (this->config.bankMinConfidence <= 0)
+		this->config.bankMinConfidence = detector->getBankConfidence();
+
+	try {
+		swapping = new FaceSwapping(config.landmarksModel, config.triangulation);
+		if (config.boxFeather)
+			swapping->setFeatherMode(FaceSwapping::FEATHER_BOX);
+		swapping->setMaxPatchSize(config.maxPatchSize);
+		swapping->setRowParallelism(config.rowThreads);
+		if (!config.landmarkTemplate.empty()) {
+			LandmarkTemplate landmarkTemplate;
+			if (!landmarkTemplate.read(config.landmarkTemplate)) {
+				delete swapping;
+				swapping = NULL;
+				return false;
+			}
+			swapping->setLandmarkTemplate(landmarkTemplate);
+		}
+	}
+	catch (std::exception& e) {
+		std::cerr << "Error loading landmarks from " << config.landmarksModel << ": " << e.what() << std::endl;
+		delete swapping;
+		swapping = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+bool SwapPipeline::detect(cv::Mat img, double minConfidence, std::vector<DetectionRegion*>& regions)
+{
+	if (!isInitialized() || img.empty() || img.type() != CV_8UC3)
+		return false;
+
+	cv::Mat detectImg = img;
+	double scale = 1.0;
+	if (config.detectSize > 0 && std::max(img.cols, img.rows) > config.detectSize) {
+		scale = (double)std::max(img.cols, img.rows) / config.detectSize;
+		cv::resize(img, detectImg, cv::Size(cvRound(img.cols / scale), cvRound(img.rows / scale)), 0, 0, cv::INTER_AREA);
+	}
+
+	std::vector<DetectionRegion*>* detected;
+	{
+		std::lock_guard<std::mutex> lock(detectorMutex);
+		detected = detector->calculate(detectImg, minConfidence);
+	}
+
+	for (size_t i = 0; i < detected->size() && scale > 1.0; i++) {
+		float x, y, w, h;
+		detected->at(i)->getBoundingBox(x, y, w, h);
+		detected->at(i)->setBoundingBox((float)(x * scale), (float)(y * scale), (float)(w * scale), (float)(h * scale));
+	}
+
+	for (size_t i = 0; i < detected->size(); i++) {
+		swapping->computeLandmarks(img, detected->at(i));
+		regions.push_back(detected->at(i));
+	}
+	delete detected;
+
+	return true;
+}
+
+bool SwapPipeline::loadFaceBank(const std::string& path)
+{
+	cv::Mat img = cv::imread(path, cv::IMREAD_COLOR);
+	if (img.empty()) {
+		std::cerr << "failed to read face bank image " << path << std::endl;
+		return false;
+	}
+	cv::Mat alpha;
+	SegmentationAlpha::read(SegmentationAlpha::getPath(path), alpha);
+	return addFaceBankImage(img, alpha);
+}
+
+bool SwapPipeline::addFaceBankImage(cv::Mat img, cv::Mat alpha)
+{
+	std::vector<DetectionRegion*> regions;
+	if (!detect(img, config.bankMinConfidence, regions))
+		return false;
+
+	int added = 0;
+	for (size_t i = 0; i < regions.size(); i++) {
+		// faces without landmarks could never be used for swapping
+		BankFace face;
+		if (swapping->prepareBankFace(img, regions[i], face, alpha)) {
+			bankFaces.push_back(face);
+			added++;
+		}
+		delete regions[i];
+	}
+
+	if (added == 0)
+		std::cerr << "no faces found in face bank image" << std::endl;
+
+	return added > 0;
+}
+
+bool SwapPipeline::loadFaceSheet(const std::string& path, const std::string& grid)
+{
+	cv::Mat sheet = cv::imread(path, cv::IMREAD_COLOR);
+	if (sheet.empty()) {
+		std::cerr << "failed to read face sheet " << path << std::endl;
+		return false;
+	}
+
+	FaceSheetLayout layout;
+	bool ok = grid.empty() ? FaceSheet::readLayout(FaceSheet::getLayoutPath(path), layout) : FaceSheet::parseGrid(grid, sheet.size(), layout);
+	if (!ok) {
+		std::cerr << "no valid layout for face sheet " << path << std::endl;
+		return false;
+	}
+	cv::Mat alpha;
+	SegmentationAlpha::read(SegmentationAlpha::getPath(path), alpha);
+	return addFaceSheet(sheet, layout, alpha);
+}
+
+bool SwapPipeline::addFaceSheet(cv::Mat sheet, const FaceSheetLayout& layout, cv::Mat alpha)
+{
+	if (!isInitialized() || sheet.empty() || sheet.type() != CV_8UC3)
+		return false;
+
+	std::vector<cv::Mat> tiles;
+	std::vector<DetectionRegion*> regions;
+	FaceSheet::load(*swapping, sheet, layout, tiles, regions);
+
+	int added = 0;
+	for (size_t i = 0; i < regions.size(); i++) {
+		BankFace face;
+		// the tiles are views into the sheet, the segmentation is cut in the same way
+		cv::Mat tileAlpha;
+		if (!alpha.empty()) {
+			cv::Size sheetSize;
+			cv::Point offset;
+			tiles[i].locateROI(sheetSize, offset);
+			if (sheetSize == alpha.size())
+				tileAlpha = alpha(cv::Rect(offset, tiles[i].size()));
+		}
+
+		if (swapping->prepareBankFace(tiles[i], regions[i], face, tileAlpha)) {
+			bankFaces.push_back(face);
+			added++;
+		}
+		delete regions[i];
+	}
+
+	if (added == 0)
+		std::cerr << "no faces found in face sheet" << std::endl;
+
+	return added > 0;
+}
+
+int SwapPipeline::process(cv::Mat frame, double minConfidence, std::vector<SwapPatch>* patches, const std::string& key)
+{
+	if (!isInitialized() || bankFaces.empty() || frame.empty() || frame.type() != CV_8UC3)
+		return -1;
+
+	std::vector<DetectionRegion*> regions;
+	if (!detect(frame, minConfidence > 0 ? minConfidence : config.minConfidence, regions))
+		return -1;
+
+	std::vector<const BankFace*> faces;
+	assignBankFaces(regions.size(), faces, key);
+	int swapped = swap(frame, regions, faces, std::function<bool()>(), patches);
+
+	for (size_t i = 0; i < regions.size(); i++)
+		delete regions[i];
+
+	return swapped;
+}
+
+void SwapPipeline::assignBankFaces(size_t numFaces, std::vector<const BankFace*>& faces, const std::string& key)
+{
+	faces.clear();
+	if (bankFaces.empty())
+		return;
+
+	uint64_t keyHash = key.empty() ? 0 : DetectionCache::hashBytes(key.data(), key.size());
+	for (size_t i = 0; i < numFaces; i++) {
+		size_t faceId;
+		if (key.empty()) {
+			faceId = nextBankFace++ % (unsigned int)bankFaces.size();
+		}
+		else {
+			uint32_t index = (uint32_t)i;
+			faceId = (size_t)(DetectionCache::hashBytes(&index, sizeof(index), keyHash) % bankFaces.size());
+		}
+		faces.push_back(&bankFaces[faceId]);
+	}
+}
+
+int SwapPipeline::swap(cv::Mat frame, const std::vector<DetectionRegion*>& regions, const std::function<bool()>& stop,
+	std::vector<SwapPatch>* patches)
+{
+	std::vector<const BankFace*> faces;
+	assignBankFaces(regions.size(), faces);
+	return swap(frame, regions, faces, stop, patches);
+}
+
+int SwapPipeline::swap(cv::Mat frame, const std::vector<DetectionRegion*>& regions, const std::vector<const BankFace*>& assigned,
+	const std::function<bool()>& stop, std::vector<SwapPatch>* patches)
+{
+	if (patches)
+		patches->clear();
+
+	if (!isInitialized() || bankFaces.empty() || frame.empty() || frame.type() != CV_8UC3 || assigned.size() != regions.size())
+		return -1;
+
+	if (regions.empty())
+		return 0;
+
+	swapping->computeLandmarks(frame, regions);
+
+	std::vector<DetectionRegion*> faces;
+	std::vector<const BankFace*> replacements;
+	for (size_t i = 0; i < regions.size(); i++) {
+		if (FaceSwapping::hasLandmarks(regions[i]) && assigned[i]) {
+			faces.push_back(regions[i]);
+			replacements.push_back(assigned[i]);
+		}
+	}
+
+	if (stop && stop())
+		return INTERRUPTED;
+
+	// the swap reads from the unmodified frame and writes into a copy, which replaces the caller's buffer only once
+	// all faces are done, so an interrupted swap never leaves a partially anonymized frame
+	cv::Mat dst = frame.clone();
+
+	int swapped = 0;
+	if (!swapping->swapFaces(frame, dst, replacements, faces, stop, &swapped))
+		return INTERRUPTED;
+
+	if (patches) {
+		std::vector<cv::Rect> rois;
+		for (size_t i = 0; i < faces.size(); i++)
+			rois.push_back(swapping->getSwapRoi(frame, faces[i], *replacements[i]));
+		PatchArchive::extract(frame, dst, rois, *patches);
+	}
+
+	dst.copyTo(frame);
+
+	// faces whose landmarks are degenerate or whose area is outside of the frame are skipped by the swap
+	return swapped;
+}
+
+}
+}
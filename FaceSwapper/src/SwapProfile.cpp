@@ -0,0 +1,75 @@
+#include "FaceSwapper/SwapProfile.h"
+#include "FaceSwapper/SwapPipeline.h"
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+static SwapProfile makeProfile(const char* name, int detectSize, const char* detectorBackend, const char* landmarksModel,
+	bool triangulation, int maxPatchSize)
+{
+	SwapProfile profile;
+	profile.name = name;
+	profile.detectSize = detectSize;
+	profile.detectorBackend = detectorBackend;
+	profile.landmarksModel = landmarksModel;
+	profile.triangulation = triangulation;
+	profile.boxFeather = false;
+	profile.maxPatchSize = maxPatchSize;
+	return profile;
+}
+
+std::vector<SwapProfile> SwapProfile::getProfiles()
+{
+	std::vector<SwapProfile> profiles;
+	profiles.push_back(makeProfile("archival", 0, "dlib", "./models/face_landmark_model.dat", true, 0));
+	profiles.push_back(makeProfile("balanced", 1280, "dlib", "./models/shape_predictor_68_face_landmarks.dat", false, 0));
+	profiles.push_back(makeProfile("realtime", 640, "ssd", "./models/shape_predictor_5_face_landmarks.dat", false, 256));
+	return profiles;
+}
+
+bool SwapProfile::find(const std::string& name, SwapProfile& profile)
+{
+	std::vector<SwapProfile> profiles = getProfiles();
+	for (size_t i = 0; i < profiles.size(); i++) {
+		if (profiles[i].name == name) {
+			profile = profiles[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<SwapProfile> SwapProfile::getFallbacks(const std::string& name)
+{
+	std::vector<SwapProfile> profiles = getProfiles();
+	for (size_t i = 0; i < profiles.size(); i++) {
+		if (profiles[i].name == name)
+			return std::vector<SwapProfile>(profiles.begin() + i, profiles.end());
+	}
+	return std::vector<SwapProfile>();
+}
+
+std::string SwapProfile::getNames()
+{
+	std::vector<SwapProfile> profiles = getProfiles();
+	std::string names;
+	for (size_t i = 0; i < profiles.size(); i++)
+		names += (i > 0 ? "|" : "") + profiles[i].name;
+	return names;
+}
+
+void SwapProfile::apply(SwapPipelineConfig& config) const
+{
+	if (config.detectorBackend != detectorBackend) {
+		config.detectorBackend = detectorBackend;
+		config.detectorModel.clear();
+	}
+	config.detectSize = detectSize;
+	config.landmarksModel = landmarksModel;
+	config.triangulation = triangulation;
+	config.boxFeather = boxFeather;
+	config.maxPatchSize = maxPatchSize;
+}
+
+}
+}
@@ -0,0 +1,185 @@
+#include "FaceSwapper/SwapProtocol.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+namespace Jrs {
+	namespace FaceSwapper {
+		namespace SwapProtocol {
+
+static void putU32(std::string& buffer, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		buffer.push_back((char)((value >> (8 * i)) & 0xff));
+}
+
+static void putString(std::string& buffer, const std::string& value)
+{
+	putU32(buffer, (uint32_t)value.size());
+	buffer.append(value);
+}
+
+static void putFloat(std::string& buffer, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	putU32(buffer, bits);
+}
+
+/// Sequential reader over a payload, all getters fail once the payload is exhausted.
+class Reader {
+
+public:
+	Reader(const std::string& buffer) : buffer(buffer), pos(0) {}
+
+	bool getU8(uint8_t& value)
+	{
+		if (pos + 1 > buffer.size())
+			return false;
+		value = (uint8_t)buffer[pos++];
+		return true;
+	}
+
+	bool getU32(uint32_t& value)
+	{
+		if (pos + 4 > buffer.size())
+			return false;
+		value = 0;
+		for (int i = 0; i < 4; i++)
+			value |= (uint32_t)(uint8_t)buffer[pos++] << (8 * i);
+		return true;
+	}
+
+	bool getFloat(float& value)
+	{
+		uint32_t bits;
+		if (!getU32(bits))
+			return false;
+		memcpy(&value, &bits, sizeof(value));
+		return true;
+	}
+
+	bool getString(std::string& value)
+	{
+		uint32_t len;
+		if (!getU32(len) || len > buffer.size() - pos)
+			return false;
+		value = buffer.substr(pos, len);
+		pos += len;
+		return true;
+	}
+
+protected:
+	const std::string& buffer;
+	size_t pos;
+};
+
+void encodeJob(const Job& job, std::string& payload)
+{
+	payload.clear();
+	payload.push_back((char)job.source);
+	putString(payload, job.input);
+	putU32(payload, job.width);
+	putU32(payload, job.height);
+	putU32(payload, job.stride);
+	putString(payload, job.output);
+	putFloat(payload, job.minConfidence);
+}
+
+bool decodeJob(const std::string& payload, Job& job)
+{
+	Reader reader(payload);
+	return reader.getU8(job.source) && reader.getString(job.input) && reader.getU32(job.width) && reader.getU32(job.height) &&
+		reader.getU32(job.stride) && reader.getString(job.output) && reader.getFloat(job.minConfidence);
+}
+
+void encodeStatus(const Status& status, std::string& payload)
+{
+	payload.clear();
+	payload.push_back((char)status.state);
+	putU32(payload, (uint32_t)status.faces);
+	putU32(payload, status.queueUs);
+	putU32(payload, status.readUs);
+	putU32(payload, status.processUs);
+	putU32(payload, status.writeUs);
+	putString(payload, status.message);
+}
+
+bool decodeStatus(const std::string& payload, Status& status)
+{
+	Reader reader(payload);
+	uint32_t faces;
+	if (!reader.getU8(status.state) || !reader.getU32(faces))
+		return false;
+	status.faces = (int32_t)faces;
+	return reader.getU32(status.queueUs) && reader.getU32(status.readUs) && reader.getU32(status.processUs) &&
+		reader.getU32(status.writeUs) && reader.getString(status.message);
+}
+
+static bool writeAll(int fd, const char* data, size_t len)
+{
+	while (len > 0) {
+		int n = (int)send(fd, data, (int)len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool readAll(int fd, char* data, size_t len)
+{
+	while (len > 0) {
+		int n = (int)recv(fd, data, (int)len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool writeMessage(int fd, MessageType type, uint32_t jobId, const std::string& payload)
+{
+	std::string message;
+	message.reserve(HEADER_SIZE + payload.size());
+	putU32(message, MAGIC);
+	putU32(message, (uint32_t)VERSION | ((uint32_t)type << 16));
+	putU32(message, jobId);
+	putU32(message, (uint32_t)payload.size());
+	message.append(payload);
+
+	return writeAll(fd, message.data(), message.size());
+}
+
+bool readMessage(int fd, Header& header, std::string& payload)
+{
+	std::string raw(HEADER_SIZE, '\0');
+	if (!readAll(fd, &raw[0], HEADER_SIZE))
+		return false;
+
+	Reader reader(raw);
+	uint32_t magic, versionType;
+	reader.getU32(magic);
+	reader.getU32(versionType);
+	reader.getU32(header.jobId);
+	reader.getU32(header.payloadSize);
+
+	if (magic != MAGIC || (versionType & 0xffff) != VERSION || header.payloadSize > MAX_PAYLOAD_SIZE)
+		return false;
+	header.type = (uint16_t)(versionType >> 16);
+
+	payload.resize(header.payloadSize);
+	return header.payloadSize == 0 || readAll(fd, &payload[0], header.payloadSize);
+}
+
+}
+}
+}
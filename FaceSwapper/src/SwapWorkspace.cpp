@@ -0,0 +1,62 @@
+#include "FaceSwapper/SwapWorkspace.h"
+
+#include <algorithm>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+SwapWorkspace::SwapWorkspace() :
+	numAllocations(0)
+{
+}
+
+SwapWorkspace& SwapWorkspace::local()
+{
+	// the threads of cv::parallel_for_ and of the worker pools are long lived, so their workspaces are reused
+	static thread_local SwapWorkspace workspace;
+	return workspace;
+}
+
+cv::Mat SwapWorkspace::getBuffer(cv::Mat& storage, cv::Size size, int type)
+{
+	if (storage.type() != type || storage.cols < size.width || storage.rows < size.height) {
+		// the other dimension is kept, so faces of varying aspect ratio do not make the buffer grow again
+		cv::Size capacity = storage.type() == type ? cv::Size(std::max(storage.cols, size.width), std::max(storage.rows, size.height)) : size;
+		storage.create(capacity, type);
+		numAllocations++;
+	}
+	return storage(cv::Rect(0, 0, size.width, size.height));
+}
+
+size_t SwapWorkspace::getCapacity() const
+{
+	const cv::Mat* buffers[] = { &mask, &alpha, &warpedFace, &distance, &proxyFrame, &patch, &patchAlpha, &faceSetFloat, &warpedFloat, &warped, &hullMask, &cloned,
+		&triangleMask, &triangleInverseMask, &triangleWarped };
+
+	size_t bytes = 0;
+	for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++)
+		bytes += buffers[i]->total() * buffers[i]->elemSize();
+	return bytes;
+}
+
+void SwapWorkspace::release()
+{
+	cv::Mat* buffers[] = { &mask, &alpha, &warpedFace, &distance, &proxyFrame, &patch, &patchAlpha, &faceSetFloat, &warpedFloat, &warped, &hullMask, &cloned,
+		&triangleMask, &triangleInverseMask, &triangleWarped };
+
+	for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++)
+		buffers[i]->release();
+
+	std::vector<int>().swap(histograms);
+	std::vector<cv::Point2f>().swap(points1);
+	std::vector<cv::Point2f>().swap(points2);
+	std::vector<cv::Point2f>().swap(hull1);
+	std::vector<cv::Point2f>().swap(hull2);
+	std::vector<cv::Point>().swap(hullInt);
+	std::vector<int>().swap(hullIndex);
+	std::vector<cv::Vec3i>().swap(triangles);
+	std::vector<cv::Vec6f>().swap(triangleList);
+}
+
+}
+}
@@ -0,0 +1,86 @@
+#include "FaceSwapper/WorkerPool.h"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+namespace Jrs {
+	namespace FaceSwapper {
+
+WorkerPool::WorkerPool(int numThreads) :
+	running(0),
+	stopping(false)
+{
+	if (numThreads <= 0)
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	for (int i = 0; i < numThreads; i++)
+		threads.push_back(std::thread(&WorkerPool::run, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueCondition.notify_all();
+
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+bool WorkerPool::post(const std::function<void()>& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		if (stopping)
+			return false;
+		queue.push_back(task);
+	}
+	queueCondition.notify_one();
+	return true;
+}
+
+void WorkerPool::wait()
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+	idleCondition.wait(lock, [this]() { return queue.empty() && running == 0; });
+}
+
+size_t WorkerPool::getQueueLength()
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+	return queue.size();
+}
+
+void WorkerPool::run()
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+
+	while (true) {
+		queueCondition.wait(lock, [this]() { return stopping || !queue.empty(); });
+		if (queue.empty())
+			return;
+
+		std::function<void()> task = queue.front();
+		queue.pop_front();
+		running++;
+
+		lock.unlock();
+		try {
+			task();
+		}
+		catch (std::exception& e) {
+			std::cerr << "worker task failed: " << e.what() << std::endl;
+		}
+		lock.lock();
+
+		running--;
+		if (queue.empty() && running == 0)
+			idleCondition.notify_all();
+	}
+}
+
+}
+}
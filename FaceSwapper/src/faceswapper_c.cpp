@@ -0,0 +1,103 @@
+#include "FaceSwapper/faceswapper_c.h"
+#include "FaceSwapper/SwapPipeline.h"
+
+#include <exception>
+#include <string>
+
+struct fs_pipeline {
+	Jrs::FaceSwapper::SwapPipeline pipeline;
+};
+
+static thread_local std::string lastError;
+
+static void setError(const std::string& message)
+{
+	lastError = message;
+}
+
+extern "C" {
+
+fs_pipeline* fs_pipeline_create(const fs_config* config)
+{
+	Jrs::FaceSwapper::SwapPipelineConfig pipelineConfig;
+	if (config) {
+		if (config->detector_model)
+			pipelineConfig.detectorModel = config->detector_model;
+		if (config->landmarks_model)
+			pipelineConfig.landmarksModel = config->landmarks_model;
+		pipelineConfig.triangulation = config->triangulation != 0;
+		if (config->min_confidence > 0)
+			pipelineConfig.minConfidence = config->min_confidence;
+		if (config->bank_min_confidence > 0)
+			pipelineConfig.bankMinConfidence = config->bank_min_confidence;
+	}
+
+	fs_pipeline* pipeline = NULL;
+	try {
+		pipeline = new fs_pipeline();
+		if (!pipeline->pipeline.init(pipelineConfig)) {
+			setError("failed to load models");
+			delete pipeline;
+			return NULL;
+		}
+	}
+	catch (std::exception& e) {
+		setError(e.what());
+		delete pipeline;
+		return NULL;
+	}
+	return pipeline;
+}
+
+void fs_pipeline_destroy(fs_pipeline* pipeline)
+{
+	delete pipeline;
+}
+
+int fs_pipeline_load_face_bank(fs_pipeline* pipeline, const char* path)
+{
+	if (!pipeline || !path) {
+		setError("invalid argument");
+		return -1;
+	}
+
+	try {
+		if (!pipeline->pipeline.loadFaceBank(path)) {
+			setError(std::string("no faces loaded from ") + path);
+			return -1;
+		}
+	}
+	catch (std::exception& e) {
+		setError(e.what());
+		return -1;
+	}
+	return 0;
+}
+
+int fs_pipeline_process(fs_pipeline* pipeline, unsigned char* bgr, int width, int height, int stride)
+{
+	if (!pipeline || !bgr || width <= 0 || height <= 0 || stride < width * 3) {
+		setError("invalid argument");
+		return -1;
+	}
+
+	try {
+		// wraps the caller's buffer, the faces are replaced in place
+		cv::Mat frame(height, width, CV_8UC3, bgr, (size_t)stride);
+		int swapped = pipeline->pipeline.process(frame);
+		if (swapped < 0)
+			setError(pipeline->pipeline.getNumBankFaces() == 0 ? "face bank is empty" : "processing failed");
+		return swapped;
+	}
+	catch (std::exception& e) {
+		setError(e.what());
+		return -1;
+	}
+}
+
+const char* fs_last_error(void)
+{
+	return lastError.c_str();
+}
+
+}
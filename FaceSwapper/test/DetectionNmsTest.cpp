@@ -0,0 +1,196 @@
+// Pins down the IoU semantics documented in DetectionNms.h and the results of greedy and weighted suppression.
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "DetectionNms.h"
+
+static int numFailed = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+			numFailed++; \
+		} \
+	} while (0)
+
+static bool near(float a, float b, float tolerance = 1e-5f)
+{
+	return fabs(a - b) <= tolerance;
+}
+
+static void testIou()
+{
+	// identical boxes
+	CHECK(DetectionNms::iou(3, 4, 10, 20, 3, 4, 10, 20) == 1.0f);
+
+	// half-open boxes touching at an edge or a corner do not overlap
+	CHECK(DetectionNms::iou(0, 0, 10, 10, 10, 0, 10, 10) == 0.0f);
+	CHECK(DetectionNms::iou(0, 0, 10, 10, 0, 10, 10, 10) == 0.0f);
+	CHECK(DetectionNms::iou(0, 0, 10, 10, 10, 10, 10, 10) == 0.0f);
+	CHECK(DetectionNms::iou(0, 0, 10, 10, 30, 30, 10, 10) == 0.0f);
+
+	// empty boxes and an empty union give 0, not NaN
+	CHECK(DetectionNms::iou(0, 0, 0, 0, 0, 0, 0, 0) == 0.0f);
+	CHECK(DetectionNms::iou(5, 5, 0, 10, 5, 5, 0, 10) == 0.0f);
+	CHECK(DetectionNms::iou(5, 5, 0, 0, 0, 0, 10, 10) == 0.0f);
+
+	// containment: intersection is the inner box, union the outer one
+	CHECK(near(DetectionNms::iou(0, 0, 20, 20, 5, 5, 10, 10), 0.25f));
+	CHECK(near(DetectionNms::iou(5, 5, 10, 10, 0, 0, 20, 20), 0.25f));
+
+	// partial overlap: 5x10 of two 10x10 boxes
+	CHECK(near(DetectionNms::iou(0, 0, 10, 10, 5, 0, 10, 10), 50.0f / 150.0f));
+}
+
+static void testIouBatch()
+{
+	// a fixed pseudo random set with a count that is not a multiple of the SSE batch size, including empty and
+	// touching boxes
+	DetectionBoxes boxes;
+	uint32_t state = 12345;
+	for (int i = 0; i < 103; i++) {
+		state = state * 1664525u + 1013904223u;
+		float x = (float)((state >> 8) % 100);
+		float y = (float)((state >> 16) % 100);
+		float w = (float)((state >> 4) % 40);
+		float h = (float)((state >> 12) % 40);
+		boxes.add(x, y, w, h, 1.0f);
+	}
+	boxes.add(0, 0, 0, 0, 1.0f);
+	boxes.add(boxes.x2[0], boxes.y1[0], 10, boxes.y2[0] - boxes.y1[0], 1.0f);
+
+	std::vector<int> candidates;
+	for (int i = 0; i < (int)boxes.size(); i++)
+		candidates.push_back(i);
+
+	std::vector<float> result;
+	for (int ref = 0; ref < (int)boxes.size(); ref++) {
+		DetectionNms::iouBatch(boxes, ref, candidates, result);
+		CHECK(result.size() == candidates.size());
+		for (size_t k = 0; k < candidates.size() && k < result.size(); k++) {
+			int c = candidates[k];
+			float expected = DetectionNms::iou(
+				boxes.x1[ref], boxes.y1[ref], boxes.x2[ref] - boxes.x1[ref], boxes.y2[ref] - boxes.y1[ref],
+				boxes.x1[c], boxes.y1[c], boxes.x2[c] - boxes.x1[c], boxes.y2[c] - boxes.y1[c]);
+			if (!near(result[k], expected)) {
+				std::cerr << "iouBatch(" << ref << ", " << c << ") = " << result[k] << ", iou = " << expected << std::endl;
+				numFailed++;
+			}
+		}
+	}
+}
+
+static void testGreedyAndWeighted()
+{
+	// 0 and 1 overlap with IoU 90/110, 2 overlaps 0 with IoU 25/175, 3 is far away
+	DetectionBoxes boxes;
+	boxes.add(0, 0, 10, 10, 0.9f);
+	boxes.add(1, 0, 10, 10, 0.6f);
+	boxes.add(5, 5, 10, 10, 0.7f);
+	boxes.add(50, 50, 10, 10, 0.8f);
+
+	std::vector<int> kept = DetectionNms::greedy(boxes, 0.5f);
+	CHECK(kept.size() == 3);
+	if (kept.size() == 3) {
+		CHECK(kept[0] == 0);
+		CHECK(kept[1] == 3);
+		CHECK(kept[2] == 2);
+	}
+
+	// a lower threshold also suppresses 2 by 0, and 1 is then suppressed by 0 before 2 could
+	kept = DetectionNms::greedy(boxes, 0.1f);
+	CHECK(kept.size() == 2);
+	if (kept.size() == 2) {
+		CHECK(kept[0] == 0);
+		CHECK(kept[1] == 3);
+	}
+
+	DetectionBoxes merged;
+	std::vector< std::vector<int> > members;
+	DetectionNms::weighted(boxes, 0.5f, merged, &members);
+	CHECK(merged.size() == 3);
+	CHECK(members.size() == 3);
+	if (merged.size() == 3 && members.size() == 3) {
+		// 0 and 1 are merged, score weighted: x1 = (0.9 * 0 + 0.6 * 1) / 1.5
+		CHECK(members[0].size() == 2);
+		CHECK(near(merged.x1[0], 0.4f));
+		CHECK(near(merged.x2[0], 10.4f));
+		CHECK(near(merged.y1[0], 0.0f));
+		CHECK(near(merged.y2[0], 10.0f));
+		CHECK(merged.score[0] == 0.9f);
+
+		// single boxes are unchanged
+		CHECK(members[1].size() == 1 && members[1][0] == 3);
+		CHECK(merged.x1[1] == 50.0f && merged.y2[1] == 60.0f && merged.score[1] == 0.8f);
+		CHECK(members[2].size() == 1 && members[2][0] == 2);
+		CHECK(merged.x1[2] == 5.0f && merged.y2[2] == 15.0f && merged.score[2] == 0.7f);
+	}
+
+	// greedy keeps the first box of each merged cluster
+	kept = DetectionNms::greedy(boxes, 0.5f);
+	for (size_t i = 0; i < kept.size() && i < members.size(); i++)
+		CHECK(kept[i] == members[i][0]);
+}
+
+static void testGrid()
+{
+	// above the grid threshold the result has to equal brute force greedy suppression
+	DetectionBoxes boxes;
+	uint32_t state = 777;
+	for (int i = 0; i < 300; i++) {
+		state = state * 1664525u + 1013904223u;
+		float x = (float)((state >> 8) % 400);
+		float y = (float)((state >> 16) % 400);
+		float size = (float)(10 + (state >> 4) % 30);
+		boxes.add(x, y, size, size, (float)((state >> 20) % 1000) / 1000.0f);
+	}
+
+	std::vector<int> order;
+	for (int i = 0; i < (int)boxes.size(); i++)
+		order.push_back(i);
+	struct ByScore {
+		const DetectionBoxes* boxes;
+		bool operator()(int a, int b) const { return boxes->score[a] > boxes->score[b] || (boxes->score[a] == boxes->score[b] && a < b); }
+	} byScore = { &boxes };
+	std::stable_sort(order.begin(), order.end(), byScore);
+
+	std::vector<int> expected;
+	std::vector<char> suppressed(boxes.size(), 0);
+	for (size_t i = 0; i < order.size(); i++) {
+		int a = order[i];
+		if (suppressed[a])
+			continue;
+		expected.push_back(a);
+		for (size_t j = i + 1; j < order.size(); j++) {
+			int b = order[j];
+			float v = DetectionNms::iou(boxes.x1[a], boxes.y1[a], boxes.x2[a] - boxes.x1[a], boxes.y2[a] - boxes.y1[a],
+				boxes.x1[b], boxes.y1[b], boxes.x2[b] - boxes.x1[b], boxes.y2[b] - boxes.y1[b]);
+			if (v > 0.3f)
+				suppressed[b] = 1;
+		}
+	}
+
+	std::vector<int> kept = DetectionNms::greedy(boxes, 0.3f);
+	CHECK(kept == expected);
+}
+
+int main()
+{
+	testIou();
+	testIouBatch();
+	testGreedyAndWeighted();
+	testGrid();
+
+	if (numFailed > 0) {
+		std::cerr << numFailed << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "all checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,127 @@
+// Checks that FaceFeatureMatcher ranks the candidates as FaceDetectionRegion::matchAppearance does.
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "FaceDetectionRegion.h"
+#include "FaceFeatureMatcher.h"
+
+static int numFailed = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+			numFailed++; \
+		} \
+	} while (0)
+
+static std::vector<double> randomFeatures(uint32_t& state, int dimension)
+{
+	std::vector<double> features(dimension);
+	for (int i = 0; i < dimension; i++) {
+		state = state * 1664525u + 1013904223u;
+		features[i] = (double)(state >> 8) / (double)(1 << 24) - 0.5;
+	}
+	return features;
+}
+
+static void testRanking()
+{
+	// a dimension that is not a multiple of the SIMD width; the candidates are placed side by side, so the overlap term
+	// of matchAppearance does not apply and its distance is 1 - score
+	const int dimension = 37;
+	const int numCandidates = 20;
+	uint32_t state = 4711;
+
+	FaceDetectionRegion query;
+	query.setBoundingBox(0, 0, 10, 10);
+	query.setFeatureVector(randomFeatures(state, dimension));
+
+	FaceFeatureMatcher matcher;
+	std::vector<FaceDetectionRegion> candidates(numCandidates);
+	for (int i = 0; i < numCandidates; i++) {
+		std::vector<double> features = randomFeatures(state, dimension);
+		// some candidates resemble the query, so the ranking is not decided by noise alone
+		if (i % 4 == 0) {
+			for (int d = 0; d < dimension; d++)
+				features[d] = query.getFeatureVector()[d] + features[d] * 0.1 * (i + 1);
+		}
+		candidates[i].setBoundingBox(20.0f * (i + 1), 0, 10, 10);
+		candidates[i].setFeatureVector(features);
+		CHECK(matcher.add(&candidates[i]) == i);
+	}
+
+	std::vector<float> distances(numCandidates);
+	std::vector<int> expected(numCandidates);
+	for (int i = 0; i < numCandidates; i++) {
+		distances[i] = query.matchAppearance(candidates[i]);
+		expected[i] = i;
+	}
+	struct ByDistance {
+		const std::vector<float>* distances;
+		bool operator()(int a, int b) const { return (*distances)[a] < (*distances)[b] || ((*distances)[a] == (*distances)[b] && a < b); }
+	} byDistance = { &distances };
+	std::sort(expected.begin(), expected.end(), byDistance);
+
+	std::vector<FaceFeatureMatcher::Match> matches = matcher.match(&query, numCandidates);
+	CHECK((int)matches.size() == numCandidates);
+	for (size_t i = 0; i < matches.size(); i++) {
+		int c = matches[i].index;
+		CHECK(c == expected[i]);
+		if (c >= 0 && c < numCandidates && fabs(1.0f - matches[i].score - distances[c]) > 1e-4f) {
+			std::cerr << "score of candidate " << c << " = " << matches[i].score << ", matchAppearance = " << distances[c] << std::endl;
+			numFailed++;
+		}
+	}
+
+	// the best k are a prefix of the full ranking
+	std::vector<FaceFeatureMatcher::Match> best = matcher.match(&query, 3);
+	CHECK(best.size() == 3);
+	for (size_t i = 0; i < best.size() && i < matches.size(); i++)
+		CHECK(best[i].index == matches[i].index);
+}
+
+static void testEdgeCases()
+{
+	FaceFeatureMatcher matcher(4);
+	std::vector<double> a(4), constant(4, 2.0);
+	a[0] = 1.0; a[1] = 2.0; a[2] = 3.0; a[3] = 5.0;
+	CHECK(matcher.add(a) == 0);
+	CHECK(matcher.add(constant) == 1);
+	CHECK(matcher.add(std::vector<double>(3, 1.0)) == -1);
+	CHECK(matcher.size() == 2);
+
+	// k is clamped to the number of candidates
+	CHECK(matcher.match(a, -1).empty());
+	CHECK(matcher.match(a, 0).empty());
+	std::vector<FaceFeatureMatcher::Match> matches = matcher.match(a, 10);
+	CHECK(matches.size() == 2);
+	if (matches.size() == 2) {
+		CHECK(matches[0].index == 0 && fabs(matches[0].score - 1.0f) < 1e-5f);
+		// candidates without variance score 0, as in matchAppearance
+		CHECK(matches[1].index == 1 && matches[1].score == 0.0f);
+	}
+
+	// a query of the wrong dimension matches nothing
+	std::vector<float> scores;
+	matcher.score(std::vector<double>(5, 1.0), scores);
+	CHECK(scores.size() == 2 && scores[0] == 0.0f && scores[1] == 0.0f);
+}
+
+int main()
+{
+	testRanking();
+	testEdgeCases();
+
+	if (numFailed > 0) {
+		std::cerr << numFailed << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "all checks passed" << std::endl;
+	return 0;
+}
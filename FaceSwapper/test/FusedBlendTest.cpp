@@ -0,0 +1,55 @@
+// Checks that the fused and the separate warp, colour correction and blend of the affine swap give the same frame
+// up to rounding, with both soft edges.
+
+#include <iostream>
+
+#include <opencv2/core/core.hpp>
+
+#include "FaceSwapper/FaceSwapping.h"
+#include "SyntheticFace.h"
+
+using namespace Jrs::FaceSwapper;
+
+int main()
+{
+	SwapFixture fixture;
+	if (!fixture.init()) {
+		std::cerr << "cannot prepare the bank face" << std::endl;
+		return 1;
+	}
+	FaceSwapping& swapping = fixture.swapping;
+	const BankFace& face = fixture.face;
+	cv::Mat frame = fixture.frame;
+
+	// a face of a different size and aspect ratio than the bank face
+	DetectionRegion region;
+	placeFace(cv::Rect(250, 140, 170, 190), region);
+
+	int failed = 0;
+	FaceSwapping::FeatherMode modes[] = { FaceSwapping::FEATHER_DISTANCE, FaceSwapping::FEATHER_BOX };
+	for (int m = 0; m < 2; m++) {
+		swapping.setFeatherMode(modes[m]);
+
+		cv::Mat fused = frame.clone();
+		swapping.setFusedBlend(true);
+		swapping.swapFaces(frame, fused, face, &region);
+
+		cv::Mat separate = frame.clone();
+		swapping.setFusedBlend(false);
+		swapping.swapFaces(frame, separate, face, &region);
+
+		double changed = cv::norm(fused, frame, cv::NORM_INF);
+		double difference = cv::norm(fused, separate, cv::NORM_INF);
+		std::cout << "feather mode " << modes[m] << ": max difference " << difference << std::endl;
+		if (changed == 0) {
+			std::cerr << "feather mode " << modes[m] << ": face not replaced" << std::endl;
+			failed++;
+		}
+		if (difference > 1) {
+			std::cerr << "feather mode " << modes[m] << ": fused and separate blend differ by " << difference << std::endl;
+			failed++;
+		}
+	}
+
+	return failed > 0 ? 1 : 0;
+}
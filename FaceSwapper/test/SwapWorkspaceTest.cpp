@@ -0,0 +1,117 @@
+// Checks that the affine swap reaches a steady state once it has seen the largest face: swapping the same faces
+// again, fused or not, must not allocate any workspace images, and must not call operator new more often than in the
+// previous round. The calls that remain come from inside OpenCV (see SwapWorkspace), so they are not required to be 0.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <iostream>
+#include <new>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/utility.hpp>
+
+#include "FaceSwapper/FaceSwapping.h"
+#include "FaceSwapper/SwapWorkspace.h"
+#include "SyntheticFace.h"
+
+// allocation counting as in FaceSwapperBenchmark (images allocated by OpenCV's fastMalloc are not included, the
+// workspace counts those of its own buffers)
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+using namespace Jrs::FaceSwapper;
+
+int main()
+{
+	SwapFixture fixture;
+	if (!fixture.init()) {
+		std::cerr << "cannot prepare the bank face" << std::endl;
+		return 1;
+	}
+	FaceSwapping& swapping = fixture.swapping;
+	const BankFace& face = fixture.face;
+	cv::Mat frame = fixture.frame;
+	// the workspaces of the row band threads are not checked, the whole face is processed by this thread; OpenCV runs
+	// sequentially, so the allocations of its thread pool do not vary between the rounds
+	swapping.setRowParallelism(1);
+	cv::setNumThreads(0);
+
+	// faces of varying size and aspect ratio, as in a video
+	cv::Rect boxes[] = { cv::Rect(250, 140, 170, 190), cv::Rect(100, 120, 120, 120), cv::Rect(300, 100, 240, 200),
+		cv::Rect(60, 200, 140, 180) };
+	const int numBoxes = sizeof(boxes) / sizeof(boxes[0]);
+	DetectionRegion regions[numBoxes];
+	for (int i = 0; i < numBoxes; i++)
+		placeFace(boxes[i], regions[i]);
+
+	SwapWorkspace& ws = SwapWorkspace::local();
+	cv::Mat dst = frame.clone();
+	size_t numAllocations = 0, capacity = 0;
+	uint64_t roundNews = 0;
+	int failed = 0;
+	for (int round = 0; round < 10; round++) {
+		uint64_t newsStart = allocationCount.load();
+		for (int fused = 0; fused < 2; fused++) {
+			swapping.setFusedBlend(fused != 0);
+			for (int i = 0; i < numBoxes; i++) {
+				frame.copyTo(dst);
+				swapping.swapFaces(frame, dst, face, &regions[i]);
+			}
+		}
+
+		uint64_t news = allocationCount.load() - newsStart;
+
+		// the first round is the warm-up, the second one the reference for operator new
+		if (round == 0) {
+			numAllocations = ws.getNumAllocations();
+			capacity = ws.getCapacity();
+			std::cout << numAllocations << " allocations, " << capacity << " bytes after the warm-up" << std::endl;
+		}
+		else if (ws.getNumAllocations() != numAllocations || ws.getCapacity() != capacity) {
+			std::cerr << "round " << round << ": " << ws.getNumAllocations() - numAllocations << " allocations, "
+				<< ws.getCapacity() << " bytes" << std::endl;
+			failed++;
+		}
+
+		if (round == 1) {
+			roundNews = news;
+			std::cout << (double)news / (2 * numBoxes) << " calls of operator new per swap (inside OpenCV)" << std::endl;
+		}
+		else if (round > 1 && news > roundNews) {
+			std::cerr << "round " << round << ": " << news << " calls of operator new, " << roundNews << " in round 1" << std::endl;
+			failed++;
+		}
+	}
+
+	if (numAllocations == 0) {
+		std::cerr << "the swap did not use the workspace" << std::endl;
+		failed++;
+	}
+
+	return failed > 0 ? 1 : 0;
+}
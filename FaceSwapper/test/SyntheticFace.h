@@ -0,0 +1,64 @@
+#pragma once
+
+// Synthetic frames and faces for the swap tests: the regions carry the 68 landmarks of the mean face shape, so the
+// affine swap runs without a detector or shape predictor.
+
+#include <algorithm>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "DetectionRegion.h"
+#include "FaceSwapper/FaceSwapping.h"
+#include "FaceSwapper/LandmarkTemplate.h"
+
+/// BGR image with smooth gradients from 'low' to 'high' (horizontal in blue, vertical in green, diagonal in red).
+static cv::Mat makeGradientImage(cv::Size size, int low, int high)
+{
+	cv::Mat image(size, CV_8UC3);
+	for (int y = 0; y < size.height; y++) {
+		unsigned char* pixel = image.ptr(y);
+		for (int x = 0; x < size.width; x++, pixel += 3) {
+			pixel[0] = (unsigned char)(low + (high - low) * x / std::max(1, size.width - 1));
+			pixel[1] = (unsigned char)(low + (high - low) * y / std::max(1, size.height - 1));
+			pixel[2] = (unsigned char)(low + (high - low) * (x + y) / std::max(1, size.width + size.height - 2));
+		}
+	}
+	return image;
+}
+
+/// Sets the bounding box of the region to 'box' and places the landmarks of the mean face shape in it, as the
+/// detector and the shape predictor would. The forehead of the outline extends above the box.
+static void placeFace(cv::Rect box, DetectionRegion& region)
+{
+	region.setBoundingBox((float)box.x, (float)box.y, (float)box.width, (float)box.height);
+	region.setCenter(box.x + box.width / 2.0f, box.y + box.height / 2.0f);
+
+	Jrs::FaceSwapper::LandmarkTemplate shape;
+	const std::vector<cv::Point2f>& points = shape.getPoints();
+	region.clearPoints();
+	for (size_t i = 0; i < points.size(); i++)
+		region.addPoint(box.x + points[i].x * box.width, box.y + points[i].y * box.height);
+}
+
+/// Swapper, bank face and frame shared by the swap tests. No shape predictor is loaded (the error about it is
+/// expected), the regions carry all landmarks. The bank face is prepared from a face of 200x200 pixels; the frame has
+/// less contrast than the face set, so the colour lookup table does not amplify rounding differences of the sampling.
+struct SwapFixture
+{
+	SwapFixture() : swapping("") {}
+
+	/// Prepares the bank face and the frame, returns false if the bank face is rejected.
+	bool init()
+	{
+		cv::Mat faceSet = makeGradientImage(cv::Size(300, 320), 40, 220);
+		DetectionRegion faceRegion;
+		placeFace(cv::Rect(50, 70, 200, 200), faceRegion);
+		frame = makeGradientImage(cv::Size(640, 480), 90, 170);
+		return swapping.prepareBankFace(faceSet, &faceRegion, face);
+	}
+
+	Jrs::FaceSwapper::FaceSwapping swapping;
+	Jrs::FaceSwapper::BankFace face;
+	cv::Mat frame;
+};
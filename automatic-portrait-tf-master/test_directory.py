@@ -4,6 +4,7 @@ import tensorflow as tf
 import tensorflow.contrib.slim as slim
 import cv2
 import os
+import struct
 import sys
 
 import slim_net
@@ -30,11 +31,7 @@ def build_image(filename):
     return img
 
 
-def save_masked_image(result, srcfilename, filename):
-    srcimg = scipy.misc.imread(srcfilename, mode='RGB')
-    height, width, _ = srcimg.shape
-    srcimg = np.reshape(srcimg, (height, width, 3))	
-    srcimg = np.asarray(srcimg, np.float32)
+def closed_mask(result):
     _, h, w = result.shape
     result = result.reshape(h * w)
     image = []
@@ -48,11 +45,55 @@ def save_masked_image(result, srcfilename, filename):
     large_image = np.reshape(large_image, (2*h, 2*w, 3))	
     large_image[int(h/2):int(h/2+h),int(w/2):int(w/2+w),:] = image
     closing = cv2.morphologyEx(large_image, cv2.MORPH_CLOSE, kernel)
-    closing_center = closing[int(h/2):int(h/2+h),int(w/2):int(w/2+w),:]
+    return closing[int(h/2):int(h/2+h),int(w/2):int(w/2+w),:]
+
+
+def save_masked_image(result, srcfilename, filename):
+    srcimg = scipy.misc.imread(srcfilename, mode='RGB')
+    height, width, _ = srcimg.shape
+    srcimg = np.reshape(srcimg, (height, width, 3))	
+    srcimg = np.asarray(srcimg, np.float32)
+    closing_center = closed_mask(result)
     masked_image = cv2.multiply(closing_center, srcimg)
     scipy.misc.imsave(filename, masked_image)
 
 
+def encode_alpha(alpha):
+    # format of SegmentationAlpha in the FaceSwapper: 16 levels, run length
+    # encoded over the rows
+    h, w = alpha.shape
+    levels = ((alpha.astype(np.int32) + 8) // 17).ravel()
+    data = bytearray(b'FSA1')
+    data += struct.pack('<II', w, h)
+    starts = np.concatenate(([0], np.flatnonzero(np.diff(levels)) + 1))
+    ends = np.concatenate((starts[1:], [levels.size]))
+    for start, end in zip(starts, ends):
+        level = int(levels[start])
+        length = int(end - start)
+        if length <= 15:
+            data.append((level << 4) | (length - 1))
+            continue
+        data.append((level << 4) | 15)
+        rest = length - 16
+        while True:
+            byte = rest & 0x7f
+            rest >>= 7
+            data.append(byte | 0x80 if rest else byte)
+            if not rest:
+                break
+    return bytes(data)
+
+
+def save_alpha(result, filename):
+    # soft foreground alpha for swapping the face, used instead of the
+    # outline of the landmarks
+    alpha = closed_mask(result)[:, :, 0]
+    alpha = cv2.GaussianBlur(alpha, (5, 5), 0)
+    alpha = np.clip(alpha * 255.0 + 0.5, 0, 255).astype(np.uint8)
+    with open(filename, 'wb') as f:
+        f.write(encode_alpha(alpha))
+
+
 def test(image_name):
     inputs = tf.placeholder(tf.float32, [1, None, None, 3])
     with slim.arg_scope(slim_net.fcn8s_arg_scope()):
@@ -98,3 +139,6 @@ if __name__ == '__main__':
         resimg = test(full_src_name)
         full_dst_name = dstpath + "/" + file
         save_masked_image(resimg, full_src_name, full_dst_name)
+        # the FaceSwapper looks for <image>.alpha next to the face bank
+        # image, which is the unmasked source image, not the masked output
+        save_alpha(resimg, full_src_name + ".alpha")